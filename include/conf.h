@@ -15,7 +15,36 @@ constexpr uint64_t kClintAddrSpaceRange = 0x10000;
 
 constexpr uint64_t kUartBase = 0x60100000;
 constexpr uint64_t kUartAddrSpaceRange = 0x1000;
+// bytes queued each way between the uart and the host console
+constexpr uint64_t kUartBufferSize = 4096;
+
+// virtio-mmio slots, all of them are in the dts and the ones without a device
+// read as device id 0. Slot n takes plic source kVirtioIrqBase + n.
+constexpr uint64_t kVirtioBase = 0x10001000;
+constexpr uint64_t kVirtioAddrSpaceRange = 0x1000;
+constexpr uint64_t kVirtioSlots = 8;
+constexpr uint64_t kVirtioIrqBase = 2;
+// the uart is source 1
+constexpr uint64_t kPlicDevices = kVirtioIrqBase + kVirtioSlots - 1;
+
+// host threads serving the requests of each virtio-blk device
+constexpr uint64_t kVirtioBlkWorkers = 4;
+constexpr uint16_t kVirtioBlkQueueSize = 256;
+constexpr uint16_t kVirtioNetQueueSize = 256;
+constexpr uint16_t kVirtioConsoleQueueSize = 128;
+// ports of the virtio-console, the -c ones
+constexpr uint64_t kVirtioConsolePorts = 16;
 
 // cpu config
 constexpr uint64_t kDecodeCacheEntryNum = 4096;
+// entries of each of the instruction and data tlb
+constexpr uint64_t kTlbEntryNum = 512;
+constexpr uint64_t kTlbWays = 4;
+// direct-mapped 4KB pages of guest ram accessed through host pointers
+constexpr uint64_t kSoftTlbEntryNum = 1024;
+// non-leaf ptes cached for each of the two upper page table levels
+constexpr uint64_t kPageWalkCacheEntryNum = 64;
 constexpr uint64_t kMtimeFreq = 10000000;
+// max insts run between two scheduler checks. Device timers and irq edges end
+// a run earlier, so this only bounds the host side work like console output.
+constexpr uint64_t kRunBudget = 16384;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstring>
 #include <memory>
@@ -8,6 +9,7 @@
 #include "conf.h"
 #include "cpu/csr.h"
 #include "cpu/decode.h"
+#include "cpu/decode_cache.h"
 #include "cpu/executor.h"
 #include "cpu/trap.h"
 
@@ -21,6 +23,11 @@ namespace cpu {
 
 namespace executor {
 class Executor;
+
+enum class ExecEngine {
+  kSwitch = 0,
+  kThreaded,
+};
 };
 
 enum class PrivilegeMode {
@@ -30,6 +37,12 @@ enum class PrivilegeMode {
   kMachine,
 };
 
+// bits of the cpu event word, the run loop only leaves its fast path when the
+// word is not zero. A clean word means no interrupt is deliverable.
+constexpr uint64_t kEventIrqDirty = 1 << 0;
+// asynchronous host request, ends the current run
+constexpr uint64_t kEventHost = 1 << 1;
+
 template <typename T, uint32_t N>
 class RegGroup {
  public:
@@ -74,18 +87,42 @@ class CPU {
   trap::Trap Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) const;
   trap::Trap Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer);
   trap::Trap Fetch(uint64_t addr, uint64_t bytes, uint8_t* buffer);
+  // 1, 2, 4 and 8 bytes accesses without the buffer round trip
+  template <typename T>
+  trap::Trap Load(uint64_t addr, T* val) const;
+  template <typename T>
+  trap::Trap Store(uint64_t addr, T val);
+  void UpdateIrq(bool meip, bool seip, bool msip, bool mtip);
+  // run at most budget insts, pending interrupts are only taken between
+  // basic blocks or engine runs, so budget bounds the interrupt latency
+  uint64_t Run(uint64_t budget);
   void Tick(bool meip, bool seip, bool msip, bool mtip, bool update);
   void Tick();
-  void FlushTlb(uint64_t vaddr, uint64_t asid);
+  trap::Trap FetchDecode(decode::DecodeInfo** info);
+  void SetExecEngine(executor::ExecEngine engine);
+  void FlushTlb(uint64_t vaddr, uint64_t asid, bool all_vaddr, bool all_asid);
+  void FlushDecodeCache();
+  void InvalidateDecodeCache(uint64_t paddr, uint64_t bytes) {
+    decode_cache_.Invalidate(paddr, bytes);
+  }
   uint64_t GetInstret() const;
+  // safe to call from other threads and signal handlers
+  void RaiseEvent(uint64_t event) {
+    events_.fetch_or(event, std::memory_order_relaxed);
+  }
 
  private:
   std::unique_ptr<executor::Executor> executor_;
   std::unique_ptr<mmu::Mmu> mmu_;
+  decode::DecodeCache decode_cache_;
+  executor::ExecEngine exec_engine_;
+  std::atomic<uint64_t> events_;
 
-  trap::Trap TickOperate();
+  trap::Trap ExecBlock(uint64_t budget, uint64_t* retired);
   void HandleTrap(trap::Trap trap, uint64_t epc);
   void HandleInterrupt(uint64_t inst_addr);
+  void HandleGuardFault();
+  bool HandleEvents();
 };
 
 }  // namespace cpu
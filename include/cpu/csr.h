@@ -1,12 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
-#include <vector>
+#include <unordered_map>
 
 namespace rv64_emulator::cpu::csr {
 
-constexpr uint64_t kCsrCapacity = 4096;
-
 constexpr uint64_t kCsrFflags = 0x001;  // Floating-Point Accrued Exceptions.
 constexpr uint64_t kCsrFrm = 0x002;     // Floating-Point Dynamic Rounding Mode
 
@@ -37,6 +36,7 @@ constexpr uint64_t kCsrMtvec = 0x305;  // Machine trap-handler base address
 constexpr uint64_t kCsrMcounteren = 0x306;  // Machine counter enable
 constexpr uint64_t kCsrMstatush =
     0x310;  // Additional machine status register, RV32 only
+constexpr uint64_t kCsrMenvcfg = 0x30a;  // Machine environment configuration
 
 // Machine Trap Handling
 constexpr uint64_t kCsrMscratch =
@@ -65,6 +65,7 @@ constexpr uint64_t kCsrSip = 0x144;
 constexpr uint64_t kCsrUie = 0x004;
 constexpr uint64_t kCsrCycle = 0xc00;
 constexpr uint64_t kCsrTime = 0xc01;
+constexpr uint64_t kCsrInstret = 0xc02;
 constexpr uint64_t kCsrSepc = 0x141;
 constexpr uint64_t kCsrUepc = 0x041;
 constexpr uint64_t kCsrScause = 0x142;
@@ -266,18 +267,112 @@ enum class RiscvMXL : uint64_t {
   kRv128 = 3,
 };
 
+// writable fields of mstatus and sstatus, and the mstatus fields visible
+// through sstatus
+constexpr uint64_t kMstatusWriteMask = 0x7e19aa;
+constexpr uint64_t kSstatusWriteMask = 0xc0122;
+constexpr uint64_t kSstatusReadMask = 0x80000003000de762;
+
+// hardware updating of pte a/d bits (Svadu), the only writable menvcfg field
+constexpr uint64_t kMenvcfgAdue = 1ULL << 61;
+
 class State {
  public:
   State();
-  uint64_t Read(uint64_t addr) const;
+
+  // hot csrs are kept in dedicated fields, constant addresses fold into a
+  // plain field access after inlining
+  uint64_t Read(uint64_t addr) const {
+    switch (addr) {
+      case kCsrMstatus:
+        return mstatus_;
+      case kCsrSstatus:
+        return mstatus_ & kSstatusReadMask;
+      case kCsrMie:
+        return mie_;
+      case kCsrMip:
+        return mip_;
+      case kCsrSie:
+        return mie_ & kCsrSInterruptMask;
+      case kCsrSip:
+        return mip_ & kCsrSInterruptMask;
+      case kCsrMedeleg:
+        return medeleg_;
+      case kCsrMideleg:
+        return mideleg_;
+      case kCsrSatp:
+        return satp_;
+      case kCsrMenvcfg:
+        return menvcfg_;
+      case kCsrMtvec:
+        return mtvec_;
+      case kCsrStvec:
+        return stvec_;
+      case kCsrMepc:
+        return mepc_;
+      case kCsrSepc:
+        return sepc_;
+      case kCsrMcause:
+        return mcause_;
+      case kCsrScause:
+        return scause_;
+      case kCsrMtval:
+        return mtval_;
+      case kCsrStval:
+        return stval_;
+      case kCsrMscratch:
+        return mscratch_;
+      case kCsrSscratch:
+        return sscratch_;
+      default:
+        return ReadCold(addr);
+    }
+  }
+
   void Write(uint64_t addr, uint64_t val);
   bool GetWfi() const;
   void SetWfi(bool wfi);
   void Reset();
+  // set event bit in word whenever the deliverable interrupt may change
+  void BindIrqEvent(std::atomic<uint64_t>* word, uint64_t event);
+  // mcycle and minstret are derived from the retired inst counter
+  void BindInstret(const uint64_t* instret);
+  // time reads mtime, the guest time stamp plus the offset the clint keeps
+  void BindMtimeOffset(const uint64_t* offset);
 
  private:
+  uint64_t mstatus_;
+  uint64_t mie_;
+  uint64_t mip_;
+  uint64_t medeleg_;
+  uint64_t mideleg_;
+  uint64_t satp_;
+  uint64_t menvcfg_;
+  uint64_t mtvec_;
+  uint64_t stvec_;
+  uint64_t mepc_;
+  uint64_t sepc_;
+  uint64_t mcause_;
+  uint64_t scause_;
+  uint64_t mtval_;
+  uint64_t stval_;
+  uint64_t mscratch_;
+  uint64_t sscratch_;
   bool wfi_;
-  std::vector<uint64_t> csr_;
+
+  const uint64_t* instret_;
+  uint64_t mcycle_offset_;
+  uint64_t minstret_offset_;
+  std::atomic<uint64_t>* irq_event_word_;
+  uint64_t irq_event_;
+  const uint64_t* mtime_offset_;
+
+  // rarely used csrs, absent ones read as zero
+  std::unordered_map<uint64_t, uint64_t> csr_;
+
+  uint64_t ReadCold(uint64_t addr) const;
+  uint64_t GetInstret() const { return instret_ ? *instret_ : 0; }
+  void RaiseIrqEvent();
 };
 
 }  // namespace rv64_emulator::cpu::csr
@@ -843,6 +843,137 @@ constexpr InstDesc kInstTable[] = {
     },
 };
 
+constexpr uint32_t kInstTableSize = sizeof(kInstTable) / sizeof(InstDesc);
+
+// O(1) token lookup tables built from kInstTable at compile time.
+// Level 1 is indexed by opcode[6:2] and funct3. The groups that funct3 can
+// not tell apart get a level 2 table indexed by funct7. Each slot keeps the
+// few remaining candidates in kInstTable order and the winner is confirmed by
+// its mask/signature, so the result is the same as a linear scan.
+constexpr uint32_t kMaxDecodeCandidates = 2;
+constexpr uint32_t kDecodeL1Size = 1 << 8;  // opcode[6:2] + funct3
+constexpr uint32_t kDecodeL2Size = 1 << 7;  // funct7
+constexpr uint32_t kDecodeL1Mask = 0x0000707f;
+constexpr uint32_t kDecodeL2Mask = 0xfe00707f;
+
+static_assert(kInstTableSize < UINT8_MAX, "inst table index exceeds uint8");
+
+using DecodeSlot = struct DecodeSlot {
+  uint8_t num;
+  uint8_t index[kMaxDecodeCandidates];
+};
+
+using DecodeL1Entry = struct DecodeL1Entry {
+  int16_t group;  // -1: no level 2 table, use slot directly
+  DecodeSlot slot;
+};
+
+template <uint32_t N>
+struct DecodeTable {
+  DecodeL1Entry l1[kDecodeL1Size];
+  DecodeSlot l2[N][kDecodeL2Size];
+};
+
+constexpr uint32_t GetDecodeL1Index(uint32_t word) {
+  return (((word >> 2) & 0x1f) << 3) | ((word >> 12) & 0x7);
+}
+
+constexpr uint32_t GetDecodeL1Word(uint32_t index) {
+  return ((index >> 3) << 2) | 0b11 | ((index & 0x7) << 12);
+}
+
+constexpr bool IsInstCompatible(const InstDesc& desc, uint32_t fixed_mask,
+                                uint32_t fixed_word) {
+  return ((desc.signature ^ fixed_word) & desc.mask & fixed_mask) == 0;
+}
+
+constexpr uint32_t CountCompatibleInsts(uint32_t fixed_mask,
+                                        uint32_t fixed_word) {
+  uint32_t cnt = 0;
+  for (uint32_t i = 0; i < kInstTableSize; i++) {
+    cnt += IsInstCompatible(kInstTable[i], fixed_mask, fixed_word) ? 1 : 0;
+  }
+  return cnt;
+}
+
+constexpr bool NeedDecodeL2(uint32_t l1_index) {
+  return CountCompatibleInsts(kDecodeL1Mask, GetDecodeL1Word(l1_index)) >
+         kMaxDecodeCandidates;
+}
+
+constexpr uint32_t CountDecodeGroups() {
+  uint32_t groups = 0;
+  for (uint32_t i = 0; i < kDecodeL1Size; i++) {
+    groups += NeedDecodeL2(i) ? 1 : 0;
+  }
+  return groups;
+}
+
+constexpr bool CheckDecodeGroups() {
+  for (uint32_t i = 0; i < kDecodeL1Size; i++) {
+    if (!NeedDecodeL2(i)) {
+      continue;
+    }
+    for (uint32_t j = 0; j < kDecodeL2Size; j++) {
+      const uint32_t kWord = GetDecodeL1Word(i) | (j << 25);
+      if (CountCompatibleInsts(kDecodeL2Mask, kWord) > kMaxDecodeCandidates) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static_assert(CheckDecodeGroups(),
+              "too many decode candidates, raise kMaxDecodeCandidates");
+
+constexpr DecodeSlot MakeDecodeSlot(uint32_t fixed_mask, uint32_t fixed_word) {
+  DecodeSlot slot = {};
+  for (uint32_t i = 0; i < kInstTableSize; i++) {
+    if (IsInstCompatible(kInstTable[i], fixed_mask, fixed_word)) {
+      slot.index[slot.num++] = i;
+    }
+  }
+  return slot;
+}
+
+template <uint32_t N>
+constexpr DecodeTable<N> MakeDecodeTable() {
+  DecodeTable<N> table = {};
+  int16_t group = 0;
+  for (uint32_t i = 0; i < kDecodeL1Size; i++) {
+    const uint32_t kWord = GetDecodeL1Word(i);
+    if (!NeedDecodeL2(i)) {
+      table.l1[i].group = -1;
+      table.l1[i].slot = MakeDecodeSlot(kDecodeL1Mask, kWord);
+      continue;
+    }
+
+    table.l1[i].group = group;
+    for (uint32_t j = 0; j < kDecodeL2Size; j++) {
+      table.l2[group][j] = MakeDecodeSlot(kDecodeL2Mask, kWord | (j << 25));
+    }
+    group++;
+  }
+  return table;
+}
+
+inline constexpr auto kDecodeTable = MakeDecodeTable<CountDecodeGroups()>();
+
+// index of the matched inst in kInstTable, -1 if not found
+constexpr int32_t GetInstIndex(uint32_t word) {
+  const DecodeL1Entry& kL1 = kDecodeTable.l1[GetDecodeL1Index(word)];
+  const DecodeSlot& kSlot =
+      kL1.group < 0 ? kL1.slot : kDecodeTable.l2[kL1.group][word >> 25];
+  for (uint32_t i = 0; i < kSlot.num; i++) {
+    const InstDesc& kDesc = kInstTable[kSlot.index[i]];
+    if ((word & kDesc.mask) == kDesc.signature) {
+      return kSlot.index[i];
+    }
+  }
+  return -1;
+}
+
 using BTypeDesc = struct BTypeDesc {
   uint32_t opcode : 7;
   uint32_t imm11 : 1;
@@ -930,6 +1061,9 @@ struct DecodeInfo {
   uint8_t mem_size;
   uint8_t br_target;  // is current inst a br target or not
 
+  // dispatch target resolved by the threaded-code engine on first use
+  const void* handler;
+
   DecodeInfo(uint32_t inst_word, uint64_t addr);
 };
 
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "conf.h"
+#include "cpu/decode.h"
+
+namespace rv64_emulator::cpu::decode {
+
+static_assert((kDecodeCacheEntryNum & (kDecodeCacheEntryNum - 1)) == 0,
+              "decode cache entry num should be power of 2");
+
+// Direct-mapped cache of decoded instructions. Entries are tagged by the
+// physical address of the instruction, so they survive satp switches and
+// sfence.vma, and only have to be dropped when the code itself changes.
+class DecodeCache {
+ public:
+  DecodeCache();
+
+  DecodeInfo* LookUp(uint64_t paddr) {
+    Entry& entry = entries_[GetIndex(paddr)];
+    return entry.tag == paddr ? &entry.info : nullptr;
+  }
+
+  // drop every cached instruction overlapping [paddr, paddr + bytes)
+  void Invalidate(uint64_t paddr, uint64_t bytes) {
+    const uint64_t kEnd = paddr + bytes;
+    for (uint64_t addr = paddr & ~kInstAlignMask; addr < kEnd;
+         addr += kInstAlignMask + 1) {
+      Entry& entry = entries_[GetIndex(addr)];
+      if (entry.tag == addr) {
+        entry.tag = kInvalidTag;
+      }
+    }
+  }
+
+  DecodeInfo* Insert(uint64_t paddr, const DecodeInfo& info);
+  void Flush();
+
+ private:
+  using Entry = struct Entry {
+    uint64_t tag;
+    DecodeInfo info;
+  };
+
+  // instructions are 4 bytes aligned without C extension
+  static constexpr uint64_t kInstAlignMask = sizeof(uint32_t) - 1;
+  static constexpr uint64_t kInvalidTag = UINT64_MAX;
+
+  std::vector<Entry> entries_;
+
+  static uint64_t GetIndex(uint64_t paddr) {
+    return (paddr >> 2) & (kDecodeCacheEntryNum - 1);
+  }
+};
+
+}  // namespace rv64_emulator::cpu::decode
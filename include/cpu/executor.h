@@ -20,6 +20,10 @@ class Executor {
  public:
   void SetProcessor(CPU* cpu);
   trap::Trap Exec(decode::DecodeInfo info);
+  // run at most budget insts from cpu pc with handler dispatch, stops after
+  // the insts that may change the interrupt state. On trap the cpu pc is the
+  // faulting inst and it is not counted in retired.
+  trap::Trap ExecThreaded(uint64_t budget, uint64_t* retired);
 
  private:
   CPU* cpu_;
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <memory>
 
+#include "conf.h"
 #include "cpu/cpu.h"
 #include "cpu/csr.h"
 #include "cpu/trap.h"
@@ -77,48 +79,280 @@ using Sv39PhysicalAddress = struct Sv39PhysicalAddress {
   uint64_t blank : 8;
 };
 
-constexpr uint64_t kTlbSize = 2;
+static_assert((kSoftTlbEntryNum & (kSoftTlbEntryNum - 1)) == 0,
+              "soft tlb entry num should be power of 2");
+
+static_assert((kPageWalkCacheEntryNum & (kPageWalkCacheEntryNum - 1)) == 0,
+              "page walk cache entry num should be power of 2");
+
+static_assert((kTlbEntryNum & (kTlbEntryNum - 1)) == 0 &&
+                  (kTlbWays & (kTlbWays - 1)) == 0 && kTlbWays <= kTlbEntryNum,
+              "tlb entry num and ways should be power of 2");
+
+enum class AccessType {
+  kFetch = 0,
+  kLoad,
+  kStore,
+};
+
+constexpr uint64_t kPageOffsetMask = 0xfff;
+
+// translation contexts of the soft tlb, the mxr variant of a context follows
+// it. Fetches ignore mprv.
+constexpr uint64_t kCtxPhys = 0;
+constexpr uint64_t kCtxSupervisor = 1;
+constexpr uint64_t kCtxUser = 3;
+
+constexpr uint64_t GetPermBit(uint64_t ctx, AccessType type) {
+  return 1ULL << (ctx * 3 + static_cast<uint64_t>(type));
+}
+
+// Set-associative tlb, every page size is probed in its own set. Entries are
+// tagged by asid, so they survive satp switches.
+class Tlb {
+ public:
+  Tlb();
+  Sv39TlbEntry* LookUp(uint64_t asid, uint64_t vaddr);
+  Sv39TlbEntry* Insert(const Sv39TlbEntry& entry);
+  // all_vaddr and all_asid stand for sfence.vma with rs1 or rs2 = x0
+  void Flush(uint64_t vaddr, uint64_t asid, bool all_vaddr, bool all_asid);
+  void Reset();
+  uint64_t GetHits() const { return hits_; }
+  uint64_t GetMisses() const { return misses_; }
+
+ private:
+  static constexpr uint64_t kSets = kTlbEntryNum / kTlbWays;
+
+  Sv39TlbEntry entries_[kSets][kTlbWays];
+  uint8_t victim_[kSets];
+  uint64_t hits_;
+  uint64_t misses_;
+};
+
+using SoftTlbEntry = struct SoftTlbEntry {
+  uint64_t tag;  // vaddr >> 12
+  // one bit for every translation context and access type
+  uint64_t perm;
+  // host address of vaddr is addend + vaddr
+  uint64_t addend;
+  uint64_t paddr;  // page aligned
+};
+
+// Fast path in front of the tlb for guest ram pages, a hit is a tag compare
+// plus a host memory access. It only holds translations of the current satp,
+// MMIO pages are never inserted.
+class SoftTlb {
+ public:
+  SoftTlb();
+
+  SoftTlbEntry* LookUp(uint64_t vaddr, uint64_t bytes, uint64_t perm) {
+    SoftTlbEntry& entry = entries_[(vaddr >> 12) & (kSoftTlbEntryNum - 1)];
+    const bool kHit =
+        entry.tag == vaddr >> 12 && (entry.perm & perm) &&
+        (vaddr & kPageOffsetMask) + bytes <= kPageOffsetMask + 1;
+    return kHit ? &entry : nullptr;
+  }
+
+  void Insert(uint64_t vaddr, uint64_t paddr, uint8_t* host, uint64_t perm,
+              uint64_t page_bytes);
+  void FlushPage(uint64_t vaddr);
+  void Flush();
+
+ private:
+  static constexpr uint64_t kInvalidTag = UINT64_MAX;
+
+  SoftTlbEntry entries_[kSoftTlbEntryNum];
+  // smallest aligned range covering every inserted superpage, a flush of an
+  // address inside it has to drop all entries
+  uint64_t large_page_addr_;
+  uint64_t large_page_mask_;
+};
+
+using PwcEntry = struct PwcEntry {
+  uint64_t root;  // paddr of the root table
+  uint64_t vpn;   // vaddr bits translated by the cached levels
+  uint64_t table;
+  // host address of table, nullptr if it is not in ram
+  uint8_t* host;
+};
+
+// Caches the non-leaf ptes of the two upper levels, a level 1 hit leaves only
+// the leaf pte to be read. Entries are keyed by the root table.
+class PageWalkCache {
+ public:
+  PageWalkCache();
+  // level 2 entries point to level 1 tables, level 1 entries to level 0 ones
+  const PwcEntry* LookUp(uint64_t root, uint64_t vaddr, uint64_t level);
+  void Insert(uint64_t root, uint64_t vaddr, uint64_t level, uint64_t table,
+              uint8_t* host);
+  // all_vaddr stands for sfence.vma with rs1 = x0
+  void Flush(uint64_t vaddr, bool all_vaddr);
+  void Reset();
+  // counted per probed level
+  uint64_t GetHits() const { return hits_; }
+  uint64_t GetMisses() const { return misses_; }
+
+ private:
+  static constexpr uint64_t kInvalidRoot = UINT64_MAX;
+
+  PwcEntry entries_[2][kPageWalkCacheEntryNum];
+  uint64_t hits_;
+  uint64_t misses_;
+
+  static uint64_t GetVpn(uint64_t vaddr, uint64_t level) {
+    return vaddr >> (12 + 9 * level);
+  }
+
+  PwcEntry* GetEntry(uint64_t vaddr, uint64_t level) {
+    return &entries_[level - 1]
+                    [GetVpn(vaddr, level) & (kPageWalkCacheEntryNum - 1)];
+  }
+};
 
 class Sv39 {
  public:
   explicit Sv39(std::shared_ptr<Bus>& bus);
-  Sv39TlbEntry* GetTlbEntry(SatpDesc satp, uint64_t vaddr);
+  // update_ad sets the a/d bits the access needs in the pte (Svadu)
+  Sv39TlbEntry* GetTlbEntry(SatpDesc satp, uint64_t vaddr, AccessType type,
+                            bool update_ad);
   bool Load(uint64_t addr, uint64_t bytes, uint8_t* buffer);
   bool Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer);
-  void FlushTlb(uint64_t vaddr, uint64_t asid);
+  void FlushTlb(uint64_t vaddr, uint64_t asid, bool all_vaddr, bool all_asid);
   void Reset();
-  void PrintStatistic();
-  ~Sv39();
+  uint8_t* GetHostPtr(uint64_t paddr, uint64_t bytes);
+  const Tlb& GetInstTlb() const { return itlb_; }
 
- private:
-  uint64_t index_;
-  uint64_t cache_hit_;
-  uint64_t cache_miss_;
+  template <typename T>
+  bool Load(uint64_t addr, T* val) {
+    return bus_->Load(addr, val);
+  }
 
-  Sv39TlbEntry tlb_[kTlbSize];
-  std::shared_ptr<Bus> bus_;
+  template <typename T>
+  bool Store(uint64_t addr, T val) {
+    return bus_->Store(addr, val);
+  }
 
-  Sv39TlbEntry* LookUpTlb(SatpDesc satp, uint64_t vaddr);
+  const Tlb& GetDataTlb() const { return dtlb_; }
+  const PageWalkCache& GetPageWalkCache() const { return pwc_; }
 
-  bool PageTableWalk(SatpDesc satp, uint64_t vaddr, Sv39PageTableEntry* pte,
+ private:
+  Tlb itlb_;
+  Tlb dtlb_;
+  PageWalkCache pwc_;
+  std::shared_ptr<Bus> bus_;
+  // host address of the last root table
+  uint64_t root_table_;
+  uint8_t* root_host_;
+
+  bool PageTableWalk(SatpDesc satp, uint64_t vaddr, AccessType type,
+                     bool update_ad, Sv39PageTableEntry* pte,
                      uint64_t* page_size);
+  bool ReadPte(uint64_t table, const uint8_t* host, uint64_t index,
+               Sv39PageTableEntry* pte);
+  bool WritePte(uint64_t table, uint8_t* host, uint64_t index,
+                Sv39PageTableEntry pte);
 };
 
 class Mmu {
  public:
   explicit Mmu(std::unique_ptr<Sv39> sv39);
   void SetProcessor(CPU* cpu);
-  void FlushTlb(uint64_t vaddr, uint64_t asid);
+  void FlushTlb(uint64_t vaddr, uint64_t asid, bool all_vaddr, bool all_asid);
+  Trap TranslateFetch(uint64_t addr, uint64_t* paddr);
   Trap Fetch(uint64_t addr, uint64_t bytes, uint8_t* buffer);
   Trap Load(uint64_t addr, uint64_t bytes, uint8_t* buffer);
   Trap Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer);
   void Reset();
 
+  template <typename T>
+  Trap Load(uint64_t addr, T* val) {
+    const SoftTlbEntry* kSoftEntry =
+        soft_tlb_.LookUp(addr, sizeof(T), GetSoftTlbPerm(AccessType::kLoad));
+    if (kSoftEntry) {
+      memcpy(val, reinterpret_cast<const void*>(kSoftEntry->addend + addr),
+             sizeof(T));
+      return cpu::trap::kNoneTrap;
+    }
+
+    uint64_t paddr = 0;
+    const Trap kTranslateTrap = TranslateLoad(addr, &paddr);
+    if (kTranslateTrap.type != cpu::trap::TrapType::kNone) {
+      return kTranslateTrap;
+    }
+
+    if (!sv39_->Load(paddr, val)) {
+      return {.type = cpu::trap::TrapType::kLoadAccessFault, .val = addr};
+    }
+    return cpu::trap::kNoneTrap;
+  }
+
+  template <typename T>
+  Trap Store(uint64_t addr, T val) {
+    const SoftTlbEntry* kSoftEntry =
+        soft_tlb_.LookUp(addr, sizeof(T), GetSoftTlbPerm(AccessType::kStore));
+    if (kSoftEntry) {
+      memcpy(reinterpret_cast<void*>(kSoftEntry->addend + addr), &val,
+             sizeof(T));
+      cpu_->InvalidateDecodeCache(
+          kSoftEntry->paddr | (addr & kPageOffsetMask), sizeof(T));
+      return cpu::trap::kNoneTrap;
+    }
+
+    uint64_t paddr = 0;
+    const Trap kTranslateTrap = TranslateStore(addr, &paddr);
+    if (kTranslateTrap.type != cpu::trap::TrapType::kNone) {
+      return kTranslateTrap;
+    }
+
+    if (!sv39_->Store(paddr, val)) {
+      return {.type = cpu::trap::TrapType::kStoreAccessFault, .val = addr};
+    }
+    cpu_->InvalidateDecodeCache(paddr, sizeof(T));
+    return cpu::trap::kNoneTrap;
+  }
+
  private:
   CPU* cpu_;
   std::unique_ptr<Sv39> sv39_;
+  SoftTlb soft_tlb_;
+  uint64_t soft_tlb_satp_;
 
   bool UsePhysAddr(SatpDesc satp, cpu::csr::MstatusDesc ms);
+  Trap TranslateLoad(uint64_t addr, uint64_t* paddr);
+  bool UpdateAd() const {
+    return cpu_->state_.Read(cpu::csr::kCsrMenvcfg) & cpu::csr::kMenvcfgAdue;
+  }
+  Trap TranslateStore(uint64_t addr, uint64_t* paddr);
+  void FillSoftTlb(uint64_t vaddr, uint64_t paddr, uint64_t perm,
+                   uint64_t page_size);
+
+  // permission bit of the current context, drops the soft tlb if satp changed
+  uint64_t GetSoftTlbPerm(AccessType type) {
+    const uint64_t kSatpVal = cpu_->state_.Read(cpu::csr::kCsrSatp);
+    if (kSatpVal != soft_tlb_satp_) {
+      soft_tlb_.Flush();
+      soft_tlb_satp_ = kSatpVal;
+    }
+    const SatpDesc kSatpDesc = *reinterpret_cast<const SatpDesc*>(&kSatpVal);
+
+    const uint64_t kMstatus = cpu_->state_.Read(cpu::csr::kCsrMstatus);
+    const cpu::csr::MstatusDesc kMstatusDesc =
+        *reinterpret_cast<const cpu::csr::MstatusDesc*>(&kMstatus);
+
+    cpu::PrivilegeMode mode = cpu_->priv_mode_;
+    if (type != AccessType::kFetch && kMstatusDesc.mprv &&
+        mode == cpu::PrivilegeMode::kMachine) {
+      mode = static_cast<cpu::PrivilegeMode>(kMstatusDesc.mpp);
+    }
+
+    if (kSatpDesc.mode == 0 || mode == cpu::PrivilegeMode::kMachine) {
+      return GetPermBit(kCtxPhys, type);
+    }
+
+    const uint64_t kCtx =
+        mode == cpu::PrivilegeMode::kUser ? kCtxUser : kCtxSupervisor;
+    return GetPermBit(kCtx + kMstatusDesc.mxr, type);
+  }
 };
 
 }  // namespace mmu
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rv64_emulator::device::block {
+
+constexpr uint64_t kSectorBytes = 512;
+
+// Storage behind a block device. Requests are served by several host threads
+// at once, implementations have to take concurrent calls.
+class Backend {
+ public:
+  virtual ~Backend() = default;
+
+  virtual uint64_t GetSize() const = 0;
+  virtual bool IsReadOnly() const = 0;
+  // transfer the whole of iov at offset or fail
+  virtual bool Read(uint64_t offset, const iovec* iov, int iovcnt) = 0;
+  virtual bool Write(uint64_t offset, const iovec* iov, int iovcnt) = 0;
+  // makes the writes completed so far durable
+  virtual bool Flush() = 0;
+};
+
+// a host file or block device used as the disk byte for byte
+class RawImage : public Backend {
+ public:
+  RawImage();
+  RawImage(const RawImage&) = delete;
+  RawImage& operator=(const RawImage&) = delete;
+  ~RawImage() override;
+
+  // the image is opened read only if asked to or if it can not be written
+  bool Open(const char* path, bool read_only);
+
+  uint64_t GetSize() const override { return size_; }
+  bool IsReadOnly() const override { return read_only_; }
+  bool Read(uint64_t offset, const iovec* iov, int iovcnt) override;
+  bool Write(uint64_t offset, const iovec* iov, int iovcnt) override;
+  bool Flush() override;
+
+ private:
+  int fd_;
+  uint64_t size_;
+  bool read_only_;
+};
+
+// overlay file layout, the header, the cluster bitmap and then every cluster
+// of the disk at its own offset. Clusters never written are holes, a fresh
+// overlay takes no disk space whatever the size of the base.
+constexpr uint64_t kCowMagic = 0x00574f4334365652;  // "RV64COW"
+constexpr uint32_t kCowVersion = 1;
+constexpr uint32_t kCowClusterBits = 16;
+constexpr uint64_t kCowHeaderBytes = 4096;
+// copy-ups of clusters sharing a stripe are serialized
+constexpr uint64_t kCowLockStripes = 64;
+
+using CowHeader = struct CowHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t cluster_bits;
+  // bytes of the disk, the size of the base image
+  uint64_t size;
+};
+
+// A read only base image shared by many instances plus a private overlay.
+// The base is mapped shared, so its page cache is shared by every process
+// using it. Writes copy the clusters they touch into the overlay, reads of
+// clusters never written come from the base.
+class CowImage : public Backend {
+ public:
+  CowImage();
+  CowImage(const CowImage&) = delete;
+  CowImage& operator=(const CowImage&) = delete;
+  ~CowImage() override;
+
+  // Opens the overlay of base, creating it if it does not exist. An empty
+  // overlay path makes a temporary one that is gone with the image.
+  bool Open(const char* base, const char* overlay);
+  // The two below must not race with requests. Discard drops every write
+  // made so far, Commit writes them into the base first, which must not be
+  // in use by other instances then.
+  bool Discard();
+  bool Commit();
+  uint64_t GetAllocatedClusters() const;
+  uint64_t GetClusterBytes() const { return cluster_bytes_; }
+
+  uint64_t GetSize() const override { return size_; }
+  bool IsReadOnly() const override { return false; }
+  bool Read(uint64_t offset, const iovec* iov, int iovcnt) override;
+  bool Write(uint64_t offset, const iovec* iov, int iovcnt) override;
+  bool Flush() override;
+
+ private:
+  std::string base_path_;
+  const uint8_t* base_;
+  uint64_t size_;
+  int fd_;
+  uint64_t cluster_bytes_;
+  uint64_t data_offset_;
+  // one bit per cluster, set once the cluster is in the overlay
+  std::vector<uint64_t> bitmap_;
+  std::mutex locks_[kCowLockStripes];
+  // copy-ups under different stripes share bitmap words, a snapshot taken
+  // earlier must not be written over a later one
+  std::mutex bitmap_mutex_;
+
+  bool IsAllocated(uint64_t cluster) const;
+  // copies the cluster into the overlay with the bytes at offset of it
+  // replaced by iov
+  bool CopyUp(uint64_t cluster, uint64_t offset, const iovec* iov,
+              int iovcnt);
+  bool WriteBitmap(uint64_t first_word, uint64_t words);
+  void Close();
+};
+
+}  // namespace rv64_emulator::device::block
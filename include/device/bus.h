@@ -1,22 +1,66 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <type_traits>
 
 #include "device/mmio.hpp"
 
 namespace rv64_emulator::device::bus {
 
-constexpr uint64_t kMaxMmioDevicesNum = 16;
+constexpr uint64_t kMaxMmioDevicesNum = 32;
 
 class Bus : public MmioDevice {
  public:
   Bus();
-  void MountDevice(MmioDeviceNode node);
+  // fails if the table is full or node overlaps a mounted device
+  bool MountDevice(MmioDeviceNode node);
 
   bool Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) override;
   bool Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) override;
+  uint8_t* GetHostPtr(uint64_t addr, uint64_t bytes) override;
   void Reset() override;
 
+  template <typename T>
+  bool Load(uint64_t addr, T* val) {
+    const auto kDevIndex = GetDeviceByRange(addr);
+    if (kDevIndex == -1) {
+      return false;
+    }
+    auto dev_node = device_ + kDevIndex;
+    addr -= dev_node->base;
+    if constexpr (std::is_same_v<T, uint8_t>) {
+      return dev_node->dev->Load8(addr, val);
+    } else if constexpr (std::is_same_v<T, uint16_t>) {
+      return dev_node->dev->Load16(addr, val);
+    } else if constexpr (std::is_same_v<T, uint32_t>) {
+      return dev_node->dev->Load32(addr, val);
+    } else {
+      static_assert(std::is_same_v<T, uint64_t>, "unsupported access width");
+      return dev_node->dev->Load64(addr, val);
+    }
+  }
+
+  template <typename T>
+  bool Store(uint64_t addr, T val) {
+    const auto kDevIndex = GetDeviceByRange(addr);
+    if (kDevIndex == -1) {
+      return false;
+    }
+    auto dev_node = device_ + kDevIndex;
+    addr -= dev_node->base;
+    if constexpr (std::is_same_v<T, uint8_t>) {
+      return dev_node->dev->Store8(addr, val);
+    } else if constexpr (std::is_same_v<T, uint16_t>) {
+      return dev_node->dev->Store16(addr, val);
+    } else if constexpr (std::is_same_v<T, uint32_t>) {
+      return dev_node->dev->Store32(addr, val);
+    } else {
+      static_assert(std::is_same_v<T, uint64_t>, "unsupported access width");
+      return dev_node->dev->Store64(addr, val);
+    }
+  }
+
  private:
   uint64_t dev_cnt_;
   MmioDeviceNode device_[kMaxMmioDevicesNum];
@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "device/mmio.hpp"
+#include "device/scheduler.h"
 
 namespace rv64_emulator::device::clint {
 
@@ -18,18 +19,27 @@ class Clint : public MmioDevice {
   bool Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) override;
 
   void Reset() override;
+  void SetScheduler(scheduler::Scheduler* scheduler) override;
 
   bool MachineTimerIrq(uint64_t hart_id);
   bool MachineSoftwareIrq(uint64_t hart_id);
 
+  // mtime is only computed when it is read
+  uint64_t GetMtime() const;
+  // for the time csr, which reads mtime as well
+  const uint64_t* GetMtimeOffset() const { return &mtime_offset_; }
   void Tick();
-  void UpdateMtime();
 
  private:
   uint64_t harts_;
-  uint64_t mtime_;
+  // mtime minus the guest time stamp, non-zero once the guest wrote mtime
+  uint64_t mtime_offset_;
   std::vector<uint64_t> mtimecmp_;
   std::vector<uint32_t> msip_;
+  // scheduler timer of each hart, due once mtime passes its mtimecmp
+  std::vector<uint64_t> timers_;
+
+  void ArmTimers();
 };
 
 }  // namespace rv64_emulator::device::clint
@@ -1,24 +1,102 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+#include <string>
 #include <vector>
 
 #include "device/mmio.hpp"
 
 namespace rv64_emulator::device::dram {
 
+// host pages backing the guest RAM, huge pages take host TLB pressure off
+// large guests. kHuge2M and kHuge1G come from the hugetlbfs pool and need a
+// guest size that is a multiple of the page, they fall back to kTransparent
+// and then kSmall when they can not be had.
+enum class PageBacking {
+  kSmall,
+  kTransparent,
+  kHuge2M,
+  kHuge1G,
+};
+
 class DRAM : public MmioDevice {
  public:
-  explicit DRAM(uint64_t mem_size);
-  DRAM(uint64_t mem_size, const char* in_file);
+  explicit DRAM(uint64_t mem_size,
+                PageBacking backing = PageBacking::kSmall);
+  DRAM(uint64_t mem_size, const char* in_file,
+       PageBacking backing = PageBacking::kSmall);
+  DRAM(const DRAM&) = delete;
+  DRAM& operator=(const DRAM&) = delete;
+  ~DRAM() override;
   bool Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) override;
   bool Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) override;
+  uint8_t* GetHostPtr(uint64_t addr, uint64_t bytes) override;
   uint64_t GetSize() const;
+  // the backing actually in use after the fallbacks
+  PageBacking GetBacking() const { return backing_; }
+  // Places the raw image in_file at offset. Regular files are mapped
+  // copy-on-write over the guest memory, guest stores only touch private
+  // pages and Reset() brings the original image back. Images that can not be
+  // mapped (hugetlbfs backed RAM, unaligned offset, no regular file) are
+  // copied in instead, and copied again by Reset().
+  bool LoadImage(uint64_t offset, const char* in_file);
   void Reset() override;
 
+  // The width specialized accesses skip the bounds check, the bus only hands
+  // out addr < size and a guard page behind RAM catches whatever crosses the
+  // end, see libs/guard.h.
+  bool Load8(uint64_t addr, uint8_t* val) override { return Read(addr, val); }
+  bool Load16(uint64_t addr, uint16_t* val) override {
+    return Read(addr, val);
+  }
+  bool Load32(uint64_t addr, uint32_t* val) override {
+    return Read(addr, val);
+  }
+  bool Load64(uint64_t addr, uint64_t* val) override {
+    return Read(addr, val);
+  }
+  bool Store8(uint64_t addr, uint8_t val) override { return Write(addr, val); }
+  bool Store16(uint64_t addr, uint16_t val) override {
+    return Write(addr, val);
+  }
+  bool Store32(uint64_t addr, uint32_t val) override {
+    return Write(addr, val);
+  }
+  bool Store64(uint64_t addr, uint64_t val) override {
+    return Write(addr, val);
+  }
+
  private:
   uint64_t size_;
-  std::vector<uint8_t> memory_;
+  // anonymous MAP_NORESERVE mapping, host pages are only committed once the
+  // guest touches them
+  uint8_t* memory_;
+  uint8_t* guard_;
+  uint64_t map_size_;
+  PageBacking backing_;
+
+  // images LoadImage() copied in rather than mapped, Reset() reloads them
+  struct CopiedImage {
+    uint64_t offset;
+    std::string path;
+  };
+  std::vector<CopiedImage> copied_images_;
+
+  bool MapRam(PageBacking backing, uint64_t ram_bytes);
+  bool CopyImage(int fd, uint64_t offset, uint64_t bytes);
+
+  template <typename T>
+  bool Read(uint64_t addr, T* val) const {
+    memcpy(val, memory_ + addr, sizeof(T));
+    return true;
+  }
+
+  template <typename T>
+  bool Write(uint64_t addr, T val) {
+    memcpy(memory_ + addr, &val, sizeof(T));
+    return true;
+  }
 };
 
 }  // namespace rv64_emulator::device::dram
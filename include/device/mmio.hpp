@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <memory>
 
+#include "device/scheduler.h"
+
 namespace rv64_emulator::device {
 
 class MmioDevice {
@@ -10,7 +12,54 @@ class MmioDevice {
   virtual bool Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) = 0;
   virtual bool Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) = 0;
   virtual void Reset() = 0;
+
+  // width specialized accesses, by default adapted to the buffer based ones
+  virtual bool Load8(uint64_t addr, uint8_t* val) {
+    return Load(addr, sizeof(*val), val);
+  }
+  virtual bool Load16(uint64_t addr, uint16_t* val) {
+    return Load(addr, sizeof(*val), reinterpret_cast<uint8_t*>(val));
+  }
+  virtual bool Load32(uint64_t addr, uint32_t* val) {
+    return Load(addr, sizeof(*val), reinterpret_cast<uint8_t*>(val));
+  }
+  virtual bool Load64(uint64_t addr, uint64_t* val) {
+    return Load(addr, sizeof(*val), reinterpret_cast<uint8_t*>(val));
+  }
+  virtual bool Store8(uint64_t addr, uint8_t val) {
+    return Store(addr, sizeof(val), &val);
+  }
+  virtual bool Store16(uint64_t addr, uint16_t val) {
+    return Store(addr, sizeof(val), reinterpret_cast<const uint8_t*>(&val));
+  }
+  virtual bool Store32(uint64_t addr, uint32_t val) {
+    return Store(addr, sizeof(val), reinterpret_cast<const uint8_t*>(&val));
+  }
+  virtual bool Store64(uint64_t addr, uint64_t val) {
+    return Store(addr, sizeof(val), reinterpret_cast<const uint8_t*>(&val));
+  }
+
+  // host memory backing [addr, addr + bytes), nullptr for devices with side
+  // effects. Valid until the device is destroyed.
+  virtual uint8_t* GetHostPtr(uint64_t /*addr*/, uint64_t /*bytes*/) {
+    return nullptr;
+  }
+
+  // devices with timers create them here
+  virtual void SetScheduler(scheduler::Scheduler* scheduler) {
+    scheduler_ = scheduler;
+  }
   virtual ~MmioDevice() = default;
+
+ protected:
+  scheduler::Scheduler* scheduler_ = nullptr;
+
+  // one of the irq lines of the device may have changed
+  void RaiseIrq() {
+    if (scheduler_) {
+      scheduler_->RaiseIrq();
+    }
+  }
 };
 
 using MmioDeviceNode = struct MmioDeviceNode {
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <cstdint>
+
+namespace rv64_emulator::device::net {
+
+// Every packet starts with the virtio-net header, so checksum offload state
+// goes through the backend along with the frame.
+constexpr uint64_t kVnetHdrBytes = 12;
+
+// Where the packets of a network device go. Calls never block, Send and Recv
+// take or give one packet and fail with errno EAGAIN when they would block.
+class Backend {
+ public:
+  virtual ~Backend() = default;
+
+  // polled for incoming packets and for room to send
+  virtual int GetFd() const = 0;
+  virtual ssize_t Send(const iovec* iov, int iovcnt) = 0;
+  virtual ssize_t Recv(const iovec* iov, int iovcnt) = 0;
+};
+
+// a host tap interface, the kernel takes and gives the virtio-net header
+class Tap : public Backend {
+ public:
+  Tap();
+  Tap(const Tap&) = delete;
+  Tap& operator=(const Tap&) = delete;
+  ~Tap() override;
+
+  bool Open(const char* ifname);
+
+  int GetFd() const override { return fd_; }
+  ssize_t Send(const iovec* iov, int iovcnt) override;
+  ssize_t Recv(const iovec* iov, int iovcnt) override;
+
+ private:
+  int fd_;
+};
+
+// Unix datagram socket carrying one packet per datagram. Two emulators link
+// up by binding each to its own path and sending to the other one, they can
+// start in any order. Adopt() takes one end of a socketpair instead.
+class DatagramSocket : public Backend {
+ public:
+  DatagramSocket();
+  DatagramSocket(const DatagramSocket&) = delete;
+  DatagramSocket& operator=(const DatagramSocket&) = delete;
+  ~DatagramSocket() override;
+
+  bool Open(const char* local, const char* peer);
+  bool Adopt(int fd);
+
+  int GetFd() const override { return fd_; }
+  ssize_t Send(const iovec* iov, int iovcnt) override;
+  ssize_t Recv(const iovec* iov, int iovcnt) override;
+
+ private:
+  int fd_;
+  // unused for connected sockets
+  sockaddr_un peer_;
+  bool has_peer_;
+  sockaddr_un local_;
+  bool bound_;
+};
+
+}  // namespace rv64_emulator::device::net
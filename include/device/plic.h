@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
+#include <map>
 #include <vector>
 
 #include "conf.h"
@@ -25,6 +27,24 @@ constexpr uint64_t kWordBits = sizeof(uint32_t) * 8;
 constexpr uint64_t kLenGroupByWord =
     (kPlicMaxDevices + kWordBits - 1) / kWordBits;
 
+constexpr uint64_t kSetWordBits = sizeof(uint64_t) * 8;
+constexpr uint64_t kLenSetWords =
+    (kPlicMaxDevices + kSetWordBits - 1) / kSetWordBits;
+static_assert(kLenSetWords <= kSetWordBits,
+              "one summary word should cover all source words");
+
+// sources as a two level bitmap, the summary tells which words are not empty
+using SourceSet = struct SourceSet {
+  uint64_t summary = 0;
+  uint64_t bits[kLenSetWords] = {0};
+
+  void SetWord(uint64_t index, uint64_t word) {
+    bits[index] = word;
+    summary &= ~(1ULL << index);
+    summary |= static_cast<uint64_t>(word != 0) << index;
+  }
+};
+
 using PlicContext = struct PlicContext {
   bool mmode = false;
   uint32_t id = 0;
@@ -32,6 +52,8 @@ using PlicContext = struct PlicContext {
   uint32_t threshold = 0;
   uint32_t enable[kLenGroupByWord] = {0};
   uint32_t claimed_[kLenGroupByWord] = {0};
+  // pending, enabled and not claimed sources
+  SourceSet eligible;
 };
 
 class Plic : public MmioDevice {
@@ -48,6 +70,15 @@ class Plic : public MmioDevice {
   uint64_t dev_num_;
   uint32_t priority_[kPlicMaxDevices] = {0};
   uint32_t pending_[kLenGroupByWord] = {0};
+  // valid sources of each non-zero priority, highest priority first
+  std::map<uint32_t, SourceSet, std::greater<uint32_t>> levels_;
+
+  void UpdateEligible(PlicContext* ctx, uint64_t word_index);
+  void UpdatePriority(uint64_t src_id, uint32_t priority);
+  // picks the claim of ctx, the cpu is only told about a changed irq line
+  void Arbitrate(PlicContext* ctx);
+  // recomputes all derived state from the registers
+  void Rebuild();
 };
 
 }  // namespace rv64_emulator::device::plic
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace rv64_emulator::device::scheduler {
+
+constexpr uint64_t kNoDeadline = UINT64_MAX;
+
+// Machine level event scheduler. Devices arm timers with deadlines in mtime
+// ticks and report irq line changes as edges, the run loop only syncs the
+// interrupt lines after an edge and lets the hart run until the earliest
+// deadline in between.
+class Scheduler {
+ public:
+  using Callback = std::function<void(uint64_t now)>;
+
+  explicit Scheduler(uint64_t max_budget);
+
+  // timers are created once by their device and re-armed as needed
+  uint64_t AddTimer(Callback callback);
+  void Arm(uint64_t timer, uint64_t deadline);
+  void Disarm(uint64_t timer);
+  uint64_t NextDeadline() const { return next_deadline_; }
+  // fires and disarms the timers due at now, earliest first, returns how many
+  // of them fired
+  uint64_t RunExpired(uint64_t now);
+
+  // safe to call from any thread, kick is run on every edge, e.g. to end the
+  // current cpu run early
+  void RaiseIrq();
+  bool TakeIrq();
+  void SetKick(std::function<void()> kick) { kick_ = std::move(kick); }
+  // blocks the idle hart until an edge or the next deadline
+  void WaitIrq(uint64_t now);
+
+  // insts the hart may run from now on before the next deadline is due
+  uint64_t GetBudget(uint64_t now) const;
+  // feeds a run of insts that took ticks into the insts per tick estimate
+  void Account(uint64_t insts, uint64_t ticks);
+
+ private:
+  using Timer = struct Timer {
+    Callback callback;
+    uint64_t deadline;
+  };
+
+  // the insts per tick rate is kept in fixed point
+  static constexpr uint64_t kRateShift = 8;
+
+  std::vector<Timer> timers_;
+  uint64_t next_deadline_;
+  uint64_t max_budget_;
+  uint64_t rate_;
+
+  std::function<void()> kick_;
+  std::atomic<bool> irq_;
+  std::atomic<bool> waiting_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+
+  void UpdateNextDeadline();
+};
+
+}  // namespace rv64_emulator::device::scheduler
@@ -1,13 +1,17 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
-#include <mutex>
-#include <queue>
 
+#include "conf.h"
 #include "device/mmio.hpp"
+#include "libs/ring_buffer.hpp"
 
 namespace rv64_emulator::device::uart {
 
+// rx is filled by the host input thread and tx drained by the host console,
+// the guest side of both runs on the cpu thread. Each buffer has exactly one
+// producer and one consumer, so no locks are taken on the mmio path.
 class Uart : public MmioDevice {
  public:
   Uart();
@@ -30,13 +34,11 @@ class Uart : public MmioDevice {
   };
 
   struct UartReg reg_;
-  std::mutex rx_lock_;
-  std::mutex tx_lock_;
 
-  bool wait_ack_;
+  std::atomic<bool> wait_ack_;
 
-  std::queue<char> rx_buffer_;
-  std::queue<char> tx_buffer_;
+  libs::RingBuffer<char, kUartBufferSize> rx_buffer_;
+  libs::RingBuffer<char, kUartBufferSize> tx_buffer_;
 };
 
 }  // namespace rv64_emulator::device::uart
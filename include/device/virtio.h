@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "device/bus.h"
+#include "device/mmio.hpp"
+#include "device/virtqueue.h"
+
+namespace rv64_emulator::device::virtio {
+
+// https://docs.oasis-open.org/virtio/virtio/v1.2/virtio-v1.2.html, 4.2.2
+constexpr uint64_t kMagicValue = 0x000;
+constexpr uint64_t kVersion = 0x004;
+constexpr uint64_t kDeviceId = 0x008;
+constexpr uint64_t kVendorId = 0x00c;
+constexpr uint64_t kDeviceFeatures = 0x010;
+constexpr uint64_t kDeviceFeaturesSel = 0x014;
+constexpr uint64_t kDriverFeatures = 0x020;
+constexpr uint64_t kDriverFeaturesSel = 0x024;
+constexpr uint64_t kQueueSel = 0x030;
+constexpr uint64_t kQueueNumMax = 0x034;
+constexpr uint64_t kQueueNum = 0x038;
+constexpr uint64_t kQueueReady = 0x044;
+constexpr uint64_t kQueueNotify = 0x050;
+constexpr uint64_t kInterruptStatus = 0x060;
+constexpr uint64_t kInterruptAck = 0x064;
+constexpr uint64_t kStatus = 0x070;
+constexpr uint64_t kQueueDescLow = 0x080;
+constexpr uint64_t kQueueDescHigh = 0x084;
+constexpr uint64_t kQueueDriverLow = 0x090;
+constexpr uint64_t kQueueDriverHigh = 0x094;
+constexpr uint64_t kQueueDeviceLow = 0x0a0;
+constexpr uint64_t kQueueDeviceHigh = 0x0a4;
+constexpr uint64_t kConfigGeneration = 0x0fc;
+constexpr uint64_t kConfig = 0x100;
+
+constexpr uint32_t kMagic = 0x74726976;
+constexpr uint32_t kMmioVersion = 2;
+constexpr uint32_t kVendor = 0x554d4551;
+
+constexpr uint64_t kFeatureIndirectDesc = 1ULL << 28;
+constexpr uint64_t kFeatureEventIdx = 1ULL << 29;
+constexpr uint64_t kFeatureVersion1 = 1ULL << 32;
+
+constexpr uint32_t kStatusAcknowledge = 1;
+constexpr uint32_t kStatusDriver = 2;
+constexpr uint32_t kStatusDriverOk = 4;
+constexpr uint32_t kStatusFeaturesOk = 8;
+constexpr uint32_t kStatusNeedsReset = 64;
+constexpr uint32_t kStatusFailed = 128;
+
+constexpr uint32_t kInterruptUsedBuffer = 1;
+constexpr uint32_t kInterruptConfigChange = 2;
+
+// Virtio over mmio, version 2. Devices derive from it, provide their config
+// space and serve their queues when the driver notifies them. A plain
+// VirtioMmio has device id 0 and no queues, an empty slot drivers skip.
+class VirtioMmio : public MmioDevice {
+ public:
+  VirtioMmio(bus::Bus* bus, uint32_t device_id, uint64_t features,
+             uint32_t queue_num, uint16_t queue_size);
+
+  bool Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) override;
+  bool Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) override;
+  void Reset() override;
+
+  // level of the plic source, safe to call from any thread
+  bool Irq() const;
+
+ protected:
+  bus::Bus* bus_;
+  std::vector<VirtQueue> queues_;
+
+  bool Negotiated(uint64_t feature) const {
+    return (driver_features_ & feature) == feature;
+  }
+  // publishes the chains pushed to the queue and raises the used buffer
+  // interrupt if the driver wants one, also called by async backends
+  void FlushQueue(uint32_t index);
+  void InterruptConfig();
+  // the device can not go on until the driver resets it, register writes
+  // only
+  void NeedsReset();
+  bool GetNeedsReset() const { return status_ & kStatusNeedsReset; }
+
+  // Serves every chain the driver made available in one batch, including
+  // the ones it adds meanwhile, with a single interrupt at the end. serve
+  // returns how many bytes it wrote to the chain.
+  template <typename Serve>
+  void ServeQueue(uint32_t index, Serve serve) {
+    VirtQueue& queue = queues_[index];
+    do {
+      queue.DisableNotify();
+      while (queue.Pop(&chain_)) {
+        queue.Push(chain_.head, serve(chain_));
+      }
+    } while (queue.EnableNotify());
+    FlushQueue(index);
+  }
+
+  // devices without a config space or notification handling keep these
+  virtual bool ReadConfig(uint64_t /*offset*/, uint64_t /*bytes*/,
+                          uint8_t* /*buffer*/) {
+    return false;
+  }
+  virtual bool WriteConfig(uint64_t /*offset*/, uint64_t /*bytes*/,
+                           const uint8_t* /*buffer*/) {
+    return false;
+  }
+  virtual void QueueNotify(uint32_t /*index*/) {}
+  // called before queues are reset, devices serving chains on other threads
+  // wait for them here
+  virtual void Quiesce() {}
+  // the driver reset the device, the queues are reset already
+  virtual void DeviceReset() {}
+
+ private:
+  uint32_t device_id_;
+  uint64_t device_features_;
+  uint64_t driver_features_;
+  uint32_t device_features_sel_;
+  uint32_t driver_features_sel_;
+  uint32_t queue_sel_;
+  uint32_t status_;
+  uint32_t config_generation_;
+  std::atomic<uint32_t> interrupt_status_;
+  // reused by ServeQueue, keeps the segment vectors allocated
+  Chain chain_;
+
+  void SetInterrupt(uint32_t bits);
+  bool LoadReg(uint64_t addr, uint32_t* val);
+  bool StoreReg(uint64_t addr, uint32_t val);
+  void ResetDevice();
+};
+
+}  // namespace rv64_emulator::device::virtio
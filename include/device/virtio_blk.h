@@ -0,0 +1,107 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "device/block.h"
+#include "device/bus.h"
+#include "device/virtio.h"
+#include "device/virtqueue.h"
+
+namespace rv64_emulator::device::virtio {
+
+// https://docs.oasis-open.org/virtio/virtio/v1.2/virtio-v1.2.html, 5.2
+constexpr uint32_t kBlkDeviceId = 2;
+
+constexpr uint64_t kBlkFeatureSegMax = 1ULL << 2;
+constexpr uint64_t kBlkFeatureRo = 1ULL << 5;
+constexpr uint64_t kBlkFeatureBlkSize = 1ULL << 6;
+constexpr uint64_t kBlkFeatureFlush = 1ULL << 9;
+
+constexpr uint32_t kBlkTypeIn = 0;
+constexpr uint32_t kBlkTypeOut = 1;
+constexpr uint32_t kBlkTypeFlush = 4;
+constexpr uint32_t kBlkTypeGetId = 8;
+
+constexpr uint8_t kBlkStatusOk = 0;
+constexpr uint8_t kBlkStatusIoErr = 1;
+constexpr uint8_t kBlkStatusUnsupp = 2;
+
+constexpr uint64_t kBlkIdBytes = 20;
+
+using BlkReqHeader = struct BlkReqHeader {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+};
+
+using BlkConfig = struct BlkConfig {
+  uint64_t capacity;
+  uint32_t size_max;
+  uint32_t seg_max;
+  uint16_t cylinders;
+  uint8_t heads;
+  uint8_t sectors;
+  uint32_t blk_size;
+};
+
+// A virtio block device with one request queue. Requests are parsed on the
+// notifying thread and served by a pool of host threads, so many of them are
+// in flight while the hart runs on. Completions are published in batches and
+// raise the interrupt straight from the pool.
+class VirtioBlk : public VirtioMmio {
+ public:
+  VirtioBlk(bus::Bus* bus, std::unique_ptr<block::Backend> backend,
+            uint64_t workers, uint16_t queue_size);
+  VirtioBlk(const VirtioBlk&) = delete;
+  VirtioBlk& operator=(const VirtioBlk&) = delete;
+  ~VirtioBlk() override;
+
+ protected:
+  bool ReadConfig(uint64_t offset, uint64_t bytes, uint8_t* buffer) override;
+  void QueueNotify(uint32_t index) override;
+  void Quiesce() override;
+
+ private:
+  using Request = struct Request {
+    uint32_t type;
+    uint64_t sector;
+    // the data buffers, without the header and the status byte
+    std::vector<iovec> data;
+    uint64_t bytes;
+    uint8_t* status;
+    // parsed and not completed yet, a worker may be using data
+    bool busy = false;
+  };
+
+  std::unique_ptr<block::Backend> backend_;
+  BlkConfig config_;
+  // indexed by chain head, a head is only reused once its chain completed
+  std::vector<Request> requests_;
+  Chain chain_;
+
+  // guards the members below and the used ring of the queue
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable idle_cv_;
+  std::deque<uint16_t> pending_;
+  // pending ones plus the ones being served
+  uint64_t in_flight_;
+  bool stop_;
+  std::vector<std::thread> workers_;
+
+  // false for chains without a header or a status byte
+  bool Parse(const Chain& chain, Request* req);
+  // returns the bytes written to the chain
+  uint32_t Serve(Request* req);
+  void Work();
+};
+
+}  // namespace rv64_emulator::device::virtio
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <poll.h>
+#include <sys/uio.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "device/bus.h"
+#include "device/virtio_io.h"
+#include "device/virtqueue.h"
+
+namespace rv64_emulator::device::virtio {
+
+// https://docs.oasis-open.org/virtio/virtio/v1.2/virtio-v1.2.html, 5.3
+constexpr uint32_t kConsoleDeviceId = 3;
+
+constexpr uint64_t kConsoleFeatureMultiport = 1ULL << 1;
+
+constexpr uint32_t kConsoleControlRxQueue = 2;
+constexpr uint32_t kConsoleControlTxQueue = 3;
+
+constexpr uint16_t kConsoleDeviceReady = 0;
+constexpr uint16_t kConsoleDeviceAdd = 1;
+constexpr uint16_t kConsolePortReady = 3;
+constexpr uint16_t kConsoleConsolePort = 4;
+constexpr uint16_t kConsolePortOpen = 6;
+constexpr uint16_t kConsolePortName = 7;
+
+using ConsoleConfig = struct ConsoleConfig {
+  uint16_t cols;
+  uint16_t rows;
+  uint32_t max_nr_ports;
+  uint32_t emerg_wr;
+};
+
+using ConsoleControl = struct ConsoleControl {
+  uint32_t id;
+  uint16_t event;
+  uint16_t value;
+};
+
+// port 0 has the first queue pair, the control queues sit between it and
+// the other ports. The tx queue follows the rx one.
+constexpr uint32_t ConsoleRxQueue(uint32_t port) {
+  return port ? 2 * port + 2 : 0;
+}
+
+using ConsolePort = struct ConsolePort {
+  // a console port becomes a hvc, the others are char devices with a name
+  std::string name;
+  bool console;
+  // host files or pipes, in_fd is -1 for output only ports. The fds stay
+  // owned by the caller, in_fd is switched to non-blocking.
+  int in_fd;
+  int out_fd;
+};
+
+// A virtio console with one port per host file or pipe. An io thread copies
+// guest output of every port into a host buffer, which is written out in
+// large chunks or once it has been pending for a while, and reads host input
+// straight into guest buffers while the guest has the port open. The writes
+// to the host are not serialized with register writes.
+class VirtioConsole : public VirtioIoDevice {
+ public:
+  VirtioConsole(bus::Bus* bus, std::vector<ConsolePort> ports,
+                uint16_t queue_size);
+  ~VirtioConsole() override;
+
+ protected:
+  bool ReadConfig(uint64_t offset, uint64_t bytes, uint8_t* buffer) override;
+  void DeviceReset() override;
+  int PollFds(std::vector<pollfd>* fds) override;
+  void ServeQueues(const std::vector<pollfd>& fds) override;
+  void ServeHost(const std::vector<pollfd>& fds) override;
+
+ private:
+  using PortState = struct PortState {
+    ConsolePort port;
+
+    // guarded by mutex_
+    bool guest_open = false;
+    bool in_eof = false;
+
+    // io thread only
+    std::string out;
+    // the host buffer is full, tx waits until it is written
+    bool tx_paused = false;
+    // out_fd would block, waits for room
+    bool out_blocked = false;
+  };
+
+  std::vector<PortState> ports_;
+  ConsoleConfig config_;
+
+  // control messages waiting for driver buffers
+  std::deque<std::string> control_;
+  Chain chain_;
+  std::vector<iovec> iov_;
+
+  // io thread only, the buffered output is written by then
+  std::chrono::steady_clock::time_point flush_deadline_;
+  bool flush_pending_;
+  // tx of a port paused and has room again, the io thread does not sleep
+  bool again_;
+
+  bool PortOpen(uint32_t port) const;
+  // in_fd is worth polling and reading
+  bool PortReadable(uint32_t port) const;
+  void SendControl(uint32_t id, uint16_t event, uint16_t value,
+                   const std::string& data);
+  void HandleControl(const ConsoleControl& msg);
+
+  void ServeControl();
+  void ServeTx(uint32_t port);
+  void ServeRx(uint32_t port);
+  // writes the buffered output without the lock held
+  void WriteOut(uint32_t port);
+};
+
+}  // namespace rv64_emulator::device::virtio
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <poll.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "device/bus.h"
+#include "device/virtio.h"
+#include "device/virtqueue.h"
+
+namespace rv64_emulator::device::virtio {
+
+// A virtio device served by an io thread, which sleeps in poll on the
+// notifications of the driver and the host fds of the device. Register
+// writes are serialized with the io thread, which keeps the rings to itself
+// otherwise. Derived devices call StartIo once they are set up and StopIo
+// before they are torn down.
+class VirtioIoDevice : public VirtioMmio {
+ public:
+  VirtioIoDevice(bus::Bus* bus, uint32_t device_id, uint64_t features,
+                 uint32_t queue_num, uint16_t queue_size);
+  VirtioIoDevice(const VirtioIoDevice&) = delete;
+  VirtioIoDevice& operator=(const VirtioIoDevice&) = delete;
+  ~VirtioIoDevice() override;
+
+  bool Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) override;
+  void Reset() override;
+
+ protected:
+  // an rx queue whose chains are popped before the host has data for them
+  using RxSlot = struct RxSlot {
+    uint32_t queue;
+    // popped but not filled yet, the host had nothing to read
+    Chain chain;
+    bool held = false;
+    // the queue ran out of buffers, no point in polling the host
+    bool starved = false;
+  };
+
+  // guards the queues and the device state against register writes
+  std::mutex mutex_;
+  std::vector<RxSlot> rx_;
+
+  void StartIo();
+  void StopIo();
+  // holds a chain of the slot, false once the queue ran out of buffers
+  bool HoldRx(RxSlot* slot);
+
+  void QueueNotify(uint32_t index) override;
+  void Quiesce() override;
+
+  // With mutex_ held, appends the host fds to wait for behind the kick fd and
+  // returns the poll timeout in ms.
+  virtual int PollFds(std::vector<pollfd>* fds) = 0;
+  // with mutex_ held, serves the queues once poll returned
+  virtual void ServeQueues(const std::vector<pollfd>& fds) = 0;
+  // without the lock, for host io that may take a while
+  virtual void ServeHost(const std::vector<pollfd>& /*fds*/) {}
+
+ private:
+  // eventfd the notifications wake the io thread with
+  int kick_fd_;
+  std::atomic<bool> stop_;
+  std::thread io_thread_;
+
+  void Kick();
+  void Io();
+};
+
+}  // namespace rv64_emulator::device::virtio
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <poll.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "device/bus.h"
+#include "device/net.h"
+#include "device/virtio_io.h"
+#include "device/virtqueue.h"
+
+namespace rv64_emulator::device::virtio {
+
+// https://docs.oasis-open.org/virtio/virtio/v1.2/virtio-v1.2.html, 5.1
+constexpr uint32_t kNetDeviceId = 1;
+
+constexpr uint64_t kNetFeatureCsum = 1ULL << 0;
+constexpr uint64_t kNetFeatureGuestCsum = 1ULL << 1;
+constexpr uint64_t kNetFeatureMac = 1ULL << 5;
+constexpr uint64_t kNetFeatureStatus = 1ULL << 16;
+
+constexpr uint32_t kNetRxQueue = 0;
+constexpr uint32_t kNetTxQueue = 1;
+
+constexpr uint8_t kNetHdrNeedsCsum = 1;
+constexpr uint8_t kNetHdrDataValid = 2;
+constexpr uint16_t kNetStatusLinkUp = 1;
+constexpr uint64_t kNetMacBytes = 6;
+
+using NetHdr = struct NetHdr {
+  uint8_t flags;
+  uint8_t gso_type;
+  uint16_t hdr_len;
+  uint16_t gso_size;
+  uint16_t csum_start;
+  uint16_t csum_offset;
+  uint16_t num_buffers;
+};
+
+using NetConfig = struct NetConfig {
+  uint8_t mac[kNetMacBytes];
+  uint16_t status;
+};
+
+// A virtio network device with one rx and one tx queue. The io thread moves
+// packets between the queues and the backend straight from and to guest
+// buffers, draining each queue in batches with notifications and interrupts
+// suppressed in between.
+class VirtioNet : public VirtioIoDevice {
+ public:
+  VirtioNet(bus::Bus* bus, std::unique_ptr<net::Backend> backend,
+            const uint8_t* mac, uint16_t queue_size);
+  ~VirtioNet() override;
+
+ protected:
+  bool ReadConfig(uint64_t offset, uint64_t bytes, uint8_t* buffer) override;
+  void Quiesce() override;
+  int PollFds(std::vector<pollfd>* fds) override;
+  void ServeQueues(const std::vector<pollfd>& fds) override;
+
+ private:
+  std::unique_ptr<net::Backend> backend_;
+  NetConfig config_;
+
+  // popped but not sent yet, the backend had no room
+  Chain tx_chain_;
+  bool tx_held_;
+  // io thread scratch for handing chains to the backend
+  std::vector<iovec> iov_;
+
+  void ServeTx();
+  void ServeRx();
+  // finishes the partial checksum of a received packet of bytes for drivers
+  // that can not
+  void CompleteCsum(const Chain& chain, NetHdr* hdr, uint64_t bytes);
+};
+
+}  // namespace rv64_emulator::device::virtio
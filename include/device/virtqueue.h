@@ -0,0 +1,119 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "device/bus.h"
+
+namespace rv64_emulator::device::virtio {
+
+constexpr uint16_t kDescFlagNext = 1;
+constexpr uint16_t kDescFlagWrite = 2;
+constexpr uint16_t kDescFlagIndirect = 4;
+
+constexpr uint16_t kAvailFlagNoInterrupt = 1;
+constexpr uint16_t kUsedFlagNoNotify = 1;
+
+using VirtqDesc = struct VirtqDesc {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+};
+
+using VirtqUsedElem = struct VirtqUsedElem {
+  uint32_t id;
+  uint32_t len;
+};
+
+// a descriptor buffer mapped to host memory
+using Segment = struct Segment {
+  uint8_t* host;
+  uint32_t len;
+};
+
+// One descriptor chain. The buffers point straight into guest RAM, so the
+// device reads and writes them without a bounce copy. DMA into code pages is
+// not tracked by the decode cache, the guest has to fence.i like on real
+// hardware.
+using Chain = struct Chain {
+  uint16_t head = 0;
+  // driver to device buffers, then device to driver ones
+  std::vector<Segment> readable;
+  std::vector<Segment> writable;
+
+  uint64_t ReadableBytes() const;
+  uint64_t WritableBytes() const;
+  // gathers up to bytes of the readable buffers from offset into dst
+  uint64_t Read(uint64_t offset, uint8_t* dst, uint64_t bytes) const;
+  // scatters src over the writable buffers from offset
+  uint64_t Write(uint64_t offset, const uint8_t* src, uint64_t bytes) const;
+};
+
+// appends the host buffers of [offset, offset + bytes) of segments to iov,
+// for handing chains to vectored host io
+void AppendIov(const std::vector<Segment>& segments, uint64_t offset,
+               uint64_t bytes, std::vector<iovec>* iov);
+
+// Device side of a split virtqueue. The rings are resolved to host pointers
+// once when the driver enables the queue. Chains are popped and pushed in
+// batches, the used index is only published by Flush(), which also tells
+// whether the driver wants an interrupt for the batch.
+class VirtQueue {
+ public:
+  explicit VirtQueue(uint16_t max_size);
+
+  uint16_t GetMaxSize() const { return max_size_; }
+  bool IsReady() const { return ready_; }
+
+  // ring layout written by the driver before it sets the queue ready
+  uint16_t size_;
+  uint64_t desc_addr_;
+  uint64_t driver_addr_;
+  uint64_t device_addr_;
+
+  // maps the rings, fails if they are not in guest RAM
+  bool Enable(bus::Bus* bus, bool event_idx);
+  void Reset();
+
+  // Takes the next available chain. Malformed chains are handed back to the
+  // driver right away with nothing written, false when none is left.
+  bool Pop(Chain* chain);
+  void Push(uint16_t head, uint32_t written);
+  // publishes the pushed chains, returns whether to interrupt the driver
+  bool Flush();
+
+  // Driver notifications are not needed while the device is draining the
+  // queue. EnableNotify returns whether chains arrived in between, the
+  // device should drain them before it waits for the next notification.
+  void DisableNotify();
+  bool EnableNotify();
+
+ private:
+  uint16_t max_size_;
+  bool ready_;
+  bool event_idx_;
+  bus::Bus* bus_;
+
+  VirtqDesc* desc_;
+  // flags, idx, ring[size_] and used_event
+  uint16_t* avail_;
+  // flags, idx, then the elements, avail_event follows them
+  uint16_t* used_flags_;
+  uint16_t* used_idx_;
+  VirtqUsedElem* used_ring_;
+  uint16_t* avail_event_;
+
+  uint16_t last_avail_;
+  uint16_t next_used_;
+  // used index the driver has last been told about
+  uint16_t signalled_used_;
+
+  uint16_t AvailIdx() const;
+  bool Walk(uint16_t head, Chain* chain);
+  bool AddSegment(const VirtqDesc& desc, Chain* chain);
+};
+
+}  // namespace rv64_emulator::device::virtio
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace rv64_emulator::libs::fdt {
+
+using MemoryRegion = struct MemoryRegion {
+  uint64_t base;
+  uint64_t size;
+};
+
+// Copies the flattened device tree dtb to out with its memory node describing
+// regions, one <base size> pair each. The first memory node below the root
+// keeps its other properties, like the phandle other nodes point at, and is
+// renamed after the first region. Further memory nodes are dropped, and a
+// tree without one gets a new node. Fails on a malformed tree or a root whose
+// #address-cells and #size-cells are not 2.
+bool SetMemory(const std::vector<uint8_t>& dtb,
+               const std::vector<MemoryRegion>& regions,
+               std::vector<uint8_t>* out);
+
+}  // namespace rv64_emulator::libs::fdt
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <csetjmp>
+#include <cstdint>
+
+namespace rv64_emulator::libs::guard {
+
+// Host ranges that are never accessible, like the PROT_NONE pages behind
+// guest RAM. Fast paths skip their bounds checks, a SIGSEGV inside a guard
+// range unwinds to the recovery point armed on the faulting thread.
+bool AddGuard(const void* base, uint64_t size);
+void RemoveGuard(const void* base);
+
+using Recovery = struct Recovery {
+  sigjmp_buf env;
+  uintptr_t fault_addr;
+};
+
+// arms rec on the calling thread and returns the one armed before, faults
+// hit without any armed recovery point still crash the process
+Recovery* SetRecovery(Recovery* rec);
+
+}  // namespace rv64_emulator::libs::guard
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace rv64_emulator::libs {
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Push is producer only, Pop, Peek and Clear are consumer only, the queries
+// are safe from either side.
+template <typename T, uint64_t N>
+class RingBuffer {
+ public:
+  static_assert(N && (N & (N - 1)) == 0,
+                "ring buffer size should be power of 2");
+
+  bool Push(const T& val) {
+    const uint64_t kTail = tail_.load(std::memory_order_relaxed);
+    if (kTail - head_.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    buffer_[kTail & (N - 1)] = val;
+    tail_.store(kTail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool Pop(T* val) {
+    if (!Peek(val)) {
+      return false;
+    }
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+    return true;
+  }
+
+  bool Peek(T* val) const {
+    const uint64_t kHead = head_.load(std::memory_order_relaxed);
+    if (kHead == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *val = buffer_[kHead & (N - 1)];
+    return true;
+  }
+
+  void Clear() {
+    head_.store(tail_.load(std::memory_order_acquire),
+                std::memory_order_release);
+  }
+
+  // head first, a racing pop can not make the size wrap around
+  uint64_t Size() const {
+    const uint64_t kHead = head_.load(std::memory_order_acquire);
+    return tail_.load(std::memory_order_acquire) - kHead;
+  }
+
+  bool Empty() const { return Size() == 0; }
+  bool Full() const { return Size() >= N; }
+
+ private:
+  // the indexes only grow, producer and consumer own a cache line each
+  alignas(64) std::atomic<uint64_t> head_ = 0;
+  alignas(64) std::atomic<uint64_t> tail_ = 0;
+  T buffer_[N];
+};
+
+}  // namespace rv64_emulator::libs
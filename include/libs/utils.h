@@ -7,6 +7,7 @@
 
 #include "cpu/cpu.h"
 #include "cpu/trap.h"
+#include "device/bus.h"
 #include "elfio/elfio.hpp"
 
 namespace rv64_emulator {
@@ -16,7 +17,9 @@ using cpu::trap::TrapType;
 
 namespace libs::util {
 
-void LoadElf(const ELFIO::elfio& reader, CPU* cpu);
+// copies PT_LOAD segments straight into RAM by physical address, call it
+// before the harts start running since no CPU side cache is invalidated
+void LoadElf(const ELFIO::elfio& reader, device::bus::Bus* bus);
 bool CheckSectionExist(const ELFIO::elfio& reader, const char* name,
                        ELFIO::Elf64_Addr* addr);
 
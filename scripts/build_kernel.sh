@@ -72,12 +72,15 @@ tar zxf "$LINUX_SRC"
 cd "linux-$LINUX_TAG"
 make ARCH=riscv CROSS_COMPILE=riscv64-unknown-linux-gnu- defconfig
 cp "$ROOT_DIR/config/kernel_config" .config
+# fills in the options the saved config leaves out, e.g. networking ones
+make ARCH=riscv CROSS_COMPILE=riscv64-unknown-linux-gnu- olddefconfig
 make ARCH=riscv CROSS_COMPILE=riscv64-unknown-linux-gnu- -j $(nproc)
 cd ..
 
 # step 4: build opensbi
 tar -zxf $OPENSBI_SRC
 cd "opensbi-$OPENSBI_TAG"
-make CROSS_COMPILE=riscv64-unknown-elf- PLATFORM=generic PLATFORM_RISCV_ISA=rv64ima FW_FDT_PATH=../rv64_emulator.dtb FW_PAYLOAD_PATH=../linux-$LINUX_TAG/arch/riscv/boot/Image
+# no FW_FDT_PATH, the firmware takes the dtb the emulator passes in a1
+make CROSS_COMPILE=riscv64-unknown-elf- PLATFORM=generic PLATFORM_RISCV_ISA=rv64ima FW_PAYLOAD_PATH=../linux-$LINUX_TAG/arch/riscv/boot/Image
 cp build/platform/generic/firmware/fw_payload.bin ..
 cd ..
@@ -1,5 +1,6 @@
 #include "cpu/cpu.h"
 
+#include <csetjmp>
 #include <cstdint>
 #include <memory>
 #include <tuple>
@@ -11,6 +12,7 @@
 #include "cpu/mmu.h"
 #include "cpu/trap.h"
 #include "libs/arithmetic.h"
+#include "libs/guard.h"
 #include "libs/utils.h"
 
 namespace rv64_emulator::cpu {
@@ -50,7 +52,11 @@ CPU::CPU(std::unique_ptr<mmu::Mmu> mmu)
       pc_(0),
       hart_id_(hart_id++),
       priv_mode_(PrivilegeMode::kMachine),
-      mmu_(std::move(mmu)) {
+      mmu_(std::move(mmu)),
+      exec_engine_(executor::ExecEngine::kSwitch),
+      events_(0) {
+  state_.BindIrqEvent(&events_, kEventIrqDirty);
+  state_.BindInstret(&instret_);
   reg_file_.xregs[10] = hart_id_;
   executor_ = std::make_unique<executor::Executor>();
   executor_->SetProcessor(this);
@@ -65,6 +71,7 @@ void CPU::Reset() {
   reg_file_.Reset();
   mmu_->Reset();
   state_.Reset();
+  decode_cache_.Flush();
 }
 
 trap::Trap CPU::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) const {
@@ -75,6 +82,25 @@ trap::Trap CPU::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
   return mmu_->Store(addr, bytes, buffer);
 }
 
+template <typename T>
+trap::Trap CPU::Load(uint64_t addr, T* val) const {
+  return mmu_->Load(addr, val);
+}
+
+template <typename T>
+trap::Trap CPU::Store(uint64_t addr, T val) {
+  return mmu_->Store(addr, val);
+}
+
+template trap::Trap CPU::Load(uint64_t addr, uint8_t* val) const;
+template trap::Trap CPU::Load(uint64_t addr, uint16_t* val) const;
+template trap::Trap CPU::Load(uint64_t addr, uint32_t* val) const;
+template trap::Trap CPU::Load(uint64_t addr, uint64_t* val) const;
+template trap::Trap CPU::Store(uint64_t addr, uint8_t val);
+template trap::Trap CPU::Store(uint64_t addr, uint16_t val);
+template trap::Trap CPU::Store(uint64_t addr, uint32_t val);
+template trap::Trap CPU::Store(uint64_t addr, uint64_t val);
+
 void CPU::HandleTrap(trap::Trap trap, uint64_t epc) {
   if (trap.type == trap::TrapType::kNone) {
     return;
@@ -171,10 +197,9 @@ void CPU::HandleInterrupt(uint64_t inst_addr) {
   }
 
   const uint64_t kCsrMipMask = TrapToMask(final_interrupt.type);
-  HandleTrap(final_interrupt, inst_addr);
-  state_.Write(csr::kCsrMip, kMip & (~kCsrMipMask));
-
   if (kCsrMipMask != 0) {
+    HandleTrap(final_interrupt, inst_addr);
+    state_.Write(csr::kCsrMip, kMip & (~kCsrMipMask));
     state_.SetWfi(false);
   }
 }
@@ -191,64 +216,195 @@ trap::Trap CPU::Fetch(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
   return mmu_->Fetch(addr, bytes, buffer);
 }
 
-trap::Trap CPU::TickOperate() {
-  if (state_.GetWfi()) {
-    const uint64_t kMie = state_.Read(csr::kCsrMie);
-    const uint64_t kMip = state_.Read(csr::kCsrMip);
-    if (kMie & kMip) {
-      state_.SetWfi(false);
+// the switch engine runs until the end of the current basic block
+static bool IsBlockEnd(const decode::DecodeInfo& info) {
+  switch (info.op) {
+    case decode::OpCode::kBranch:
+    case decode::OpCode::kJal:
+    case decode::OpCode::kJalr:
+    case decode::OpCode::kSystem:
+    case decode::OpCode::kFence:
+      return true;
+    default:
+      return false;
+  }
+}
+
+trap::Trap CPU::ExecBlock(uint64_t budget, uint64_t* retired) {
+  *retired = 0;
+  while (*retired < budget) {
+    // fetch and decode stage
+    decode::DecodeInfo* cached_info = nullptr;
+    const trap::Trap kFetchTrap = FetchDecode(&cached_info);
+    if (kFetchTrap.type != trap::TrapType::kNone) {
+      return kFetchTrap;
+    }
+
+    // the same physical inst may be mapped at different virtual addresses
+    auto info = *cached_info;
+    info.pc = pc_;
+    if (info.token == decode::InstToken::UNKNOWN) {
+      return {.type = trap::TrapType::kIllegalInstruction, .val = info.word};
+    }
+
+    // execute stage
+    pc_ += info.size;
+    const trap::Trap kExecTrap = executor_->Exec(info);
+    reg_file_.xregs[0] = 0;
+    if (kExecTrap.type != trap::TrapType::kNone) {
+      pc_ = info.pc;
+      return kExecTrap;
+    }
+
+    ++instret_;
+    ++(*retired);
+    if (IsBlockEnd(info)) {
+      break;
     }
-    return trap::kNoneTrap;
   }
 
-  // fetch stage
-  uint32_t word = 0;
-  const trap::Trap kFetchTrap =
-      Fetch(pc_, sizeof(uint32_t), reinterpret_cast<uint8_t*>(&word));
-  if (kFetchTrap.type != trap::TrapType::kNone) {
-    return kFetchTrap;
+  return trap::kNoneTrap;
+}
+
+trap::Trap CPU::FetchDecode(decode::DecodeInfo** info) {
+  // only the translation is needed if the inst is decoded before
+  uint64_t paddr = 0;
+  const trap::Trap kTranslateTrap = mmu_->TranslateFetch(pc_, &paddr);
+  if (kTranslateTrap.type != trap::TrapType::kNone) {
+    return kTranslateTrap;
   }
 
-  // decode stage
-  auto info = decode::DecodeInfo(word, pc_);
-  pc_ += info.size;
-  if (info.token == decode::InstToken::UNKNOWN) {
-    return {.type = trap::TrapType::kIllegalInstruction, .val = word};
+  decode::DecodeInfo* cached_info = decode_cache_.LookUp(paddr);
+  if (!cached_info) {
+    uint32_t word = 0;
+    const trap::Trap kFetchTrap =
+        Fetch(pc_, sizeof(uint32_t), reinterpret_cast<uint8_t*>(&word));
+    if (kFetchTrap.type != trap::TrapType::kNone) {
+      return kFetchTrap;
+    }
+    cached_info = decode_cache_.Insert(paddr, decode::DecodeInfo(word, pc_));
   }
 
-  // execute stage
-  const trap::Trap kExecTrap = executor_->Exec(info);
-  reg_file_.xregs[0] = 0;
-  return kExecTrap;
+  *info = cached_info;
+  return trap::kNoneTrap;
 }
 
-void CPU::Tick(bool meip, bool seip, bool msip, bool mtip, bool update) {
-  if (update) {
-    uint64_t mip_val = state_.Read(csr::kCsrMip);
-    auto* mip_desc = reinterpret_cast<csr::MipDesc*>(&mip_val);
-    mip_desc->meip = meip;
-    mip_desc->seip = seip;
-    mip_desc->msip = msip;
-    mip_desc->mtip = mtip;
-    state_.Write(csr::kCsrMip, *reinterpret_cast<const uint64_t*>(mip_desc));
+void CPU::UpdateIrq(bool meip, bool seip, bool msip, bool mtip) {
+  const uint64_t kOldMip = state_.Read(csr::kCsrMip);
+  uint64_t mip_val = kOldMip;
+  auto* mip_desc = reinterpret_cast<csr::MipDesc*>(&mip_val);
+  mip_desc->meip = meip;
+  mip_desc->seip = seip;
+  mip_desc->msip = msip;
+  mip_desc->mtip = mtip;
+
+  // only line changes may change the deliverable interrupt
+  if (mip_val != kOldMip) {
+    state_.Write(csr::kCsrMip, mip_val);
+  }
+}
+
+bool CPU::HandleEvents() {
+  const uint64_t kEvents = events_.exchange(0, std::memory_order_relaxed);
+
+  if (kEvents & kEventIrqDirty) {
+    HandleInterrupt(pc_);
   }
 
-  const uint64_t kEpc = pc_;
-  const trap::Trap kTrap = TickOperate();
+  return kEvents & kEventHost;
+}
+
+// a width specialized access of the current inst crossed the end of RAM into
+// its guard page, nothing was committed yet but pc_ is already past the inst
+void CPU::HandleGuardFault() {
+  pc_ -= sizeof(uint32_t);
+
+  decode::DecodeInfo* info = nullptr;
+  const trap::Trap kFetchTrap = FetchDecode(&info);
+  if (kFetchTrap.type != trap::TrapType::kNone) {
+    HandleTrap(kFetchTrap, pc_);
+    return;
+  }
+
+  const uint64_t kAddr = reg_file_.xregs[info->rs1] +
+                         (info->op == decode::OpCode::kAmo ? 0 : info->imm);
+  const bool kIsLoad = info->op == decode::OpCode::kLoad ||
+                       info->token == decode::InstToken::LR_W ||
+                       info->token == decode::InstToken::LR_D;
+  HandleTrap({.type = kIsLoad ? trap::TrapType::kLoadAccessFault
+                              : trap::TrapType::kStoreAccessFault,
+              .val = kAddr},
+             pc_);
+}
+
+uint64_t CPU::Run(uint64_t budget) {
+  // the progress lives in instret_ only, locals changed after sigsetjmp would
+  // be lost when a guard fault jumps back here
+  const uint64_t kStartInstret = instret_;
+  libs::guard::Recovery recovery;
+  libs::guard::Recovery* const kOuterRecovery =
+      libs::guard::SetRecovery(&recovery);
+  if (sigsetjmp(recovery.env, 0)) {
+    HandleGuardFault();
+    ++instret_;
+  }
+
+  while (instret_ - kStartInstret < budget) {
+    const uint64_t kExecuted = instret_ - kStartInstret;
+    if (state_.GetWfi()) {
+      const uint64_t kMie = state_.Read(csr::kCsrMie);
+      const uint64_t kMip = state_.Read(csr::kCsrMip);
+      if (!(kMie & kMip)) {
+        // nothing could wake the hart before the next irq update
+        instret_ += budget - kExecuted;
+        break;
+      }
+      state_.SetWfi(false);
+      HandleInterrupt(pc_);
+      ++instret_;
+      continue;
+    }
+
+    uint64_t retired = 0;
+    const trap::Trap kTrap =
+        exec_engine_ == executor::ExecEngine::kThreaded
+            ? executor_->ExecThreaded(budget - kExecuted, &retired)
+            : ExecBlock(budget - kExecuted, &retired);
 
-  HandleTrap(kTrap, kEpc);
-  HandleInterrupt(pc_);
+    // pc still points to the faulting inst, which is counted as well
+    if (kTrap.type != trap::TrapType::kNone) {
+      HandleTrap(kTrap, pc_);
+      ++instret_;
+    }
 
-  // post exec
-  state_.Write(csr::kCsrMinstret, ++instret_);
+    // pending interrupts are only taken between blocks
+    if (events_.load(std::memory_order_relaxed) && HandleEvents()) {
+      break;
+    }
+  }
+
+  libs::guard::SetRecovery(kOuterRecovery);
+  return instret_ - kStartInstret;
+}
+
+void CPU::Tick(bool meip, bool seip, bool msip, bool mtip, bool update) {
+  if (update) {
+    UpdateIrq(meip, seip, msip, mtip);
+  }
+  Run(1);
 }
 
 void CPU::Tick() { Tick(false, false, false, false, false); }
 
-void CPU::FlushTlb(uint64_t vaddr, uint64_t asid) {
-  mmu_->FlushTlb(vaddr, asid);
+void CPU::FlushTlb(uint64_t vaddr, uint64_t asid, bool all_vaddr,
+                   bool all_asid) {
+  mmu_->FlushTlb(vaddr, asid, all_vaddr, all_asid);
 }
 
+void CPU::FlushDecodeCache() { decode_cache_.Flush(); }
+
+void CPU::SetExecEngine(executor::ExecEngine engine) { exec_engine_ = engine; }
+
 uint64_t CPU::GetInstret() const { return instret_; }
 
 }  // namespace rv64_emulator::cpu
@@ -1,110 +1,118 @@
 #include "cpu/csr.h"
 
+#include <atomic>
 #include <cstdint>
 
 #include "libs/arithmetic.h"
+#include "libs/utils.h"
 
 namespace rv64_emulator::cpu::csr {
 
-State::State() : wfi_(false), csr_(kCsrCapacity, 0) {
-  // set up MISA description
-  auto* misa_desc = reinterpret_cast<MisaDesc*>(&csr_[kCsrMisa]);
-  misa_desc->mxl = static_cast<uint64_t>(RiscvMXL::kRv64);
-  misa_desc->I = 1;  // RV32I/64I/128I base ISA implemented
-  misa_desc->M = 1;  // Integer Multiply/Divide extension implemented
-  misa_desc->A = 1;  // Atomic extension implemented
-  misa_desc->S = 1;  // Supervisor mode implemented
-  misa_desc->U = 1;  // User mode implemented
-
-  // set up Mstatus val
-  auto* mstatus_desc = reinterpret_cast<MstatusDesc*>(&csr_[kCsrMstatus]);
-  mstatus_desc->sxl = static_cast<uint64_t>(RiscvMXL::kRv64);
-  mstatus_desc->uxl = static_cast<uint64_t>(RiscvMXL::kRv64);
+State::State()
+    : wfi_(false),
+      instret_(nullptr),
+      irq_event_word_(nullptr),
+      irq_event_(0),
+      mtime_offset_(nullptr) {
+  Reset();
 }
 
-uint64_t State::Read(uint64_t addr) const {
-  uint64_t res = 0;
-
+uint64_t State::ReadCold(uint64_t addr) const {
   switch (addr) {
-    case kCsrSstatus: {
-      auto* ss_desc = reinterpret_cast<SstatusDesc*>(&res);
-      const auto* ms_desc =
-          reinterpret_cast<const MstatusDesc*>(&csr_[kCsrMstatus]);
-      ss_desc->sie = ms_desc->sie;
-      ss_desc->spie = ms_desc->spie;
-      ss_desc->ube = ms_desc->ube;
-      ss_desc->spp = ms_desc->spp;
-      ss_desc->vs = ms_desc->vs;
-      ss_desc->fs = ms_desc->fs;
-      ss_desc->xs = ms_desc->xs;
-      ss_desc->sum = ms_desc->sum;
-      ss_desc->mxr = ms_desc->mxr;
-      ss_desc->uxl = ms_desc->uxl;
-      ss_desc->sd = ms_desc->sd;
-    } break;
-    case kCsrSie:
-      res = csr_[kCsrMie] & kCsrSInterruptMask;
-      break;
-    case kCsrSip:
-      res = csr_[kCsrMip] & kCsrSInterruptMask;
-      break;
+    case kCsrMCycle:
+    case kCsrCycle:
+      return GetInstret() + mcycle_offset_;
+    case kCsrMinstret:
+    case kCsrInstret:
+      return GetInstret() + minstret_offset_;
+    case kCsrTime:
+      return libs::util::ReadGuestTimeStamp() +
+             (mtime_offset_ ? *mtime_offset_ : 0);
     case kCsrTselect:
     case kCsrTdata1:
-      res = 0;
-      break;
+      return 0;
     default:
-      res = csr_[addr];
       break;
   }
 
-  return res;
+  const auto kIter = csr_.find(addr);
+  return kIter == csr_.end() ? 0 : kIter->second;
 }
 
 void State::Write(uint64_t addr, uint64_t val) {
   switch (addr) {
-    case kCsrSstatus: {
-      const auto* val_desc = reinterpret_cast<const SstatusDesc*>(&val);
-      auto* ss_desc = reinterpret_cast<SstatusDesc*>(&csr_[kCsrMstatus]);
-      ss_desc->sie = val_desc->sie;
-      ss_desc->spie = val_desc->spie;
-      ss_desc->spp = val_desc->spp;
-      ss_desc->sum = val_desc->sum;
-      ss_desc->mxr = val_desc->mxr;
-    } break;
+    case kCsrSstatus:
+      mstatus_ = (mstatus_ & ~kSstatusWriteMask) | (val & kSstatusWriteMask);
+      break;
+    case kCsrMstatus:
+      // sum and mxr are always true
+      // tw is not supported but wfi impl as nop
+      mstatus_ = (mstatus_ & ~kMstatusWriteMask) | (val & kMstatusWriteMask);
+      break;
     case kCsrMie:
+      mie_ = val & kCsrMInterruptMask;
+      break;
     case kCsrMip:
-      csr_[addr] = val & kCsrMInterruptMask;
+      mip_ = val & kCsrMInterruptMask;
       break;
     case kCsrSie:
-      csr_[kCsrMie] &= (~kCsrSInterruptMask);
-      csr_[kCsrMie] |= (val & kCsrSInterruptMask);
+      mie_ = (mie_ & ~kCsrSInterruptMask) | (val & kCsrSInterruptMask);
       break;
     case kCsrSip:
-      csr_[kCsrMip] &= (~kCsrSInterruptMask);
-      csr_[kCsrMip] |= (val & kCsrSInterruptMask);
-      break;
-    case kCsrMstatus: {
-      const auto* val_desc = reinterpret_cast<const MstatusDesc*>(&val);
-      auto* ms_desc = reinterpret_cast<MstatusDesc*>(&csr_[kCsrMstatus]);
-
-      ms_desc->sie = val_desc->sie;
-      ms_desc->mie = val_desc->mie;
-      ms_desc->spie = val_desc->spie;
-      ms_desc->mpie = val_desc->mpie;
-      ms_desc->spp = val_desc->spp;
-      ms_desc->mpp = val_desc->mpp;
-      ms_desc->mprv = val_desc->mprv;
-      ms_desc->sum = val_desc->sum;  // always true
-      ms_desc->mxr = val_desc->mxr;  // always true
-      ms_desc->tvm = val_desc->tvm;
-      ms_desc->tw = val_desc->tw;  // not supported but wfi impl as nop
-      ms_desc->tsr = val_desc->tsr;
-    } break;
+      mip_ = (mip_ & ~kCsrSInterruptMask) | (val & kCsrSInterruptMask);
+      break;
     case kCsrMideleg:
-      csr_[addr] = val & kCsrSInterruptMask;
+      mideleg_ = val & kCsrSInterruptMask;
       break;
     case kCsrMedeleg:
-      csr_[addr] = val & kCsrSExceptionMask;
+      medeleg_ = val & kCsrSExceptionMask;
+      break;
+    case kCsrSatp: {
+      auto new_satp = *reinterpret_cast<const SatpDesc*>(&val);
+      const auto kOldSatp = *reinterpret_cast<const SatpDesc*>(&satp_);
+      if (new_satp.mode != 0 && new_satp.mode != 8) {
+        new_satp.mode = kOldSatp.mode;
+      }
+      satp_ = *reinterpret_cast<uint64_t*>(&new_satp);
+    } break;
+    case kCsrMenvcfg:
+      menvcfg_ = val & kMenvcfgAdue;
+      break;
+    case kCsrMtvec:
+      mtvec_ = val;
+      break;
+    case kCsrStvec:
+      stvec_ = val;
+      break;
+    case kCsrMepc:
+      mepc_ = val;
+      break;
+    case kCsrSepc:
+      sepc_ = val;
+      break;
+    case kCsrMcause:
+      mcause_ = val;
+      break;
+    case kCsrScause:
+      scause_ = val;
+      break;
+    case kCsrMtval:
+      mtval_ = val;
+      break;
+    case kCsrStval:
+      stval_ = val;
+      break;
+    case kCsrMscratch:
+      mscratch_ = val;
+      break;
+    case kCsrSscratch:
+      sscratch_ = val;
+      break;
+    case kCsrMCycle:
+      mcycle_offset_ = val - GetInstret();
+      break;
+    case kCsrMinstret:
+      minstret_offset_ = val - GetInstret();
       break;
     case kCsrMisa:
     case kCsrTselect:
@@ -112,36 +120,98 @@ void State::Write(uint64_t addr, uint64_t val) {
     case kCsrMVendorId:
     case kCsrMArchId:
     case kCsrMImpId:
+    case kCsrCycle:
+    case kCsrTime:
+    case kCsrInstret:
       break;
-    case kCsrSatp: {
-      auto new_satp = *reinterpret_cast<const SatpDesc*>(&val);
-      const auto kOldSatp = *reinterpret_cast<const SatpDesc*>(&csr_[addr]);
-      if (new_satp.mode != 0 && new_satp.mode != 8) {
-        new_satp.mode = kOldSatp.mode;
-      }
-      csr_[addr] = *reinterpret_cast<uint64_t*>(&new_satp);
-    } break;
     default:
       csr_[addr] = val;
       break;
   }
+
+  // privilege changes always come with a status write, so they are covered
+  switch (addr) {
+    case kCsrSstatus:
+    case kCsrMstatus:
+    case kCsrMie:
+    case kCsrMip:
+    case kCsrSie:
+    case kCsrSip:
+    case kCsrMideleg:
+      RaiseIrqEvent();
+      break;
+    default:
+      break;
+  }
+}
+
+void State::BindIrqEvent(std::atomic<uint64_t>* word, uint64_t event) {
+  irq_event_word_ = word;
+  irq_event_ = event;
+  RaiseIrqEvent();
+}
+
+void State::RaiseIrqEvent() {
+  if (irq_event_word_) {
+    irq_event_word_->fetch_or(irq_event_, std::memory_order_relaxed);
+  }
 }
 
 bool State::GetWfi() const { return wfi_; }
 
 void State::SetWfi(bool wfi) { wfi_ = wfi; }
 
+void State::BindInstret(const uint64_t* instret) {
+  instret_ = instret;
+  mcycle_offset_ = 0;
+  minstret_offset_ = 0;
+}
+
+void State::BindMtimeOffset(const uint64_t* offset) { mtime_offset_ = offset; }
+
 void State::Reset() {
+  mstatus_ = 0;
+  mie_ = 0;
+  mip_ = 0;
+  medeleg_ = 0;
+  mideleg_ = 0;
+  satp_ = 0;
+  // a/d bits are updated by hardware until the firmware opts out
+  menvcfg_ = kMenvcfgAdue;
+  mtvec_ = 0;
+  stvec_ = 0;
+  mepc_ = 0;
+  sepc_ = 0;
+  mcause_ = 0;
+  scause_ = 0;
+  mtval_ = 0;
+  stval_ = 0;
+  mscratch_ = 0;
+  sscratch_ = 0;
   wfi_ = false;
 
-  const uint64_t kOriginMisa = csr_[kCsrMisa];
-  std::fill(csr_.begin(), csr_.end(), 0);
-  csr_[kCsrMisa] = kOriginMisa;
+  // counters restart from zero
+  mcycle_offset_ = -GetInstret();
+  minstret_offset_ = -GetInstret();
+
+  csr_.clear();
+
+  // set up MISA description
+  MisaDesc misa_desc = {};
+  misa_desc.mxl = static_cast<uint64_t>(RiscvMXL::kRv64);
+  misa_desc.I = 1;  // RV32I/64I/128I base ISA implemented
+  misa_desc.M = 1;  // Integer Multiply/Divide extension implemented
+  misa_desc.A = 1;  // Atomic extension implemented
+  misa_desc.S = 1;  // Supervisor mode implemented
+  misa_desc.U = 1;  // User mode implemented
+  csr_[kCsrMisa] = *reinterpret_cast<const uint64_t*>(&misa_desc);
 
   // set up Mstatus val
-  auto* mstatus_desc = reinterpret_cast<MstatusDesc*>(&csr_[kCsrMstatus]);
+  auto* mstatus_desc = reinterpret_cast<MstatusDesc*>(&mstatus_);
   mstatus_desc->sxl = static_cast<uint64_t>(RiscvMXL::kRv64);
   mstatus_desc->uxl = static_cast<uint64_t>(RiscvMXL::kRv64);
+
+  RaiseIrqEvent();
 }
 
 }  // namespace rv64_emulator::cpu::csr
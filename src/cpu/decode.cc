@@ -51,14 +51,8 @@ constexpr __attribute__((always_inline)) int32_t GetImm(T desc) {
 }
 
 static InstToken GetToken(uint32_t word) {
-  InstToken token = InstToken::UNKNOWN;
-  for (const auto& inst : kInstTable) {
-    if ((word & inst.mask) == inst.signature) {
-      token = inst.token;
-      break;
-    }
-  }
-  return token;
+  const int32_t kIndex = GetInstIndex(word);
+  return kIndex < 0 ? InstToken::UNKNOWN : kInstTable[kIndex].token;
 }
 
 DecodeInfo::DecodeInfo(uint32_t inst_word, uint64_t addr)
@@ -67,7 +61,8 @@ DecodeInfo::DecodeInfo(uint32_t inst_word, uint64_t addr)
       token(GetToken(inst_word)),
       // size(!(inst_word & 0b11) ? 2 : 4),
       size(4),
-      br_target(0) {
+      br_target(0),
+      handler(nullptr) {
   const auto kCommDesc = *reinterpret_cast<const RTypeDesc*>(&word);
   op = static_cast<OpCode>(kCommDesc.opcode);
   rd = kCommDesc.rd;
@@ -0,0 +1,26 @@
+#include "cpu/decode_cache.h"
+
+#include <cstdint>
+
+#include "conf.h"
+#include "cpu/decode.h"
+
+namespace rv64_emulator::cpu::decode {
+
+DecodeCache::DecodeCache()
+    : entries_(kDecodeCacheEntryNum, Entry{kInvalidTag, DecodeInfo(0, 0)}) {}
+
+DecodeInfo* DecodeCache::Insert(uint64_t paddr, const DecodeInfo& info) {
+  Entry& entry = entries_[GetIndex(paddr)];
+  entry.tag = paddr;
+  entry.info = info;
+  return &entry.info;
+}
+
+void DecodeCache::Flush() {
+  for (auto& entry : entries_) {
+    entry.tag = kInvalidTag;
+  }
+}
+
+}  // namespace rv64_emulator::cpu::decode
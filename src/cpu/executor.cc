@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <cstdint>
 #include <cstdlib>
+#include <iterator>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -70,8 +72,46 @@ const std::unordered_set<uint64_t> kAllowedCsrs = {
     csr::kCsrSstatus,    csr::kCsrStval,    csr::kCsrStvec,
     csr::kCsrTdata1,     csr::kCsrTselect,  csr::kCsrMconfigPtr,
     csr::kCsrScounteren, csr::kCsrSscratch, csr::kCsrTime,
+    csr::kCsrMenvcfg,
 };
 
+template <typename T>
+static trap::Trap LoadZeroExtend(CPU* cpu, uint64_t addr, uint64_t* val) {
+  T data = 0;
+  const trap::Trap kTrap = cpu->Load(addr, &data);
+  *val = data;
+  return kTrap;
+}
+
+// dispatch decoded access widths to the width specialized accesses
+static trap::Trap LoadBySize(CPU* cpu, uint64_t addr, uint64_t size,
+                             uint64_t* val) {
+  switch (size) {
+    case sizeof(uint8_t):
+      return LoadZeroExtend<uint8_t>(cpu, addr, val);
+    case sizeof(uint16_t):
+      return LoadZeroExtend<uint16_t>(cpu, addr, val);
+    case sizeof(uint32_t):
+      return LoadZeroExtend<uint32_t>(cpu, addr, val);
+    default:
+      return LoadZeroExtend<uint64_t>(cpu, addr, val);
+  }
+}
+
+static trap::Trap StoreBySize(CPU* cpu, uint64_t addr, uint64_t size,
+                              uint64_t val) {
+  switch (size) {
+    case sizeof(uint8_t):
+      return cpu->Store<uint8_t>(addr, val);
+    case sizeof(uint16_t):
+      return cpu->Store<uint16_t>(addr, val);
+    case sizeof(uint32_t):
+      return cpu->Store<uint32_t>(addr, val);
+    default:
+      return cpu->Store<uint64_t>(addr, val);
+  }
+}
+
 void Executor::SetProcessor(CPU* cpu) { cpu_ = cpu; }
 
 trap::Trap Executor::RegTypeExec(decode::DecodeInfo info) {
@@ -89,7 +129,7 @@ trap::Trap Executor::RegTypeExec(decode::DecodeInfo info) {
       val = kRs1Val - kRs2Val;
       break;
     case decode::InstToken::SLL:
-      val = kRs1Val << kRs2Val;
+      val = kRs1Val << (kRs2Val & 0x3f);
       break;
     case decode::InstToken::SLT:
       val = kRs1Val < kRs2Val ? 1 : 0;
@@ -101,10 +141,10 @@ trap::Trap Executor::RegTypeExec(decode::DecodeInfo info) {
       val = kRs1Val ^ kRs2Val;
       break;
     case decode::InstToken::SRL:
-      val = kU64Rs1Val >> kU64Rs2Val;
+      val = kU64Rs1Val >> (kU64Rs2Val & 0x3f);
       break;
     case decode::InstToken::SRA:
-      val = kRs1Val >> kRs2Val;
+      val = kRs1Val >> (kRs2Val & 0x3f);
       break;
     case decode::InstToken::OR:
       val = kRs1Val | kRs2Val;
@@ -182,13 +222,13 @@ trap::Trap Executor::Rv32TypeExec(decode::DecodeInfo info) {
       val = kRs1Val - kRs2Val;
       break;
     case decode::InstToken::SLLW:
-      val = kRs1Val << kRs2Val;
+      val = kRs1Val << (kRs2Val & 0x1f);
       break;
     case decode::InstToken::SRLW:
-      val = (int64_t)(int32_t)((uint32_t)kRs1Val >> (uint32_t)kRs2Val);
+      val = (int64_t)(int32_t)((uint32_t)kRs1Val >> (kRs2Val & 0x1f));
       break;
     case decode::InstToken::SRAW:
-      val = kRs1Val >> kRs2Val;
+      val = kRs1Val >> (kRs2Val & 0x1f);
       break;
     case decode::InstToken::MULW:
       val = kRs1Val * kRs2Val;
@@ -388,8 +428,7 @@ trap::Trap Executor::LoadTypeExec(decode::DecodeInfo info) {
       (int64_t)cpu_->reg_file_.xregs[info.rs1] + info.imm;
 
   uint64_t data = 0;
-  const auto kLoadTrap =
-      cpu_->Load(kTargetAddr, info.mem_size, reinterpret_cast<uint8_t*>(&data));
+  const auto kLoadTrap = LoadBySize(cpu_, kTargetAddr, info.mem_size, &data);
   if (kLoadTrap.type != trap::TrapType::kNone) {
     return kLoadTrap;
   }
@@ -425,8 +464,7 @@ trap::Trap Executor::StoreTypeExec(decode::DecodeInfo info) {
   const uint64_t kTargetAddr = kRs1Val + info.imm;
 
   const auto kStoreTrap =
-      cpu_->Store(kTargetAddr, info.mem_size,
-                  reinterpret_cast<const uint8_t*>(&kU64Rs2Val));
+      StoreBySize(cpu_, kTargetAddr, info.mem_size, kU64Rs2Val);
   if (kStoreTrap.type != trap::TrapType::kNone) {
     return kStoreTrap;
   }
@@ -450,10 +488,6 @@ trap::Trap Executor::CsrTypeExec(decode::DecodeInfo info) {
     }
   }
 
-  if (kImm == csr::kCsrTime) {
-    cpu_->state_.Write(kImm, libs::util::ReadGuestTimeStamp());
-  }
-
   bool writable = info.rs1 != 0;
   if (info.token == decode::InstToken::CSRRW ||
       info.token == decode::InstToken::CSRRWI) {
@@ -526,7 +560,7 @@ trap::Trap Executor::SfenceVmaExec(decode::DecodeInfo info) {
 
   const auto kVirtAddr = (int64_t)cpu_->reg_file_.xregs[info.rs1];
   const auto kAsid = (int64_t)cpu_->reg_file_.xregs[info.rs2];
-  cpu_->FlushTlb(kVirtAddr, kAsid & 0xffff);
+  cpu_->FlushTlb(kVirtAddr, kAsid & 0xffff, info.rs1 == 0, info.rs2 == 0);
   return trap::kNoneTrap;
 }
 
@@ -620,6 +654,9 @@ trap::Trap Executor::SystemTypeExec(decode::DecodeInfo info) {
 
 trap::Trap Executor::FenceTypeExec(decode::DecodeInfo info) {
   // TODO(wade): implement fence
+  if (info.token == decode::InstToken::FENCE_I) {
+    cpu_->FlushDecodeCache();
+  }
   return trap::kNoneTrap;
 }
 
@@ -644,9 +681,8 @@ trap::Trap Executor::AmoLrExec(decode::DecodeInfo info) {
       .hart_id = cpu_->hart_id_,
   };
 
-  int64_t val = 0;
-  const auto kLrTrap =
-      cpu_->Load(kU64Rs1Val, info.mem_size, reinterpret_cast<uint8_t*>(&val));
+  uint64_t val = 0;
+  const auto kLrTrap = LoadBySize(cpu_, kU64Rs1Val, info.mem_size, &val);
   if (kLrTrap.type != trap::TrapType::kNone) {
     return kLrTrap;
   }
@@ -672,8 +708,7 @@ trap::Trap Executor::AmoScExec(decode::DecodeInfo info) {
       reservation_.valid && reservation_.hart_id == cpu_->hart_id_) {
     reservation_.valid = 0;
     const auto kScTrap =
-        cpu_->Store(kU64Rs1Val, info.mem_size,
-                    reinterpret_cast<const uint8_t*>(&kU64Rs2Val));
+        StoreBySize(cpu_, kU64Rs1Val, info.mem_size, kU64Rs2Val);
     if (kScTrap.type != trap::TrapType::kNone) {
       return kScTrap;
     }
@@ -710,8 +745,7 @@ trap::Trap Executor::AmoTypeExec(decode::DecodeInfo info) {
   }
 
   uint64_t mem_rs1 = 0;
-  const auto kLoadTrap = cpu_->Load(kU64Rs1Val, info.mem_size,
-                                    reinterpret_cast<uint8_t*>(&mem_rs1));
+  const auto kLoadTrap = LoadBySize(cpu_, kU64Rs1Val, info.mem_size, &mem_rs1);
   if (kLoadTrap.type != trap::TrapType::kNone) {
     return kLoadTrap;
   }
@@ -777,8 +811,8 @@ trap::Trap Executor::AmoTypeExec(decode::DecodeInfo info) {
     default:
       return ILL_TRAP(info.word);
   }
-  const auto kStoreTrap = cpu_->Store(
-      kU64Rs1Val, info.mem_size, reinterpret_cast<const uint8_t*>(&target_val));
+  const auto kStoreTrap =
+      StoreBySize(cpu_, kU64Rs1Val, info.mem_size, target_val);
   if (kStoreTrap.type != trap::TrapType::kNone) {
     return kStoreTrap;
   }
@@ -839,4 +873,398 @@ trap::Trap Executor::Exec(decode::DecodeInfo info) {
   return ret;
 }
 
+#define THREADED_TARGET(token, label) \
+  [static_cast<int32_t>(decode::InstToken::token) + 1] = &&label
+
+#define THREADED_TRAP(value) \
+  do {                       \
+    cpu_->pc_ = pc;          \
+    return value;            \
+  } while (0)
+
+#define THREADED_RETIRE() \
+  do {                    \
+    xregs[0] = 0;         \
+    ++cpu_->instret_;     \
+    ++(*retired);         \
+  } while (0)
+
+// each handler owns a copy of the dispatch, so the host predictor sees one
+// indirect jump per guest inst instead of the shared switch
+#define THREADED_NEXT()                                                   \
+  do {                                                                    \
+    const trap::Trap kFetchTrap = cpu_->FetchDecode(&entry);              \
+    if (kFetchTrap.type != trap::TrapType::kNone) {                       \
+      return kFetchTrap;                                                  \
+    }                                                                     \
+    if (!entry->handler) {                                                \
+      entry->handler = kHandlers[static_cast<int32_t>(entry->token) + 1]; \
+    }                                                                     \
+    pc = cpu_->pc_;                                                       \
+    cpu_->pc_ = pc + entry->size;                                         \
+    goto* entry->handler;                                                 \
+  } while (0)
+
+#define THREADED_DISPATCH()   \
+  do {                        \
+    THREADED_RETIRE();        \
+    if (*retired >= budget) { \
+      return trap::kNoneTrap; \
+    }                         \
+    THREADED_NEXT();          \
+  } while (0)
+
+#ifdef UNIT_TEST
+#define THREADED_CHECK_TARGET(target)                 \
+  do {                                                \
+    if (!libs::util::CheckPcAlign<false>((target))) { \
+      THREADED_TRAP(INSTR_MISALIGN_TRAP((target)));   \
+    }                                                 \
+  } while (0)
+#else
+#define THREADED_CHECK_TARGET(target)
+#endif
+
+#define THREADED_BRANCH(cond)                  \
+  do {                                         \
+    if (cond) {                                \
+      const uint64_t kNewPC = pc + entry->imm; \
+      THREADED_CHECK_TARGET(kNewPC);           \
+      cpu_->pc_ = kNewPC;                      \
+    }                                          \
+    THREADED_DISPATCH();                       \
+  } while (0)
+
+#define THREADED_LOAD(T)                                            \
+  do {                                                              \
+    const uint64_t kAddr = (int64_t)xregs[entry->rs1] + entry->imm; \
+    std::make_unsigned_t<T> data = 0;                               \
+    const trap::Trap kLoadTrap = cpu_->Load(kAddr, &data);          \
+    if (kLoadTrap.type != trap::TrapType::kNone) {                  \
+      THREADED_TRAP(kLoadTrap);                                     \
+    }                                                               \
+    xregs[entry->rd] = (int64_t)(T)data;                            \
+    THREADED_DISPATCH();                                            \
+  } while (0)
+
+#define THREADED_STORE(T)                                                   \
+  do {                                                                      \
+    const uint64_t kAddr = (int64_t)xregs[entry->rs1] + entry->imm;         \
+    const trap::Trap kStoreTrap = cpu_->Store<T>(kAddr, xregs[entry->rs2]); \
+    if (kStoreTrap.type != trap::TrapType::kNone) {                         \
+      THREADED_TRAP(kStoreTrap);                                            \
+    }                                                                       \
+    THREADED_DISPATCH();                                                    \
+  } while (0)
+
+trap::Trap Executor::ExecThreaded(uint64_t budget, uint64_t* retired) {
+  // indexed by token + 1, simple insts are executed in place, the others
+  // fall back to the per type executors
+  static const void* const kHandlers[] = {
+      THREADED_TARGET(UNKNOWN, do_illegal),
+      THREADED_TARGET(LUI, do_lui),
+      THREADED_TARGET(AUIPC, do_auipc),
+      THREADED_TARGET(JAL, do_jal),
+      THREADED_TARGET(JALR, do_jalr),
+      THREADED_TARGET(BEQ, do_beq),
+      THREADED_TARGET(BNE, do_bne),
+      THREADED_TARGET(BLT, do_blt),
+      THREADED_TARGET(BGE, do_bge),
+      THREADED_TARGET(BLTU, do_bltu),
+      THREADED_TARGET(BGEU, do_bgeu),
+      THREADED_TARGET(LB, do_lb),
+      THREADED_TARGET(LH, do_lh),
+      THREADED_TARGET(LW, do_lw),
+      THREADED_TARGET(LBU, do_lbu),
+      THREADED_TARGET(LHU, do_lhu),
+      THREADED_TARGET(SB, do_sb),
+      THREADED_TARGET(SH, do_sh),
+      THREADED_TARGET(SW, do_sw),
+      THREADED_TARGET(LWU, do_lwu),
+      THREADED_TARGET(LD, do_ld),
+      THREADED_TARGET(SD, do_sd),
+      THREADED_TARGET(ADDI, do_addi),
+      THREADED_TARGET(SLTI, do_slti),
+      THREADED_TARGET(SLTIU, do_sltiu),
+      THREADED_TARGET(XORI, do_xori),
+      THREADED_TARGET(ORI, do_ori),
+      THREADED_TARGET(ANDI, do_andi),
+      THREADED_TARGET(ADD, do_add),
+      THREADED_TARGET(SUB, do_sub),
+      THREADED_TARGET(SLL, do_sll),
+      THREADED_TARGET(SLT, do_slt),
+      THREADED_TARGET(SLTU, do_sltu),
+      THREADED_TARGET(XOR, do_xor),
+      THREADED_TARGET(SRL, do_srl),
+      THREADED_TARGET(SRA, do_sra),
+      THREADED_TARGET(OR, do_or),
+      THREADED_TARGET(AND, do_and),
+      THREADED_TARGET(FENCE, do_nop),
+      THREADED_TARGET(FENCE_TSO, do_nop),
+      THREADED_TARGET(PAUSE, do_nop),
+      THREADED_TARGET(ECALL, do_system),
+      THREADED_TARGET(EBREAK, do_system),
+      THREADED_TARGET(SLLI, do_slli),
+      THREADED_TARGET(SRLI, do_srli),
+      THREADED_TARGET(SRAI, do_srai),
+      THREADED_TARGET(ADDIW, do_addiw),
+      THREADED_TARGET(SLLIW, do_slliw),
+      THREADED_TARGET(SRLIW, do_srliw),
+      THREADED_TARGET(SRAIW, do_sraiw),
+      THREADED_TARGET(ADDW, do_addw),
+      THREADED_TARGET(SUBW, do_subw),
+      THREADED_TARGET(SLLW, do_sllw),
+      THREADED_TARGET(SRLW, do_srlw),
+      THREADED_TARGET(SRAW, do_sraw),
+      THREADED_TARGET(MRET, do_system),
+      THREADED_TARGET(WFI, do_system),
+      THREADED_TARGET(CSRRW, do_system),
+      THREADED_TARGET(CSRRS, do_system),
+      THREADED_TARGET(CSRRC, do_system),
+      THREADED_TARGET(CSRRWI, do_system),
+      THREADED_TARGET(CSRRSI, do_system),
+      THREADED_TARGET(CSRRCI, do_system),
+      THREADED_TARGET(FENCE_I, do_system),
+      THREADED_TARGET(MUL, do_exec),
+      THREADED_TARGET(MULH, do_exec),
+      THREADED_TARGET(MULHSU, do_exec),
+      THREADED_TARGET(MULHU, do_exec),
+      THREADED_TARGET(DIV, do_exec),
+      THREADED_TARGET(DIVU, do_exec),
+      THREADED_TARGET(REM, do_exec),
+      THREADED_TARGET(REMU, do_exec),
+      THREADED_TARGET(MULW, do_exec),
+      THREADED_TARGET(DIVW, do_exec),
+      THREADED_TARGET(DIVUW, do_exec),
+      THREADED_TARGET(REMW, do_exec),
+      THREADED_TARGET(REMUW, do_exec),
+      THREADED_TARGET(SRET, do_system),
+      THREADED_TARGET(SFENCE_VMA, do_system),
+      THREADED_TARGET(LR_W, do_exec),
+      THREADED_TARGET(LR_D, do_exec),
+      THREADED_TARGET(SC_W, do_exec),
+      THREADED_TARGET(SC_D, do_exec),
+      THREADED_TARGET(AMOSWAP_D, do_exec),
+      THREADED_TARGET(AMOSWAP_W, do_exec),
+      THREADED_TARGET(AMOADD_D, do_exec),
+      THREADED_TARGET(AMOADD_W, do_exec),
+      THREADED_TARGET(AMOXOR_D, do_exec),
+      THREADED_TARGET(AMOXOR_W, do_exec),
+      THREADED_TARGET(AMOAND_D, do_exec),
+      THREADED_TARGET(AMOAND_W, do_exec),
+      THREADED_TARGET(AMOOR_D, do_exec),
+      THREADED_TARGET(AMOOR_W, do_exec),
+      THREADED_TARGET(AMOMIN_D, do_exec),
+      THREADED_TARGET(AMOMIN_W, do_exec),
+      THREADED_TARGET(AMOMAX_D, do_exec),
+      THREADED_TARGET(AMOMAX_W, do_exec),
+      THREADED_TARGET(AMOMINU_D, do_exec),
+      THREADED_TARGET(AMOMINU_W, do_exec),
+      THREADED_TARGET(AMOMAXU_D, do_exec),
+      THREADED_TARGET(AMOMAXU_W, do_exec),
+  };
+  static_assert(std::size(kHandlers) == decode::kInstTableSize + 1,
+                "every inst token should have a threaded handler");
+
+  auto& xregs = cpu_->reg_file_.xregs;
+  decode::DecodeInfo* entry = nullptr;
+  uint64_t pc = 0;
+
+  *retired = 0;
+  if (budget == 0) {
+    return trap::kNoneTrap;
+  }
+
+  THREADED_NEXT();
+
+do_illegal:
+  THREADED_TRAP(ILL_TRAP(entry->word));
+
+do_lui:
+  xregs[entry->rd] = (int64_t)entry->imm;
+  THREADED_DISPATCH();
+
+do_auipc:
+  xregs[entry->rd] = pc + entry->imm;
+  THREADED_DISPATCH();
+
+do_jal: {
+  const uint64_t kNewPC = pc + entry->imm;
+  THREADED_CHECK_TARGET(kNewPC);
+  xregs[entry->rd] = pc + entry->size;
+  cpu_->pc_ = kNewPC;
+  THREADED_DISPATCH();
+}
+
+do_jalr: {
+  const uint64_t kNewPC =
+      ((int64_t)xregs[entry->rs1] + entry->imm) & 0xfffffffffffffffe;
+  THREADED_CHECK_TARGET(kNewPC);
+  xregs[entry->rd] = pc + entry->size;
+  cpu_->pc_ = kNewPC;
+  THREADED_DISPATCH();
+}
+
+do_beq:
+  THREADED_BRANCH(xregs[entry->rs1] == xregs[entry->rs2]);
+do_bne:
+  THREADED_BRANCH(xregs[entry->rs1] != xregs[entry->rs2]);
+do_blt:
+  THREADED_BRANCH((int64_t)xregs[entry->rs1] < (int64_t)xregs[entry->rs2]);
+do_bge:
+  THREADED_BRANCH((int64_t)xregs[entry->rs1] >= (int64_t)xregs[entry->rs2]);
+do_bltu:
+  THREADED_BRANCH(xregs[entry->rs1] < xregs[entry->rs2]);
+do_bgeu:
+  THREADED_BRANCH(xregs[entry->rs1] >= xregs[entry->rs2]);
+
+do_lb:
+  THREADED_LOAD(int8_t);
+do_lh:
+  THREADED_LOAD(int16_t);
+do_lw:
+  THREADED_LOAD(int32_t);
+do_lbu:
+  THREADED_LOAD(uint8_t);
+do_lhu:
+  THREADED_LOAD(uint16_t);
+do_lwu:
+  THREADED_LOAD(uint32_t);
+do_ld:
+  THREADED_LOAD(uint64_t);
+
+do_sb:
+  THREADED_STORE(uint8_t);
+do_sh:
+  THREADED_STORE(uint16_t);
+do_sw:
+  THREADED_STORE(uint32_t);
+do_sd:
+  THREADED_STORE(uint64_t);
+
+do_addi:
+  xregs[entry->rd] = (int64_t)xregs[entry->rs1] + entry->imm;
+  THREADED_DISPATCH();
+do_slti:
+  xregs[entry->rd] = (int64_t)xregs[entry->rs1] < entry->imm ? 1 : 0;
+  THREADED_DISPATCH();
+do_sltiu:
+  xregs[entry->rd] = xregs[entry->rs1] < (uint64_t)(int64_t)entry->imm ? 1 : 0;
+  THREADED_DISPATCH();
+do_xori:
+  xregs[entry->rd] = xregs[entry->rs1] ^ (int64_t)entry->imm;
+  THREADED_DISPATCH();
+do_ori:
+  xregs[entry->rd] = xregs[entry->rs1] | (int64_t)entry->imm;
+  THREADED_DISPATCH();
+do_andi:
+  xregs[entry->rd] = xregs[entry->rs1] & (int64_t)entry->imm;
+  THREADED_DISPATCH();
+do_slli:
+  xregs[entry->rd] = xregs[entry->rs1] << (entry->imm & 0x3f);
+  THREADED_DISPATCH();
+do_srli:
+  xregs[entry->rd] = xregs[entry->rs1] >> (entry->imm & 0x3f);
+  THREADED_DISPATCH();
+do_srai:
+  xregs[entry->rd] = (int64_t)xregs[entry->rs1] >> (entry->imm & 0x3f);
+  THREADED_DISPATCH();
+
+do_add:
+  xregs[entry->rd] = xregs[entry->rs1] + xregs[entry->rs2];
+  THREADED_DISPATCH();
+do_sub:
+  xregs[entry->rd] = xregs[entry->rs1] - xregs[entry->rs2];
+  THREADED_DISPATCH();
+do_sll:
+  xregs[entry->rd] = xregs[entry->rs1] << (xregs[entry->rs2] & 0x3f);
+  THREADED_DISPATCH();
+do_slt:
+  xregs[entry->rd] =
+      (int64_t)xregs[entry->rs1] < (int64_t)xregs[entry->rs2] ? 1 : 0;
+  THREADED_DISPATCH();
+do_sltu:
+  xregs[entry->rd] = xregs[entry->rs1] < xregs[entry->rs2] ? 1 : 0;
+  THREADED_DISPATCH();
+do_xor:
+  xregs[entry->rd] = xregs[entry->rs1] ^ xregs[entry->rs2];
+  THREADED_DISPATCH();
+do_srl:
+  xregs[entry->rd] = xregs[entry->rs1] >> (xregs[entry->rs2] & 0x3f);
+  THREADED_DISPATCH();
+do_sra:
+  xregs[entry->rd] =
+      (int64_t)xregs[entry->rs1] >> (xregs[entry->rs2] & 0x3f);
+  THREADED_DISPATCH();
+do_or:
+  xregs[entry->rd] = xregs[entry->rs1] | xregs[entry->rs2];
+  THREADED_DISPATCH();
+do_and:
+  xregs[entry->rd] = xregs[entry->rs1] & xregs[entry->rs2];
+  THREADED_DISPATCH();
+
+do_addiw:
+  xregs[entry->rd] = (int64_t)(int32_t)((uint32_t)xregs[entry->rs1] +
+                                        (uint32_t)entry->imm);
+  THREADED_DISPATCH();
+do_slliw:
+  xregs[entry->rd] =
+      (int64_t)(int32_t)((uint32_t)xregs[entry->rs1] << (entry->imm & 0x1f));
+  THREADED_DISPATCH();
+do_srliw:
+  xregs[entry->rd] =
+      (int64_t)(int32_t)((uint32_t)xregs[entry->rs1] >> (entry->imm & 0x1f));
+  THREADED_DISPATCH();
+do_sraiw:
+  xregs[entry->rd] =
+      (int64_t)((int32_t)xregs[entry->rs1] >> (entry->imm & 0x1f));
+  THREADED_DISPATCH();
+do_addw:
+  xregs[entry->rd] = (int64_t)(int32_t)((uint32_t)xregs[entry->rs1] +
+                                        (uint32_t)xregs[entry->rs2]);
+  THREADED_DISPATCH();
+do_subw:
+  xregs[entry->rd] = (int64_t)(int32_t)((uint32_t)xregs[entry->rs1] -
+                                        (uint32_t)xregs[entry->rs2]);
+  THREADED_DISPATCH();
+do_sllw:
+  xregs[entry->rd] = (int64_t)(int32_t)((uint32_t)xregs[entry->rs1]
+                                        << (xregs[entry->rs2] & 0x1f));
+  THREADED_DISPATCH();
+do_srlw:
+  xregs[entry->rd] = (int64_t)(int32_t)((uint32_t)xregs[entry->rs1] >>
+                                        (xregs[entry->rs2] & 0x1f));
+  THREADED_DISPATCH();
+do_sraw:
+  xregs[entry->rd] =
+      (int64_t)((int32_t)xregs[entry->rs1] >> (xregs[entry->rs2] & 0x1f));
+  THREADED_DISPATCH();
+
+do_nop:
+  THREADED_DISPATCH();
+
+do_exec: {
+  decode::DecodeInfo info = *entry;
+  info.pc = pc;
+  const trap::Trap kExecTrap = Exec(info);
+  if (kExecTrap.type != trap::TrapType::kNone) {
+    THREADED_TRAP(kExecTrap);
+  }
+  THREADED_DISPATCH();
+}
+
+// system insts may change the privilege, translation or interrupt state,
+// so they always end the run
+do_system: {
+  decode::DecodeInfo info = *entry;
+  info.pc = pc;
+  const trap::Trap kExecTrap = Exec(info);
+  if (kExecTrap.type != trap::TrapType::kNone) {
+    THREADED_TRAP(kExecTrap);
+  }
+  THREADED_RETIRE();
+  return trap::kNoneTrap;
+}
+}
+
 }  // namespace rv64_emulator::cpu::executor
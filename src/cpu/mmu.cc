@@ -8,7 +8,6 @@
 #include "cpu/csr.h"
 #include "cpu/trap.h"
 #include "device/bus.h"
-#include "fmt/core.h"
 
 namespace rv64_emulator::mmu {
 
@@ -66,60 +65,281 @@ GetTlbTag(uint64_t vaddr, uint64_t page_size) {
   return vaddr >> bits;
 }
 
-Sv39::Sv39(std::shared_ptr<Bus>& bus)
-    : index_(0), cache_hit_(0), cache_miss_(0), bus_(bus) {
-  memset(tlb_, 0, sizeof(tlb_));
+constexpr uint64_t kMaxPageSize = 3;
+
+constexpr uint64_t kPhysPerm = GetPermBit(kCtxPhys, AccessType::kFetch) |
+                               GetPermBit(kCtxPhys, AccessType::kLoad) |
+                               GetPermBit(kCtxPhys, AccessType::kStore);
+
+// same checks as the slow paths of Mmu, for every virtual context
+uint64_t GetVirtualPerm(const Sv39TlbEntry* entry) {
+  if (!entry->A) {
+    return 0;
+  }
+
+  uint64_t perm = 0;
+  for (const uint64_t kCtx : {kCtxSupervisor, kCtxUser}) {
+    for (uint64_t mxr = 0; mxr < 2; mxr++) {
+      if (entry->X && entry->U == (kCtx == kCtxUser)) {
+        perm |= GetPermBit(kCtx + mxr, AccessType::kFetch);
+      }
+      if (entry->R || (mxr && entry->X)) {
+        perm |= GetPermBit(kCtx + mxr, AccessType::kLoad);
+      }
+      if (entry->W && entry->D) {
+        perm |= GetPermBit(kCtx + mxr, AccessType::kStore);
+      }
+    }
+  }
+  return perm;
 }
 
-Sv39::~Sv39() { PrintStatistic(); }
+Tlb::Tlb() { Reset(); }
+
+Sv39TlbEntry* Tlb::LookUp(uint64_t asid, uint64_t vaddr) {
+  // 4KB pages are the most common, probe them first
+  for (uint64_t page_size = 1; page_size <= kMaxPageSize; page_size++) {
+    const uint64_t kTag = GetTlbTag(vaddr, page_size);
+    Sv39TlbEntry* set = entries_[kTag & (kSets - 1)];
+    for (uint64_t i = 0; i < kTlbWays; i++) {
+      Sv39TlbEntry* entry = set + i;
+      if (entry->page_size == page_size && entry->tag == kTag &&
+          (entry->asid == asid || entry->G)) {
+        hits_++;
+        return entry;
+      }
+    }
+  }
+
+  misses_++;
+  return nullptr;
+}
+
+Sv39TlbEntry* Tlb::Insert(const Sv39TlbEntry& entry) {
+  const uint64_t kIndex = entry.tag & (kSets - 1);
+  Sv39TlbEntry* set = entries_[kIndex];
 
-void Sv39::PrintStatistic() {
-  if (cache_hit_ + cache_miss_ > 0) {
-    float hit_rate = (cache_hit_ * 1.0) / (cache_hit_ + cache_miss_) * 100;
-    fmt::print("======== Cache Statistics Start ========\n");
-    fmt::print("hit: {}\n", cache_hit_);
-    fmt::print("miss: {}\n", cache_miss_);
-    fmt::print("hit rate: {:.2f}%\n", hit_rate);
-    fmt::print("======== Cache Statistics End ========\n");
+  // take an invalid way first, otherwise replace round robin
+  uint64_t way = victim_[kIndex];
+  for (uint64_t i = 0; i < kTlbWays; i++) {
+    if (set[i].page_size == 0) {
+      way = i;
+      break;
+    }
   }
+  victim_[kIndex] = (way + 1) % kTlbWays;
+
+  set[way] = entry;
+  return set + way;
 }
 
-Sv39TlbEntry* Sv39::LookUpTlb(SatpDesc satp, uint64_t vaddr) {
-  for (uint64_t i = 0; i < kTlbSize; i++) {
-    Sv39TlbEntry* entry = tlb_ + i;
-    if (entry->asid == satp.asid || entry->G) {
-      if (entry->page_size > 0) {
-        if (GetTlbTag(vaddr, entry->page_size) == entry->tag) {
-          return tlb_ + i;
+void Tlb::Flush(uint64_t vaddr, uint64_t asid, bool all_vaddr, bool all_asid) {
+  // global mappings are only dropped when no asid is given
+  const auto kMatchAsid = [&](const Sv39TlbEntry& entry) {
+    return all_asid || (entry.asid == asid && !entry.G);
+  };
+
+  if (all_vaddr) {
+    for (auto& set : entries_) {
+      for (auto& entry : set) {
+        if (kMatchAsid(entry)) {
+          entry.page_size = 0;
         }
       }
     }
+    return;
+  }
+
+  for (uint64_t page_size = 1; page_size <= kMaxPageSize; page_size++) {
+    const uint64_t kTag = GetTlbTag(vaddr, page_size);
+    for (auto& entry : entries_[kTag & (kSets - 1)]) {
+      if (entry.page_size == page_size && entry.tag == kTag &&
+          kMatchAsid(entry)) {
+        entry.page_size = 0;
+      }
+    }
+  }
+}
+
+void Tlb::Reset() {
+  memset(entries_, 0, sizeof(entries_));
+  memset(victim_, 0, sizeof(victim_));
+  hits_ = 0;
+  misses_ = 0;
+}
+
+SoftTlb::SoftTlb() { Flush(); }
+
+void SoftTlb::Insert(uint64_t vaddr, uint64_t paddr, uint8_t* host,
+                     uint64_t perm, uint64_t page_bytes) {
+  const uint64_t kTag = vaddr >> 12;
+  const uint64_t kPagePaddr = paddr & ~kPageOffsetMask;
+  SoftTlbEntry& entry = entries_[kTag & (kSoftTlbEntryNum - 1)];
+
+  // the same mapping seen from another context keeps its permissions
+  if (entry.tag != kTag || entry.paddr != kPagePaddr) {
+    entry.tag = kTag;
+    entry.perm = 0;
+    entry.addend =
+        reinterpret_cast<uint64_t>(host) - (vaddr & ~kPageOffsetMask);
+    entry.paddr = kPagePaddr;
+  }
+  entry.perm |= perm;
+
+  if (page_bytes <= kPageOffsetMask + 1) {
+    return;
+  }
+
+  uint64_t mask = ~(page_bytes - 1);
+  if (large_page_addr_ != kInvalidTag) {
+    mask &= large_page_mask_;
+    while ((large_page_addr_ ^ vaddr) & mask) {
+      mask <<= 1;
+    }
+  }
+  large_page_addr_ = vaddr & mask;
+  large_page_mask_ = mask;
+}
+
+void SoftTlb::FlushPage(uint64_t vaddr) {
+  if ((vaddr & large_page_mask_) == large_page_addr_) {
+    Flush();
+    return;
   }
 
+  SoftTlbEntry& entry = entries_[(vaddr >> 12) & (kSoftTlbEntryNum - 1)];
+  if (entry.tag == vaddr >> 12) {
+    entry.tag = kInvalidTag;
+  }
+}
+
+void SoftTlb::Flush() {
+  for (auto& entry : entries_) {
+    entry.tag = kInvalidTag;
+  }
+  large_page_addr_ = kInvalidTag;
+  large_page_mask_ = 0;
+}
+
+PageWalkCache::PageWalkCache() { Reset(); }
+
+const PwcEntry* PageWalkCache::LookUp(uint64_t root, uint64_t vaddr,
+                                      uint64_t level) {
+  const PwcEntry* kEntry = GetEntry(vaddr, level);
+  if (kEntry->root == root && kEntry->vpn == GetVpn(vaddr, level)) {
+    hits_++;
+    return kEntry;
+  }
+
+  misses_++;
   return nullptr;
 }
 
-bool Sv39::PageTableWalk(SatpDesc satp, uint64_t vaddr, Sv39PageTableEntry* pte,
+void PageWalkCache::Insert(uint64_t root, uint64_t vaddr, uint64_t level,
+                           uint64_t table, uint8_t* host) {
+  *GetEntry(vaddr, level) = {
+      .root = root,
+      .vpn = GetVpn(vaddr, level),
+      .table = table,
+      .host = host,
+  };
+}
+
+void PageWalkCache::Flush(uint64_t vaddr, bool all_vaddr) {
+  if (all_vaddr) {
+    for (auto& level : entries_) {
+      for (auto& entry : level) {
+        entry.root = kInvalidRoot;
+      }
+    }
+    return;
+  }
+
+  // only leaf ptes have to be ordered by an address fence, but guests often
+  // free page tables with per page fences, so the walk of vaddr is dropped
+  // from every address space
+  for (uint64_t level = 1; level <= 2; level++) {
+    PwcEntry* entry = GetEntry(vaddr, level);
+    if (entry->vpn == GetVpn(vaddr, level)) {
+      entry->root = kInvalidRoot;
+    }
+  }
+}
+
+void PageWalkCache::Reset() {
+  memset(entries_, 0, sizeof(entries_));
+  Flush(0, true);
+  hits_ = 0;
+  misses_ = 0;
+}
+
+Sv39::Sv39(std::shared_ptr<Bus>& bus)
+    : bus_(bus), root_table_(UINT64_MAX), root_host_(nullptr) {}
+
+bool Sv39::ReadPte(uint64_t table, const uint8_t* host, uint64_t index,
+                   Sv39PageTableEntry* pte) {
+  if (host) {
+    memcpy(pte, host + index * sizeof(Sv39PageTableEntry),
+           sizeof(Sv39PageTableEntry));
+    return true;
+  }
+
+  return bus_->Load(table + index * sizeof(Sv39PageTableEntry),
+                    reinterpret_cast<uint64_t*>(pte));
+}
+
+bool Sv39::WritePte(uint64_t table, uint8_t* host, uint64_t index,
+                    Sv39PageTableEntry pte) {
+  if (host) {
+    memcpy(host + index * sizeof(Sv39PageTableEntry), &pte,
+           sizeof(Sv39PageTableEntry));
+    return true;
+  }
+
+  return bus_->Store(table + index * sizeof(Sv39PageTableEntry),
+                     *reinterpret_cast<const uint64_t*>(&pte));
+}
+
+bool Sv39::PageTableWalk(SatpDesc satp, uint64_t vaddr, AccessType type,
+                         bool update_ad, Sv39PageTableEntry* pte,
                          uint64_t* page_size) {
   // filter out all mode not sv39
   if (satp.mode != static_cast<uint64_t>(AddressMode::kSv39)) {
     return false;
   }
 
+  constexpr uint64_t kTableBytes = 4096;
+  const uint64_t kRoot = satp.ppn << 12;
+  if (kRoot != root_table_) {
+    root_table_ = kRoot;
+    root_host_ = bus_->GetHostPtr(kRoot, kTableBytes);
+  }
+
+  // start from the deepest table found in the page walk cache
+  int level = 2;
+  uint64_t page_table_addr = kRoot;
+  uint8_t* host = root_host_;
+  for (int i = 1; i <= 2; i++) {
+    const PwcEntry* kEntry = pwc_.LookUp(kRoot, vaddr, i);
+    if (kEntry) {
+      level = i - 1;
+      page_table_addr = kEntry->table;
+      host = kEntry->host;
+      break;
+    }
+  }
+
   Sv39PageTableEntry sv39_pte;
-  uint64_t page_table_addr = satp.ppn << 12;
   const Sv39VirtualAddress kSv39Va =
       *reinterpret_cast<const Sv39VirtualAddress*>(&vaddr);
 
-  for (int i = 2; i >= 0; i--) {
+  for (int i = level; i >= 0; i--) {
     const uint64_t kPageEntryIndex = (i == 2)   ? kSv39Va.vpn_2
                                      : (i == 1) ? kSv39Va.vpn_1
                                                 : kSv39Va.vpn_0;
-    const uint64_t kPhysAddr =
-        page_table_addr + kPageEntryIndex * sizeof(Sv39PageTableEntry);
 
-    const bool kSuccess = bus_->Load(kPhysAddr, sizeof(Sv39PageTableEntry),
-                                     reinterpret_cast<uint8_t*>(&sv39_pte));
+    const bool kSuccess =
+        ReadPte(page_table_addr, host, kPageEntryIndex, &sv39_pte);
 
     if (!kSuccess || !sv39_pte.V || (!sv39_pte.R && sv39_pte.W) ||
         sv39_pte.reserved || sv39_pte.pbmt) {
@@ -137,6 +357,10 @@ bool Sv39::PageTableWalk(SatpDesc satp, uint64_t vaddr, Sv39PageTableEntry* pte,
       };
 
       page_table_addr = *reinterpret_cast<const uint64_t*>(&kSv39Pa);
+      host = bus_->GetHostPtr(page_table_addr, kTableBytes);
+      if (i > 0) {
+        pwc_.Insert(kRoot, vaddr, i, page_table_addr, host);
+      }
     } else {
       // leaf
       const bool kPpnInvalid = (i == 2 && (sv39_pte.ppn_1 || sv39_pte.ppn_0)) ||
@@ -145,6 +369,16 @@ bool Sv39::PageTableWalk(SatpDesc satp, uint64_t vaddr, Sv39PageTableEntry* pte,
         return false;
       }
 
+      // d is only set for stores the pte permits, a may be set speculatively
+      const bool kSetDirty = type == AccessType::kStore && sv39_pte.W;
+      if (update_ad && (!sv39_pte.A || (kSetDirty && !sv39_pte.D))) {
+        sv39_pte.A = 1;
+        sv39_pte.D |= kSetDirty;
+        if (!WritePte(page_table_addr, host, kPageEntryIndex, sv39_pte)) {
+          return false;
+        }
+      }
+
       *pte = sv39_pte;
       *page_size = i + 1;
       return true;
@@ -154,7 +388,8 @@ bool Sv39::PageTableWalk(SatpDesc satp, uint64_t vaddr, Sv39PageTableEntry* pte,
   return false;
 }
 
-Sv39TlbEntry* Sv39::GetTlbEntry(SatpDesc satp, uint64_t vaddr) {
+Sv39TlbEntry* Sv39::GetTlbEntry(SatpDesc satp, uint64_t vaddr,
+                                AccessType type, bool update_ad) {
   // sv39_va[39:63] = sv39_va[38]
   const bool kSv39VirtualAddressLegal =
       (0 <= vaddr && vaddr <= 0x0000003fffffffff) ||
@@ -163,21 +398,26 @@ Sv39TlbEntry* Sv39::GetTlbEntry(SatpDesc satp, uint64_t vaddr) {
     return nullptr;
   }
 
-  Sv39TlbEntry* tlb_entry = LookUpTlb(satp, vaddr);
-  if (tlb_entry) {
-    cache_hit_++;
+  Tlb& tlb = type == AccessType::kFetch ? itlb_ : dtlb_;
+  Sv39TlbEntry* tlb_entry = tlb.LookUp(satp.asid, vaddr);
+  // entries lacking the a/d bits of the access are walked again to update
+  // the pte
+  const bool kNeedAd =
+      update_ad && tlb_entry &&
+      (!tlb_entry->A ||
+       (type == AccessType::kStore && tlb_entry->W && !tlb_entry->D));
+  if (tlb_entry && !kNeedAd) {
     return tlb_entry;
   }
 
   // cache miss, now walk the page table
-  cache_miss_++;
   Sv39PageTableEntry pte;
   uint64_t out_size;
-  if (!PageTableWalk(satp, vaddr, &pte, &out_size)) {
+  if (!PageTableWalk(satp, vaddr, type, update_ad, &pte, &out_size)) {
     return nullptr;
   }
 
-  tlb_[index_] = {
+  const Sv39TlbEntry kNewEntry = {
       .ppn = GetPpnByPageTableEntry(pte),
       .tag = GetTlbTag(vaddr, out_size),
       .asid = satp.asid,
@@ -191,9 +431,17 @@ Sv39TlbEntry* Sv39::GetTlbEntry(SatpDesc satp, uint64_t vaddr) {
       .page_size = out_size,
   };
 
-  tlb_entry = tlb_ + index_;
-  index_ = (index_ + 1) % kTlbSize;
-  return tlb_entry;
+  // refresh in place if the mapping is still the same size
+  if (tlb_entry) {
+    if (tlb_entry->tag == kNewEntry.tag &&
+        tlb_entry->page_size == kNewEntry.page_size) {
+      *tlb_entry = kNewEntry;
+      return tlb_entry;
+    }
+    tlb_entry->page_size = 0;
+  }
+
+  return tlb.Insert(kNewEntry);
 }
 
 bool Sv39::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
@@ -204,30 +452,27 @@ bool Sv39::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
   return bus_->Store(addr, bytes, buffer);
 }
 
-void Sv39::FlushTlb(uint64_t vaddr, uint64_t asid) {
-  for (uint64_t i = 0; i < kTlbSize; i++) {
-    Sv39TlbEntry* entry = tlb_ + i;
-    if (asid == 0 || entry->asid == asid) {
-      if (vaddr == 0) {
-        entry->page_size = 0;
-      } else {
-        if (entry->page_size > 0) {
-          if (entry->tag == GetTlbTag(vaddr, entry->page_size)) {
-            entry->page_size = 0;
-          }
-        }
-      }
-    }
-  }
+void Sv39::FlushTlb(uint64_t vaddr, uint64_t asid, bool all_vaddr,
+                    bool all_asid) {
+  itlb_.Flush(vaddr, asid, all_vaddr, all_asid);
+  dtlb_.Flush(vaddr, asid, all_vaddr, all_asid);
+  pwc_.Flush(vaddr, all_vaddr);
+}
+
+uint8_t* Sv39::GetHostPtr(uint64_t paddr, uint64_t bytes) {
+  return bus_->GetHostPtr(paddr, bytes);
 }
 
 void Sv39::Reset() {
-  index_ = 0;
-  memset(tlb_, 0, sizeof(tlb_));
+  itlb_.Reset();
+  dtlb_.Reset();
+  pwc_.Reset();
+  root_table_ = UINT64_MAX;
   bus_->Reset();
 }
 
-Mmu::Mmu(std::unique_ptr<Sv39> sv39) : cpu_(nullptr), sv39_(std::move(sv39)) {}
+Mmu::Mmu(std::unique_ptr<Sv39> sv39)
+    : cpu_(nullptr), sv39_(std::move(sv39)), soft_tlb_satp_(0) {}
 
 bool Mmu::UsePhysAddr(SatpDesc satp, cpu::csr::MstatusDesc ms) {
   constexpr auto kMach = cpu::PrivilegeMode::kMachine;
@@ -236,33 +481,39 @@ bool Mmu::UsePhysAddr(SatpDesc satp, cpu::csr::MstatusDesc ms) {
           (cpu_->priv_mode_ == kMach && (!ms.mprv || ms.mpp == kMachVal)));
 }
 
-void Mmu::SetProcessor(CPU* cpu) { cpu_ = cpu; }
-
-void Mmu::FlushTlb(uint64_t vaddr, uint64_t asid) {
-  sv39_->FlushTlb(vaddr, asid);
+void Mmu::FillSoftTlb(uint64_t vaddr, uint64_t paddr, uint64_t perm,
+                      uint64_t page_size) {
+  // only ram pages get a host pointer
+  uint8_t* host =
+      sv39_->GetHostPtr(paddr & ~kPageOffsetMask, kPageOffsetMask + 1);
+  if (host) {
+    soft_tlb_.Insert(vaddr, paddr, host, perm, 8ULL << (page_size * 9));
+  }
 }
 
-Trap Mmu::Fetch(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
-  // if (bytes == 4 && addr % 4 == 2) {
-  //   const Trap kTrap1 = Fetch(addr, 2, buffer);
-  //   if (kTrap1.type != cpu::trap::TrapType::kNone) {
-  //     return kTrap1;
-  //   }
+void Mmu::SetProcessor(CPU* cpu) { cpu_ = cpu; }
 
-  //   const Trap kTrap2 = Fetch(addr + 2, 2, buffer + 2);
-  //   if (kTrap2.type != cpu::trap::TrapType::kNone) {
-  //     return MAKE_TRAP(kTrap2.type, addr);
-  //   }
+void Mmu::FlushTlb(uint64_t vaddr, uint64_t asid, bool all_vaddr,
+                   bool all_asid) {
+  sv39_->FlushTlb(vaddr, asid, all_vaddr, all_asid);
+  if (all_vaddr) {
+    soft_tlb_.Flush();
+  } else {
+    soft_tlb_.FlushPage(vaddr);
+  }
+}
 
-  //   return cpu::trap::kNoneTrap;
-  // }
+Trap Mmu::TranslateFetch(uint64_t addr, uint64_t* paddr) {
+  const SoftTlbEntry* kSoftEntry =
+      soft_tlb_.LookUp(addr, 1, GetSoftTlbPerm(AccessType::kFetch));
+  if (kSoftEntry) {
+    *paddr = kSoftEntry->paddr | (addr & kPageOffsetMask);
+    return cpu::trap::kNoneTrap;
+  }
 
   const uint64_t kSatpVal = cpu_->state_.Read(cpu::csr::kCsrSatp);
   const SatpDesc kSatpDesc = *reinterpret_cast<const SatpDesc*>(&kSatpVal);
 
-  const Trap kInstructionAccessTrap =
-      MAKE_TRAP(cpu::trap::TrapType::kInstructionAccessFault, addr);
-
   const auto kCurMode = cpu_->priv_mode_;
   const bool kUsePhysAddr =
       (kCurMode == PrivilegeMode::kMachine || kSatpDesc.mode == 0);
@@ -271,7 +522,9 @@ Trap Mmu::Fetch(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
     // CHECK_RANGE_PAGE_ALIGN(addr, bytes,
     //                        cpu::trap::TrapType::kInstructionAddressMisaligned);
 
-    const Sv39TlbEntry* kTlbEntry = sv39_->GetTlbEntry(kSatpDesc, addr);
+    const Sv39TlbEntry* kTlbEntry =
+        sv39_->GetTlbEntry(kSatpDesc, addr, AccessType::kFetch,
+                           UpdateAd());
     if (!kTlbEntry || !kTlbEntry->A || !kTlbEntry->X) {
       return MAKE_TRAP(cpu::trap::TrapType::kInstructionPageFault, addr);
     }
@@ -281,14 +534,54 @@ Trap Mmu::Fetch(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
       return MAKE_TRAP(cpu::trap::TrapType::kInstructionPageFault, addr);
     }
 
-    addr = MapVirtualAddress(kTlbEntry, addr);
+    *paddr = MapVirtualAddress(kTlbEntry, addr);
+    FillSoftTlb(addr, *paddr, GetVirtualPerm(kTlbEntry),
+                kTlbEntry->page_size);
+    return cpu::trap::kNoneTrap;
+  }
+
+  *paddr = addr;
+  FillSoftTlb(addr, addr, kPhysPerm, 1);
+  return cpu::trap::kNoneTrap;
+}
+
+Trap Mmu::Fetch(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
+  // if (bytes == 4 && addr % 4 == 2) {
+  //   const Trap kTrap1 = Fetch(addr, 2, buffer);
+  //   if (kTrap1.type != cpu::trap::TrapType::kNone) {
+  //     return kTrap1;
+  //   }
+
+  //   const Trap kTrap2 = Fetch(addr + 2, 2, buffer + 2);
+  //   if (kTrap2.type != cpu::trap::TrapType::kNone) {
+  //     return MAKE_TRAP(kTrap2.type, addr);
+  //   }
+
+  //   return cpu::trap::kNoneTrap;
+  // }
+
+  const SoftTlbEntry* kSoftEntry =
+      soft_tlb_.LookUp(addr, bytes, GetSoftTlbPerm(AccessType::kFetch));
+  if (kSoftEntry) {
+    memcpy(buffer, reinterpret_cast<const uint8_t*>(kSoftEntry->addend + addr),
+           bytes);
+    return cpu::trap::kNoneTrap;
+  }
+
+  const Trap kInstructionAccessTrap =
+      MAKE_TRAP(cpu::trap::TrapType::kInstructionAccessFault, addr);
+
+  uint64_t paddr = 0;
+  const Trap kTranslateTrap = TranslateFetch(addr, &paddr);
+  if (kTranslateTrap.type != cpu::trap::TrapType::kNone) {
+    return kTranslateTrap;
   }
 
-  const bool kSucc = sv39_->Load(addr, bytes, buffer);
+  const bool kSucc = sv39_->Load(paddr, bytes, buffer);
   return kSucc ? cpu::trap::kNoneTrap : kInstructionAccessTrap;
 }
 
-Trap Mmu::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
+Trap Mmu::TranslateLoad(uint64_t addr, uint64_t* paddr) {
   const uint64_t kSatpVal = cpu_->state_.Read(cpu::csr::kCsrSatp);
   const SatpDesc kSatpDesc = *reinterpret_cast<const SatpDesc*>(&kSatpVal);
 
@@ -296,14 +589,13 @@ Trap Mmu::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
   const cpu::csr::MstatusDesc kMstatusDesc =
       *reinterpret_cast<const cpu::csr::MstatusDesc*>(&kMstatus);
 
-  const Trap kLoadAccessTrap =
-      MAKE_TRAP(cpu::trap::TrapType::kLoadAccessFault, addr);
-
   // virtual addr load
   if (!UsePhysAddr(kSatpDesc, kMstatusDesc)) {
     // CHECK_RANGE_PAGE_ALIGN(addr, bytes,
     //                        cpu::trap::TrapType::kLoadAddressMisaligned);
-    const Sv39TlbEntry* kTlbEntry = sv39_->GetTlbEntry(kSatpDesc, addr);
+    const Sv39TlbEntry* kTlbEntry =
+        sv39_->GetTlbEntry(kSatpDesc, addr, AccessType::kLoad,
+                           UpdateAd());
     if (!kTlbEntry || !kTlbEntry->A ||
         (!kTlbEntry->R && !(kMstatusDesc.mxr && kTlbEntry->X))) {
       return MAKE_TRAP(cpu::trap::TrapType::kLoadPageFault, addr);
@@ -312,14 +604,17 @@ Trap Mmu::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
     //   CHECK_VIRTUAL_MEMORY_ACCESS_PRIVILEGE(cpu_->priv_mode_, kMstatusDesc,
     //                                         kTlbEntry, addr, Load);
     // }
-    addr = MapVirtualAddress(kTlbEntry, addr);
+    *paddr = MapVirtualAddress(kTlbEntry, addr);
+    FillSoftTlb(addr, *paddr, GetVirtualPerm(kTlbEntry), kTlbEntry->page_size);
+    return cpu::trap::kNoneTrap;
   }
 
-  const bool kSucc = sv39_->Load(addr, bytes, buffer);
-  return kSucc ? cpu::trap::kNoneTrap : kLoadAccessTrap;
+  *paddr = addr;
+  FillSoftTlb(addr, addr, kPhysPerm, 1);
+  return cpu::trap::kNoneTrap;
 }
 
-Trap Mmu::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
+Trap Mmu::TranslateStore(uint64_t addr, uint64_t* paddr) {
   const uint64_t kSatpVal = cpu_->state_.Read(cpu::csr::kCsrSatp);
   const SatpDesc kSatpDesc = *reinterpret_cast<const SatpDesc*>(&kSatpVal);
 
@@ -327,14 +622,13 @@ Trap Mmu::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
   const cpu::csr::MstatusDesc kMstatusDesc =
       *reinterpret_cast<const cpu::csr::MstatusDesc*>(&kMstatus);
 
-  const Trap kStoreAccessTrap =
-      MAKE_TRAP(cpu::trap::TrapType::kStoreAccessFault, addr);
-
   // virtual addr store
   if (!UsePhysAddr(kSatpDesc, kMstatusDesc)) {
     // CHECK_RANGE_PAGE_ALIGN(addr, bytes,
     //                        cpu::trap::TrapType::kStoreAddressMisaligned);
-    const Sv39TlbEntry* kTlbEntry = sv39_->GetTlbEntry(kSatpDesc, addr);
+    const Sv39TlbEntry* kTlbEntry =
+        sv39_->GetTlbEntry(kSatpDesc, addr, AccessType::kStore,
+                           UpdateAd());
     // D 位在 C906 的硬件实现与 W 属性类似。
     // 当 D 位为 0 时，store 会触发 Page Fault
     if (!kTlbEntry || !kTlbEntry->A || !kTlbEntry->W || !kTlbEntry->D) {
@@ -344,13 +638,69 @@ Trap Mmu::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
     // CHECK_VIRTUAL_MEMORY_ACCESS_PRIVILEGE(cpu_->priv_mode_, kMstatusDesc,
     //                                       kTlbEntry, addr, Store);
     // }
-    addr = MapVirtualAddress(kTlbEntry, addr);
+    *paddr = MapVirtualAddress(kTlbEntry, addr);
+    FillSoftTlb(addr, *paddr, GetVirtualPerm(kTlbEntry), kTlbEntry->page_size);
+    return cpu::trap::kNoneTrap;
+  }
+
+  *paddr = addr;
+  FillSoftTlb(addr, addr, kPhysPerm, 1);
+  return cpu::trap::kNoneTrap;
+}
+
+Trap Mmu::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
+  const SoftTlbEntry* kSoftEntry =
+      soft_tlb_.LookUp(addr, bytes, GetSoftTlbPerm(AccessType::kLoad));
+  if (kSoftEntry) {
+    memcpy(buffer, reinterpret_cast<const uint8_t*>(kSoftEntry->addend + addr),
+           bytes);
+    return cpu::trap::kNoneTrap;
+  }
+
+  uint64_t paddr = 0;
+  const Trap kTranslateTrap = TranslateLoad(addr, &paddr);
+  if (kTranslateTrap.type != cpu::trap::TrapType::kNone) {
+    return kTranslateTrap;
   }
 
-  const bool kSucc = sv39_->Store(addr, bytes, buffer);
-  return kSucc ? cpu::trap::kNoneTrap : kStoreAccessTrap;
+  const bool kSucc = sv39_->Load(paddr, bytes, buffer);
+  if (!kSucc) {
+    return MAKE_TRAP(cpu::trap::TrapType::kLoadAccessFault, addr);
+  }
+  return cpu::trap::kNoneTrap;
 }
 
-void Mmu::Reset() { sv39_->Reset(); }
+Trap Mmu::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
+  const SoftTlbEntry* kSoftEntry =
+      soft_tlb_.LookUp(addr, bytes, GetSoftTlbPerm(AccessType::kStore));
+  if (kSoftEntry) {
+    memcpy(reinterpret_cast<uint8_t*>(kSoftEntry->addend + addr), buffer,
+           bytes);
+    cpu_->InvalidateDecodeCache(kSoftEntry->paddr | (addr & kPageOffsetMask),
+                                bytes);
+    return cpu::trap::kNoneTrap;
+  }
+
+  uint64_t paddr = 0;
+  const Trap kTranslateTrap = TranslateStore(addr, &paddr);
+  if (kTranslateTrap.type != cpu::trap::TrapType::kNone) {
+    return kTranslateTrap;
+  }
+
+  const bool kSucc = sv39_->Store(paddr, bytes, buffer);
+  if (!kSucc) {
+    return MAKE_TRAP(cpu::trap::TrapType::kStoreAccessFault, addr);
+  }
+
+  // self-modifying code: drop stale decoded insts of the written bytes
+  cpu_->InvalidateDecodeCache(paddr, bytes);
+  return cpu::trap::kNoneTrap;
+}
+
+void Mmu::Reset() {
+  sv39_->Reset();
+  soft_tlb_.Flush();
+  soft_tlb_satp_ = 0;
+}
 
 }  // namespace rv64_emulator::mmu
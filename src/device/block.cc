@@ -0,0 +1,381 @@
+#include "device/block.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace rv64_emulator::device::block {
+
+// preadv and pwritev may stop early and take at most IOV_MAX buffers, loops
+// until all of iov is transferred
+static bool Transfer(int fd, bool write, uint64_t offset, const iovec* iov,
+                     int iovcnt) {
+  std::vector<iovec> left(iov, iov + iovcnt);
+  uint64_t first = 0;
+  while (first < left.size()) {
+    const int kCnt = static_cast<int>(
+        std::min<uint64_t>(left.size() - first, IOV_MAX));
+    const ssize_t kDone = write ? pwritev(fd, &left[first], kCnt, offset)
+                                : preadv(fd, &left[first], kCnt, offset);
+    if (kDone < 0 && errno == EINTR) {
+      continue;
+    }
+    // reading nothing means the file got shorter
+    if (kDone <= 0) {
+      return false;
+    }
+
+    offset += kDone;
+    uint64_t rest = kDone;
+    while (first < left.size() && rest >= left[first].iov_len) {
+      rest -= left[first].iov_len;
+      first++;
+    }
+    if (rest) {
+      left[first].iov_base = static_cast<uint8_t*>(left[first].iov_base) + rest;
+      left[first].iov_len -= rest;
+    }
+  }
+  return true;
+}
+
+static uint64_t IovBytes(const iovec* iov, int iovcnt) {
+  uint64_t bytes = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    bytes += iov[i].iov_len;
+  }
+  return bytes;
+}
+
+// appends the buffers of [offset, offset + bytes) of iov to out
+static void SliceIov(const iovec* iov, int iovcnt, uint64_t offset,
+                     uint64_t bytes, std::vector<iovec>* out) {
+  for (int i = 0; i < iovcnt && bytes; i++) {
+    if (offset >= iov[i].iov_len) {
+      offset -= iov[i].iov_len;
+      continue;
+    }
+    const uint64_t kLen = std::min(iov[i].iov_len - offset, bytes);
+    out->push_back({.iov_base = static_cast<uint8_t*>(iov[i].iov_base) + offset,
+                    .iov_len = kLen});
+    bytes -= kLen;
+    offset = 0;
+  }
+}
+
+RawImage::RawImage() : fd_(-1), size_(0), read_only_(true) {}
+
+RawImage::~RawImage() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool RawImage::Open(const char* path, bool read_only) {
+  int fd = read_only ? -1 : open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0 && (read_only || errno == EACCES || errno == EROFS)) {
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    read_only = true;
+  }
+  if (fd < 0) {
+    return false;
+  }
+
+  // works for block devices as well as for files
+  const off_t kSize = lseek(fd, 0, SEEK_END);
+  if (kSize < 0) {
+    close(fd);
+    return false;
+  }
+
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  fd_ = fd;
+  size_ = kSize;
+  read_only_ = read_only;
+  return true;
+}
+
+bool RawImage::Read(uint64_t offset, const iovec* iov, int iovcnt) {
+  return Transfer(fd_, false, offset, iov, iovcnt);
+}
+
+bool RawImage::Write(uint64_t offset, const iovec* iov, int iovcnt) {
+  return !read_only_ && Transfer(fd_, true, offset, iov, iovcnt);
+}
+
+bool RawImage::Flush() { return read_only_ || fdatasync(fd_) == 0; }
+
+CowImage::CowImage()
+    : base_(nullptr),
+      size_(0),
+      fd_(-1),
+      cluster_bytes_(1ULL << kCowClusterBits),
+      data_offset_(0) {}
+
+CowImage::~CowImage() { Close(); }
+
+void CowImage::Close() {
+  if (base_) {
+    munmap(const_cast<uint8_t*>(base_), size_);
+    base_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  size_ = 0;
+  bitmap_.clear();
+}
+
+bool CowImage::Open(const char* base, const char* overlay) {
+  Close();
+
+  const int kBaseFd = open(base, O_RDONLY | O_CLOEXEC);
+  if (kBaseFd < 0) {
+    return false;
+  }
+  const off_t kBaseSize = lseek(kBaseFd, 0, SEEK_END);
+  void* mem = kBaseSize > 0 ? mmap(nullptr, kBaseSize, PROT_READ, MAP_SHARED,
+                                   kBaseFd, 0)
+                            : MAP_FAILED;
+  close(kBaseFd);
+  if (mem == MAP_FAILED) {
+    return false;
+  }
+  base_ = static_cast<const uint8_t*>(mem);
+  size_ = kBaseSize;
+  base_path_ = base;
+
+  if (overlay[0] == '\0') {
+    char path[] = "/tmp/rv64_overlay_XXXXXX";
+    fd_ = mkstemp(path);
+    if (fd_ >= 0) {
+      unlink(path);
+    }
+  } else {
+    fd_ = open(overlay, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  }
+  struct stat st;
+  if (fd_ < 0 || fstat(fd_, &st) != 0) {
+    Close();
+    return false;
+  }
+
+  CowHeader header = {
+      .magic = kCowMagic,
+      .version = kCowVersion,
+      .cluster_bits = kCowClusterBits,
+      .size = size_,
+  };
+  const bool kFresh = st.st_size == 0;
+  if (!kFresh &&
+      (pread(fd_, &header, sizeof(header), 0) != sizeof(header) ||
+       header.magic != kCowMagic || header.version != kCowVersion ||
+       header.cluster_bits < 12 || header.cluster_bits > 24 ||
+       header.size != size_)) {
+    // not an overlay, or one of another base
+    Close();
+    return false;
+  }
+
+  cluster_bytes_ = 1ULL << header.cluster_bits;
+  const uint64_t kClusters = (size_ + cluster_bytes_ - 1) / cluster_bytes_;
+  bitmap_.assign((kClusters + 63) / 64, 0);
+  const uint64_t kBitmapBytes = bitmap_.size() * sizeof(uint64_t);
+  data_offset_ = (kCowHeaderBytes + kBitmapBytes + cluster_bytes_ - 1) &
+                 ~(cluster_bytes_ - 1);
+
+  const iovec kBitmapIov = {.iov_base = bitmap_.data(),
+                            .iov_len = kBitmapBytes};
+  const bool kOk =
+      kFresh ? pwrite(fd_, &header, sizeof(header), 0) == sizeof(header) &&
+                   ftruncate(fd_, data_offset_ + size_) == 0
+             : Transfer(fd_, false, kCowHeaderBytes, &kBitmapIov, 1);
+  if (!kOk) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool CowImage::IsAllocated(uint64_t cluster) const {
+  return (__atomic_load_n(&bitmap_[cluster / 64], __ATOMIC_ACQUIRE) >>
+          (cluster % 64)) &
+         1;
+}
+
+uint64_t CowImage::GetAllocatedClusters() const {
+  uint64_t clusters = 0;
+  for (const uint64_t kWord : bitmap_) {
+    clusters += __builtin_popcountll(kWord);
+  }
+  return clusters;
+}
+
+bool CowImage::WriteBitmap(uint64_t first_word, uint64_t words) {
+  std::lock_guard<std::mutex> lock(bitmap_mutex_);
+  std::vector<uint64_t> snapshot(words);
+  for (uint64_t i = 0; i < words; i++) {
+    snapshot[i] = __atomic_load_n(&bitmap_[first_word + i], __ATOMIC_ACQUIRE);
+  }
+  const iovec kIov = {.iov_base = snapshot.data(),
+                      .iov_len = words * sizeof(uint64_t)};
+  return Transfer(fd_, true, kCowHeaderBytes + first_word * sizeof(uint64_t),
+                  &kIov, 1);
+}
+
+bool CowImage::Read(uint64_t offset, const iovec* iov, int iovcnt) {
+  const uint64_t kTotal = IovBytes(iov, iovcnt);
+  if (offset > size_ || kTotal > size_ - offset) {
+    return false;
+  }
+
+  std::vector<iovec> piece;
+  for (uint64_t done = 0; done < kTotal;) {
+    // one transfer for every run of clusters in the same place
+    const uint64_t kPos = offset + done;
+    const bool kAllocated = IsAllocated(kPos / cluster_bytes_);
+    uint64_t len = std::min(cluster_bytes_ - kPos % cluster_bytes_,
+                            kTotal - done);
+    while (done + len < kTotal &&
+           IsAllocated((kPos + len) / cluster_bytes_) == kAllocated) {
+      len = std::min(len + cluster_bytes_, kTotal - done);
+    }
+
+    piece.clear();
+    SliceIov(iov, iovcnt, done, len, &piece);
+    if (kAllocated) {
+      if (!Transfer(fd_, false, data_offset_ + kPos, piece.data(),
+                    static_cast<int>(piece.size()))) {
+        return false;
+      }
+    } else {
+      const uint8_t* src = base_ + kPos;
+      for (const auto& kIov : piece) {
+        memcpy(kIov.iov_base, src, kIov.iov_len);
+        src += kIov.iov_len;
+      }
+    }
+    done += len;
+  }
+  return true;
+}
+
+bool CowImage::Write(uint64_t offset, const iovec* iov, int iovcnt) {
+  const uint64_t kTotal = IovBytes(iov, iovcnt);
+  if (offset > size_ || kTotal > size_ - offset) {
+    return false;
+  }
+
+  std::vector<iovec> piece;
+  for (uint64_t done = 0; done < kTotal;) {
+    const uint64_t kPos = offset + done;
+    const uint64_t kCluster = kPos / cluster_bytes_;
+    uint64_t len = std::min(cluster_bytes_ - kPos % cluster_bytes_,
+                            kTotal - done);
+    bool allocated = IsAllocated(kCluster);
+    // clusters already in the overlay are written in place, in runs
+    while (allocated && done + len < kTotal &&
+           IsAllocated((kPos + len) / cluster_bytes_)) {
+      len = std::min(len + cluster_bytes_, kTotal - done);
+    }
+
+    piece.clear();
+    SliceIov(iov, iovcnt, done, len, &piece);
+    const int kCnt = static_cast<int>(piece.size());
+    if (!allocated) {
+      // another request may be copying the same cluster up
+      std::lock_guard<std::mutex> lock(locks_[kCluster % kCowLockStripes]);
+      allocated = IsAllocated(kCluster);
+      if (!allocated &&
+          !CopyUp(kCluster, kPos % cluster_bytes_, piece.data(), kCnt)) {
+        return false;
+      }
+    }
+    if (allocated &&
+        !Transfer(fd_, true, data_offset_ + kPos, piece.data(), kCnt)) {
+      return false;
+    }
+    done += len;
+  }
+  return true;
+}
+
+bool CowImage::CopyUp(uint64_t cluster, uint64_t offset, const iovec* iov,
+                      int iovcnt) {
+  const uint64_t kStart = cluster * cluster_bytes_;
+  const uint64_t kBytes = std::min(cluster_bytes_, size_ - kStart);
+  const uint64_t kLen = IovBytes(iov, iovcnt);
+
+  // a write of the whole cluster needs nothing from the base
+  if (offset == 0 && kLen == kBytes) {
+    if (!Transfer(fd_, true, data_offset_ + kStart, iov, iovcnt)) {
+      return false;
+    }
+  } else {
+    std::vector<uint8_t> buf(base_ + kStart, base_ + kStart + kBytes);
+    uint8_t* dst = buf.data() + offset;
+    for (int i = 0; i < iovcnt; i++) {
+      memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+      dst += iov[i].iov_len;
+    }
+    const iovec kIov = {.iov_base = buf.data(), .iov_len = kBytes};
+    if (!Transfer(fd_, true, data_offset_ + kStart, &kIov, 1)) {
+      return false;
+    }
+  }
+
+  // the data is in place before the cluster is seen as allocated
+  __atomic_fetch_or(&bitmap_[cluster / 64], 1ULL << (cluster % 64),
+                    __ATOMIC_RELEASE);
+  return WriteBitmap(cluster / 64, 1);
+}
+
+bool CowImage::Flush() { return fdatasync(fd_) == 0; }
+
+bool CowImage::Discard() {
+  std::fill(bitmap_.begin(), bitmap_.end(), 0);
+  // cutting the data off and growing it back leaves holes behind
+  return WriteBitmap(0, bitmap_.size()) && ftruncate(fd_, data_offset_) == 0 &&
+         ftruncate(fd_, data_offset_ + size_) == 0 && fdatasync(fd_) == 0;
+}
+
+bool CowImage::Commit() {
+  const int kBaseFd = open(base_path_.c_str(), O_WRONLY | O_CLOEXEC);
+  if (kBaseFd < 0) {
+    return false;
+  }
+
+  std::vector<uint8_t> buf(cluster_bytes_);
+  bool ok = true;
+  const uint64_t kClusters = (size_ + cluster_bytes_ - 1) / cluster_bytes_;
+  for (uint64_t i = 0; i < kClusters && ok; i++) {
+    if (!IsAllocated(i)) {
+      continue;
+    }
+    const uint64_t kStart = i * cluster_bytes_;
+    const iovec kIov = {.iov_base = buf.data(),
+                        .iov_len = std::min(cluster_bytes_, size_ - kStart)};
+    ok = Transfer(fd_, false, data_offset_ + kStart, &kIov, 1) &&
+         Transfer(kBaseFd, true, kStart, &kIov, 1);
+  }
+  ok = ok && fdatasync(kBaseFd) == 0;
+  close(kBaseFd);
+  // the shared mapping of the base sees the committed clusters already
+  return ok && Discard();
+}
+
+}  // namespace rv64_emulator::device::block
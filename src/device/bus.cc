@@ -9,8 +9,21 @@ namespace rv64_emulator::device::bus {
 
 Bus::Bus() : dev_cnt_(0) {}
 
-void Bus::MountDevice(MmioDeviceNode node) {
+bool Bus::MountDevice(MmioDeviceNode node) {
+  if (dev_cnt_ == kMaxMmioDevicesNum) {
+    return false;
+  }
+
+  for (uint64_t i = 0; i < dev_cnt_; i++) {
+    const auto* kIter = device_ + i;
+    if (node.base < kIter->base + kIter->size &&
+        kIter->base < node.base + node.size) {
+      return false;
+    }
+  }
+
   device_[dev_cnt_++] = std::move(node);
+  return true;
 }
 
 int64_t Bus::GetDeviceByRange(uint64_t addr) {
@@ -41,6 +54,15 @@ bool Bus::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
   return dev_node->dev->Store(addr - dev_node->base, bytes, buffer);
 }
 
+uint8_t* Bus::GetHostPtr(uint64_t addr, uint64_t bytes) {
+  const auto kDevIndex = GetDeviceByRange(addr);
+  if (kDevIndex == -1) {
+    return nullptr;
+  }
+  auto dev_node = device_ + kDevIndex;
+  return dev_node->dev->GetHostPtr(addr - dev_node->base, bytes);
+}
+
 void Bus::Reset() {
   for (uint64_t i = 0; i < dev_cnt_; i++) {
     device_[i].dev->Reset();
@@ -13,12 +13,13 @@ using libs::util::ReadGuestTimeStamp;
 
 Clint::Clint(uint64_t harts)
     : harts_(harts),
-      mtime_(ReadGuestTimeStamp()),
+      mtime_offset_(0),
       mtimecmp_(harts, 0),
       msip_(harts, 0) {}
 
 bool Clint::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
   uint8_t* start_addr = nullptr;
+  uint64_t mtime = 0;
   if (kMsipBase <= addr && addr + bytes <= kMsipBase + harts_ * 4) {
     // msip
     start_addr = reinterpret_cast<uint8_t*>(msip_.data()) + addr - kMsipBase;
@@ -28,7 +29,8 @@ bool Clint::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
     start_addr =
         reinterpret_cast<uint8_t*>(mtimecmp_.data()) + addr - kMtimeCmpBase;
   } else if (kMtimeBase <= addr && addr + bytes <= kMtimeBase + 8) {
-    start_addr = reinterpret_cast<uint8_t*>(&mtime_) + addr - kMtimeBase;
+    mtime = GetMtime();
+    start_addr = reinterpret_cast<uint8_t*>(&mtime) + addr - kMtimeBase;
   } else {
     return false;
   }
@@ -45,16 +47,31 @@ bool Clint::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
     for (auto& msip : msip_) {
       msip &= 1;
     }
+    RaiseIrq();
   } else if (kMtimeCmpBase <= addr &&
              addr + bytes <= kMtimeCmpBase + harts_ * 8) {
     // mtimecmp
+    const uint64_t kMtime = GetMtime();
+    const std::vector<uint64_t> kOldMtimeCmp = mtimecmp_;
     uint8_t* start_addr =
         reinterpret_cast<uint8_t*>(mtimecmp_.data()) + addr - kMtimeCmpBase;
     memcpy(start_addr, buffer, bytes);
+    ArmTimers();
+    // a later compare value lowers a pending timer irq right away, a due one
+    // is raised by its timer
+    for (uint64_t i = 0; i < harts_; i++) {
+      if (kMtime > kOldMtimeCmp[i] && kMtime <= mtimecmp_[i]) {
+        RaiseIrq();
+      }
+    }
   } else if (kMtimeBase <= addr && addr + bytes <= kMtimeBase + 8) {
-    uint8_t* start_addr =
-        reinterpret_cast<uint8_t*>(&mtime_) + addr - kMtimeBase;
-    memcpy(start_addr, buffer, bytes);
+    uint64_t mtime = GetMtime();
+    memcpy(reinterpret_cast<uint8_t*>(&mtime) + addr - kMtimeBase, buffer,
+           bytes);
+    mtime_offset_ = mtime - ReadGuestTimeStamp();
+    // every deadline moves with mtime
+    ArmTimers();
+    RaiseIrq();
   } else {
     return false;
   }
@@ -63,21 +80,56 @@ bool Clint::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
 }
 
 void Clint::Reset() {
-  mtime_ = ReadGuestTimeStamp();
+  mtime_offset_ = 0;
   std::fill(mtimecmp_.begin(), mtimecmp_.end(), 0);
   std::fill(msip_.begin(), msip_.end(), 0);
+  ArmTimers();
+}
+
+void Clint::SetScheduler(scheduler::Scheduler* scheduler) {
+  scheduler_ = scheduler;
+  timers_.clear();
+  for (uint64_t i = 0; i < harts_; i++) {
+    timers_.push_back(
+        scheduler->AddTimer([this](uint64_t) { RaiseIrq(); }));
+  }
+  ArmTimers();
+}
+
+void Clint::ArmTimers() {
+  const uint64_t kNow = ReadGuestTimeStamp();
+  const uint64_t kMtime = kNow + mtime_offset_;
+  for (uint64_t i = 0; i < timers_.size(); i++) {
+    // the irq is raised once mtime is strictly greater than mtimecmp,
+    // deadlines are host based guest time stamps without the mtime offset
+    const uint64_t kDeadline = mtimecmp_[i] + 1 - mtime_offset_;
+    const bool kDue = mtimecmp_[i] < kMtime;
+    // The deadline wraps around when mtime was moved far from the time
+    // stamps. A due compare value then fires right away, one beyond the
+    // last time stamp never does.
+    if (mtimecmp_[i] == UINT64_MAX || (!kDue && kDeadline <= kNow)) {
+      scheduler_->Disarm(timers_[i]);
+    } else {
+      scheduler_->Arm(timers_[i], kDue ? std::min(kDeadline, kNow) : kDeadline);
+    }
+  }
 }
 
 bool Clint::MachineTimerIrq(const uint64_t hart_id) {
-  return mtime_ > mtimecmp_[hart_id];
+  return GetMtime() > mtimecmp_[hart_id];
 }
 
 bool Clint::MachineSoftwareIrq(const uint64_t hart_id) {
   return (msip_[hart_id] & 1) == 1;
 }
 
-void Clint::Tick() { mtime_++; }
+uint64_t Clint::GetMtime() const {
+  return ReadGuestTimeStamp() + mtime_offset_;
+}
 
-void Clint::UpdateMtime() { mtime_ = ReadGuestTimeStamp(); }
+void Clint::Tick() {
+  mtime_offset_++;
+  ArmTimers();
+}
 
 }  // namespace rv64_emulator::device::clint
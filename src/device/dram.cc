@@ -1,30 +1,175 @@
 #include "device/dram.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
-#include <filesystem>
-#include <fstream>
 
 #include "conf.h"
+#include "fmt/core.h"
+#include "libs/guard.h"
 
 namespace rv64_emulator::device::dram {
 
-DRAM::DRAM(uint64_t mem_size) : size_(mem_size), memory_(mem_size, 0) {}
+static uint64_t GetPageBytes(PageBacking backing) {
+  switch (backing) {
+    case PageBacking::kTransparent:
+    case PageBacking::kHuge2M:
+      return 1ULL << 21;
+    case PageBacking::kHuge1G:
+      return 1ULL << 30;
+    default:
+      return sysconf(_SC_PAGESIZE);
+  }
+}
+
+DRAM::DRAM(uint64_t mem_size, PageBacking backing)
+    : size_(mem_size), backing_(PageBacking::kSmall) {
+  const uint64_t kPageMask = sysconf(_SC_PAGESIZE) - 1;
+  const uint64_t kRamBytes = (mem_size + kPageMask) & ~kPageMask;
+  const uint64_t kGuardBytes = kPageMask + 1;
+  const uint64_t kAlign = GetPageBytes(backing);
+  map_size_ = kRamBytes + kGuardBytes;
+
+  // reserve RAM, the guard page behind it and the slack to align RAM for
+  // huge pages, RAM is mapped over the reservation afterwards
+  const uint64_t kReserveBytes = map_size_ + kAlign;
+  void* mem = mmap(nullptr, kReserveBytes, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem == MAP_FAILED) {
+    fmt::print("failed to reserve {} bytes of guest memory: {}\n", mem_size,
+               strerror(errno));
+    exit(-1);
+  }
+
+  const auto kReserved = reinterpret_cast<uint64_t>(mem);
+  const uint64_t kBase = (kReserved + kAlign - 1) & ~(kAlign - 1);
+  if (kBase > kReserved) {
+    munmap(mem, kBase - kReserved);
+  }
+  if (kReserved + kReserveBytes > kBase + map_size_) {
+    munmap(reinterpret_cast<void*>(kBase + map_size_),
+           kReserved + kReserveBytes - kBase - map_size_);
+  }
+
+  memory_ = reinterpret_cast<uint8_t*>(kBase);
+  guard_ = memory_ + kRamBytes;
+  if (!MapRam(backing, kRamBytes)) {
+    fmt::print("failed to map {} bytes of guest memory: {}\n", mem_size,
+               strerror(errno));
+    exit(-1);
+  }
+
+  if (!libs::guard::AddGuard(guard_, kGuardBytes)) {
+    fmt::print("failed to set up the guard page behind guest memory\n");
+    exit(-1);
+  }
+}
+
+bool DRAM::MapRam(PageBacking backing, uint64_t ram_bytes) {
+  constexpr int kProt = PROT_READ | PROT_WRITE;
+  constexpr int kFlags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+
+#ifdef MAP_HUGETLB
+  // no MAP_NORESERVE here, an exhausted pool should fail now rather than
+  // SIGBUS on the first guest touch
+  if ((backing == PageBacking::kHuge2M || backing == PageBacking::kHuge1G) &&
+      size_ % GetPageBytes(backing) == 0) {
+    const int kHugeShift = backing == PageBacking::kHuge2M ? 21 : 30;
+    if (mmap(memory_, size_, kProt,
+             kFlags | MAP_HUGETLB | (kHugeShift << MAP_HUGE_SHIFT), -1,
+             0) != MAP_FAILED) {
+      backing_ = backing;
+      return true;
+    }
+  }
+#endif
+
+  if (mmap(memory_, ram_bytes, kProt, kFlags | MAP_NORESERVE, -1, 0) ==
+      MAP_FAILED) {
+    return false;
+  }
+
+#ifdef MADV_HUGEPAGE
+  if (backing != PageBacking::kSmall &&
+      madvise(memory_, ram_bytes, MADV_HUGEPAGE) == 0) {
+    backing_ = PageBacking::kTransparent;
+  }
+#endif
+  return true;
+}
+
+DRAM::DRAM(uint64_t mem_size, const char* in_file, PageBacking backing)
+    : DRAM(mem_size, backing) {
+  if (!LoadImage(0, in_file)) {
+    fmt::print("failed to load image {}: {}\n", in_file, strerror(errno));
+    exit(-1);
+  }
+}
 
-DRAM::DRAM(uint64_t mem_size, const char* in_file) : DRAM(mem_size) {
-  uint64_t file_size = std::filesystem::file_size(in_file);
-  std::ifstream file(in_file, std::ios::in | std::ios::binary);
+bool DRAM::LoadImage(uint64_t offset, const char* in_file) {
+  const int kFd = open(in_file, O_RDONLY);
+  if (kFd < 0) {
+    return false;
+  }
 
-  file.read(reinterpret_cast<char*>(memory_.data()),
-            std::max(file_size, mem_size));
+  struct stat st;
+  if (fstat(kFd, &st) != 0 || offset >= size_) {
+    close(kFd);
+    return false;
+  }
+
+  const uint64_t kBytes = std::min<uint64_t>(st.st_size, size_ - offset);
+  const uint64_t kPageMask = sysconf(_SC_PAGESIZE) - 1;
+  const uint64_t kMapBytes = (kBytes + kPageMask) & ~kPageMask;
+
+  bool succ = true;
+  const bool kHugetlb = backing_ == PageBacking::kHuge2M ||
+                        backing_ == PageBacking::kHuge1G;
+  if (!kHugetlb && S_ISREG(st.st_mode) && (offset & kPageMask) == 0 &&
+      offset + kMapBytes <= size_) {
+    // the tail of the last page past the end of file reads as zero
+    succ = mmap(memory_ + offset, kBytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED, kFd, 0) != MAP_FAILED;
+  } else {
+    succ = CopyImage(kFd, offset, kBytes);
+    if (succ) {
+      copied_images_.push_back({offset, in_file});
+    }
+  }
+
+  close(kFd);
+  return succ;
+}
+
+bool DRAM::CopyImage(int fd, uint64_t offset, uint64_t bytes) {
+  for (uint64_t done = 0; done < bytes;) {
+    const ssize_t kRead =
+        pread(fd, memory_ + offset + done, bytes - done, done);
+    if (kRead <= 0) {
+      return false;
+    }
+    done += kRead;
+  }
+  return true;
+}
+
+DRAM::~DRAM() {
+  libs::guard::RemoveGuard(guard_);
+  munmap(memory_, map_size_);
 }
 
 uint64_t DRAM::GetSize() const { return size_; }
 
 bool DRAM::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
   if (addr + bytes <= size_) {
-    memcpy(buffer, &memory_[addr], bytes);
+    memcpy(buffer, memory_ + addr, bytes);
     return true;
   }
 
@@ -33,13 +178,40 @@ bool DRAM::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
 
 bool DRAM::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
   if (addr + bytes <= size_) {
-    memcpy(&memory_[addr], buffer, bytes);
+    memcpy(memory_ + addr, buffer, bytes);
     return true;
   }
 
   return false;
 }
 
-void DRAM::Reset() { std::fill(memory_.begin(), memory_.end(), 0); }
+uint8_t* DRAM::GetHostPtr(uint64_t addr, uint64_t bytes) {
+  return addr + bytes <= size_ ? memory_ + addr : nullptr;
+}
+
+// dropping the pages hands them back to the host, the next touch faults in a
+// fresh zero page, or the original image for a region mapped by LoadImage().
+// Copied images are read in again. The mapping itself stays put, so host
+// pointers cached by the soft TLB and the page walk cache remain valid.
+void DRAM::Reset() {
+  // hugetlbfs only takes MADV_DONTNEED on newer kernels
+  if (madvise(memory_, size_, MADV_DONTNEED) != 0) {
+    memset(memory_, 0, size_);
+  }
+
+  for (const auto& image : copied_images_) {
+    const int kFd = open(image.path.c_str(), O_RDONLY);
+    struct stat st;
+    if (kFd < 0 || fstat(kFd, &st) != 0 ||
+        !CopyImage(kFd, image.offset,
+                   std::min<uint64_t>(st.st_size, size_ - image.offset))) {
+      fmt::print("failed to reload image {} on reset: {}\n", image.path,
+                 strerror(errno));
+    }
+    if (kFd >= 0) {
+      close(kFd);
+    }
+  }
+}
 
 }  // namespace rv64_emulator::device::dram
@@ -0,0 +1,156 @@
+#include "device/net.h"
+
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace rv64_emulator::device::net {
+
+// enough queued datagrams for a burst of full sized frames each way
+constexpr int kSocketBufferBytes = 4 << 20;
+
+Tap::Tap() : fd_(-1) {}
+
+Tap::~Tap() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool Tap::Open(const char* ifname) {
+  const int kFd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (kFd < 0) {
+    return false;
+  }
+
+  ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+  int hdr_bytes = kVnetHdrBytes;
+  // the host finishes partial checksums of the guest and hands its own
+  // packets over with them left to do
+  if (ioctl(kFd, TUNSETIFF, &ifr) != 0 ||
+      ioctl(kFd, TUNSETVNETHDRSZ, &hdr_bytes) != 0 ||
+      ioctl(kFd, TUNSETOFFLOAD, TUN_F_CSUM) != 0) {
+    close(kFd);
+    return false;
+  }
+
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  fd_ = kFd;
+  return true;
+}
+
+ssize_t Tap::Send(const iovec* iov, int iovcnt) {
+  return writev(fd_, iov, iovcnt);
+}
+
+ssize_t Tap::Recv(const iovec* iov, int iovcnt) {
+  return readv(fd_, iov, iovcnt);
+}
+
+static bool MakeAddr(const char* path, sockaddr_un* addr) {
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    return false;
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strncpy(addr->sun_path, path, sizeof(addr->sun_path) - 1);
+  return true;
+}
+
+DatagramSocket::DatagramSocket() : fd_(-1), has_peer_(false), bound_(false) {}
+
+DatagramSocket::~DatagramSocket() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  if (bound_) {
+    unlink(local_.sun_path);
+  }
+}
+
+bool DatagramSocket::Open(const char* local, const char* peer) {
+  sockaddr_un local_addr;
+  sockaddr_un peer_addr;
+  if (fd_ >= 0 || !MakeAddr(local, &local_addr) ||
+      !MakeAddr(peer, &peer_addr)) {
+    return false;
+  }
+
+  const int kFd =
+      socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (kFd < 0) {
+    return false;
+  }
+  // a stale path of an earlier run is taken over
+  unlink(local);
+  if (bind(kFd, reinterpret_cast<const sockaddr*>(&local_addr),
+           sizeof(local_addr)) != 0) {
+    close(kFd);
+    return false;
+  }
+  setsockopt(kFd, SOL_SOCKET, SO_SNDBUF, &kSocketBufferBytes,
+             sizeof(kSocketBufferBytes));
+  setsockopt(kFd, SOL_SOCKET, SO_RCVBUF, &kSocketBufferBytes,
+             sizeof(kSocketBufferBytes));
+
+  fd_ = kFd;
+  local_ = local_addr;
+  bound_ = true;
+  peer_ = peer_addr;
+  has_peer_ = true;
+  return true;
+}
+
+bool DatagramSocket::Adopt(int fd) {
+  if (fd_ >= 0) {
+    return false;
+  }
+  const int kFlags = fcntl(fd, F_GETFL);
+  if (kFlags < 0 || fcntl(fd, F_SETFL, kFlags | O_NONBLOCK) != 0) {
+    return false;
+  }
+  fd_ = fd;
+  return true;
+}
+
+ssize_t DatagramSocket::Send(const iovec* iov, int iovcnt) {
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  if (has_peer_) {
+    msg.msg_name = &peer_;
+    msg.msg_namelen = sizeof(peer_);
+  }
+  msg.msg_iov = const_cast<iovec*>(iov);
+  msg.msg_iovlen = iovcnt;
+  return sendmsg(fd_, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+ssize_t DatagramSocket::Recv(const iovec* iov, int iovcnt) {
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = const_cast<iovec*>(iov);
+  msg.msg_iovlen = iovcnt;
+  const ssize_t kBytes = recvmsg(fd_, &msg, MSG_DONTWAIT);
+  // a datagram larger than the buffers is dropped, not cut short
+  if (kBytes >= 0 && (msg.msg_flags & MSG_TRUNC)) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  return kBytes;
+}
+
+}  // namespace rv64_emulator::device::net
@@ -19,32 +19,101 @@ void Plic::UpdateExt(uint32_t src_id, bool fired) {
   const uint32_t kIndex = src_id / kWordBits;
   const uint32_t kOffset = src_id % kWordBits;
   const uint32_t kMask = (1U << kOffset);
+  const uint32_t kOld = pending_[kIndex];
   pending_[kIndex] &= ~kMask;
   if (fired) {
     pending_[kIndex] |= kMask;
   }
+
+  // the run loop reports every line on each sync, most of them unchanged
+  if (pending_[kIndex] == kOld) {
+    return;
+  }
+  for (auto& ctx : contexts_) {
+    UpdateEligible(&ctx, kIndex);
+    Arbitrate(&ctx);
+  }
 }
 
 bool Plic::GetInterrupt(uint64_t ctx_id) {
-  uint64_t max_priority = 0;
-  uint64_t best_interrupt = 0;
-  for (uint64_t i = 0; i < dev_num_; i++) {
-    const uint64_t kIndex = i / kWordBits;
-    const uint64_t kOffset = i % kWordBits;
-    const uint32_t kMask = 1U << kOffset;
-
-    if ((priority_[i] >= contexts_[ctx_id].threshold) &&
-        (pending_[kIndex] & kMask) &&
-        (contexts_[ctx_id].enable[kIndex] & kMask) &&
-        !(contexts_[ctx_id].claimed_[kIndex] & kMask)) {
-      if (max_priority < priority_[i]) {
-        max_priority = priority_[i];
-        best_interrupt = i;
+  return contexts_[ctx_id].claim != 0;
+}
+
+void Plic::UpdateEligible(PlicContext* ctx, uint64_t word_index) {
+  constexpr uint64_t kWordsPerSetWord = kSetWordBits / kWordBits;
+  const uint64_t kSetIndex = word_index / kWordsPerSetWord;
+  uint64_t word = 0;
+  for (uint64_t i = 0; i < kWordsPerSetWord; i++) {
+    const uint64_t kIndex = kSetIndex * kWordsPerSetWord + i;
+    if (kIndex < kLenGroupByWord) {
+      const uint32_t kBits =
+          pending_[kIndex] & ctx->enable[kIndex] & ~ctx->claimed_[kIndex];
+      word |= static_cast<uint64_t>(kBits) << (i * kWordBits);
+    }
+  }
+  ctx->eligible.SetWord(kSetIndex, word);
+}
+
+void Plic::UpdatePriority(uint64_t src_id, uint32_t priority) {
+  const uint64_t kIndex = src_id / kSetWordBits;
+  const uint64_t kMask = 1ULL << (src_id % kSetWordBits);
+
+  // source 0 does not exist, it never takes part in the arbitration
+  auto level = levels_.find(priority_[src_id]);
+  if (src_id != 0 && level != levels_.end()) {
+    level->second.SetWord(kIndex, level->second.bits[kIndex] & ~kMask);
+    if (level->second.summary == 0) {
+      levels_.erase(level);
+    }
+  }
+
+  priority_[src_id] = priority;
+  if (src_id != 0 && priority != 0) {
+    SourceSet& set = levels_[priority];
+    set.SetWord(kIndex, set.bits[kIndex] | kMask);
+  }
+}
+
+void Plic::Arbitrate(PlicContext* ctx) {
+  // the highest priority wins, ties go to the lowest source id
+  uint32_t best_interrupt = 0;
+  for (auto iter = levels_.begin();
+       iter != levels_.end() && iter->first >= ctx->threshold &&
+       best_interrupt == 0;
+       ++iter) {
+    const SourceSet& kLevel = iter->second;
+    for (uint64_t words = kLevel.summary & ctx->eligible.summary; words;
+         words &= words - 1) {
+      const uint64_t kIndex = __builtin_ctzll(words);
+      const uint64_t kBits = kLevel.bits[kIndex] & ctx->eligible.bits[kIndex];
+      if (kBits) {
+        best_interrupt = kIndex * kSetWordBits + __builtin_ctzll(kBits);
+        break;
       }
     }
   }
-  contexts_[ctx_id].claim = best_interrupt;
-  return best_interrupt != 0;
+
+  const bool kLineChanged = (best_interrupt != 0) != (ctx->claim != 0);
+  ctx->claim = best_interrupt;
+  if (kLineChanged) {
+    RaiseIrq();
+  }
+}
+
+void Plic::Rebuild() {
+  levels_.clear();
+  for (uint64_t i = 0; i < dev_num_; i++) {
+    const uint32_t kPriority = priority_[i];
+    priority_[i] = 0;
+    UpdatePriority(i, kPriority);
+  }
+
+  for (auto& ctx : contexts_) {
+    for (uint64_t i = 0; i < kLenGroupByWord; i++) {
+      UpdateEligible(&ctx, i);
+    }
+    Arbitrate(&ctx);
+  }
 }
 
 // https://github.com/riscv/riscv-plic-spec/blob/master/riscv-plic.adoc#memory-map
@@ -102,6 +171,8 @@ bool Plic::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
       const uint32_t kMask = (1U << (kClaim % kWordBits));
       memcpy(buffer, &kClaim, bytes);
       contexts_[kCtxId].claimed_[kClaim / kWordBits] |= kMask;
+      UpdateEligible(&contexts_[kCtxId], kClaim / kWordBits);
+      Arbitrate(&contexts_[kCtxId]);
       return true;
     }
   }
@@ -115,7 +186,12 @@ bool Plic::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
     if (kSourceIndex > dev_num_ - 1) {
       return false;
     }
-    memcpy(&priority_[kSourceIndex], buffer, bytes);
+    uint32_t priority = priority_[kSourceIndex];
+    memcpy(&priority, buffer, std::min(bytes, sizeof(priority)));
+    UpdatePriority(kSourceIndex, priority);
+    for (auto& ctx : contexts_) {
+      Arbitrate(&ctx);
+    }
     return true;
   }
 
@@ -126,6 +202,14 @@ bool Plic::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
       return false;
     }
     memcpy(&pending_[kPendingIndex], buffer, bytes);
+    const uint64_t kEnd =
+        std::min(kPendingIndex + (bytes + 3) / 4, kLenGroupByWord);
+    for (auto& ctx : contexts_) {
+      for (uint64_t i = kPendingIndex; i < kEnd; i++) {
+        UpdateEligible(&ctx, i);
+      }
+      Arbitrate(&ctx);
+    }
     return true;
   }
 
@@ -140,6 +224,12 @@ bool Plic::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
       return false;
     }
     memcpy(&(contexts_[kCtxId].enable[kEnableIndex]), buffer, bytes);
+    const uint64_t kEnd =
+        std::min(kEnableIndex + (bytes + 3) / 4, kLenGroupByWord);
+    for (uint64_t i = kEnableIndex; i < kEnd; i++) {
+      UpdateEligible(&contexts_[kCtxId], i);
+    }
+    Arbitrate(&contexts_[kCtxId]);
     return true;
   }
 
@@ -152,6 +242,7 @@ bool Plic::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
     const uint64_t kOffset = addr % kContextBytesPerHart;
     if (kOffset == 0) {
       memcpy(&(contexts_[kCtxId].threshold), buffer, bytes);
+      Arbitrate(&contexts_[kCtxId]);
       return true;
     }
 
@@ -165,6 +256,8 @@ bool Plic::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
       const uint32_t kOffset = kVal % kWordBits;
       const uint32_t kMask = ~(1U << kOffset);
       contexts_[kCtxId].claimed_[kIndex] &= kMask;
+      UpdateEligible(&contexts_[kCtxId], kIndex);
+      Arbitrate(&contexts_[kCtxId]);
       return true;
     }
   }
@@ -177,6 +270,7 @@ void Plic::Reset() {
   memset(pending_, 0, sizeof(pending_));
 
   std::fill(contexts_.begin(), contexts_.end(), PlicContext{});
+  Rebuild();
 }
 
 }  // namespace rv64_emulator::device::plic
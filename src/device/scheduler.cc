@@ -0,0 +1,111 @@
+#include "device/scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+#include "conf.h"
+
+namespace rv64_emulator::device::scheduler {
+
+// an idle hart rechecks the deadlines at least this often
+constexpr auto kMaxIdleWait = std::chrono::milliseconds(10);
+
+Scheduler::Scheduler(uint64_t max_budget)
+    : next_deadline_(kNoDeadline),
+      max_budget_(max_budget),
+      // until the first runs are accounted every run gets the full budget
+      rate_(max_budget << kRateShift),
+      irq_(false),
+      waiting_(false) {}
+
+uint64_t Scheduler::AddTimer(Callback callback) {
+  timers_.push_back({.callback = std::move(callback), .deadline = kNoDeadline});
+  return timers_.size() - 1;
+}
+
+void Scheduler::Arm(uint64_t timer, uint64_t deadline) {
+  timers_[timer].deadline = deadline;
+  if (deadline < next_deadline_) {
+    next_deadline_ = deadline;
+  } else {
+    UpdateNextDeadline();
+  }
+}
+
+void Scheduler::Disarm(uint64_t timer) { Arm(timer, kNoDeadline); }
+
+uint64_t Scheduler::RunExpired(uint64_t now) {
+  uint64_t fired = 0;
+  // a callback may arm timers again, so rescan after each one
+  while (next_deadline_ <= now) {
+    auto timer = std::min_element(
+        timers_.begin(), timers_.end(),
+        [](const Timer& a, const Timer& b) { return a.deadline < b.deadline; });
+    timer->deadline = kNoDeadline;
+    UpdateNextDeadline();
+    timer->callback(now);
+    fired++;
+  }
+  return fired;
+}
+
+void Scheduler::RaiseIrq() {
+  irq_.store(true);
+  if (kick_) {
+    kick_();
+  }
+  if (waiting_.load()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cond_.notify_one();
+  }
+}
+
+bool Scheduler::TakeIrq() { return irq_.exchange(false); }
+
+void Scheduler::WaitIrq(uint64_t now) {
+  std::chrono::microseconds wait = kMaxIdleWait;
+  const uint64_t kTicks = next_deadline_ > now ? next_deadline_ - now : 0;
+  if (kTicks < kMtimeFreq) {
+    wait = std::min<std::chrono::microseconds>(
+        wait, std::chrono::microseconds(kTicks * 1000000 / kMtimeFreq));
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // RaiseIrq checks waiting_ after setting irq_, so an edge is either seen
+  // by the predicate or notifies under the lock
+  waiting_.store(true);
+  cond_.wait_for(lock, wait, [this]() { return irq_.load(); });
+  waiting_.store(false);
+}
+
+uint64_t Scheduler::GetBudget(uint64_t now) const {
+  if (next_deadline_ == kNoDeadline) {
+    return max_budget_;
+  }
+  const uint64_t kTicks = next_deadline_ > now ? next_deadline_ - now : 0;
+  if (kTicks >= (max_budget_ << kRateShift) / std::max<uint64_t>(rate_, 1)) {
+    return max_budget_;
+  }
+  return std::max<uint64_t>((kTicks * rate_) >> kRateShift, 1);
+}
+
+void Scheduler::Account(uint64_t insts, uint64_t ticks) {
+  if (ticks == 0) {
+    return;
+  }
+  // moving average, a single slow run should not shorten the next ones much
+  const uint64_t kRate = (insts << kRateShift) / ticks;
+  rate_ = std::max<uint64_t>((rate_ * 7 + kRate) / 8, 1);
+}
+
+void Scheduler::UpdateNextDeadline() {
+  next_deadline_ = kNoDeadline;
+  for (const auto& kTimer : timers_) {
+    next_deadline_ = std::min(next_deadline_, kTimer.deadline);
+  }
+}
+
+}  // namespace rv64_emulator::device::scheduler
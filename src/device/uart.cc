@@ -4,8 +4,6 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
-#include <mutex>
-#include <queue>
 
 namespace rv64_emulator::device::uart {
 
@@ -24,21 +22,32 @@ bool Uart::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
     return false;
   }
 
-  std::lock_guard<std::mutex> lock(rx_lock_);
-  if (!rx_buffer_.empty()) {
+  char ch = 0;
+  const bool kRxValid = rx_buffer_.Peek(&ch);
+  if (kRxValid) {
     reg_.status |= kRxFifoValidData;
-    reg_.rx_fifo = rx_buffer_.front();
+    reg_.rx_fifo = ch;
   } else {
     reg_.status &= ~kRxFifoValidData;
   }
 
+  if (tx_buffer_.Full()) {
+    reg_.status |= kTxFifoFull;
+  } else {
+    reg_.status &= ~kTxFifoFull;
+  }
+
   memcpy(buffer, reinterpret_cast<const char*>(&reg_) + addr, bytes);
-  wait_ack_ = false;
+  // status polls are frequent, only an actual line change is an edge
+  bool irq_changed = wait_ack_.exchange(false, std::memory_order_relaxed);
   constexpr auto kRxFifoBias = offsetof(struct UartReg, rx_fifo);
-  if (addr <= kRxFifoBias && kRxFifoBias <= addr + bytes) {
-    if (!rx_buffer_.empty()) {
-      rx_buffer_.pop();
-    }
+  // only the byte shown in rx_fifo is consumed, one the input thread pushed
+  // after the peek waits for the next read
+  if (kRxValid && addr <= kRxFifoBias && kRxFifoBias <= addr + bytes) {
+    irq_changed |= rx_buffer_.Pop(&ch);
+  }
+  if (irq_changed) {
+    RaiseIrq();
   }
 
   return true;
@@ -53,23 +62,21 @@ bool Uart::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
   constexpr auto kTxFifoBias = offsetof(struct UartReg, tx_fifo);
   constexpr auto kControlBias = offsetof(struct UartReg, control);
 
-  std::lock_guard<std::mutex> lock_tx(tx_lock_);
+  // the guest is told about a full fifo through the status register, what
+  // it writes anyway is dropped like on the real device
   if (addr <= kTxFifoBias && kTxFifoBias <= addr + bytes) {
-    tx_buffer_.push(reg_.tx_fifo & 0xff);
+    tx_buffer_.Push(reg_.tx_fifo & 0xff);
   }
 
   if (addr <= kControlBias && kControlBias <= addr + bytes) {
+    // the console drains tx on the cpu thread, so clearing it here keeps a
+    // single consumer
     if (reg_.control & kControlRstTx) {
-      while (!tx_buffer_.empty()) {
-        tx_buffer_.pop();
-      }
+      tx_buffer_.Clear();
     }
-
-    std::lock_guard<std::mutex> lock_rx(rx_lock_);
     if (reg_.control & kControlRstRx) {
-      while (!rx_buffer_.empty()) {
-        rx_buffer_.pop();
-      }
+      rx_buffer_.Clear();
+      RaiseIrq();
     }
   }
 
@@ -78,41 +85,34 @@ bool Uart::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
 
 void Uart::Reset() {
   reg_.status = kTxFifoEmpty;
-  wait_ack_ = false;
-  while (!rx_buffer_.empty()) {
-    rx_buffer_.pop();
-  }
-  while (!tx_buffer_.empty()) {
-    tx_buffer_.pop();
-  }
+  wait_ack_.store(false, std::memory_order_relaxed);
+  rx_buffer_.Clear();
+  tx_buffer_.Clear();
 }
 
+// input typed faster than the guest reads it is dropped once rx is full
 void Uart::Putc(char ch) {
-  std::lock_guard<std::mutex> lock(rx_lock_);
-  rx_buffer_.push(ch);
+  if (rx_buffer_.Push(ch)) {
+    RaiseIrq();
+  }
 }
 
 char Uart::Getc() {
-  std::lock_guard<std::mutex> lock(tx_lock_);
-  if (!tx_buffer_.empty()) {
-    char res = tx_buffer_.front();
-    tx_buffer_.pop();
-    if (tx_buffer_.empty()) {
-      wait_ack_ = true;
-    }
-    return res;
+  char res = 0;
+  if (!tx_buffer_.Pop(&res)) {
+    return EOF;
+  }
+  if (tx_buffer_.Empty()) {
+    wait_ack_.store(true, std::memory_order_relaxed);
+    RaiseIrq();
   }
-  return EOF;
+  return res;
 }
 
-bool Uart::TxBufferNotEmpty() {
-  std::lock_guard<std::mutex> lock(tx_lock_);
-  return !tx_buffer_.empty();
-}
+bool Uart::TxBufferNotEmpty() { return !tx_buffer_.Empty(); }
 
 bool Uart::Irq() {
-  std::lock_guard<std::mutex> lock(rx_lock_);
-  return !rx_buffer_.empty() || wait_ack_;
+  return !rx_buffer_.Empty() || wait_ack_.load(std::memory_order_relaxed);
 }
 
 }  // namespace rv64_emulator::device::uart
@@ -0,0 +1,242 @@
+#include "device/virtio.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "device/bus.h"
+#include "device/virtqueue.h"
+
+namespace rv64_emulator::device::virtio {
+
+VirtioMmio::VirtioMmio(bus::Bus* bus, uint32_t device_id, uint64_t features,
+                       uint32_t queue_num, uint16_t queue_size)
+    : bus_(bus),
+      queues_(queue_num, VirtQueue(queue_size)),
+      device_id_(device_id),
+      // the queue engine always handles these
+      device_features_(features | kFeatureVersion1 | kFeatureIndirectDesc |
+                       kFeatureEventIdx),
+      config_generation_(0),
+      interrupt_status_(0) {
+  ResetDevice();
+}
+
+bool VirtioMmio::Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) {
+  if (addr >= kConfig) {
+    return ReadConfig(addr - kConfig, bytes, buffer);
+  }
+
+  uint32_t val = 0;
+  // the registers only take aligned 32 bits accesses
+  if (bytes != sizeof(val) || addr % sizeof(val) || !LoadReg(addr, &val)) {
+    return false;
+  }
+  memcpy(buffer, &val, sizeof(val));
+  return true;
+}
+
+bool VirtioMmio::Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) {
+  if (addr >= kConfig) {
+    return WriteConfig(addr - kConfig, bytes, buffer);
+  }
+
+  uint32_t val = 0;
+  if (bytes != sizeof(val) || addr % sizeof(val)) {
+    return false;
+  }
+  memcpy(&val, buffer, sizeof(val));
+  return StoreReg(addr, val);
+}
+
+void VirtioMmio::Reset() {
+  Quiesce();
+  ResetDevice();
+  DeviceReset();
+}
+
+bool VirtioMmio::Irq() const {
+  return interrupt_status_.load(std::memory_order_acquire) != 0;
+}
+
+void VirtioMmio::FlushQueue(uint32_t index) {
+  if (queues_[index].Flush()) {
+    SetInterrupt(kInterruptUsedBuffer);
+  }
+}
+
+void VirtioMmio::InterruptConfig() {
+  config_generation_++;
+  SetInterrupt(kInterruptConfigChange);
+}
+
+void VirtioMmio::NeedsReset() {
+  status_ |= kStatusNeedsReset;
+  InterruptConfig();
+}
+
+void VirtioMmio::SetInterrupt(uint32_t bits) {
+  // only the rising line is an edge for the plic
+  if (interrupt_status_.fetch_or(bits, std::memory_order_acq_rel) == 0) {
+    RaiseIrq();
+  }
+}
+
+bool VirtioMmio::LoadReg(uint64_t addr, uint32_t* val) {
+  const VirtQueue* queue =
+      queue_sel_ < queues_.size() ? &queues_[queue_sel_] : nullptr;
+
+  switch (addr) {
+    case kMagicValue:
+      *val = kMagic;
+      break;
+    case kVersion:
+      *val = kMmioVersion;
+      break;
+    case kDeviceId:
+      *val = device_id_;
+      break;
+    case kVendorId:
+      *val = kVendor;
+      break;
+    case kDeviceFeatures:
+      *val = device_features_sel_ > 1
+                 ? 0
+                 : device_features_ >> (32 * device_features_sel_);
+      break;
+    case kQueueNumMax:
+      // queues the device does not have read as size 0
+      *val = queue ? queue->GetMaxSize() : 0;
+      break;
+    case kQueueReady:
+      *val = queue ? queue->IsReady() : 0;
+      break;
+    case kInterruptStatus:
+      *val = interrupt_status_.load(std::memory_order_acquire);
+      break;
+    case kStatus:
+      *val = status_;
+      break;
+    case kConfigGeneration:
+      *val = config_generation_;
+      break;
+    default:
+      // write only registers read as 0
+      *val = 0;
+      break;
+  }
+  return true;
+}
+
+bool VirtioMmio::StoreReg(uint64_t addr, uint32_t val) {
+  VirtQueue* queue =
+      queue_sel_ < queues_.size() ? &queues_[queue_sel_] : nullptr;
+  // the layout of a live queue must not change under the device
+  const bool kQueueWritable = queue && !queue->IsReady();
+  // replaces the low or high half of a 64 bits queue address
+  auto set_half = [val](uint64_t* reg, bool high) {
+    const uint32_t kShift = high ? 32 : 0;
+    *reg = (*reg & ~(0xffffffffULL << kShift)) |
+           (static_cast<uint64_t>(val) << kShift);
+  };
+
+  switch (addr) {
+    case kDeviceFeaturesSel:
+      device_features_sel_ = val;
+      break;
+    case kDriverFeatures:
+      if (!(status_ & kStatusFeaturesOk) && driver_features_sel_ <= 1) {
+        const uint32_t kShift = 32 * driver_features_sel_;
+        driver_features_ &= ~(0xffffffffULL << kShift);
+        driver_features_ |= static_cast<uint64_t>(val) << kShift;
+      }
+      break;
+    case kDriverFeaturesSel:
+      driver_features_sel_ = val;
+      break;
+    case kQueueSel:
+      queue_sel_ = val;
+      break;
+    case kQueueNum:
+      if (kQueueWritable) {
+        queue->size_ = val;
+      }
+      break;
+    case kQueueReady:
+      if (!queue) {
+        break;
+      }
+      if (val == 0) {
+        Quiesce();
+        queue->Reset();
+      } else if (!queue->IsReady() &&
+                 !queue->Enable(bus_, Negotiated(kFeatureEventIdx))) {
+        // the rings are not in RAM, the device can not go on
+        NeedsReset();
+      }
+      break;
+    case kQueueNotify:
+      if ((status_ & kStatusDriverOk) && val < queues_.size() &&
+          queues_[val].IsReady()) {
+        QueueNotify(val);
+      }
+      break;
+    case kInterruptAck:
+      if (interrupt_status_.fetch_and(~val, std::memory_order_acq_rel) &&
+          !Irq()) {
+        RaiseIrq();
+      }
+      break;
+    case kStatus:
+      if (val == 0) {
+        Quiesce();
+        ResetDevice();
+        DeviceReset();
+        break;
+      }
+      // features are only accepted if the device offers all of them
+      if ((val & kStatusFeaturesOk) && !(status_ & kStatusFeaturesOk) &&
+          ((driver_features_ & ~device_features_) ||
+           !Negotiated(kFeatureVersion1))) {
+        val &= ~kStatusFeaturesOk;
+      }
+      status_ = val;
+      break;
+    case kQueueDescLow:
+    case kQueueDescHigh:
+      if (kQueueWritable) {
+        set_half(&queue->desc_addr_, addr == kQueueDescHigh);
+      }
+      break;
+    case kQueueDriverLow:
+    case kQueueDriverHigh:
+      if (kQueueWritable) {
+        set_half(&queue->driver_addr_, addr == kQueueDriverHigh);
+      }
+      break;
+    case kQueueDeviceLow:
+    case kQueueDeviceHigh:
+      if (kQueueWritable) {
+        set_half(&queue->device_addr_, addr == kQueueDeviceHigh);
+      }
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+void VirtioMmio::ResetDevice() {
+  for (auto& queue : queues_) {
+    queue.Reset();
+  }
+  driver_features_ = 0;
+  device_features_sel_ = 0;
+  driver_features_sel_ = 0;
+  queue_sel_ = 0;
+  status_ = 0;
+  if (interrupt_status_.exchange(0, std::memory_order_acq_rel)) {
+    RaiseIrq();
+  }
+}
+
+}  // namespace rv64_emulator::device::virtio
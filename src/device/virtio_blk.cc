@@ -0,0 +1,203 @@
+#include "device/virtio_blk.h"
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "device/block.h"
+#include "device/bus.h"
+#include "device/virtio.h"
+#include "device/virtqueue.h"
+
+namespace rv64_emulator::device::virtio {
+
+static_assert(sizeof(BlkConfig) == 24, "virtio-blk config layout");
+
+constexpr char kBlkId[kBlkIdBytes] = "rv64_emulator";
+
+VirtioBlk::VirtioBlk(bus::Bus* bus, std::unique_ptr<block::Backend> backend,
+                     uint64_t workers, uint16_t queue_size)
+    : VirtioMmio(bus, kBlkDeviceId,
+                 kBlkFeatureSegMax | kBlkFeatureBlkSize | kBlkFeatureFlush |
+                     (backend->IsReadOnly() ? kBlkFeatureRo : 0),
+                 1, queue_size),
+      backend_(std::move(backend)),
+      config_({
+          .capacity = backend_->GetSize() / block::kSectorBytes,
+          .size_max = 0,
+          // the header and the status byte take a descriptor each
+          .seg_max = static_cast<uint32_t>(queue_size - 2),
+          .cylinders = 0,
+          .heads = 0,
+          .sectors = 0,
+          .blk_size = block::kSectorBytes,
+      }),
+      requests_(queue_size),
+      in_flight_(0),
+      stop_(false) {
+  for (uint64_t i = 0; i < workers; i++) {
+    workers_.emplace_back(&VirtioBlk::Work, this);
+  }
+}
+
+VirtioBlk::~VirtioBlk() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+bool VirtioBlk::ReadConfig(uint64_t offset, uint64_t bytes, uint8_t* buffer) {
+  if (offset + bytes > sizeof(config_)) {
+    return false;
+  }
+  memcpy(buffer, reinterpret_cast<const uint8_t*>(&config_) + offset, bytes);
+  return true;
+}
+
+void VirtioBlk::QueueNotify(uint32_t index) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  VirtQueue& queue = queues_[index];
+  const uint64_t kQueued = pending_.size();
+  do {
+    queue.DisableNotify();
+    while (!GetNeedsReset() && queue.Pop(&chain_)) {
+      Request& req = requests_[chain_.head];
+      if (req.busy) {
+        // the driver handed out a head it does not own, its request is
+        // still being served from the buffers Parse would replace
+        NeedsReset();
+        break;
+      }
+      if (!Parse(chain_, &req)) {
+        queue.Push(chain_.head, 0);
+        continue;
+      }
+      req.busy = true;
+      pending_.push_back(chain_.head);
+      in_flight_++;
+    }
+  } while (!GetNeedsReset() && queue.EnableNotify());
+  // hands back the malformed chains
+  FlushQueue(index);
+
+  if (pending_.size() > kQueued) {
+    work_cv_.notify_all();
+  }
+}
+
+void VirtioBlk::Quiesce() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this]() { return in_flight_ == 0; });
+}
+
+bool VirtioBlk::Parse(const Chain& chain, Request* req) {
+  BlkReqHeader header;
+  if (chain.Read(0, reinterpret_cast<uint8_t*>(&header), sizeof(header)) !=
+          sizeof(header) ||
+      chain.writable.empty()) {
+    return false;
+  }
+
+  // the status is the last byte the device writes
+  const Segment& kLast = chain.writable.back();
+  req->type = header.type;
+  req->sector = header.sector;
+  req->status = kLast.host + kLast.len - 1;
+  req->data.clear();
+  if (header.type == kBlkTypeOut) {
+    req->bytes = chain.ReadableBytes() - sizeof(header);
+    AppendIov(chain.readable, sizeof(header), req->bytes, &req->data);
+  } else {
+    req->bytes = chain.WritableBytes() - 1;
+    AppendIov(chain.writable, 0, req->bytes, &req->data);
+  }
+  return true;
+}
+
+uint32_t VirtioBlk::Serve(Request* req) {
+  const uint64_t kCapacity = config_.capacity;
+  const int kIovCnt = static_cast<int>(req->data.size());
+  uint8_t status = kBlkStatusOk;
+  uint32_t written = 0;
+
+  switch (req->type) {
+    case kBlkTypeIn:
+    case kBlkTypeOut: {
+      const bool kIn = req->type == kBlkTypeIn;
+      if (req->bytes % block::kSectorBytes || req->sector > kCapacity ||
+          req->bytes / block::kSectorBytes > kCapacity - req->sector) {
+        status = kBlkStatusIoErr;
+        break;
+      }
+      const uint64_t kOffset = req->sector * block::kSectorBytes;
+      if (req->bytes &&
+          !(kIn ? backend_->Read(kOffset, req->data.data(), kIovCnt)
+                : backend_->Write(kOffset, req->data.data(), kIovCnt))) {
+        status = kBlkStatusIoErr;
+        break;
+      }
+      written = kIn ? req->bytes : 0;
+      break;
+    }
+    case kBlkTypeFlush:
+      status = backend_->Flush() ? kBlkStatusOk : kBlkStatusIoErr;
+      break;
+    case kBlkTypeGetId: {
+      uint64_t done = 0;
+      for (const auto& kIov : req->data) {
+        const uint64_t kLen = std::min(kIov.iov_len, kBlkIdBytes - done);
+        memcpy(kIov.iov_base, kBlkId + done, kLen);
+        done += kLen;
+      }
+      written = done;
+      break;
+    }
+    default:
+      status = kBlkStatusUnsupp;
+      break;
+  }
+
+  *req->status = status;
+  return written + sizeof(status);
+}
+
+void VirtioBlk::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_cv_.wait(lock, [this]() { return stop_ || !pending_.empty(); });
+    if (stop_) {
+      return;
+    }
+    const uint16_t kHead = pending_.front();
+    pending_.pop_front();
+
+    lock.unlock();
+    const uint32_t kWritten = Serve(&requests_[kHead]);
+    lock.lock();
+
+    queues_[0].Push(kHead, kWritten);
+    requests_[kHead].busy = false;
+    in_flight_--;
+    // while requests are queued a later completion publishes this one too,
+    // one interrupt then covers the whole burst
+    if (pending_.empty()) {
+      FlushQueue(0);
+    }
+    if (in_flight_ == 0) {
+      idle_cv_.notify_all();
+    }
+  }
+}
+
+}  // namespace rv64_emulator::device::virtio
@@ -0,0 +1,294 @@
+#include "device/virtio_console.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "device/virtio.h"
+#include "device/virtio_io.h"
+#include "device/virtqueue.h"
+
+namespace rv64_emulator::device::virtio {
+
+static_assert(sizeof(ConsoleConfig) == 12, "virtio-console config layout");
+static_assert(sizeof(ConsoleControl) == 8, "virtio-console control layout");
+
+// guest output is written out once this much is buffered, or once it has
+// been pending for kPortFlushInterval
+constexpr uint64_t kPortWriteBytes = 64 << 10;
+constexpr auto kPortFlushInterval = std::chrono::milliseconds(20);
+// tx stops taking guest buffers of a port with this much buffered, which
+// only happens while its out_fd would block
+constexpr uint64_t kPortBufferBytes = 1 << 20;
+// rx chains filled per port and wakeup, then the other ports get their turn
+constexpr uint64_t kPortRxBudget = 64;
+
+VirtioConsole::VirtioConsole(bus::Bus* bus, std::vector<ConsolePort> ports,
+                             uint16_t queue_size)
+    : VirtioIoDevice(bus, kConsoleDeviceId, kConsoleFeatureMultiport,
+                     2 * (ports.size() + 1), queue_size),
+      config_({.cols = 0,
+               .rows = 0,
+               .max_nr_ports = static_cast<uint32_t>(ports.size()),
+               .emerg_wr = 0}),
+      flush_pending_(false),
+      again_(false) {
+  ports_.resize(ports.size());
+  for (uint64_t i = 0; i < ports.size(); i++) {
+    ports_[i].port = std::move(ports[i]);
+    const int kInFd = ports_[i].port.in_fd;
+    if (kInFd >= 0) {
+      fcntl(kInFd, F_SETFL, fcntl(kInFd, F_GETFL) | O_NONBLOCK);
+    }
+    rx_.push_back({.queue = ConsoleRxQueue(i), .chain = {}});
+  }
+  StartIo();
+}
+
+VirtioConsole::~VirtioConsole() {
+  StopIo();
+  // what the guest wrote last still reaches the host
+  for (uint32_t i = 0; i < ports_.size(); i++) {
+    WriteOut(i);
+  }
+}
+
+bool VirtioConsole::ReadConfig(uint64_t offset, uint64_t bytes,
+                               uint8_t* buffer) {
+  if (offset + bytes > sizeof(config_)) {
+    return false;
+  }
+  memcpy(buffer, reinterpret_cast<const uint8_t*>(&config_) + offset, bytes);
+  return true;
+}
+
+void VirtioConsole::DeviceReset() {
+  for (auto& port : ports_) {
+    port.guest_open = false;
+  }
+  control_.clear();
+}
+
+bool VirtioConsole::PortOpen(uint32_t port) const {
+  // a driver without multiport only knows port 0, as a console
+  return Negotiated(kConsoleFeatureMultiport) ? ports_[port].guest_open
+                                              : port == 0;
+}
+
+bool VirtioConsole::PortReadable(uint32_t port) const {
+  const PortState& kPort = ports_[port];
+  return kPort.port.in_fd >= 0 && PortOpen(port) && !kPort.in_eof &&
+         !rx_[port].starved;
+}
+
+void VirtioConsole::SendControl(uint32_t id, uint16_t event, uint16_t value,
+                                const std::string& data) {
+  const ConsoleControl kMsg = {.id = id, .event = event, .value = value};
+  std::string msg(reinterpret_cast<const char*>(&kMsg), sizeof(kMsg));
+  msg += data;
+  control_.push_back(std::move(msg));
+}
+
+void VirtioConsole::HandleControl(const ConsoleControl& msg) {
+  switch (msg.event) {
+    case kConsoleDeviceReady:
+      for (uint32_t i = 0; msg.value && i < ports_.size(); i++) {
+        SendControl(i, kConsoleDeviceAdd, 1, "");
+      }
+      break;
+    case kConsolePortReady: {
+      if (msg.id >= ports_.size() || !msg.value) {
+        break;
+      }
+      const ConsolePort& kPort = ports_[msg.id].port;
+      if (kPort.console) {
+        SendControl(msg.id, kConsoleConsolePort, 1, "");
+      } else if (!kPort.name.empty()) {
+        SendControl(msg.id, kConsolePortName, 1, kPort.name);
+      }
+      // the host end is connected for as long as the device exists
+      SendControl(msg.id, kConsolePortOpen, 1, "");
+      break;
+    }
+    case kConsolePortOpen:
+      if (msg.id < ports_.size()) {
+        ports_[msg.id].guest_open = msg.value;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+int VirtioConsole::PollFds(std::vector<pollfd>* fds) {
+  for (uint32_t i = 0; i < ports_.size(); i++) {
+    const PortState& kPort = ports_[i];
+    // negative fds are left out by poll
+    fds->push_back({.fd = PortReadable(i) ? kPort.port.in_fd : -1,
+                    .events = POLLIN,
+                    .revents = 0});
+    fds->push_back({.fd = kPort.out_blocked ? kPort.port.out_fd : -1,
+                    .events = POLLOUT,
+                    .revents = 0});
+  }
+
+  if (again_) {
+    return 0;
+  }
+  if (!flush_pending_) {
+    return -1;
+  }
+  const auto kLeft = std::chrono::ceil<std::chrono::milliseconds>(
+      flush_deadline_ - std::chrono::steady_clock::now());
+  return std::max<int>(kLeft.count(), 0);
+}
+
+void VirtioConsole::ServeQueues(const std::vector<pollfd>& /*fds*/) {
+  ServeControl();
+  for (uint32_t i = 0; i < ports_.size(); i++) {
+    ServeTx(i);
+    if (PortReadable(i)) {
+      ServeRx(i);
+    }
+  }
+}
+
+void VirtioConsole::ServeHost(const std::vector<pollfd>& fds) {
+  const auto kNow = std::chrono::steady_clock::now();
+  const bool kDue = flush_pending_ && kNow >= flush_deadline_;
+  bool pending = false;
+  again_ = false;
+  for (uint32_t i = 0; i < ports_.size(); i++) {
+    PortState& port = ports_[i];
+    const bool kWritable = port.out_blocked && fds[2 + 2 * i].revents != 0;
+    port.out_blocked &= !kWritable;
+    if (!port.out_blocked && !port.out.empty() &&
+        (kDue || kWritable || port.out.size() >= kPortWriteBytes)) {
+      WriteOut(i);
+    }
+    // tx takes guest buffers again without waiting for a kick
+    again_ |= port.tx_paused && port.out.size() < kPortBufferBytes;
+    pending |= !port.out.empty();
+  }
+  if (!pending) {
+    flush_pending_ = false;
+  } else if (!flush_pending_ || kDue) {
+    flush_pending_ = true;
+    flush_deadline_ = kNow + kPortFlushInterval;
+  }
+}
+
+void VirtioConsole::ServeControl() {
+  ServeQueue(kConsoleControlTxQueue, [this](const Chain& chain) {
+    ConsoleControl msg;
+    if (chain.Read(0, reinterpret_cast<uint8_t*>(&msg), sizeof(msg)) ==
+        sizeof(msg)) {
+      HandleControl(msg);
+    }
+    return 0;
+  });
+
+  VirtQueue& queue = queues_[kConsoleControlRxQueue];
+  if (control_.empty() || !queue.IsReady()) {
+    return;
+  }
+  // the rest waits for the driver to hand out buffers again
+  while (!control_.empty() && queue.Pop(&chain_)) {
+    const std::string& kMsg = control_.front();
+    queue.Push(chain_.head,
+               chain_.Write(0, reinterpret_cast<const uint8_t*>(kMsg.data()),
+                            kMsg.size()));
+    control_.pop_front();
+  }
+  FlushQueue(kConsoleControlRxQueue);
+}
+
+void VirtioConsole::ServeTx(uint32_t port) {
+  PortState& state = ports_[port];
+  VirtQueue& queue = queues_[ConsoleRxQueue(port) + 1];
+  state.tx_paused = false;
+  if (!queue.IsReady()) {
+    return;
+  }
+
+  do {
+    queue.DisableNotify();
+    while (state.out.size() < kPortBufferBytes && queue.Pop(&chain_)) {
+      for (const auto& kSegment : chain_.readable) {
+        if (state.port.out_fd >= 0) {
+          state.out.append(reinterpret_cast<const char*>(kSegment.host),
+                           kSegment.len);
+        }
+      }
+      queue.Push(chain_.head, 0);
+    }
+    if (state.out.size() >= kPortBufferBytes) {
+      // notifications stay off, the io thread comes back once it has written
+      state.tx_paused = true;
+      break;
+    }
+  } while (queue.EnableNotify());
+  FlushQueue(ConsoleRxQueue(port) + 1);
+}
+
+void VirtioConsole::ServeRx(uint32_t port) {
+  PortState& state = ports_[port];
+  VirtQueue& queue = queues_[ConsoleRxQueue(port)];
+  RxSlot& slot = rx_[port];
+  for (uint64_t filled = 0; filled < kPortRxBudget && HoldRx(&slot);) {
+    iov_.clear();
+    AppendIov(slot.chain.writable, 0, slot.chain.WritableBytes(), &iov_);
+    const ssize_t kBytes =
+        iov_.empty() ? 0
+                     : readv(state.port.in_fd, iov_.data(),
+                             static_cast<int>(iov_.size()));
+    if (kBytes < 0 && (errno == EAGAIN || errno == EINTR)) {
+      break;
+    }
+    if (kBytes <= 0 && !iov_.empty()) {
+      // the end of a file or a pipe without writers, the chain is kept
+      state.in_eof = true;
+      break;
+    }
+    queue.Push(slot.chain.head, kBytes);
+    slot.held = false;
+    filled++;
+  }
+  FlushQueue(ConsoleRxQueue(port));
+}
+
+void VirtioConsole::WriteOut(uint32_t port) {
+  PortState& state = ports_[port];
+  uint64_t done = 0;
+  while (done < state.out.size()) {
+    const ssize_t kWritten = write(state.port.out_fd, state.out.data() + done,
+                                   state.out.size() - done);
+    if (kWritten < 0 && errno == EINTR) {
+      continue;
+    }
+    if (kWritten < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      state.out_blocked = true;
+      break;
+    }
+    if (kWritten <= 0) {
+      // nobody reads the other end any more, like a hung up tty the output
+      // goes nowhere
+      done = state.out.size();
+      break;
+    }
+    done += kWritten;
+  }
+  state.out.erase(0, done);
+}
+
+}  // namespace rv64_emulator::device::virtio
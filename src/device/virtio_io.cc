@@ -0,0 +1,128 @@
+#include "device/virtio_io.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "device/virtio.h"
+#include "device/virtqueue.h"
+#include "fmt/core.h"
+
+namespace rv64_emulator::device::virtio {
+
+VirtioIoDevice::VirtioIoDevice(bus::Bus* bus, uint32_t device_id,
+                               uint64_t features, uint32_t queue_num,
+                               uint16_t queue_size)
+    : VirtioMmio(bus, device_id, features, queue_num, queue_size),
+      kick_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      stop_(false) {
+  if (kick_fd_ < 0) {
+    fmt::print("failed to create the virtio eventfd: {}\n", strerror(errno));
+    exit(-1);
+  }
+}
+
+VirtioIoDevice::~VirtioIoDevice() {
+  StopIo();
+  close(kick_fd_);
+}
+
+bool VirtioIoDevice::Store(uint64_t addr, uint64_t bytes,
+                           const uint8_t* buffer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return VirtioMmio::Store(addr, bytes, buffer);
+}
+
+void VirtioIoDevice::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  VirtioMmio::Reset();
+}
+
+void VirtioIoDevice::StartIo() {
+  io_thread_ = std::thread(&VirtioIoDevice::Io, this);
+}
+
+void VirtioIoDevice::StopIo() {
+  if (!io_thread_.joinable()) {
+    return;
+  }
+  stop_.store(true);
+  Kick();
+  io_thread_.join();
+}
+
+bool VirtioIoDevice::HoldRx(RxSlot* slot) {
+  VirtQueue& queue = queues_[slot->queue];
+  if (!queue.IsReady()) {
+    slot->starved = true;
+    return false;
+  }
+
+  while (!slot->held) {
+    queue.DisableNotify();
+    if (queue.Pop(&slot->chain)) {
+      slot->held = true;
+    } else if (!queue.EnableNotify()) {
+      // the driver kicks once it adds buffers
+      slot->starved = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+void VirtioIoDevice::QueueNotify(uint32_t /*index*/) { Kick(); }
+
+void VirtioIoDevice::Quiesce() {
+  // the register write holds the lock, the chains are just forgotten
+  for (auto& slot : rx_) {
+    slot.held = false;
+    slot.starved = false;
+  }
+}
+
+void VirtioIoDevice::Kick() {
+  const uint64_t kOne = 1;
+  // a full counter wakes the io thread all the same
+  if (write(kick_fd_, &kOne, sizeof(kOne)) < 0 && errno != EAGAIN) {
+    fmt::print("failed to kick the virtio io thread: {}\n", strerror(errno));
+  }
+}
+
+void VirtioIoDevice::Io() {
+  std::vector<pollfd> fds;
+  while (!stop_.load()) {
+    fds.assign(1, {.fd = kick_fd_, .events = POLLIN, .revents = 0});
+    int timeout = -1;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      timeout = PollFds(&fds);
+    }
+    if (poll(fds.data(), fds.size(), timeout) < 0) {
+      continue;
+    }
+
+    uint64_t kicks = 0;
+    const bool kKicked =
+        read(kick_fd_, &kicks, sizeof(kicks)) == sizeof(kicks);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto& slot : rx_) {
+        // a kick may come with fresh rx buffers
+        slot.starved &= !kKicked;
+      }
+      ServeQueues(fds);
+    }
+    ServeHost(fds);
+  }
+}
+
+}  // namespace rv64_emulator::device::virtio
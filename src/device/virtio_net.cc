@@ -0,0 +1,177 @@
+#include "device/virtio_net.h"
+
+#include <poll.h>
+#include <sys/uio.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "device/net.h"
+#include "device/virtio_io.h"
+#include "device/virtqueue.h"
+
+namespace rv64_emulator::device::virtio {
+
+static_assert(sizeof(NetHdr) == net::kVnetHdrBytes, "virtio-net header");
+
+// packets moved between two used ring updates, so that a long burst does
+// not keep the driver waiting for its first interrupt
+constexpr uint64_t kNetBatch = 64;
+// rx packets taken per wakeup, then tx gets its turn
+constexpr uint64_t kNetRxBudget = 256;
+
+VirtioNet::VirtioNet(bus::Bus* bus, std::unique_ptr<net::Backend> backend,
+                     const uint8_t* mac, uint16_t queue_size)
+    : VirtioIoDevice(bus, kNetDeviceId,
+                     kNetFeatureCsum | kNetFeatureGuestCsum | kNetFeatureMac |
+                         kNetFeatureStatus,
+                     2, queue_size),
+      backend_(std::move(backend)),
+      tx_held_(false) {
+  memcpy(config_.mac, mac, kNetMacBytes);
+  config_.status = kNetStatusLinkUp;
+  rx_.push_back({.queue = kNetRxQueue, .chain = {}});
+  StartIo();
+}
+
+VirtioNet::~VirtioNet() { StopIo(); }
+
+bool VirtioNet::ReadConfig(uint64_t offset, uint64_t bytes, uint8_t* buffer) {
+  if (offset + bytes > sizeof(config_)) {
+    return false;
+  }
+  memcpy(buffer, reinterpret_cast<const uint8_t*>(&config_) + offset, bytes);
+  return true;
+}
+
+void VirtioNet::Quiesce() {
+  VirtioIoDevice::Quiesce();
+  tx_held_ = false;
+}
+
+int VirtioNet::PollFds(std::vector<pollfd>* fds) {
+  const short kEvents =
+      (rx_[0].starved ? 0 : POLLIN) | (tx_held_ ? POLLOUT : 0);
+  fds->push_back({.fd = backend_->GetFd(), .events = kEvents, .revents = 0});
+  return -1;
+}
+
+void VirtioNet::ServeQueues(const std::vector<pollfd>& /*fds*/) {
+  ServeTx();
+  if (!rx_[0].starved) {
+    ServeRx();
+  }
+}
+
+void VirtioNet::ServeTx() {
+  VirtQueue& queue = queues_[kNetTxQueue];
+  if (!queue.IsReady()) {
+    return;
+  }
+
+  uint64_t sent = 0;
+  do {
+    queue.DisableNotify();
+    while (tx_held_ || queue.Pop(&tx_chain_)) {
+      iov_.clear();
+      AppendIov(tx_chain_.readable, 0, tx_chain_.ReadableBytes(), &iov_);
+      if (backend_->Send(iov_.data(), static_cast<int>(iov_.size())) < 0 &&
+          (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        // resumed once the backend has room, no kicks needed until then
+        tx_held_ = true;
+        FlushQueue(kNetTxQueue);
+        return;
+      }
+      // other errors drop the packet, like a nic without a link would
+      tx_held_ = false;
+      queue.Push(tx_chain_.head, 0);
+      if (++sent % kNetBatch == 0) {
+        FlushQueue(kNetTxQueue);
+      }
+    }
+  } while (queue.EnableNotify());
+  FlushQueue(kNetTxQueue);
+}
+
+void VirtioNet::ServeRx() {
+  VirtQueue& queue = queues_[kNetRxQueue];
+  RxSlot& slot = rx_[0];
+  uint64_t received = 0;
+  // runts and failed reads count too, a flood of them must not keep the
+  // lock either
+  for (uint64_t taken = 0; taken < kNetRxBudget && HoldRx(&slot); taken++) {
+    const Chain& kChain = slot.chain;
+    if (kChain.WritableBytes() < sizeof(NetHdr)) {
+      // too small for any packet, goes back empty
+      queue.Push(kChain.head, 0);
+      slot.held = false;
+      continue;
+    }
+
+    // the header goes through a copy to be fixed up, the frame does not
+    NetHdr hdr;
+    iov_.clear();
+    iov_.push_back({.iov_base = &hdr, .iov_len = sizeof(hdr)});
+    AppendIov(kChain.writable, sizeof(hdr),
+              kChain.WritableBytes() - sizeof(hdr), &iov_);
+    const ssize_t kBytes =
+        backend_->Recv(iov_.data(), static_cast<int>(iov_.size()));
+    if (kBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (kBytes < static_cast<ssize_t>(sizeof(hdr))) {
+      // a runt or a packet too big for the buffers, the chain takes the next
+      continue;
+    }
+
+    hdr.num_buffers = 1;
+    if (!Negotiated(kNetFeatureGuestCsum)) {
+      if (hdr.flags & kNetHdrNeedsCsum) {
+        CompleteCsum(kChain, &hdr, kBytes);
+      }
+      hdr.flags = 0;
+    }
+    kChain.Write(0, reinterpret_cast<const uint8_t*>(&hdr), sizeof(hdr));
+    queue.Push(kChain.head, kBytes);
+    slot.held = false;
+    if (++received % kNetBatch == 0) {
+      FlushQueue(kNetRxQueue);
+    }
+  }
+  FlushQueue(kNetRxQueue);
+}
+
+void VirtioNet::CompleteCsum(const Chain& chain, NetHdr* hdr,
+                             uint64_t bytes) {
+  // offsets are from the start of the frame, behind the header
+  const uint64_t kStart = sizeof(*hdr) + hdr->csum_start;
+  const uint64_t kField = kStart + hdr->csum_offset;
+  if (kField + sizeof(uint16_t) > bytes) {
+    return;
+  }
+
+  // one's complement sum of big endian words, the field holds the pseudo
+  // header sum already
+  uint64_t sum = 0;
+  uint64_t pos = 0;
+  for (const auto& kSegment : chain.writable) {
+    for (uint32_t i = 0; i < kSegment.len && pos < bytes; i++, pos++) {
+      if (pos >= kStart) {
+        sum += (pos - kStart) % 2 ? kSegment.host[i]
+                                  : kSegment.host[i] << 8;
+      }
+    }
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  const uint8_t kCsum[] = {static_cast<uint8_t>(~sum >> 8),
+                           static_cast<uint8_t>(~sum)};
+  chain.Write(kField, kCsum, sizeof(kCsum));
+}
+
+}  // namespace rv64_emulator::device::virtio
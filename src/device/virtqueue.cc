@@ -0,0 +1,276 @@
+#include "device/virtqueue.h"
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "device/bus.h"
+
+namespace rv64_emulator::device::virtio {
+
+// the driver runs on another host thread than async device backends, ring
+// indexes are published with release and read with acquire semantics
+static uint16_t LoadAcquire(const uint16_t* ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void StoreRelease(uint16_t* ptr, uint16_t val) {
+  __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+uint64_t Chain::ReadableBytes() const {
+  uint64_t bytes = 0;
+  for (const auto& kSegment : readable) {
+    bytes += kSegment.len;
+  }
+  return bytes;
+}
+
+uint64_t Chain::WritableBytes() const {
+  uint64_t bytes = 0;
+  for (const auto& kSegment : writable) {
+    bytes += kSegment.len;
+  }
+  return bytes;
+}
+
+uint64_t Chain::Read(uint64_t offset, uint8_t* dst, uint64_t bytes) const {
+  uint64_t done = 0;
+  for (const auto& kSegment : readable) {
+    if (done == bytes) {
+      break;
+    }
+    if (offset >= kSegment.len) {
+      offset -= kSegment.len;
+      continue;
+    }
+    const uint64_t kLen = std::min(kSegment.len - offset, bytes - done);
+    memcpy(dst + done, kSegment.host + offset, kLen);
+    done += kLen;
+    offset = 0;
+  }
+  return done;
+}
+
+uint64_t Chain::Write(uint64_t offset, const uint8_t* src,
+                      uint64_t bytes) const {
+  uint64_t done = 0;
+  for (const auto& kSegment : writable) {
+    if (done == bytes) {
+      break;
+    }
+    if (offset >= kSegment.len) {
+      offset -= kSegment.len;
+      continue;
+    }
+    const uint64_t kLen = std::min(kSegment.len - offset, bytes - done);
+    memcpy(kSegment.host + offset, src + done, kLen);
+    done += kLen;
+    offset = 0;
+  }
+  return done;
+}
+
+void AppendIov(const std::vector<Segment>& segments, uint64_t offset,
+               uint64_t bytes, std::vector<iovec>* iov) {
+  for (const auto& kSegment : segments) {
+    if (bytes == 0) {
+      break;
+    }
+    if (offset >= kSegment.len) {
+      offset -= kSegment.len;
+      continue;
+    }
+    const uint64_t kLen = std::min(kSegment.len - offset, bytes);
+    iov->push_back({.iov_base = kSegment.host + offset, .iov_len = kLen});
+    bytes -= kLen;
+    offset = 0;
+  }
+}
+
+VirtQueue::VirtQueue(uint16_t max_size) : max_size_(max_size) { Reset(); }
+
+void VirtQueue::Reset() {
+  size_ = max_size_;
+  desc_addr_ = 0;
+  driver_addr_ = 0;
+  device_addr_ = 0;
+  ready_ = false;
+  event_idx_ = false;
+  bus_ = nullptr;
+  desc_ = nullptr;
+  avail_ = nullptr;
+  used_flags_ = nullptr;
+  used_idx_ = nullptr;
+  used_ring_ = nullptr;
+  avail_event_ = nullptr;
+  last_avail_ = 0;
+  next_used_ = 0;
+  signalled_used_ = 0;
+}
+
+bool VirtQueue::Enable(bus::Bus* bus, bool event_idx) {
+  // split queue sizes are powers of 2
+  if (size_ == 0 || size_ > max_size_ || (size_ & (size_ - 1))) {
+    return false;
+  }
+
+  auto* desc = bus->GetHostPtr(desc_addr_, sizeof(VirtqDesc) * size_);
+  auto* avail = bus->GetHostPtr(driver_addr_, sizeof(uint16_t) * (3 + size_));
+  auto* used = bus->GetHostPtr(
+      device_addr_, sizeof(uint16_t) * 3 + sizeof(VirtqUsedElem) * size_);
+  if (!desc || !avail || !used) {
+    return false;
+  }
+
+  bus_ = bus;
+  event_idx_ = event_idx;
+  desc_ = reinterpret_cast<VirtqDesc*>(desc);
+  avail_ = reinterpret_cast<uint16_t*>(avail);
+  used_flags_ = reinterpret_cast<uint16_t*>(used);
+  used_idx_ = used_flags_ + 1;
+  used_ring_ = reinterpret_cast<VirtqUsedElem*>(used_flags_ + 2);
+  avail_event_ = reinterpret_cast<uint16_t*>(used_ring_ + size_);
+  last_avail_ = 0;
+  next_used_ = 0;
+  signalled_used_ = 0;
+  ready_ = true;
+  return true;
+}
+
+uint16_t VirtQueue::AvailIdx() const { return LoadAcquire(avail_ + 1); }
+
+bool VirtQueue::Pop(Chain* chain) {
+  if (!ready_) {
+    return false;
+  }
+
+  while (last_avail_ != AvailIdx()) {
+    const uint16_t kHead = avail_[2 + last_avail_ % size_];
+    last_avail_++;
+    if (Walk(kHead, chain)) {
+      return true;
+    }
+    Push(kHead, 0);
+  }
+  return false;
+}
+
+bool VirtQueue::AddSegment(const VirtqDesc& desc, Chain* chain) {
+  if (desc.len == 0) {
+    return true;
+  }
+  uint8_t* host = bus_->GetHostPtr(desc.addr, desc.len);
+  if (!host) {
+    return false;
+  }
+  auto& segments =
+      (desc.flags & kDescFlagWrite) ? chain->writable : chain->readable;
+  segments.push_back({.host = host, .len = desc.len});
+  return true;
+}
+
+bool VirtQueue::Walk(uint16_t head, Chain* chain) {
+  chain->head = head;
+  chain->readable.clear();
+  chain->writable.clear();
+
+  // a chain visits each descriptor at most once, more means a loop
+  uint16_t index = head;
+  for (uint32_t visited = 0; visited < size_; visited++) {
+    if (index >= size_) {
+      return false;
+    }
+    const VirtqDesc kDesc = desc_[index];
+
+    if (kDesc.flags & kDescFlagIndirect) {
+      // the whole chain lives in the indirect table
+      const uint32_t kNum = kDesc.len / sizeof(VirtqDesc);
+      const auto* table = reinterpret_cast<const VirtqDesc*>(
+          bus_->GetHostPtr(kDesc.addr, kDesc.len));
+      if (!table || kNum == 0 || (kDesc.flags & kDescFlagNext)) {
+        return false;
+      }
+      uint32_t sub = 0;
+      for (uint32_t i = 0; i < kNum; i++) {
+        const VirtqDesc kSubDesc = table[sub];
+        if ((kSubDesc.flags & kDescFlagIndirect) ||
+            !AddSegment(kSubDesc, chain)) {
+          return false;
+        }
+        if (!(kSubDesc.flags & kDescFlagNext)) {
+          return true;
+        }
+        sub = kSubDesc.next;
+        if (sub >= kNum) {
+          return false;
+        }
+      }
+      return false;
+    }
+
+    if (!AddSegment(kDesc, chain)) {
+      return false;
+    }
+    if (!(kDesc.flags & kDescFlagNext)) {
+      return true;
+    }
+    index = kDesc.next;
+  }
+  return false;
+}
+
+void VirtQueue::Push(uint16_t head, uint32_t written) {
+  VirtqUsedElem& elem = used_ring_[next_used_ % size_];
+  elem.id = head;
+  elem.len = written;
+  next_used_++;
+}
+
+bool VirtQueue::Flush() {
+  if (!ready_ || next_used_ == signalled_used_) {
+    return false;
+  }
+
+  const uint16_t kOld = signalled_used_;
+  const uint16_t kNew = next_used_;
+  StoreRelease(used_idx_, kNew);
+  signalled_used_ = kNew;
+  // the used index has to be visible before the driver's wishes are read
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if (event_idx_) {
+    // interrupt once the driver's used_event is crossed by this batch
+    const uint16_t kUsedEvent = LoadAcquire(avail_ + 2 + size_);
+    return static_cast<uint16_t>(kNew - kUsedEvent - 1) <
+           static_cast<uint16_t>(kNew - kOld);
+  }
+  return !(LoadAcquire(avail_) & kAvailFlagNoInterrupt);
+}
+
+void VirtQueue::DisableNotify() {
+  if (ready_ && !event_idx_) {
+    StoreRelease(used_flags_, kUsedFlagNoNotify);
+  }
+}
+
+bool VirtQueue::EnableNotify() {
+  if (!ready_) {
+    return false;
+  }
+  if (event_idx_) {
+    // notify once anything beyond what was consumed so far is added
+    StoreRelease(avail_event_, last_avail_);
+  } else {
+    StoreRelease(used_flags_, 0);
+  }
+  // the driver may have added chains before it could see the update
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return AvailIdx() != last_avail_;
+}
+
+}  // namespace rv64_emulator::device::virtio
@@ -92,16 +92,43 @@ asmjit::arm::Mem __attribute__((always_inline)) XRegToMem(uint32_t rv_reg) {
   return asmjit::arm::ptr(asmjit::a64::regs::x29, kXregBias + (rv_reg << 3));
 }
 
+template <typename T>
+uint64_t MmuLoadAs(cpu::CPU* p, uint64_t addr, cpu::trap::Trap* t) {
+  T val = 0;
+  *t = p->Load(addr, &val);
+  return val;
+}
+
 uint64_t MmuLoad(cpu::CPU* p, uint64_t addr, uint64_t size,
                  cpu::trap::Trap* t) {
-  uint64_t val = 0;
-  *t = p->Load(addr, size, reinterpret_cast<uint8_t*>(&val));
-  return val;
+  switch (size) {
+    case sizeof(uint8_t):
+      return MmuLoadAs<uint8_t>(p, addr, t);
+    case sizeof(uint16_t):
+      return MmuLoadAs<uint16_t>(p, addr, t);
+    case sizeof(uint32_t):
+      return MmuLoadAs<uint32_t>(p, addr, t);
+    default:
+      return MmuLoadAs<uint64_t>(p, addr, t);
+  }
 }
 
 void MmuStore(cpu::CPU* p, uint64_t addr, uint64_t size, uint64_t data,
               cpu::trap::Trap* t) {
-  *t = p->Store(addr, size, reinterpret_cast<const uint8_t*>(&data));
+  switch (size) {
+    case sizeof(uint8_t):
+      *t = p->Store<uint8_t>(addr, data);
+      break;
+    case sizeof(uint16_t):
+      *t = p->Store<uint16_t>(addr, data);
+      break;
+    case sizeof(uint32_t):
+      *t = p->Store<uint32_t>(addr, data);
+      break;
+    default:
+      *t = p->Store<uint64_t>(addr, data);
+      break;
+  }
 }
 
 void JitEmitter::SaveVolatileA64Reg() {
@@ -0,0 +1,302 @@
+#include "libs/fdt.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fmt/core.h"
+
+namespace rv64_emulator::libs::fdt {
+
+constexpr uint32_t kMagic = 0xd00dfeed;
+constexpr uint32_t kHeaderBytes = 40;
+constexpr uint32_t kVersion = 17;
+constexpr uint32_t kLastCompVersion = 16;
+
+constexpr uint32_t kBeginNode = 1;
+constexpr uint32_t kEndNode = 2;
+constexpr uint32_t kProp = 3;
+constexpr uint32_t kNop = 4;
+constexpr uint32_t kEnd = 9;
+
+// header words, in the order they are laid out
+enum HeaderWord {
+  kHdrMagic = 0,
+  kHdrTotalSize,
+  kHdrOffStruct,
+  kHdrOffStrings,
+  kHdrOffMemRsvMap,
+  kHdrVersion,
+  kHdrLastCompVersion,
+  kHdrBootCpuId,
+  kHdrSizeStrings,
+  kHdrSizeStruct,
+};
+
+static uint32_t ReadBe32(const uint8_t* ptr) {
+  return static_cast<uint32_t>(ptr[0]) << 24 |
+         static_cast<uint32_t>(ptr[1]) << 16 |
+         static_cast<uint32_t>(ptr[2]) << 8 | static_cast<uint32_t>(ptr[3]);
+}
+
+static void AppendBe32(std::vector<uint8_t>* out, uint32_t val) {
+  const uint8_t kBytes[] = {
+      static_cast<uint8_t>(val >> 24), static_cast<uint8_t>(val >> 16),
+      static_cast<uint8_t>(val >> 8), static_cast<uint8_t>(val)};
+  out->insert(out->end(), kBytes, kBytes + sizeof(kBytes));
+}
+
+static void AppendPadded(std::vector<uint8_t>* out, const void* data,
+                         uint32_t len) {
+  const auto* kData = static_cast<const uint8_t*>(data);
+  out->insert(out->end(), kData, kData + len);
+  out->resize((out->size() + 3) & ~3ULL, 0);
+}
+
+static uint32_t Align4(uint32_t len) { return (len + 3) & ~3U; }
+
+static bool IsMemoryNode(const char* name) {
+  return strcmp(name, "memory") == 0 || strncmp(name, "memory@", 7) == 0;
+}
+
+class Writer {
+ public:
+  explicit Writer(std::string strings) : strings_(std::move(strings)) {}
+
+  void BeginNode(const char* name) {
+    AppendBe32(&structs_, kBeginNode);
+    AppendPadded(&structs_, name, strlen(name) + 1);
+  }
+
+  void EndNode() { AppendBe32(&structs_, kEndNode); }
+
+  void Prop(uint32_t name_off, const void* value, uint32_t len) {
+    AppendBe32(&structs_, kProp);
+    AppendBe32(&structs_, len);
+    AppendBe32(&structs_, name_off);
+    AppendPadded(&structs_, value, len);
+  }
+
+  void Prop(const char* name, const void* value, uint32_t len) {
+    Prop(StringOffset(name), value, len);
+  }
+
+  void Reg(const std::vector<MemoryRegion>& regions) {
+    std::vector<uint8_t> cells;
+    for (const auto& kRegion : regions) {
+      AppendBe32(&cells, kRegion.base >> 32);
+      AppendBe32(&cells, kRegion.base);
+      AppendBe32(&cells, kRegion.size >> 32);
+      AppendBe32(&cells, kRegion.size);
+    }
+    Prop("reg", cells.data(), cells.size());
+  }
+
+  void End() { AppendBe32(&structs_, kEnd); }
+
+  const std::vector<uint8_t>& Structs() const { return structs_; }
+  const std::string& Strings() const { return strings_; }
+
+ private:
+  std::vector<uint8_t> structs_;
+  std::string strings_;
+
+  // names sharing a suffix share the bytes as well
+  uint32_t StringOffset(const char* name) {
+    const std::string kKey(name, strlen(name) + 1);
+    const size_t kPos = strings_.find(kKey);
+    if (kPos != std::string::npos) {
+      return kPos;
+    }
+    strings_.append(kKey);
+    return strings_.size() - kKey.size();
+  }
+};
+
+bool SetMemory(const std::vector<uint8_t>& dtb,
+               const std::vector<MemoryRegion>& regions,
+               std::vector<uint8_t>* out) {
+  if (dtb.size() < kHeaderBytes || regions.empty()) {
+    return false;
+  }
+  auto header = [&dtb](HeaderWord word) {
+    return ReadBe32(dtb.data() + word * sizeof(uint32_t));
+  };
+  const uint32_t kTotalSize = header(kHdrTotalSize);
+  const uint32_t kOffStruct = header(kHdrOffStruct);
+  const uint32_t kOffStrings = header(kHdrOffStrings);
+  const uint32_t kOffMemRsvMap = header(kHdrOffMemRsvMap);
+  const uint32_t kSizeStrings = header(kHdrSizeStrings);
+  const uint32_t kSizeStruct = header(kHdrSizeStruct);
+  if (header(kHdrMagic) != kMagic || header(kHdrVersion) < kVersion ||
+      kTotalSize > dtb.size() || kOffStruct > kTotalSize ||
+      kSizeStruct > kTotalSize - kOffStruct || kOffStrings > kTotalSize ||
+      kSizeStrings > kTotalSize - kOffStrings || kOffMemRsvMap > kTotalSize) {
+    return false;
+  }
+
+  // the reservation map runs up to and including an all zero entry
+  uint32_t rsv_bytes = 0;
+  while (true) {
+    if (kOffMemRsvMap + rsv_bytes + 16 > kTotalSize) {
+      return false;
+    }
+    const uint8_t* kEntry = dtb.data() + kOffMemRsvMap + rsv_bytes;
+    rsv_bytes += 16;
+    if (std::all_of(kEntry, kEntry + 16, [](uint8_t b) { return b == 0; })) {
+      break;
+    }
+  }
+
+  const uint8_t* kStructs = dtb.data() + kOffStruct;
+  const char* kStrings = reinterpret_cast<const char*>(dtb.data()) + kOffStrings;
+  Writer writer(std::string(kStrings, kSizeStrings));
+
+  // the root defaults, as in the devicetree spec
+  uint32_t address_cells = 2;
+  uint32_t size_cells = 1;
+  const std::string kMemoryName = fmt::format("memory@{:x}", regions[0].base);
+  const char kDeviceType[] = "memory";
+
+  uint32_t pos = 0;
+  uint32_t depth = 0;
+  // depth of a dropped memory node still being skipped, 0 when none
+  uint32_t skip_depth = 0;
+  bool in_memory = false;
+  bool memory_done = false;
+  bool reg_done = false;
+  bool end = false;
+  while (!end) {
+    if (pos + sizeof(uint32_t) > kSizeStruct) {
+      return false;
+    }
+    const uint32_t kToken = ReadBe32(kStructs + pos);
+    pos += sizeof(uint32_t);
+
+    switch (kToken) {
+      case kBeginNode: {
+        const char* kName = reinterpret_cast<const char*>(kStructs + pos);
+        const uint32_t kLen = strnlen(kName, kSizeStruct - pos);
+        if (kLen == kSizeStruct - pos) {
+          return false;
+        }
+        pos += Align4(kLen + 1);
+        depth++;
+        if (skip_depth) {
+          skip_depth++;
+        } else if (depth == 2 && IsMemoryNode(kName)) {
+          if (memory_done) {
+            skip_depth = 1;
+          } else if (address_cells != 2 || size_cells != 2) {
+            return false;
+          } else {
+            memory_done = true;
+            in_memory = true;
+            writer.BeginNode(kMemoryName.c_str());
+          }
+        } else {
+          writer.BeginNode(kName);
+        }
+        break;
+      }
+      case kEndNode:
+        if (depth == 0) {
+          return false;
+        }
+        if (skip_depth) {
+          skip_depth--;
+          depth--;
+          break;
+        }
+        if (in_memory && depth == 2) {
+          if (!reg_done) {
+            writer.Reg(regions);
+          }
+          in_memory = false;
+        }
+        if (depth == 1 && !memory_done) {
+          if (address_cells != 2 || size_cells != 2) {
+            return false;
+          }
+          writer.BeginNode(kMemoryName.c_str());
+          writer.Prop("device_type", kDeviceType, sizeof(kDeviceType));
+          writer.Reg(regions);
+          writer.EndNode();
+          memory_done = true;
+        }
+        depth--;
+        writer.EndNode();
+        break;
+      case kProp: {
+        if (pos + 2 * sizeof(uint32_t) > kSizeStruct) {
+          return false;
+        }
+        const uint32_t kLen = ReadBe32(kStructs + pos);
+        const uint32_t kNameOff = ReadBe32(kStructs + pos + sizeof(uint32_t));
+        pos += 2 * sizeof(uint32_t);
+        if (kLen > kSizeStruct - pos || kNameOff >= kSizeStrings) {
+          return false;
+        }
+        const uint8_t* kValue = kStructs + pos;
+        pos += Align4(kLen);
+        if (skip_depth) {
+          break;
+        }
+        const char* kName = kStrings + kNameOff;
+        if (depth == 1 && kLen == sizeof(uint32_t)) {
+          if (strcmp(kName, "#address-cells") == 0) {
+            address_cells = ReadBe32(kValue);
+          } else if (strcmp(kName, "#size-cells") == 0) {
+            size_cells = ReadBe32(kValue);
+          }
+        }
+        if (in_memory && depth == 2 && strcmp(kName, "reg") == 0) {
+          writer.Reg(regions);
+          reg_done = true;
+        } else {
+          writer.Prop(kNameOff, kValue, kLen);
+        }
+        break;
+      }
+      case kNop:
+        break;
+      case kEnd:
+        end = true;
+        break;
+      default:
+        return false;
+    }
+  }
+  if (depth != 0 || !memory_done) {
+    return false;
+  }
+  writer.End();
+
+  const auto& kNewStructs = writer.Structs();
+  const auto& kNewStrings = writer.Strings();
+  const uint32_t kNewOffStruct = kHeaderBytes + rsv_bytes;
+  const uint32_t kNewOffStrings = kNewOffStruct + kNewStructs.size();
+  const uint32_t kNewTotalSize = kNewOffStrings + kNewStrings.size();
+
+  out->clear();
+  AppendBe32(out, kMagic);
+  AppendBe32(out, kNewTotalSize);
+  AppendBe32(out, kNewOffStruct);
+  AppendBe32(out, kNewOffStrings);
+  AppendBe32(out, kHeaderBytes);
+  AppendBe32(out, kVersion);
+  AppendBe32(out, kLastCompVersion);
+  AppendBe32(out, header(kHdrBootCpuId));
+  AppendBe32(out, kNewStrings.size());
+  AppendBe32(out, kNewStructs.size());
+  out->insert(out->end(), dtb.begin() + kOffMemRsvMap,
+              dtb.begin() + kOffMemRsvMap + rsv_bytes);
+  out->insert(out->end(), kNewStructs.begin(), kNewStructs.end());
+  out->insert(out->end(), kNewStrings.begin(), kNewStrings.end());
+  return true;
+}
+
+}  // namespace rv64_emulator::libs::fdt
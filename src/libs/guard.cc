@@ -0,0 +1,92 @@
+#include "libs/guard.h"
+
+#include <signal.h>
+
+#include <atomic>
+#include <csetjmp>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+namespace rv64_emulator::libs::guard {
+
+constexpr uint64_t kMaxGuardsNum = 16;
+
+using Range = struct Range {
+  std::atomic<uintptr_t> base;
+  std::atomic<uintptr_t> end;
+};
+
+static Range guards[kMaxGuardsNum];
+static std::mutex guards_mutex;
+static struct sigaction old_action;
+static thread_local Recovery* recovery = nullptr;
+
+static bool InGuard(uintptr_t addr) {
+  for (const auto& range : guards) {
+    if (range.base.load(std::memory_order_acquire) <= addr &&
+        addr < range.end.load(std::memory_order_acquire)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void SegvHandler(int /*sig*/, siginfo_t* info, void* /*ctx*/) {
+  const auto kAddr = reinterpret_cast<uintptr_t>(info->si_addr);
+  if (recovery && InGuard(kAddr)) {
+    recovery->fault_addr = kAddr;
+    siglongjmp(recovery->env, 1);
+  }
+
+  // not ours, the faulting access is replayed under the old action
+  sigaction(SIGSEGV, &old_action, nullptr);
+}
+
+static bool InstallHandler() {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = SegvHandler;
+  // the handler is left with siglongjmp and the signal mask is not saved,
+  // so SIGSEGV must not stay blocked afterwards
+  action.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&action.sa_mask);
+  return sigaction(SIGSEGV, &action, &old_action) == 0;
+}
+
+bool AddGuard(const void* base, uint64_t size) {
+  static const bool kInstalled = InstallHandler();
+  if (!kInstalled) {
+    return false;
+  }
+
+  const std::lock_guard<std::mutex> kLock(guards_mutex);
+  for (auto& range : guards) {
+    if (range.end.load(std::memory_order_relaxed) == 0) {
+      const auto kBase = reinterpret_cast<uintptr_t>(base);
+      range.base.store(kBase, std::memory_order_release);
+      range.end.store(kBase + size, std::memory_order_release);
+      return true;
+    }
+  }
+  return false;
+}
+
+void RemoveGuard(const void* base) {
+  const std::lock_guard<std::mutex> kLock(guards_mutex);
+  for (auto& range : guards) {
+    if (range.base.load(std::memory_order_relaxed) ==
+        reinterpret_cast<uintptr_t>(base)) {
+      range.end.store(0, std::memory_order_release);
+      range.base.store(0, std::memory_order_release);
+    }
+  }
+}
+
+Recovery* SetRecovery(Recovery* rec) {
+  Recovery* prev = recovery;
+  recovery = rec;
+  return prev;
+}
+
+}  // namespace rv64_emulator::libs::guard
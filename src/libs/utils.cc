@@ -12,6 +12,7 @@
 #include "cpu/cpu.h"
 #include "cpu/csr.h"
 #include "cpu/trap.h"
+#include "device/bus.h"
 #include "elfio/elfio.hpp"
 #include "error_code.h"
 #include "fmt/core.h"
@@ -20,7 +21,7 @@ namespace rv64_emulator::libs::util {
 
 using cpu::CPU;
 
-void LoadElf(const ELFIO::elfio& reader, CPU* cpu) {
+void LoadElf(const ELFIO::elfio& reader, device::bus::Bus* bus) {
   std::string err_msg = reader.validate();
   if (!err_msg.empty()) {
     fmt::print("Error occurs while loading elf: {}\n", err_msg);
@@ -38,14 +39,17 @@ void LoadElf(const ELFIO::elfio& reader, CPU* cpu) {
 
     const ELFIO::Elf_Xword kSegFileSize = segment->get_file_size();
     const ELFIO::Elf_Xword kSegMemize = segment->get_memory_size();
-    const ELFIO::Elf_Xword kSegAddr = segment->get_virtual_address();
-
-    char const* bytes = segment->get_data();
-    for (ELFIO::Elf_Xword i = kSegAddr; i < kSegAddr + kSegMemize; i++) {
-      const uint8_t kVal =
-          i < kSegAddr + kSegFileSize ? bytes[i - kSegAddr] : 0;
-      cpu->Store(i, sizeof(uint8_t), &kVal);
+    const ELFIO::Elf_Xword kSegAddr = segment->get_physical_address();
+
+    uint8_t* host = bus->GetHostPtr(kSegAddr, kSegMemize);
+    if (!host) {
+      fmt::print("Error occurs while loading elf: segment {:#x} not in RAM\n",
+                 kSegAddr);
+      exit(static_cast<int>(
+          rv64_emulator::errorcode::ElfErrorCode::kInvalidFile));
     }
+    memcpy(host, segment->get_data(), kSegFileSize);
+    memset(host + kSegFileSize, 0, kSegMemize - kSegFileSize);
   }
 }
 
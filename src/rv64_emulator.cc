@@ -1,40 +1,147 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <iterator>
 #include <memory>
+#include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "conf.h"
 #include "cpu/cpu.h"
 #include "cpu/mmu.h"
+#include "device/block.h"
 #include "device/bus.h"
 #include "device/clint.h"
 #include "device/dram.h"
 #include "device/mmio.hpp"
+#include "device/net.h"
 #include "device/plic.h"
+#include "device/scheduler.h"
 #include "device/uart.h"
+#include "device/virtio.h"
+#include "device/virtio_blk.h"
+#include "device/virtio_console.h"
+#include "device/virtio_net.h"
 #include "fmt/core.h"
+#include "libs/fdt.h"
 #include "libs/utils.h"
 
+// the dtb scripts/build_kernel.sh builds along with the firmware, taken when
+// -t does not name one
+constexpr char kDefaultDtb[] = "build/kernel/rv64_emulator.dtb";
+
+// guest console output is written once a line is complete or when it has
+// been pending for this long, instead of once per char
+constexpr auto kConsoleFlushInterval = std::chrono::milliseconds(20);
+
 bool delay_cr = false;
-bool send_ctrl_c = false;
+// ctrl-c is handed from the signal handler to the input thread, which stays
+// the only producer of the uart rx buffer
+int ctrl_c_pipe[2];
+rv64_emulator::cpu::CPU* running_cpu = nullptr;
+
+// The hvc pipe does not block. Once a guest that does not read the port has
+// filled it, further typing is dropped like on a full uart fifo, waiting for
+// room would stall the input thread and ctrl-c with it.
+void WriteHvc(int hvc_in, const char* buf, uint64_t bytes) {
+  uint64_t done = 0;
+  while (done < bytes) {
+    const ssize_t kWritten = write(hvc_in, buf + done, bytes - done);
+    if (kWritten >= 0) {
+      done += kWritten;
+    } else if (errno == EAGAIN) {
+      return;
+    } else if (errno != EINTR) {
+      fmt::print("failed to pass input to the console port: {}\n",
+                 strerror(errno));
+      return;
+    }
+  }
+}
 
-void UartInput(rv64_emulator::device::uart::Uart* uart) {
+// with a console port on the terminal the typing goes to the port, through
+// hvc_in, instead of the uart
+void UartInput(rv64_emulator::device::uart::Uart* uart, int hvc_in) {
   termios tmp;
   tcgetattr(STDIN_FILENO, &tmp);
   tmp.c_lflag &= (~ICANON & ~ECHO);
   tcsetattr(STDIN_FILENO, TCSANOW, &tmp);
+
+  pollfd fds[] = {
+      {.fd = STDIN_FILENO, .events = POLLIN, .revents = 0},
+      {.fd = ctrl_c_pipe[0], .events = POLLIN, .revents = 0},
+  };
   while (true) {
-    char c = getchar();
-    if (c == 10) {
-      c = 13;
+    if (poll(fds, std::size(fds), -1) <= 0) {
+      continue;
+    }
+    for (auto& fd : fds) {
+      if (!fd.revents) {
+        continue;
+      }
+      char c = 0;
+      const ssize_t kRead = read(fd.fd, &c, sizeof(c));
+      if (kRead < 0 && (errno == EINTR || errno == EAGAIN)) {
+        continue;
+      }
+      if (kRead != 1) {
+        // stdin hit its end or hung up, poll would report it forever. A
+        // negative fd is left out, ctrl-c keeps working.
+        fd.fd = -1;
+        continue;
+      }
+      c = c == '\n' ? '\r' : c;
+      if (hvc_in >= 0) {
+        WriteHvc(hvc_in, &c, sizeof(c));
+      } else {
+        uart->Putc(c);
+      }
+    }
+  }
+}
+
+// moves the pending guest output to out, returns whether a line got completed
+bool DrainConsole(rv64_emulator::device::uart::Uart* uart, std::string* out) {
+  bool line_end = false;
+  while (uart->TxBufferNotEmpty()) {
+    const char kCh = uart->Getc();
+    if (kCh == '\r') {
+      delay_cr = true;
+      continue;
+    }
+    if (delay_cr && kCh != '\n') {
+      out->push_back('\r');
+    }
+    out->push_back(kCh);
+    delay_cr = false;
+    line_end |= kCh == '\n';
+  }
+  return line_end;
+}
+
+void FlushConsole(std::string* out) {
+  for (uint64_t done = 0; done < out->size();) {
+    const ssize_t kWritten =
+        write(STDOUT_FILENO, out->data() + done, out->size() - done);
+    if (kWritten < 0 && errno != EINTR) {
+      break;
     }
-    uart->Putc(c);
+    done += kWritten > 0 ? kWritten : 0;
   }
+  out->clear();
 }
 
 void SigintHangler(int x) {
@@ -43,7 +150,20 @@ void SigintHangler(int x) {
     exit(0);
   }
   last_time = time(nullptr);
-  send_ctrl_c = true;
+  const int kErrno = errno;
+  const char kCtrlC = 3;
+  ssize_t written = 0;
+  do {
+    written = write(ctrl_c_pipe[1], &kCtrlC, sizeof(kCtrlC));
+  } while (written < 0 && errno == EINTR);
+  if (written != sizeof(kCtrlC)) {
+    // the guest can not be interrupted, quit like a second ctrl-c would
+    exit(0);
+  }
+  errno = kErrno;
+  if (running_cpu) {
+    running_cpu->RaiseEvent(rv64_emulator::cpu::kEventHost);
+  }
 }
 
 std::unique_ptr<rv64_emulator::cpu::CPU> MakeCPU(
@@ -53,76 +173,573 @@ std::unique_ptr<rv64_emulator::cpu::CPU> MakeCPU(
   return std::make_unique<rv64_emulator::cpu::CPU>(std::move(mmu));
 }
 
+using RamRegion = rv64_emulator::libs::fdt::MemoryRegion;
+
+// Writes dtb with its memory node describing regions to the end of the first
+// region, where the boot image does not reach, and returns its guest address.
+// The firmware finds it in a1.
+uint64_t PlaceDtb(const char* path, const std::vector<RamRegion>& regions,
+                  uint64_t image_bytes, rv64_emulator::device::bus::Bus* bus) {
+  std::vector<uint8_t> dtb;
+  const int kFd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (kFd >= 0 && fstat(kFd, &st) == 0) {
+    dtb.resize(st.st_size);
+    if (read(kFd, dtb.data(), dtb.size()) != st.st_size) {
+      dtb.clear();
+    }
+  }
+  if (kFd >= 0) {
+    close(kFd);
+  }
+
+  std::vector<uint8_t> patched;
+  if (dtb.empty() ||
+      !rv64_emulator::libs::fdt::SetMemory(dtb, regions, &patched)) {
+    return 0;
+  }
+
+  const RamRegion& kFirst = regions.front();
+  if (patched.size() + image_bytes > kFirst.size) {
+    return 0;
+  }
+  const uint64_t kAddr = (kFirst.base + kFirst.size - patched.size()) & ~7ULL;
+  if (kAddr < kFirst.base + image_bytes ||
+      !bus->Store(kAddr, patched.size(), patched.data())) {
+    return 0;
+  }
+  return kAddr;
+}
+
+using DiskImage = struct DiskImage {
+  std::string path;
+  bool read_only;
+  // writes go to an overlay of the image, a temporary one if overlay is empty
+  bool cow;
+  std::string overlay;
+};
+
+// image[,ro|,cow[=overlay]]
+bool ParseDisk(const char* arg, DiskImage* disk) {
+  const char* kOpt = strchr(arg, ',');
+  disk->path.assign(arg, kOpt ? kOpt - arg : strlen(arg));
+  disk->read_only = false;
+  disk->cow = false;
+  disk->overlay.clear();
+  if (!kOpt) {
+    return !disk->path.empty();
+  }
+  if (strcmp(kOpt, ",ro") == 0) {
+    disk->read_only = true;
+  } else if (strcmp(kOpt, ",cow") == 0) {
+    disk->cow = true;
+  } else if (strncmp(kOpt, ",cow=", 5) == 0 && kOpt[5] != '\0') {
+    disk->cow = true;
+    disk->overlay = kOpt + 5;
+  } else {
+    return false;
+  }
+  return !disk->path.empty();
+}
+
+std::unique_ptr<rv64_emulator::device::block::Backend> OpenDisk(
+    const DiskImage& disk) {
+  if (disk.cow) {
+    auto image = std::make_unique<rv64_emulator::device::block::CowImage>();
+    if (!image->Open(disk.path.c_str(), disk.overlay.c_str())) {
+      return nullptr;
+    }
+    return image;
+  }
+  auto image = std::make_unique<rv64_emulator::device::block::RawImage>();
+  if (!image->Open(disk.path.c_str(), disk.read_only)) {
+    return nullptr;
+  }
+  return image;
+}
+
+using NetLink = struct NetLink {
+  // a tap interface name, or the two unix socket paths
+  bool tap;
+  std::string local;
+  std::string peer;
+};
+
+// tap:ifname or unix:local:peer
+bool ParseNet(const char* arg, NetLink* link) {
+  if (strncmp(arg, "tap:", 4) == 0) {
+    link->tap = true;
+    link->local = arg + 4;
+    link->peer.clear();
+    return !link->local.empty();
+  }
+  const char* kPeer = strncmp(arg, "unix:", 5) == 0 ? strchr(arg + 5, ':')
+                                                     : nullptr;
+  if (!kPeer) {
+    return false;
+  }
+  link->tap = false;
+  link->local.assign(arg + 5, kPeer - arg - 5);
+  link->peer = kPeer + 1;
+  return !link->local.empty() && !link->peer.empty();
+}
+
+std::unique_ptr<rv64_emulator::device::net::Backend> OpenNet(
+    const NetLink& link) {
+  if (link.tap) {
+    auto tap = std::make_unique<rv64_emulator::device::net::Tap>();
+    if (!tap->Open(link.local.c_str())) {
+      return nullptr;
+    }
+    return tap;
+  }
+  auto socket = std::make_unique<rv64_emulator::device::net::DatagramSocket>();
+  if (!socket->Open(link.local.c_str(), link.peer.c_str())) {
+    return nullptr;
+  }
+  return socket;
+}
+
+// a locally administered qemu style address, stable for the same endpoint so
+// the guest keeps its leases across runs
+void MakeMac(const NetLink& link, uint8_t* mac) {
+  uint32_t hash = 2166136261U;
+  for (const char kChar : link.local) {
+    hash = (hash ^ static_cast<uint8_t>(kChar)) * 16777619U;
+  }
+  const uint8_t kMac[] = {0x52,
+                          0x54,
+                          0x00,
+                          static_cast<uint8_t>(hash >> 16),
+                          static_cast<uint8_t>(hash >> 8),
+                          static_cast<uint8_t>(hash)};
+  memcpy(mac, kMac, sizeof(kMac));
+}
+
+using ConsoleLink = struct ConsoleLink {
+  // the console port sits on the terminal, the others on host files
+  bool console;
+  std::string name;
+  std::string out;
+  std::string in;
+};
+
+// console or name:out[:in]
+bool ParseConsole(const char* arg, ConsoleLink* link) {
+  link->console = strcmp(arg, "console") == 0;
+  link->name.clear();
+  link->out.clear();
+  link->in.clear();
+  if (link->console) {
+    return true;
+  }
+  const char* kOut = strchr(arg, ':');
+  if (!kOut) {
+    return false;
+  }
+  const char* kIn = strchr(kOut + 1, ':');
+  link->name.assign(arg, kOut - arg);
+  link->out.assign(kOut + 1, kIn ? kIn - kOut - 1 : strlen(kOut + 1));
+  if (kIn) {
+    link->in = kIn + 1;
+  }
+  return !link->name.empty() && !link->out.empty() && (!kIn || kIn[1]);
+}
+
+// Fifos are opened read write, so that opening the output does not wait for
+// a reader and the input does not end when a writer goes away. Output fds
+// do not block, the device buffers what a slow reader does not take yet.
+bool OpenConsolePort(const ConsoleLink& link,
+                     rv64_emulator::device::virtio::ConsolePort* port) {
+  struct stat st;
+  const bool kOutFifo =
+      stat(link.out.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+  port->name = link.name;
+  port->console = false;
+  port->out_fd = open(
+      link.out.c_str(),
+      (kOutFifo ? O_RDWR : O_WRONLY | O_CREAT | O_APPEND) | O_NONBLOCK |
+          O_CLOEXEC,
+      0644);
+  port->in_fd = -1;
+  if (port->out_fd < 0) {
+    return false;
+  }
+  if (!link.in.empty()) {
+    const bool kInFifo =
+        stat(link.in.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+    port->in_fd =
+        open(link.in.c_str(), (kInFifo ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+  }
+  return link.in.empty() || port->in_fd >= 0;
+}
+
+void Usage(const char* name) {
+  fmt::print(
+      "usage: {} [-b run budget] [-c console|name:out[:in]]... "
+      "[-d disk image[,ro|,cow[=overlay]]]... "
+      "[-e switch|threaded] [-m memory size in MiB[@base]]... "
+      "[-n tap:ifname|unix:local:peer]... [-p thp|2m|1g] [-t dtb file] "
+      "<elf file>\n",
+      name);
+}
+
 int main(int argc, char* argv[]) {
-  if (argc != 2) {
+  auto engine = rv64_emulator::cpu::executor::ExecEngine::kSwitch;
+
+  uint64_t run_budget = kRunBudget;
+  std::vector<RamRegion> ram_regions;
+  std::vector<DiskImage> disks;
+  std::vector<NetLink> links;
+  std::vector<ConsoleLink> consoles;
+  auto backing = rv64_emulator::device::dram::PageBacking::kSmall;
+  const char* dtb_path = nullptr;
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "b:c:d:e:m:n:p:t:")) != -1) {
+    switch (opt) {
+      case 'b':
+        run_budget = strtoull(optarg, nullptr, 0);
+        if (run_budget == 0) {
+          fmt::print("{} error: invalid run budget {}\n", argv[0], optarg);
+          exit(-1);
+        }
+        break;
+      case 'c': {
+        // every -c adds a port to the virtio-console behind the network links
+        ConsoleLink link;
+        if (!ParseConsole(optarg, &link)) {
+          fmt::print("{} error: invalid console port {}\n", argv[0], optarg);
+          exit(-1);
+        }
+        const bool kTaken =
+            link.console && std::any_of(consoles.begin(), consoles.end(),
+                                        [](const ConsoleLink& kLink) {
+                                          return kLink.console;
+                                        });
+        if (kTaken || consoles.size() == kVirtioConsolePorts) {
+          fmt::print("{} error: no free console port for {}\n", argv[0],
+                     optarg);
+          exit(-1);
+        }
+        if (consoles.empty() && disks.size() + links.size() == kVirtioSlots) {
+          fmt::print("{} error: no free virtio slot for {}\n", argv[0],
+                     optarg);
+          exit(-1);
+        }
+        consoles.push_back(std::move(link));
+        break;
+      }
+      case 'd': {
+        // every -d adds a virtio-blk disk, disks take the first virtio slots
+        DiskImage disk;
+        if (!ParseDisk(optarg, &disk)) {
+          fmt::print("{} error: invalid disk {}\n", argv[0], optarg);
+          exit(-1);
+        }
+        if (disks.size() + links.size() + !consoles.empty() == kVirtioSlots) {
+          fmt::print("{} error: no free virtio slot for {}\n", argv[0],
+                     optarg);
+          exit(-1);
+        }
+        disks.push_back(std::move(disk));
+        break;
+      }
+      case 'e':
+        if (strcmp(optarg, "switch") == 0) {
+          engine = rv64_emulator::cpu::executor::ExecEngine::kSwitch;
+        } else if (strcmp(optarg, "threaded") == 0) {
+          engine = rv64_emulator::cpu::executor::ExecEngine::kThreaded;
+        } else {
+          fmt::print("{} error: unknown exec engine {}\n", argv[0], optarg);
+          exit(-1);
+        }
+        break;
+      case 'm': {
+        // every -m adds a RAM region, by default right behind the last one
+        char* end = nullptr;
+        const uint64_t kSize = strtoull(optarg, &end, 0) << 20;
+        uint64_t base = ram_regions.empty() ? kDramBaseAddr
+                                            : ram_regions.back().base +
+                                                  ram_regions.back().size;
+        if (*end == '@') {
+          base = strtoull(end + 1, &end, 0);
+        }
+        if (kSize == 0 || *end != '\0') {
+          fmt::print("{} error: invalid memory region {}\n", argv[0], optarg);
+          exit(-1);
+        }
+        ram_regions.push_back({.base = base, .size = kSize});
+        break;
+      }
+      case 'n': {
+        // every -n adds a virtio-net device in the slots behind the disks
+        NetLink link;
+        if (!ParseNet(optarg, &link)) {
+          fmt::print("{} error: invalid network link {}\n", argv[0], optarg);
+          exit(-1);
+        }
+        if (disks.size() + links.size() + !consoles.empty() == kVirtioSlots) {
+          fmt::print("{} error: no free virtio slot for {}\n", argv[0],
+                     optarg);
+          exit(-1);
+        }
+        links.push_back(std::move(link));
+        break;
+      }
+      case 'p':
+        if (strcmp(optarg, "thp") == 0) {
+          backing = rv64_emulator::device::dram::PageBacking::kTransparent;
+        } else if (strcmp(optarg, "2m") == 0) {
+          backing = rv64_emulator::device::dram::PageBacking::kHuge2M;
+        } else if (strcmp(optarg, "1g") == 0) {
+          backing = rv64_emulator::device::dram::PageBacking::kHuge1G;
+        } else {
+          fmt::print("{} error: unknown page backing {}\n", argv[0], optarg);
+          exit(-1);
+        }
+        break;
+      case 't':
+        // the memory node of the dtb is rewritten to describe the -m regions
+        dtb_path = optarg;
+        break;
+      default:
+        Usage(argv[0]);
+        exit(-1);
+    }
+  }
+
+  if (optind != argc - 1) {
     fmt::print("{} error: no input elf file\n", argv[0]);
+    Usage(argv[0]);
     exit(-1);
   }
 
+  if (pipe(ctrl_c_pipe) != 0) {
+    fmt::print("{} error: failed to create the ctrl-c pipe\n", argv[0]);
+    exit(-1);
+  }
   signal(SIGINT, SigintHangler);
+  // a console port reader going away must not take the emulator down
+  if (!consoles.empty()) {
+    signal(SIGPIPE, SIG_IGN);
+  }
+
+  rv64_emulator::device::scheduler::Scheduler scheduler(run_budget);
+  // Device edges end the current run, the lines are only synced between
+  // runs. Edges raised between runs are picked up anyway, kicking the cpu for
+  // them would only cut the next run short. The kick is in place before the
+  // input and the device io threads start raising edges, running_cpu is set
+  // before the first run.
+  std::atomic<bool> cpu_running(false);
+  scheduler.SetKick([&]() {
+    if (cpu_running.load()) {
+      running_cpu->RaiseEvent(rv64_emulator::cpu::kEventHost);
+    }
+  });
 
-  auto dram =
-      std::make_unique<rv64_emulator::device::dram::DRAM>(kDramSize, argv[1]);
   auto uart = std::make_unique<rv64_emulator::device::uart::Uart>();
   auto clint = std::make_unique<rv64_emulator::device::clint::Clint>(1);
-  auto plic = std::make_unique<rv64_emulator::device::plic::Plic>(1, true, 2);
+  auto plic = std::make_unique<rv64_emulator::device::plic::Plic>(
+      1, true, kPlicDevices);
 
   auto raw_clint = clint.get();
   auto raw_uart = uart.get();
   auto raw_plic = plic.get();
 
+  uart->SetScheduler(&scheduler);
+  clint->SetScheduler(&scheduler);
+  plic->SetScheduler(&scheduler);
+
+  if (ram_regions.empty()) {
+    ram_regions.push_back({.base = kDramBaseAddr, .size = kDramSize});
+  }
+  if (!dtb_path && access(kDefaultDtb, R_OK) == 0) {
+    dtb_path = kDefaultDtb;
+  }
+  // a1 stays 0, only firmware with a built-in dtb boots that way
+  if (!dtb_path) {
+    fmt::print("{} warning: no dtb given with -t and none at {}, the "
+               "firmware has to bring its own and the guest does not learn "
+               "about the -m regions\n",
+               argv[0], kDefaultDtb);
+  }
+
   auto bus = std::make_shared<rv64_emulator::device::bus::Bus>();
-  bus->MountDevice({
+  auto mount = [&](rv64_emulator::device::MmioDeviceNode node) {
+    const uint64_t kBase = node.base;
+    if (!bus->MountDevice(std::move(node))) {
+      fmt::print("{} error: address range at {:#x} overlaps another one\n",
+                 argv[0], kBase);
+      exit(-1);
+    }
+  };
+
+  // RAM takes nearly every access that misses the soft tlb, keep it first in
+  // the device scan. The image goes to the first region, where the hart
+  // starts as well.
+  for (const auto& kRegion : ram_regions) {
+    auto dram =
+        &kRegion == &ram_regions.front()
+            ? std::make_unique<rv64_emulator::device::dram::DRAM>(
+                  kRegion.size, argv[optind], backing)
+            : std::make_unique<rv64_emulator::device::dram::DRAM>(
+                  kRegion.size, backing);
+    if (dram->GetBacking() != backing) {
+      fmt::print("{} warning: requested huge pages are not available at "
+                 "{:#x}, falling back to smaller pages\n",
+                 argv[0], kRegion.base);
+    }
+    mount({
+        .base = kRegion.base,
+        .size = kRegion.size,
+        .dev = std::move(dram),
+    });
+  }
+
+  mount({
       .base = kClintBase,
       .size = kClintAddrSpaceRange,
       .dev = std::move(clint),
   });
-  bus->MountDevice({
+  mount({
       .base = kPlicBase,
       .size = kPlicAddrSpaceRange,
       .dev = std::move(plic),
   });
-  bus->MountDevice({
+  mount({
       .base = kUartBase,
       .size = kUartAddrSpaceRange,
       .dev = std::move(uart),
   });
-  bus->MountDevice({
-      .base = kDramBaseAddr,
-      .size = kDramSize,
-      .dev = std::move(dram),
-  });
 
-  std::thread uart_input_thread(UartInput, raw_uart);
+  std::vector<rv64_emulator::device::virtio::VirtioMmio*> virtio_devs;
+  int hvc_pipe[2] = {-1, -1};
+  for (uint64_t i = 0; i < kVirtioSlots; i++) {
+    std::unique_ptr<rv64_emulator::device::virtio::VirtioMmio> dev;
+    if (i < disks.size()) {
+      auto image = OpenDisk(disks[i]);
+      if (!image) {
+        fmt::print("{} error: failed to open disk image {}: {}\n", argv[0],
+                   disks[i].path, strerror(errno));
+        exit(-1);
+      }
+      dev = std::make_unique<rv64_emulator::device::virtio::VirtioBlk>(
+          bus.get(), std::move(image), kVirtioBlkWorkers,
+          kVirtioBlkQueueSize);
+    } else if (i < disks.size() + links.size()) {
+      const NetLink& kLink = links[i - disks.size()];
+      auto backend = OpenNet(kLink);
+      if (!backend) {
+        fmt::print("{} error: failed to open network link {}: {}\n",
+                   argv[0], kLink.local, strerror(errno));
+        exit(-1);
+      }
+      uint8_t mac[rv64_emulator::device::virtio::kNetMacBytes];
+      MakeMac(kLink, mac);
+      dev = std::make_unique<rv64_emulator::device::virtio::VirtioNet>(
+          bus.get(), std::move(backend), mac, kVirtioNetQueueSize);
+    } else if (i == disks.size() + links.size() && !consoles.empty()) {
+      std::vector<rv64_emulator::device::virtio::ConsolePort> ports;
+      for (const auto& kLink : consoles) {
+        rv64_emulator::device::virtio::ConsolePort port;
+        if (kLink.console) {
+          if (pipe2(hvc_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+            fmt::print("{} error: failed to create the console pipe\n",
+                       argv[0]);
+            exit(-1);
+          }
+          port = {.name = {},
+                  .console = true,
+                  .in_fd = hvc_pipe[0],
+                  .out_fd = STDOUT_FILENO};
+        } else if (!OpenConsolePort(kLink, &port)) {
+          fmt::print("{} error: failed to open console port {}: {}\n",
+                     argv[0], kLink.name, strerror(errno));
+          exit(-1);
+        }
+        ports.push_back(std::move(port));
+      }
+      dev = std::make_unique<rv64_emulator::device::virtio::VirtioConsole>(
+          bus.get(), std::move(ports), kVirtioConsoleQueueSize);
+    } else {
+      dev = std::make_unique<rv64_emulator::device::virtio::VirtioMmio>(
+          bus.get(), 0, 0, 0, 0);
+    }
+    dev->SetScheduler(&scheduler);
+    virtio_devs.push_back(dev.get());
+    mount({
+        .base = kVirtioBase + i * kVirtioAddrSpaceRange,
+        .size = kVirtioAddrSpaceRange,
+        .dev = std::move(dev),
+    });
+  }
+
+  std::thread uart_input_thread(UartInput, raw_uart, hvc_pipe[1]);
 
   auto cpu1 = MakeCPU(bus);
 
-  cpu1->pc_ = kDramBaseAddr;
+  cpu1->pc_ = ram_regions.front().base;
+  if (dtb_path) {
+    struct stat st;
+    const uint64_t kDtbAddr =
+        stat(argv[optind], &st) == 0
+            ? PlaceDtb(dtb_path, ram_regions, st.st_size, bus.get())
+            : 0;
+    if (kDtbAddr == 0) {
+      fmt::print("{} error: failed to place the device tree {}\n", argv[0],
+                 dtb_path);
+      exit(-1);
+    }
+    // a0 holds the hart id, a1 the device tree, as a previous boot stage
+    // would hand them over
+    cpu1->reg_file_.xregs[10] = 0;
+    cpu1->reg_file_.xregs[11] = kDtbAddr;
+  }
+  cpu1->SetExecEngine(engine);
+  cpu1->state_.BindMtimeOffset(raw_clint->GetMtimeOffset());
+  running_cpu = cpu1.get();
+
+  scheduler.RaiseIrq();
 
+  std::string console_out;
+  auto last_console_flush = std::chrono::steady_clock::now();
   while (true) {
-    raw_clint->UpdateMtime();
-    raw_plic->UpdateExt(1, raw_uart->Irq());
-    cpu1->Tick(raw_plic->GetInterrupt(0), raw_plic->GetInterrupt(1),
-               raw_clint->MachineSoftwareIrq(0), raw_clint->MachineTimerIrq(0),
-               true);
-
-    while (raw_uart->TxBufferNotEmpty()) {
-      char ch = raw_uart->Getc();
-      if (ch == '\r') {
-        delay_cr = true;
-      } else {
-        if (delay_cr && ch != '\n') {
-          fmt::print("\r");
-        }
-        fmt::print("{}", ch);
-        fflush(stdout);
-        delay_cr = false;
+    const uint64_t kNow = rv64_emulator::libs::util::ReadGuestTimeStamp();
+    scheduler.RunExpired(kNow);
+    if (scheduler.TakeIrq()) {
+      raw_plic->UpdateExt(1, raw_uart->Irq());
+      for (uint64_t i = 0; i < virtio_devs.size(); i++) {
+        raw_plic->UpdateExt(kVirtioIrqBase + i, virtio_devs[i]->Irq());
+      }
+      cpu1->UpdateIrq(raw_plic->GetInterrupt(0), raw_plic->GetInterrupt(1),
+                      raw_clint->MachineSoftwareIrq(0),
+                      raw_clint->MachineTimerIrq(0));
+    }
+
+    cpu_running.store(true);
+    const uint64_t kRetired = cpu1->Run(scheduler.GetBudget(kNow));
+    cpu_running.store(false);
+    const uint64_t kEnd = rv64_emulator::libs::util::ReadGuestTimeStamp();
+    // a waiting hart retires its whole budget at once, keep it out of the
+    // rate estimate
+    const bool kIdle = cpu1->state_.GetWfi();
+    if (!kIdle) {
+      scheduler.Account(kRetired, kEnd - kNow);
+    }
+
+    const bool kLineEnd = DrainConsole(raw_uart, &console_out);
+    if (!console_out.empty()) {
+      const auto kFlushNow = std::chrono::steady_clock::now();
+      if (kLineEnd || kIdle ||
+          kFlushNow - last_console_flush >= kConsoleFlushInterval) {
+        FlushConsole(&console_out);
+        last_console_flush = kFlushNow;
       }
     }
 
-    if (send_ctrl_c) {
-      raw_uart->Putc(3);
-      send_ctrl_c = false;
+    if (kIdle) {
+      scheduler.WaitIrq(kEnd);
     }
   }
 
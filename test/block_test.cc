@@ -0,0 +1,200 @@
+#include "device/block.h"
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fmt/core.h"
+#include "gtest/gtest.h"
+
+using namespace rv64_emulator::device::block;
+
+// a few clusters and a partial one at the end
+constexpr uint64_t kBaseBytes = (4ULL << kCowClusterBits) + 0x3000;
+
+class CowImageTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    fmt::print("start running CowImage test case...\n");
+  }
+
+  static void TearDownTestSuite() {
+    fmt::print("finish running CowImage test case...\n");
+  }
+
+  void SetUp() override {
+    char base[] = "/tmp/cow_base_XXXXXX";
+    const int kFd = mkstemp(base);
+    ASSERT_GE(kFd, 0);
+    base_ = base;
+    // every 4K page of the base is filled with its page number
+    for (uint64_t i = 0; i < kBaseBytes / 4096; i++) {
+      std::vector<uint8_t> page(4096, i);
+      ASSERT_EQ(pwrite(kFd, page.data(), page.size(), i * 4096), 4096);
+    }
+    close(kFd);
+    overlay_ = base_ + ".cow";
+  }
+
+  void TearDown() override {
+    unlink(base_.c_str());
+    unlink(overlay_.c_str());
+  }
+
+  static bool Read(Backend* image, uint64_t offset, std::vector<uint8_t>* buf) {
+    const iovec kIov = {.iov_base = buf->data(), .iov_len = buf->size()};
+    return image->Read(offset, &kIov, 1);
+  }
+
+  static bool Write(Backend* image, uint64_t offset, uint8_t val,
+                    uint64_t bytes) {
+    std::vector<uint8_t> buf(bytes, val);
+    const iovec kIov = {.iov_base = buf.data(), .iov_len = buf.size()};
+    return image->Write(offset, &kIov, 1);
+  }
+
+  uint8_t BaseByte(uint64_t offset) {
+    RawImage base;
+    EXPECT_TRUE(base.Open(base_.c_str(), true));
+    std::vector<uint8_t> byte(1);
+    EXPECT_TRUE(Read(&base, offset, &byte));
+    return byte[0];
+  }
+
+  std::string base_;
+  std::string overlay_;
+};
+
+TEST_F(CowImageTest, ReadThrough) {
+  CowImage image;
+  ASSERT_TRUE(image.Open(base_.c_str(), overlay_.c_str()));
+  ASSERT_EQ(image.GetSize(), kBaseBytes);
+  ASSERT_FALSE(image.IsReadOnly());
+
+  std::vector<uint8_t> buf(0x3000);
+  ASSERT_TRUE(Read(&image, kBaseBytes - buf.size(), &buf));
+  ASSERT_EQ(buf[0], kBaseBytes / 4096 - 3);
+  ASSERT_EQ(buf.back(), kBaseBytes / 4096 - 1);
+  ASSERT_FALSE(Read(&image, kBaseBytes - buf.size() + 1, &buf));
+
+  // a fresh overlay takes no data blocks
+  struct stat st;
+  ASSERT_EQ(stat(overlay_.c_str(), &st), 0);
+  ASSERT_LE(st.st_blocks * 512, kCowHeaderBytes * 2);
+  ASSERT_EQ(image.GetAllocatedClusters(), 0);
+}
+
+TEST_F(CowImageTest, CopyUp) {
+  const uint64_t kCluster = 1ULL << kCowClusterBits;
+  {
+    CowImage image;
+    ASSERT_TRUE(image.Open(base_.c_str(), overlay_.c_str()));
+    // a partial write keeps the rest of the cluster from the base, a write
+    // across two clusters copies both
+    ASSERT_TRUE(Write(&image, 0x1000, 0xaa, 0x1000));
+    ASSERT_TRUE(Write(&image, 2 * kCluster - 0x800, 0xbb, 0x1000));
+    ASSERT_EQ(image.GetAllocatedClusters(), 3);
+    ASSERT_TRUE(Write(&image, 0x1800, 0xcc, 0x100));
+    ASSERT_EQ(image.GetAllocatedClusters(), 3);
+    ASSERT_TRUE(image.Flush());
+  }
+
+  // the writes are kept by the overlay only
+  CowImage image;
+  ASSERT_TRUE(image.Open(base_.c_str(), overlay_.c_str()));
+  ASSERT_EQ(image.GetAllocatedClusters(), 3);
+  std::vector<uint8_t> buf(2 * kCluster);
+  ASSERT_TRUE(Read(&image, 0, &buf));
+  ASSERT_EQ(buf[0], 0);
+  ASSERT_EQ(buf[0x1000], 0xaa);
+  ASSERT_EQ(buf[0x1800], 0xcc);
+  ASSERT_EQ(buf[0x1900], 0xaa);
+  ASSERT_EQ(buf[0x2000], 2);
+  ASSERT_EQ(buf[kCluster], kCluster / 4096);
+  ASSERT_EQ(buf[2 * kCluster - 0x801], (2 * kCluster - 0x801) / 4096);
+  ASSERT_EQ(buf[2 * kCluster - 0x800], 0xbb);
+  ASSERT_EQ(BaseByte(0x1000), 1);
+
+  std::vector<uint8_t> next(0x1000);
+  ASSERT_TRUE(Read(&image, 2 * kCluster, &next));
+  ASSERT_EQ(next[0x7ff], 0xbb);
+  ASSERT_EQ(next[0x800], 2 * kCluster / 4096);
+}
+
+TEST_F(CowImageTest, DiscardCommit) {
+  CowImage image;
+  ASSERT_TRUE(image.Open(base_.c_str(), overlay_.c_str()));
+  ASSERT_TRUE(Write(&image, 0, 0xaa, 0x1000));
+  ASSERT_TRUE(image.Discard());
+  ASSERT_EQ(image.GetAllocatedClusters(), 0);
+  std::vector<uint8_t> buf(1);
+  ASSERT_TRUE(Read(&image, 0, &buf));
+  ASSERT_EQ(buf[0], 0);
+
+  // the tail cluster is shorter than the others
+  ASSERT_TRUE(Write(&image, kBaseBytes - 0x1000, 0xdd, 0x1000));
+  ASSERT_TRUE(image.Commit());
+  ASSERT_EQ(image.GetAllocatedClusters(), 0);
+  ASSERT_EQ(BaseByte(kBaseBytes - 1), 0xdd);
+  ASSERT_EQ(BaseByte(kBaseBytes - 0x1001), kBaseBytes / 4096 - 2);
+  ASSERT_TRUE(Read(&image, kBaseBytes - 1, &buf));
+  ASSERT_EQ(buf[0], 0xdd);
+}
+
+TEST_F(CowImageTest, Reject) {
+  // a temporary overlay leaves nothing behind
+  CowImage temp;
+  ASSERT_TRUE(temp.Open(base_.c_str(), ""));
+  ASSERT_TRUE(Write(&temp, 0, 0xaa, 0x1000));
+
+  // an overlay of another base, or no overlay at all
+  CowImage image;
+  ASSERT_TRUE(image.Open(base_.c_str(), overlay_.c_str()));
+  ASSERT_TRUE(truncate(base_.c_str(), kBaseBytes - 0x1000) == 0);
+  ASSERT_FALSE(image.Open(base_.c_str(), overlay_.c_str()));
+  ASSERT_FALSE(image.Open(base_.c_str(), base_.c_str()));
+}
+
+TEST_F(CowImageTest, ConcurrentCopyUp) {
+  {
+    CowImage image;
+    ASSERT_TRUE(image.Open(base_.c_str(), overlay_.c_str()));
+
+    // threads writing different sectors of the same clusters all land, each
+    // starts at another cluster so copy-ups of one bitmap word overlap
+    std::vector<std::thread> threads;
+    for (uint64_t i = 0; i < 8; i++) {
+      threads.emplace_back([&image, i]() {
+        for (uint64_t n = 0; n < 4; n++) {
+          const uint64_t kCluster = (i + n) % 4;
+          const uint64_t kOffset = (kCluster << kCowClusterBits) + i * 0x1000;
+          EXPECT_TRUE(Write(&image, kOffset, 0x80 + i, 0x1000));
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    ASSERT_EQ(image.GetAllocatedClusters(), 4);
+  }
+
+  // the bitmap on disk lost no cluster either
+  CowImage image;
+  ASSERT_TRUE(image.Open(base_.c_str(), overlay_.c_str()));
+  ASSERT_EQ(image.GetAllocatedClusters(), 4);
+  std::vector<uint8_t> buf(kBaseBytes);
+  ASSERT_TRUE(Read(&image, 0, &buf));
+  for (uint64_t cluster = 0; cluster < 4; cluster++) {
+    for (uint64_t i = 0; i < 16; i++) {
+      const uint64_t kOffset = (cluster << kCowClusterBits) + i * 0x1000;
+      ASSERT_EQ(buf[kOffset + 0xfff], i < 8 ? 0x80 + i : kOffset / 4096);
+    }
+  }
+}
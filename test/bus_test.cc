@@ -1,6 +1,8 @@
 #include "device/bus.h"
 
+#include <csetjmp>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <utility>
 
@@ -8,6 +10,7 @@
 #include "device/dram.h"
 #include "fmt/core.h"
 #include "gtest/gtest.h"
+#include "libs/guard.h"
 
 class BusTest : public testing::Test {
  protected:
@@ -40,7 +43,7 @@ constexpr uint64_t kArbitrarilyVal = 0x1122334455667788;
 
 TEST_F(BusTest, Load) {
   // bypass the bus and store dram directly
-  uint64_t* raw_data_ptr = reinterpret_cast<uint64_t*>(dram_->memory_.data());
+  uint64_t* raw_data_ptr = reinterpret_cast<uint64_t*>(dram_->memory_);
   *raw_data_ptr = 0x1122334455667788;
 
   // no device mounted
@@ -76,7 +79,7 @@ TEST_F(BusTest, Store) {
 
   // read from dram directly
   const uint64_t* kRawData =
-      reinterpret_cast<uint64_t*>(raw_dram_ptr->memory_.data());
+      reinterpret_cast<uint64_t*>(raw_dram_ptr->memory_);
   uint64_t res = 0;
   ASSERT_TRUE(bus_->Load(kDramBaseAddr, sizeof(uint64_t),
                          reinterpret_cast<uint8_t*>(&res)));
@@ -111,3 +114,107 @@ TEST_F(BusTest, InvalidRange) {
                     reinterpret_cast<const uint8_t*>(&kArbitrarilyVal)));
   }
 }
+
+// only implements the buffer based accesses
+class ScratchDevice : public rv64_emulator::device::MmioDevice {
+ public:
+  bool Load(uint64_t addr, uint64_t bytes, uint8_t* buffer) override {
+    if (addr + bytes > sizeof(reg_)) {
+      return false;
+    }
+    memcpy(buffer, reg_ + addr, bytes);
+    return true;
+  }
+  bool Store(uint64_t addr, uint64_t bytes, const uint8_t* buffer) override {
+    if (addr + bytes > sizeof(reg_)) {
+      return false;
+    }
+    memcpy(reg_ + addr, buffer, bytes);
+    return true;
+  }
+  void Reset() override {}
+
+ private:
+  uint8_t reg_[16] = {0};
+};
+
+TEST_F(BusTest, MultipleRamRegions) {
+  constexpr uint64_t kHighBase = 0x100000000;
+  ASSERT_TRUE(bus_->MountDevice({
+      .base = kDramBaseAddr,
+      .size = kDramSize,
+      .dev = std::move(dram_),
+  }));
+  ASSERT_TRUE(bus_->MountDevice({
+      .base = kHighBase,
+      .size = kDramSize,
+      .dev = std::make_unique<rv64_emulator::device::dram::DRAM>(kDramSize),
+  }));
+
+  // overlapping either end of a mounted region is refused
+  for (const auto kBase : {kDramBaseAddr - 0x1000, kHighBase + kDramSize - 1}) {
+    ASSERT_FALSE(bus_->MountDevice({
+        .base = kBase,
+        .size = 0x2000,
+        .dev = std::make_unique<rv64_emulator::device::dram::DRAM>(0x2000),
+    }));
+  }
+
+  ASSERT_TRUE(bus_->Store<uint64_t>(kDramBaseAddr, 1));
+  ASSERT_TRUE(bus_->Store<uint64_t>(kHighBase, 2));
+  uint64_t low = 0;
+  uint64_t high = 0;
+  ASSERT_TRUE(bus_->Load(kDramBaseAddr, &low));
+  ASSERT_TRUE(bus_->Load(kHighBase, &high));
+  ASSERT_EQ(low, 1);
+  ASSERT_EQ(high, 2);
+  ASSERT_NE(bus_->GetHostPtr(kHighBase, sizeof(uint64_t)),
+            bus_->GetHostPtr(kDramBaseAddr, sizeof(uint64_t)));
+}
+
+TEST_F(BusTest, WidthSpecialized) {
+  constexpr uint64_t kScratchBase = 0x1000;
+  bus_->MountDevice({
+      .base = kDramBaseAddr,
+      .size = kDramSize,
+      .dev = std::move(dram_),
+  });
+  bus_->MountDevice({
+      .base = kScratchBase,
+      .size = 16,
+      .dev = std::make_unique<ScratchDevice>(),
+  });
+
+  for (const uint64_t kBase : {kDramBaseAddr, kScratchBase}) {
+    ASSERT_TRUE(bus_->Store<uint64_t>(kBase, kArbitrarilyVal));
+    ASSERT_TRUE(bus_->Store<uint16_t>(kBase + 8, 0xaabb));
+
+    uint8_t u8 = 0;
+    uint16_t u16 = 0;
+    uint32_t u32 = 0;
+    uint64_t u64 = 0;
+    ASSERT_TRUE(bus_->Load(kBase + 1, &u8));
+    ASSERT_TRUE(bus_->Load(kBase + 2, &u16));
+    ASSERT_TRUE(bus_->Load(kBase + 4, &u32));
+    ASSERT_TRUE(bus_->Load(kBase + 8, &u64));
+    ASSERT_EQ(0x77, u8);
+    ASSERT_EQ(0x5566, u16);
+    ASSERT_EQ(0x11223344, u32);
+    ASSERT_EQ(0xaabb, u64);
+  }
+
+  ASSERT_FALSE(bus_->Store<uint32_t>(kDramBaseAddr - 4, 0));
+
+  // crossing the end of RAM is caught by the guard page instead of a check
+  rv64_emulator::libs::guard::Recovery recovery;
+  auto* const kOuter = rv64_emulator::libs::guard::SetRecovery(&recovery);
+  volatile bool faulted = false;
+  if (sigsetjmp(recovery.env, 0) == 0) {
+    uint64_t res = 0;
+    bus_->Load(kDramBaseAddr + kDramSize - 4, &res);
+  } else {
+    faulted = true;
+  }
+  rv64_emulator::libs::guard::SetRecovery(kOuter);
+  ASSERT_TRUE(faulted);
+}
@@ -5,12 +5,17 @@
 #include <random>
 #include <utility>
 
+#include "conf.h"
+#include "device/scheduler.h"
 #include "fmt/core.h"
 #include "gtest/gtest.h"
 #include "libs/utils.h"
 
 using rv64_emulator::device::clint::Clint;
+using rv64_emulator::device::scheduler::kNoDeadline;
+using rv64_emulator::device::scheduler::Scheduler;
 using rv64_emulator::libs::util::RandomGenerator;
+using rv64_emulator::libs::util::ReadGuestTimeStamp;
 
 class ClintTest : public testing::Test {
  protected:
@@ -86,14 +91,15 @@ TEST_F(ClintTest, LoadMtimeCmp) {
 
 TEST_F(ClintTest, LoadMtime) {
   const uint64_t kRandomNumber = rg.Get();
-  clint_->mtime_ = kRandomNumber;
+  clint_->mtime_offset_ = kRandomNumber - ReadGuestTimeStamp();
 
   constexpr uint64_t kAddrBase = rv64_emulator::device::clint::kMtimeBase;
 
+  // mtime keeps running, it is computed on each read
   uint64_t res = UINT64_MAX;
   ASSERT_TRUE(
       clint_->Load(kAddrBase, sizeof(res), reinterpret_cast<uint8_t*>(&res)));
-  ASSERT_EQ(res, kRandomNumber);
+  ASSERT_LT(res - kRandomNumber, kMtimeFreq);
 
   // out of range
   ASSERT_FALSE(clint_->Load(kAddrBase + sizeof(res) - 1, sizeof(res),
@@ -152,7 +158,7 @@ TEST_F(ClintTest, StoreMtime) {
 
   ASSERT_TRUE(clint_->Store(kAddrBase, sizeof(kRandomNumber),
                             reinterpret_cast<const uint8_t*>(&kRandomNumber)));
-  ASSERT_EQ(clint_->mtime_, kRandomNumber);
+  ASSERT_LT(clint_->GetMtime() - kRandomNumber, kMtimeFreq);
 
   // out of range
   ASSERT_FALSE(clint_->Store(kAddrBase + sizeof(kRandomNumber) - 1,
@@ -162,7 +168,7 @@ TEST_F(ClintTest, StoreMtime) {
 
 TEST_F(ClintTest, Reset) {
   // generate random value
-  clint_->mtime_ = rg.Get();
+  clint_->mtime_offset_ = rg.Get();
   for (uint64_t i = 0; i < clint_->harts_; i++) {
     clint_->msip_[i] = rg.Get();
     clint_->mtimecmp_[i] = rg.Get();
@@ -175,22 +181,24 @@ TEST_F(ClintTest, Reset) {
     ASSERT_EQ(clint_->msip_[i], 0);
     ASSERT_EQ(clint_->mtimecmp_[i], 0);
   }
+  ASSERT_EQ(clint_->mtime_offset_, 0);
 }
 
 TEST_F(ClintTest, Tick) {
   const uint16_t kMax = rg.Get(1, UINT16_MAX);
-  const uint64_t kOrigin = clint_->mtime_;
+  const uint64_t kOrigin = clint_->mtime_offset_;
   for (uint16_t i = 0; i < kMax; i++) {
     clint_->Tick();
   }
-  ASSERT_EQ(clint_->mtime_ - kOrigin, kMax);
+  ASSERT_EQ(clint_->mtime_offset_ - kOrigin, kMax);
 }
 
 TEST_F(ClintTest, TimerIrq) {
   const uint64_t kRandomNumber = rg.Get(UINT8_MAX, UINT16_MAX);
   clint_->mtimecmp_.at(0) = kRandomNumber - 1;
-  clint_->mtimecmp_.at(1) = kRandomNumber + 1;
-  clint_->mtime_ = kRandomNumber;
+  // far enough that mtime does not run past it during the test
+  clint_->mtimecmp_.at(1) = kRandomNumber + kMtimeFreq;
+  clint_->mtime_offset_ = kRandomNumber - ReadGuestTimeStamp();
 
   ASSERT_TRUE(clint_->MachineTimerIrq(0));
   ASSERT_FALSE(clint_->MachineTimerIrq(1));
@@ -208,3 +216,86 @@ TEST_F(ClintTest, SoftwareIrq) {
   ASSERT_TRUE(msip0 || msip1);
   ASSERT_FALSE(msip0 && msip1);
 }
+
+TEST_F(ClintTest, TimerDeadline) {
+  Scheduler scheduler(kRunBudget);
+  clint_->mtimecmp_[0] = UINT64_MAX;
+  clint_->mtimecmp_[1] = UINT64_MAX;
+  clint_->SetScheduler(&scheduler);
+  ASSERT_EQ(scheduler.NextDeadline(), kNoDeadline);
+
+  // the timer irq is due once mtime passes mtimecmp
+  constexpr uint64_t kAddrBase = rv64_emulator::device::clint::kMtimeCmpBase;
+  const uint64_t kMtimeCmp = rg.Get(0, UINT32_MAX);
+  ASSERT_TRUE(clint_->Store(kAddrBase + 8, sizeof(kMtimeCmp),
+                            reinterpret_cast<const uint8_t*>(&kMtimeCmp)));
+  ASSERT_EQ(scheduler.NextDeadline(), kMtimeCmp + 1);
+  // the irq is only raised once the deadline passes
+  ASSERT_FALSE(scheduler.TakeIrq());
+
+  ASSERT_EQ(scheduler.RunExpired(kMtimeCmp), 0);
+  ASSERT_FALSE(scheduler.TakeIrq());
+  ASSERT_EQ(scheduler.RunExpired(kMtimeCmp + 1), 1);
+  ASSERT_TRUE(scheduler.TakeIrq());
+  ASSERT_EQ(scheduler.NextDeadline(), kNoDeadline);
+  ASSERT_TRUE(clint_->MachineTimerIrq(1));
+
+  // a later compare value lowers the pending irq at once
+  constexpr uint64_t kNever = UINT64_MAX;
+  ASSERT_TRUE(clint_->Store(kAddrBase + 8, sizeof(kNever),
+                            reinterpret_cast<const uint8_t*>(&kNever)));
+  ASSERT_TRUE(scheduler.TakeIrq());
+  ASSERT_FALSE(clint_->MachineTimerIrq(1));
+
+  // deadlines follow mtime writes
+  constexpr uint64_t kMtime = 100;
+  ASSERT_TRUE(clint_->Store(kAddrBase + 8, sizeof(kMtime),
+                            reinterpret_cast<const uint8_t*>(&kMtime)));
+  ASSERT_TRUE(clint_->Store(rv64_emulator::device::clint::kMtimeBase,
+                            sizeof(kMtime),
+                            reinterpret_cast<const uint8_t*>(&kMtime)));
+  ASSERT_EQ(scheduler.NextDeadline(), kMtime + 1 - clint_->mtime_offset_);
+  ASSERT_TRUE(scheduler.TakeIrq());
+
+  // msip writes are edges as well
+  constexpr uint32_t kMsip = 1;
+  ASSERT_TRUE(clint_->Store(rv64_emulator::device::clint::kMsipBase,
+                            sizeof(kMsip),
+                            reinterpret_cast<const uint8_t*>(&kMsip)));
+  ASSERT_TRUE(scheduler.TakeIrq());
+}
+
+TEST_F(ClintTest, TimerDeadlineWrap) {
+  Scheduler scheduler(kRunBudget);
+  clint_->mtimecmp_[0] = UINT64_MAX;
+  clint_->mtimecmp_[1] = UINT64_MAX;
+  clint_->SetScheduler(&scheduler);
+
+  // mtime moved far ahead of the time stamps, a compare value between them
+  // is due at once instead of after the deadline wrapped around
+  constexpr uint64_t kAddrBase = rv64_emulator::device::clint::kMtimeCmpBase;
+  constexpr uint64_t kMtime = 1ULL << 62;
+  ASSERT_TRUE(clint_->Store(rv64_emulator::device::clint::kMtimeBase,
+                            sizeof(kMtime),
+                            reinterpret_cast<const uint8_t*>(&kMtime)));
+  ASSERT_TRUE(scheduler.TakeIrq());
+  constexpr uint64_t kMtimeCmp = 1ULL << 61;
+  ASSERT_TRUE(clint_->Store(kAddrBase + 8, sizeof(kMtimeCmp),
+                            reinterpret_cast<const uint8_t*>(&kMtimeCmp)));
+  ASSERT_LE(scheduler.NextDeadline(), ReadGuestTimeStamp());
+  ASSERT_EQ(scheduler.RunExpired(ReadGuestTimeStamp()), 1);
+  ASSERT_TRUE(scheduler.TakeIrq());
+  ASSERT_TRUE(clint_->MachineTimerIrq(1));
+
+  // mtime moved behind the time stamps, a compare value near the end is
+  // not due before the deadline wrapped around
+  constexpr uint64_t kZero = 0;
+  ASSERT_TRUE(clint_->Store(rv64_emulator::device::clint::kMtimeBase,
+                            sizeof(kZero),
+                            reinterpret_cast<const uint8_t*>(&kZero)));
+  constexpr uint64_t kLate = UINT64_MAX - 1;
+  ASSERT_TRUE(clint_->Store(kAddrBase + 8, sizeof(kLate),
+                            reinterpret_cast<const uint8_t*>(&kLate)));
+  ASSERT_EQ(scheduler.NextDeadline(), kNoDeadline);
+  ASSERT_FALSE(clint_->MachineTimerIrq(1));
+}
@@ -7,9 +7,12 @@
 #include <filesystem>
 #include <memory>
 #include <thread>
+#include <vector>
 
 #include "conf.h"
 #include "cpu/csr.h"
+#include "cpu/decode.h"
+#include "cpu/executor.h"
 #include "cpu/mmu.h"
 #include "cpu/trap.h"
 #include "device/bus.h"
@@ -163,6 +166,369 @@ TEST_F(CpuTest, Wfi) {
   ASSERT_EQ(0, cpu_->pc_);
 }
 
+TEST_F(CpuTest, DecodeCache) {
+  // addi x1, x0, imm
+  const auto kAddiWord = [](uint32_t imm) -> uint32_t {
+    return (imm << 20) | 0x00000093;
+  };
+  constexpr uint32_t kFenceIWord = 0x0000100f;
+
+  uint32_t word = kAddiWord(1);
+  cpu_->Store(kDramBaseAddr, sizeof(uint32_t),
+              reinterpret_cast<const uint8_t*>(&word));
+  cpu_->Store(kDramBaseAddr + 4, sizeof(uint32_t),
+              reinterpret_cast<const uint8_t*>(&kFenceIWord));
+  cpu_->pc_ = kDramBaseAddr;
+  cpu_->Tick();
+  ASSERT_EQ(1, cpu_->reg_file_.xregs[1]);
+
+  // stores through the cpu drop the stale decoded inst
+  word = kAddiWord(2);
+  cpu_->Store(kDramBaseAddr, sizeof(uint32_t),
+              reinterpret_cast<const uint8_t*>(&word));
+  cpu_->pc_ = kDramBaseAddr;
+  cpu_->Tick();
+  ASSERT_EQ(2, cpu_->reg_file_.xregs[1]);
+
+  // stores bypassing the cpu need a fence.i to be visible
+  word = kAddiWord(3);
+  ASSERT_TRUE(cpu_->mmu_->sv39_->bus_->Store(
+      kDramBaseAddr, sizeof(uint32_t),
+      reinterpret_cast<const uint8_t*>(&word)));
+  cpu_->pc_ = kDramBaseAddr + 4;
+  cpu_->Tick();
+  cpu_->pc_ = kDramBaseAddr;
+  cpu_->Tick();
+  ASSERT_EQ(3, cpu_->reg_file_.xregs[1]);
+}
+
+TEST_F(CpuTest, RunInterruptLatency) {
+  using rv64_emulator::cpu::executor::ExecEngine;
+
+  // 8 x "addi x1, x1, 1", then "jal x0, -32" back to the first one
+  constexpr uint32_t kAddiWord = 0x00108093;
+  constexpr uint32_t kJalBackWord = 0xfe1ff06f;
+  // jal x0, 0
+  constexpr uint32_t kSpinWord = 0x0000006f;
+  constexpr uint64_t kHandlerAddr = kDramBaseAddr + 0x1000;
+  constexpr uint64_t kBudget = 100;
+
+  constexpr auto kTrap =
+      rv64_emulator::cpu::trap::TrapType::kMachineTimerInterrupt;
+  const uint64_t kMtipMask = rv64_emulator::libs::util::TrapToMask(kTrap);
+
+  for (const auto kEngine : {ExecEngine::kSwitch, ExecEngine::kThreaded}) {
+    cpu_->Reset();
+    cpu_->SetExecEngine(kEngine);
+    for (uint64_t i = 0; i < 8; i++) {
+      cpu_->Store(kDramBaseAddr + i * 4, sizeof(uint32_t),
+                  reinterpret_cast<const uint8_t*>(&kAddiWord));
+    }
+    cpu_->Store(kDramBaseAddr + 32, sizeof(uint32_t),
+                reinterpret_cast<const uint8_t*>(&kJalBackWord));
+    cpu_->Store(kHandlerAddr, sizeof(uint32_t),
+                reinterpret_cast<const uint8_t*>(&kSpinWord));
+    cpu_->state_.Write(rv64_emulator::cpu::csr::kCsrMtvec, kHandlerAddr);
+    cpu_->state_.Write(rv64_emulator::cpu::csr::kCsrMie, kMtipMask);
+    cpu_->state_.Write(rv64_emulator::cpu::csr::kCsrMstatus, 0b1000);
+    cpu_->pc_ = kDramBaseAddr;
+
+    ASSERT_EQ(kBudget, cpu_->Run(kBudget));
+    ASSERT_EQ(kBudget, cpu_->instret_);
+    // 11 loops of 9 insts, then one more addi
+    ASSERT_EQ(11 * 8 + 1, cpu_->reg_file_.xregs[1]);
+
+    // the interrupt is taken within one run
+    cpu_->UpdateIrq(false, false, false, true);
+    ASSERT_EQ(kBudget, cpu_->Run(kBudget));
+    ASSERT_EQ(kHandlerAddr, cpu_->pc_);
+    const uint64_t kEpc = cpu_->state_.Read(rv64_emulator::cpu::csr::kCsrMepc);
+    ASSERT_TRUE(kEpc >= kDramBaseAddr && kEpc <= kDramBaseAddr + 32);
+    if (kEngine == ExecEngine::kSwitch) {
+      // the switch engine stops at the first basic block boundary
+      ASSERT_EQ(kDramBaseAddr, kEpc);
+    }
+  }
+}
+
+TEST_F(CpuTest, CsrState) {
+  using rv64_emulator::cpu::csr::kCsrMCycle;
+  using rv64_emulator::cpu::csr::kCsrMinstret;
+  using rv64_emulator::cpu::csr::kCsrMstatus;
+  using rv64_emulator::cpu::csr::kCsrSstatus;
+  using rv64_emulator::cpu::csr::kCsrTime;
+
+  // jal x0, 0
+  constexpr uint32_t kSpinWord = 0x0000006f;
+  cpu_->Store(kDramBaseAddr, sizeof(uint32_t),
+              reinterpret_cast<const uint8_t*>(&kSpinWord));
+  cpu_->pc_ = kDramBaseAddr;
+
+  // counters follow the retired insts without being written every tick
+  ASSERT_EQ(64, cpu_->Run(64));
+  ASSERT_EQ(64, cpu_->state_.Read(kCsrMinstret));
+  ASSERT_EQ(64, cpu_->state_.Read(kCsrMCycle));
+  cpu_->state_.Write(kCsrMinstret, 1000);
+  ASSERT_EQ(8, cpu_->Run(8));
+  ASSERT_EQ(1008, cpu_->state_.Read(kCsrMinstret));
+  ASSERT_EQ(72, cpu_->state_.Read(kCsrMCycle));
+
+  const uint64_t kTime = cpu_->state_.Read(kCsrTime);
+  ASSERT_LE(kTime, cpu_->state_.Read(kCsrTime));
+
+  // time follows mtime writes of the guest
+  rv64_emulator::device::clint::Clint clint(1);
+  cpu_->state_.BindMtimeOffset(clint.GetMtimeOffset());
+  constexpr uint64_t kMtime = 1ULL << 62;
+  ASSERT_TRUE(clint.Store(rv64_emulator::device::clint::kMtimeBase,
+                          sizeof(kMtime),
+                          reinterpret_cast<const uint8_t*>(&kMtime)));
+  ASSERT_GE(cpu_->state_.Read(kCsrTime), kMtime);
+  ASSERT_LE(cpu_->state_.Read(kCsrTime), clint.GetMtime());
+  cpu_->state_.BindMtimeOffset(nullptr);
+
+  cpu_->Reset();
+  ASSERT_EQ(0, cpu_->state_.Read(kCsrMinstret));
+
+  // only the writable status fields change, sstatus is a view of mstatus
+  const uint64_t kXlen = cpu_->state_.Read(kCsrMstatus);
+  cpu_->state_.Write(kCsrMstatus, UINT64_MAX);
+  ASSERT_EQ(kXlen | rv64_emulator::cpu::csr::kMstatusWriteMask,
+            cpu_->state_.Read(kCsrMstatus));
+  cpu_->state_.Write(kCsrSstatus, 0);
+  ASSERT_EQ(kXlen | (rv64_emulator::cpu::csr::kMstatusWriteMask &
+                     ~rv64_emulator::cpu::csr::kSstatusWriteMask),
+            cpu_->state_.Read(kCsrMstatus));
+  ASSERT_EQ((kXlen | rv64_emulator::cpu::csr::kMstatusWriteMask) &
+                rv64_emulator::cpu::csr::kSstatusReadMask &
+                ~rv64_emulator::cpu::csr::kSstatusWriteMask,
+            cpu_->state_.Read(kCsrSstatus));
+}
+
+TEST_F(CpuTest, EventWord) {
+  // jal x0, 0
+  constexpr uint32_t kSpinWord = 0x0000006f;
+  cpu_->Store(kDramBaseAddr, sizeof(uint32_t),
+              reinterpret_cast<const uint8_t*>(&kSpinWord));
+  cpu_->pc_ = kDramBaseAddr;
+
+  // nothing is deliverable once the first evaluation is done
+  ASSERT_EQ(16, cpu_->Run(16));
+  ASSERT_EQ(0, cpu_->events_.load());
+
+  // unchanged irq lines keep the word clean
+  cpu_->UpdateIrq(false, false, false, false);
+  ASSERT_EQ(0, cpu_->events_.load());
+  cpu_->UpdateIrq(false, false, false, true);
+  ASSERT_EQ(rv64_emulator::cpu::kEventIrqDirty, cpu_->events_.load());
+  ASSERT_EQ(16, cpu_->Run(16));
+  ASSERT_EQ(0, cpu_->events_.load());
+
+  // irq related csr writes dirty the word, others don't
+  cpu_->state_.Write(rv64_emulator::cpu::csr::kCsrMscratch, 1);
+  ASSERT_EQ(0, cpu_->events_.load());
+  cpu_->state_.Write(rv64_emulator::cpu::csr::kCsrMie, 0);
+  ASSERT_EQ(rv64_emulator::cpu::kEventIrqDirty, cpu_->events_.load());
+  ASSERT_EQ(16, cpu_->Run(16));
+
+  // host events end the run at the next block boundary
+  cpu_->RaiseEvent(rv64_emulator::cpu::kEventHost);
+  ASSERT_EQ(1, cpu_->Run(16));
+  ASSERT_EQ(0, cpu_->events_.load());
+  ASSERT_EQ(kDramBaseAddr, cpu_->pc_);
+}
+
+TEST_F(CpuTest, ThreadedEngine) {
+  using rv64_emulator::cpu::decode::InstToken;
+  using rv64_emulator::cpu::decode::kInstTable;
+  using rv64_emulator::cpu::executor::ExecEngine;
+  using rv64_emulator::libs::util::RandomGenerator;
+
+  constexpr InstToken kAluTokens[] = {
+      InstToken::LUI,   InstToken::AUIPC, InstToken::ADDI,  InstToken::SLTI,
+      InstToken::SLTIU, InstToken::XORI,  InstToken::ORI,   InstToken::ANDI,
+      InstToken::SLLI,  InstToken::SRLI,  InstToken::SRAI,  InstToken::ADD,
+      InstToken::SUB,   InstToken::SLL,   InstToken::SLT,   InstToken::SLTU,
+      InstToken::XOR,   InstToken::SRL,   InstToken::SRA,   InstToken::OR,
+      InstToken::AND,   InstToken::ADDIW, InstToken::SLLIW, InstToken::SRLIW,
+      InstToken::SRAIW, InstToken::ADDW,  InstToken::SUBW,  InstToken::SLLW,
+      InstToken::SRLW,  InstToken::SRAW,  InstToken::MUL,   InstToken::MULH,
+      InstToken::MULHU, InstToken::DIV,   InstToken::REMU,  InstToken::DIVW,
+      InstToken::REMW,  InstToken::FENCE,
+  };
+  constexpr InstToken kMemTokens[] = {
+      InstToken::LB,  InstToken::LH, InstToken::LW, InstToken::LBU,
+      InstToken::LHU, InstToken::LWU, InstToken::LD, InstToken::SB,
+      InstToken::SH,  InstToken::SW, InstToken::SD,
+  };
+  constexpr InstToken kBranchTokens[] = {
+      InstToken::BEQ, InstToken::BNE,  InstToken::BLT,
+      InstToken::BGE, InstToken::BLTU, InstToken::BGEU,
+  };
+
+  constexpr uint64_t kProgramInsts = 256;
+  constexpr uint64_t kSteps = kProgramInsts + 64;
+  constexpr uint64_t kDataAddr = kDramBaseAddr + 0x10000;
+  constexpr uint64_t kDataBytes = 0x1000;
+  // jal x0, 0
+  constexpr uint32_t kSpinWord = 0x0000006f;
+
+  const auto kSignature = [&](InstToken token) {
+    for (const auto& kDesc : kInstTable) {
+      if (kDesc.token == token) {
+        return kDesc;
+      }
+    }
+    return kInstTable[0];
+  };
+
+  RandomGenerator<uint32_t> rg(0, UINT32_MAX);
+  const auto kMakeWord = [&]() -> uint32_t {
+    const uint32_t kRd = rg.Get(1, 30) << 7;
+    const uint32_t kOffset = rg.Get(1, 3) * 4;
+    switch (rg.Get(0, 7)) {
+      case 0: {
+        // loads and stores stay inside the data area addressed by x31
+        const auto kDesc = kSignature(kMemTokens[rg.Get(0, 10)]);
+        const uint32_t kImm = rg.Get(0, kDataBytes / 8 - 1) * 8;
+        const uint32_t kWord =
+            (rg.Get() & ~kDesc.mask & 0x01f00000) | kDesc.signature | 31 << 15;
+        if ((kDesc.signature & 0x7f) == 0x23) {
+          return kWord | (kImm >> 5) << 25 | (kImm & 0x1f) << 7;
+        }
+        return kWord | kImm << 20 | kRd;
+      }
+      case 1: {
+        // forward branches never leave the program
+        const auto kDesc = kSignature(kBranchTokens[rg.Get(0, 5)]);
+        return (rg.Get() & 0x01ff8000) | kDesc.signature |
+               ((kOffset >> 5) & 0x3f) << 25 | ((kOffset >> 1) & 0xf) << 8;
+      }
+      case 2:
+        // jal rd, offset
+        return ((kOffset >> 1) & 0x3ff) << 21 | kRd | 0x6f;
+      default: {
+        const auto kDesc =
+            kSignature(kAluTokens[rg.Get(0, std::size(kAluTokens) - 1)]);
+        return (rg.Get() & ~kDesc.mask & ~0xf80u) | kDesc.signature | kRd;
+      }
+    }
+  };
+
+  for (uint32_t round = 0; round < 64; round++) {
+    std::vector<uint32_t> program;
+    for (uint64_t i = 0; i < kProgramInsts; i++) {
+      program.push_back(kMakeWord());
+    }
+    for (uint64_t i = 0; i < 4; i++) {
+      program.push_back(kSpinWord);
+    }
+    std::vector<uint32_t> data(kDataBytes / sizeof(uint32_t));
+    std::generate(data.begin(), data.end(), [&]() { return rg.Get(); });
+    uint64_t xregs[32] = {0};
+    for (uint32_t i = 1; i < 31; i++) {
+      xregs[i] = (uint64_t)rg.Get() << 32 | rg.Get();
+    }
+    xregs[31] = kDataAddr;
+
+    const auto kPrepare = [&](ExecEngine engine) {
+      cpu_->Reset();
+      cpu_->SetExecEngine(engine);
+      cpu_->Store(kDramBaseAddr, program.size() * sizeof(uint32_t),
+                  reinterpret_cast<const uint8_t*>(program.data()));
+      cpu_->Store(kDataAddr, kDataBytes,
+                  reinterpret_cast<const uint8_t*>(data.data()));
+      for (uint32_t i = 0; i < 32; i++) {
+        cpu_->reg_file_.xregs[i] = xregs[i];
+      }
+      cpu_->pc_ = kDramBaseAddr;
+    };
+
+    const auto kSnapshot = [&]() {
+      std::vector<uint64_t> state(kDataBytes / sizeof(uint64_t));
+      cpu_->Load(kDataAddr, kDataBytes,
+                 reinterpret_cast<uint8_t*>(state.data()));
+      for (uint32_t i = 0; i < 32; i++) {
+        state.push_back(cpu_->reg_file_.xregs[i]);
+      }
+      state.push_back(cpu_->pc_);
+      state.push_back(cpu_->instret_);
+      return state;
+    };
+
+    kPrepare(ExecEngine::kSwitch);
+    for (uint64_t i = 0; i < kSteps; i++) {
+      cpu_->Tick();
+    }
+    const auto kExpected = kSnapshot();
+
+    kPrepare(ExecEngine::kThreaded);
+    for (uint64_t i = 0; i < kSteps; i++) {
+      cpu_->Tick();
+    }
+    ASSERT_EQ(kExpected, kSnapshot()) << "threaded tick, round " << round;
+
+    kPrepare(ExecEngine::kThreaded);
+    uint64_t retired = 0;
+    const auto kTrap = cpu_->executor_->ExecThreaded(kSteps, &retired);
+    ASSERT_EQ(rv64_emulator::cpu::trap::TrapType::kNone, kTrap.type);
+    ASSERT_EQ(kSteps, retired);
+    ASSERT_EQ(kExpected, kSnapshot()) << "threaded run, round " << round;
+
+    for (const auto kEngine : {ExecEngine::kSwitch, ExecEngine::kThreaded}) {
+      kPrepare(kEngine);
+      ASSERT_EQ(kSteps, cpu_->Run(kSteps));
+      ASSERT_EQ(kExpected, kSnapshot()) << "block run, round " << round;
+    }
+  }
+}
+
+TEST_F(CpuTest, GuardFault) {
+  using rv64_emulator::cpu::executor::ExecEngine;
+  using rv64_emulator::cpu::trap::kTrapToCauseTable;
+  using rv64_emulator::cpu::trap::TrapType;
+
+  // ld x2, 0(x1) and sd x2, 0(x1)
+  constexpr uint32_t kLdWord = 0x0000b103;
+  constexpr uint32_t kSdWord = 0x0020b023;
+  // crosses the end of RAM into the guard page
+  constexpr uint64_t kAddr = kDramBaseAddr + kDramSize - 4;
+  constexpr uint64_t kVal = 0x1122334455667788;
+
+  for (const auto kEngine : {ExecEngine::kSwitch, ExecEngine::kThreaded}) {
+    cpu_->Reset();
+    cpu_->SetExecEngine(kEngine);
+    cpu_->state_.Write(rv64_emulator::cpu::csr::kCsrMtvec,
+                       kArbitrarilyHandlerVector);
+    cpu_->Store(kDramBaseAddr, sizeof(uint32_t),
+                reinterpret_cast<const uint8_t*>(&kLdWord));
+    cpu_->Store(kDramBaseAddr + 4, sizeof(uint32_t),
+                reinterpret_cast<const uint8_t*>(&kSdWord));
+    cpu_->reg_file_.xregs[1] = kAddr;
+    cpu_->reg_file_.xregs[2] = kVal;
+
+    for (const auto& [kPc, kTrap] : {
+             std::make_pair(kDramBaseAddr, TrapType::kLoadAccessFault),
+             std::make_pair(kDramBaseAddr + 4, TrapType::kStoreAccessFault),
+         }) {
+      cpu_->pc_ = kPc;
+      ASSERT_EQ(cpu_->Run(1), 1);
+      ASSERT_EQ(cpu_->pc_, kArbitrarilyHandlerVector);
+      ASSERT_EQ(cpu_->state_.Read(rv64_emulator::cpu::csr::kCsrMepc), kPc);
+      ASSERT_EQ(cpu_->state_.Read(rv64_emulator::cpu::csr::kCsrMcause),
+                kTrapToCauseTable[static_cast<uint64_t>(kTrap)]);
+      ASSERT_EQ(cpu_->state_.Read(rv64_emulator::cpu::csr::kCsrMtval), kAddr);
+    }
+
+    // neither access got committed
+    ASSERT_EQ(cpu_->reg_file_.xregs[2], kVal);
+    uint32_t tail = UINT32_MAX;
+    ASSERT_TRUE(cpu_->mmu_->sv39_->bus_->Load(
+        kAddr, sizeof(uint32_t), reinterpret_cast<uint8_t*>(&tail)));
+    ASSERT_EQ(tail, 0);
+  }
+}
+
 TEST_F(CpuTest, OfficalTests) {
   std::string_view elf_dir = "test/elf";
 
@@ -187,7 +553,8 @@ TEST_F(CpuTest, OfficalTests) {
     ASSERT_TRUE(kToHostSectionExist) << "input file is not offical test case";
 
     cpu_->Reset();
-    rv64_emulator::libs::util::LoadElf(reader, cpu_.get());
+    rv64_emulator::libs::util::LoadElf(reader,
+                                       cpu_->mmu_->sv39_->bus_.get());
 
     const uint64_t kEntryAddr = reader.get_entry();
     cpu_->pc_ = kEntryAddr;
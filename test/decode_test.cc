@@ -0,0 +1,66 @@
+#include "cpu/decode.h"
+
+#include <cstdint>
+
+#include "fmt/core.h"
+#include "gtest/gtest.h"
+#include "libs/utils.h"
+
+using rv64_emulator::cpu::decode::GetInstIndex;
+using rv64_emulator::cpu::decode::kInstTable;
+using rv64_emulator::cpu::decode::kInstTableSize;
+using rv64_emulator::libs::util::RandomGenerator;
+
+class DecodeTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    fmt::print("start running Decode test case...\n");
+  }
+
+  static void TearDownTestSuite() {
+    fmt::print("finish running Decode test case...\n");
+  }
+
+  void SetUp() override {}
+  void TearDown() override {}
+
+  static int32_t LinearScanInstIndex(uint32_t word) {
+    for (uint32_t i = 0; i < kInstTableSize; i++) {
+      if ((word & kInstTable[i].mask) == kInstTable[i].signature) {
+        return i;
+      }
+    }
+    return -1;
+  }
+};
+
+constexpr uint64_t kRandomRounds = 1 << 16;
+
+TEST_F(DecodeTest, Signatures) {
+  for (uint32_t i = 0; i < kInstTableSize; i++) {
+    const uint32_t kWord = kInstTable[i].signature;
+    ASSERT_EQ(LinearScanInstIndex(kWord), GetInstIndex(kWord))
+        << kInstTable[i].name;
+  }
+}
+
+TEST_F(DecodeTest, RandomOperands) {
+  RandomGenerator<uint32_t> rg(0, UINT32_MAX);
+  for (uint32_t i = 0; i < kInstTableSize; i++) {
+    const auto& kDesc = kInstTable[i];
+    for (uint64_t j = 0; j < 256; j++) {
+      const uint32_t kWord = (rg.Get() & ~kDesc.mask) | kDesc.signature;
+      ASSERT_EQ(LinearScanInstIndex(kWord), GetInstIndex(kWord))
+          << fmt::format("{} {:#010x}", kDesc.name, kWord);
+    }
+  }
+}
+
+TEST_F(DecodeTest, RandomWords) {
+  RandomGenerator<uint32_t> rg(0, UINT32_MAX);
+  for (uint64_t i = 0; i < kRandomRounds; i++) {
+    const uint32_t kWord = rg.Get();
+    ASSERT_EQ(LinearScanInstIndex(kWord), GetInstIndex(kWord))
+        << fmt::format("{:#010x}", kWord);
+  }
+}
@@ -1,7 +1,13 @@
 #include "device/dram.h"
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <memory>
+#include <string>
 
 #include "conf.h"
 #include "fmt/core.h"
@@ -36,7 +42,7 @@ TEST_F(DRAMTest, Store) {
   ASSERT_TRUE(dram_->Store(kArbitraryAddr, sizeof(uint64_t),
                            reinterpret_cast<const uint8_t*>(&kArbitraryVal)));
 
-  const uint8_t* kRawBytes = dram_->memory_.data();
+  const uint8_t* kRawBytes = dram_->memory_;
 
   const auto* kDwordRawData = reinterpret_cast<const uint64_t*>(kRawBytes);
   ASSERT_EQ(*kDwordRawData, kArbitraryVal);
@@ -46,7 +52,7 @@ TEST_F(DRAMTest, Load) {
   dram_->Store(kArbitraryAddr, sizeof(uint64_t),
                reinterpret_cast<const uint8_t*>(&kArbitraryVal));
 
-  uint64_t* dword_ptr = reinterpret_cast<uint64_t*>(dram_->memory_.data());
+  uint64_t* dword_ptr = reinterpret_cast<uint64_t*>(dram_->memory_);
   *dword_ptr = kArbitraryVal;
 
   uint64_t res;
@@ -66,3 +72,97 @@ TEST_F(DRAMTest, InvalidStoreAddressRange) {
   ASSERT_FALSE(dram_->Store(dram_->GetSize() - 7, sizeof(uint64_t),
                             reinterpret_cast<const uint8_t*>(&kArbitraryVal)));
 }
+
+TEST_F(DRAMTest, ResetDropsContents) {
+  const uint64_t kAddr = dram_->GetSize() - sizeof(uint64_t);
+  uint8_t* host = dram_->GetHostPtr(kAddr, sizeof(uint64_t));
+  ASSERT_TRUE(dram_->Store64(kAddr, kArbitraryVal));
+
+  dram_->Reset();
+
+  uint64_t res = kArbitraryVal;
+  ASSERT_TRUE(dram_->Load64(kAddr, &res));
+  ASSERT_EQ(res, 0);
+  ASSERT_EQ(dram_->GetHostPtr(kAddr, sizeof(uint64_t)), host);
+}
+
+TEST_F(DRAMTest, LoadImage) {
+  const std::string kImage =
+      (std::filesystem::temp_directory_path() / "dram_test_image.bin").string();
+  {
+    std::ofstream file(kImage, std::ios::out | std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&kArbitraryVal),
+               sizeof(kArbitraryVal));
+  }
+
+  // page aligned offset is mapped, the other one is read
+  constexpr uint64_t kMappedOffset = 0x2000;
+  constexpr uint64_t kReadOffset = 0x3004;
+  ASSERT_TRUE(dram_->LoadImage(kMappedOffset, kImage.c_str()));
+  ASSERT_TRUE(dram_->LoadImage(kReadOffset, kImage.c_str()));
+  ASSERT_FALSE(dram_->LoadImage(dram_->GetSize(), kImage.c_str()));
+  ASSERT_FALSE(dram_->LoadImage(0, "/nonexistent/dram_test_image.bin"));
+
+  uint64_t res = 0;
+  ASSERT_TRUE(dram_->Load64(kMappedOffset, &res));
+  ASSERT_EQ(res, kArbitraryVal);
+  ASSERT_TRUE(dram_->Load64(kMappedOffset + sizeof(uint64_t), &res));
+  ASSERT_EQ(res, 0);
+  ASSERT_TRUE(dram_->Load64(kReadOffset, &res));
+  ASSERT_EQ(res, kArbitraryVal);
+
+  // guest stores stay private to the guest
+  ASSERT_TRUE(dram_->Store64(kMappedOffset, 0));
+  {
+    uint64_t on_disk = 0;
+    std::ifstream file(kImage, std::ios::in | std::ios::binary);
+    file.read(reinterpret_cast<char*>(&on_disk), sizeof(on_disk));
+    ASSERT_EQ(on_disk, kArbitraryVal);
+  }
+
+  // reset brings both images back, whichever way they were loaded
+  ASSERT_TRUE(dram_->Store64(kReadOffset, 0));
+  ASSERT_TRUE(dram_->Store64(kReadOffset + sizeof(uint64_t), kArbitraryVal));
+  dram_->Reset();
+  ASSERT_TRUE(dram_->Load64(kMappedOffset, &res));
+  ASSERT_EQ(res, kArbitraryVal);
+  ASSERT_TRUE(dram_->Load64(kReadOffset, &res));
+  ASSERT_EQ(res, kArbitraryVal);
+  ASSERT_TRUE(dram_->Load64(kReadOffset + sizeof(uint64_t), &res));
+  ASSERT_EQ(res, 0);
+
+  std::filesystem::remove(kImage);
+}
+
+TEST_F(DRAMTest, HugePageFallback) {
+  using rv64_emulator::device::dram::PageBacking;
+
+  // the size is no multiple of 1 GiB, so hugetlbfs is not even tried
+  rv64_emulator::device::dram::DRAM dram(kDramSize, PageBacking::kHuge1G);
+  ASSERT_NE(dram.GetBacking(), PageBacking::kHuge1G);
+  ASSERT_NE(dram.GetBacking(), PageBacking::kHuge2M);
+
+  const uint64_t kAddr = dram.GetSize() - sizeof(uint64_t);
+  uint64_t res = 0;
+  ASSERT_TRUE(dram.Store64(kAddr, kArbitraryVal));
+  ASSERT_TRUE(dram.Load64(kAddr, &res));
+  ASSERT_EQ(res, kArbitraryVal);
+}
+
+TEST_F(DRAMTest, SparseBacking) {
+  // far more than the host is expected to commit, only touched pages count
+  constexpr uint64_t kSize = 16ULL << 30;
+  rv64_emulator::device::dram::DRAM dram(kSize);
+  const uint64_t kPageBytes = sysconf(_SC_PAGESIZE);
+
+  const uint64_t kTouched = kSize / 2;
+  ASSERT_TRUE(dram.Store64(kTouched, kArbitraryVal));
+
+  for (const auto kOffset : {kTouched, kTouched + kPageBytes, kSize - 8}) {
+    unsigned char resident = 0;
+    ASSERT_EQ(mincore(dram.GetHostPtr(kOffset & ~(kPageBytes - 1), 1),
+                      kPageBytes, &resident),
+              0);
+    ASSERT_EQ(resident & 1, kOffset == kTouched);
+  }
+}
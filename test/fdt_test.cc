@@ -0,0 +1,225 @@
+#include "libs/fdt.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+#include "gtest/gtest.h"
+
+using rv64_emulator::libs::fdt::MemoryRegion;
+using rv64_emulator::libs::fdt::SetMemory;
+
+// lays out a flattened device tree the way dtc does, with properties named
+// in order of first use
+class DtbBuilder {
+ public:
+  DtbBuilder& Begin(const char* name) {
+    Word(1);
+    Bytes(name, strlen(name) + 1);
+    return *this;
+  }
+
+  DtbBuilder& End() {
+    Word(2);
+    return *this;
+  }
+
+  DtbBuilder& Prop(const char* name, const std::vector<uint32_t>& cells) {
+    std::vector<uint8_t> value;
+    for (const uint32_t kCell : cells) {
+      for (int shift = 24; shift >= 0; shift -= 8) {
+        value.push_back(kCell >> shift);
+      }
+    }
+    return Prop(name, value.data(), value.size());
+  }
+
+  DtbBuilder& Prop(const char* name, const char* str) {
+    return Prop(name, str, strlen(str) + 1);
+  }
+
+  std::vector<uint8_t> Build() {
+    Word(9);
+    std::vector<uint8_t> dtb;
+    const uint32_t kOffStruct = 40 + 16;
+    const uint32_t kOffStrings = kOffStruct + structs_.size();
+    const uint32_t kHeader[] = {
+        0xd00dfeed,
+        static_cast<uint32_t>(kOffStrings + strings_.size()),
+        kOffStruct,
+        kOffStrings,
+        40,
+        17,
+        16,
+        0,
+        static_cast<uint32_t>(strings_.size()),
+        static_cast<uint32_t>(structs_.size()),
+    };
+    for (const uint32_t kWord : kHeader) {
+      for (int shift = 24; shift >= 0; shift -= 8) {
+        dtb.push_back(kWord >> shift);
+      }
+    }
+    dtb.resize(kOffStruct, 0);
+    dtb.insert(dtb.end(), structs_.begin(), structs_.end());
+    dtb.insert(dtb.end(), strings_.begin(), strings_.end());
+    return dtb;
+  }
+
+ private:
+  std::vector<uint8_t> structs_;
+  std::string strings_;
+
+  DtbBuilder& Prop(const char* name, const void* value, uint32_t len) {
+    const std::string kKey(name, strlen(name) + 1);
+    size_t off = strings_.find(kKey);
+    if (off == std::string::npos) {
+      off = strings_.size();
+      strings_.append(kKey);
+    }
+    Word(3);
+    Word(len);
+    Word(off);
+    Bytes(value, len);
+    return *this;
+  }
+
+  void Word(uint32_t word) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      structs_.push_back(word >> shift);
+    }
+  }
+
+  void Bytes(const void* data, uint32_t len) {
+    const auto* kData = static_cast<const uint8_t*>(data);
+    structs_.insert(structs_.end(), kData, kData + len);
+    structs_.resize((structs_.size() + 3) & ~3ULL, 0);
+  }
+};
+
+class FdtTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    fmt::print("start running Fdt test case...\n");
+  }
+
+  static void TearDownTestSuite() {
+    fmt::print("finish running Fdt test case...\n");
+  }
+
+  void SetUp() override {}
+
+  void TearDown() override {}
+};
+
+const std::vector<MemoryRegion> kRegions = {
+    {.base = 0x40000000, .size = 0x80000000},
+    {.base = 0x100000000, .size = 0x100000000},
+};
+
+TEST_F(FdtTest, RewriteMemoryNode) {
+  const auto kDtb = DtbBuilder()
+                        .Begin("")
+                        .Prop("#address-cells", {2})
+                        .Prop("#size-cells", {2})
+                        .Begin("cpu@0")
+                        .Prop("next-level-cache", {1})
+                        .End()
+                        .Begin("memory@80000000")
+                        .Prop("device_type", "memory")
+                        .Prop("reg", {0, 0x80000000, 0, 0x4000000})
+                        .Prop("phandle", {1})
+                        .End()
+                        .Begin("memory@200000000")
+                        .Prop("device_type", "memory")
+                        .Prop("reg", {2, 0, 0, 0x4000000})
+                        .Begin("nested")
+                        .End()
+                        .End()
+                        .Begin("soc")
+                        .End()
+                        .End()
+                        .Build();
+
+  // the first node keeps its phandle, the second one is gone
+  const auto kExpected = DtbBuilder()
+                             .Begin("")
+                             .Prop("#address-cells", {2})
+                             .Prop("#size-cells", {2})
+                             .Begin("cpu@0")
+                             .Prop("next-level-cache", {1})
+                             .End()
+                             .Begin("memory@40000000")
+                             .Prop("device_type", "memory")
+                             .Prop("reg", {0, 0x40000000, 0, 0x80000000, 1, 0,
+                                           1, 0})
+                             .Prop("phandle", {1})
+                             .End()
+                             .Begin("soc")
+                             .End()
+                             .End()
+                             .Build();
+
+  std::vector<uint8_t> out;
+  ASSERT_TRUE(SetMemory(kDtb, kRegions, &out));
+  ASSERT_EQ(out, kExpected);
+}
+
+TEST_F(FdtTest, AddMemoryNode) {
+  const auto kDtb = DtbBuilder()
+                        .Begin("")
+                        .Prop("#address-cells", {2})
+                        .Prop("#size-cells", {2})
+                        .Begin("chosen")
+                        .Prop("bootargs", "console=ttyUL0")
+                        .End()
+                        .End()
+                        .Build();
+
+  const auto kExpected = DtbBuilder()
+                             .Begin("")
+                             .Prop("#address-cells", {2})
+                             .Prop("#size-cells", {2})
+                             .Begin("chosen")
+                             .Prop("bootargs", "console=ttyUL0")
+                             .End()
+                             .Begin("memory@40000000")
+                             .Prop("device_type", "memory")
+                             .Prop("reg", {0, 0x40000000, 0, 0x80000000, 1, 0,
+                                           1, 0})
+                             .End()
+                             .End()
+                             .Build();
+
+  std::vector<uint8_t> out;
+  ASSERT_TRUE(SetMemory(kDtb, kRegions, &out));
+  ASSERT_EQ(out, kExpected);
+}
+
+TEST_F(FdtTest, RejectBadTree) {
+  std::vector<uint8_t> out;
+
+  // one size cell can not hold the regions above 4 GiB
+  const auto kNarrow = DtbBuilder()
+                           .Begin("")
+                           .Prop("#address-cells", {2})
+                           .Prop("#size-cells", {1})
+                           .Begin("memory@80000000")
+                           .Prop("reg", {0, 0x80000000, 0x4000000})
+                           .End()
+                           .End()
+                           .Build();
+  ASSERT_FALSE(SetMemory(kNarrow, kRegions, &out));
+
+  auto bad_magic = DtbBuilder().Begin("").End().Build();
+  bad_magic[0] = 0;
+  ASSERT_FALSE(SetMemory(bad_magic, kRegions, &out));
+
+  auto truncated = DtbBuilder().Begin("").End().Build();
+  truncated.resize(truncated.size() - 4);
+  ASSERT_FALSE(SetMemory(truncated, kRegions, &out));
+
+  ASSERT_FALSE(SetMemory(DtbBuilder().Begin("").End().Build(), {}, &out));
+}
@@ -0,0 +1,361 @@
+#include "cpu/mmu.h"
+
+#include <cstdint>
+#include <memory>
+
+#include "conf.h"
+#include "cpu/cpu.h"
+#include "cpu/csr.h"
+#include "cpu/trap.h"
+#include "device/bus.h"
+#include "device/dram.h"
+#include "fmt/core.h"
+#include "gtest/gtest.h"
+
+using rv64_emulator::cpu::PrivilegeMode;
+using rv64_emulator::cpu::csr::kCsrMenvcfg;
+using rv64_emulator::cpu::csr::kCsrSatp;
+using rv64_emulator::cpu::trap::TrapType;
+using rv64_emulator::mmu::AccessType;
+
+// v, r, w, x, u, g, a, d bits of a page table entry
+constexpr uint64_t kPteV = 1 << 0;
+constexpr uint64_t kPteRwx = 0b111 << 1;
+constexpr uint64_t kPteG = 1 << 5;
+constexpr uint64_t kPteA = 1 << 6;
+constexpr uint64_t kPteAd = 0b11 << 6;
+
+constexpr uint64_t kRootTable = kDramBaseAddr + 0x100000;
+constexpr uint64_t kLevel1Table = kDramBaseAddr + 0x101000;
+constexpr uint64_t kLevel0Table = kDramBaseAddr + 0x102000;
+
+constexpr uint64_t kPage = kDramBaseAddr + 0x200000;
+constexpr uint64_t kOtherPage = kDramBaseAddr + 0x201000;
+constexpr uint64_t kMegaPage = kDramBaseAddr + 0x400000;
+
+// 0x1000 is a 4KB page, 0x200000 is a 2MB page
+constexpr uint64_t kVaddr = 0x1000;
+constexpr uint64_t kMegaVaddr = 0x200000;
+
+class MmuTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    fmt::print("start running MMU test case...\n");
+  }
+
+  static void TearDownTestSuite() {
+    fmt::print("finish running MMU test case...\n");
+  }
+
+  void SetUp() override {
+    auto dram = std::make_unique<rv64_emulator::device::dram::DRAM>(kDramSize);
+    auto bus = std::make_shared<rv64_emulator::device::bus::Bus>();
+    bus->MountDevice({
+        .base = kDramBaseAddr,
+        .size = kDramSize,
+        .dev = std::move(dram),
+    });
+
+    auto sv39 = std::make_unique<rv64_emulator::mmu::Sv39>(bus);
+    auto mmu = std::make_unique<rv64_emulator::mmu::Mmu>(std::move(sv39));
+    cpu_ = std::make_unique<rv64_emulator::cpu::CPU>(std::move(mmu));
+
+    WritePte(kRootTable, 0, Pte(kLevel1Table, kPteV));
+    WritePte(kLevel1Table, 0, Pte(kLevel0Table, kPteV));
+    WritePte(kLevel0Table, 1, Pte(kPage, kPteV | kPteRwx | kPteAd));
+    WritePte(kLevel1Table, 1, Pte(kMegaPage, kPteV | kPteRwx | kPteAd));
+    WriteData(kPage, 1);
+    WriteData(kOtherPage, 2);
+    WriteData(kMegaPage, 3);
+
+    cpu_->priv_mode_ = PrivilegeMode::kSupervisor;
+    SetAsid(1);
+  }
+
+  void TearDown() override {}
+
+  static uint64_t Pte(uint64_t paddr, uint64_t flags) {
+    return (paddr >> 12) << 10 | flags;
+  }
+
+  void WritePte(uint64_t table, uint64_t index, uint64_t pte) {
+    ASSERT_TRUE(cpu_->mmu_->sv39_->bus_->Store(
+        table + index * sizeof(uint64_t), sizeof(uint64_t),
+        reinterpret_cast<const uint8_t*>(&pte)));
+  }
+
+  uint64_t ReadPte(uint64_t table, uint64_t index) {
+    uint64_t pte = 0;
+    EXPECT_TRUE(cpu_->mmu_->sv39_->bus_->Load(
+        table + index * sizeof(uint64_t), sizeof(uint64_t),
+        reinterpret_cast<uint8_t*>(&pte)));
+    return pte;
+  }
+
+  void WriteData(uint64_t paddr, uint64_t val) {
+    ASSERT_TRUE(cpu_->mmu_->sv39_->bus_->Store(
+        paddr, sizeof(uint64_t), reinterpret_cast<const uint8_t*>(&val)));
+  }
+
+  void SetAsid(uint64_t asid) {
+    cpu_->state_.Write(kCsrSatp, 8ULL << 60 | asid << 44 | kRootTable >> 12);
+  }
+
+  // look up the tlb behind the soft tlb
+  uint64_t LookUp(uint64_t vaddr, AccessType type) {
+    const uint64_t kSatp = cpu_->state_.Read(kCsrSatp);
+    const auto* kEntry = cpu_->mmu_->sv39_->GetTlbEntry(
+        *reinterpret_cast<const rv64_emulator::cpu::csr::SatpDesc*>(&kSatp),
+        vaddr, type, false);
+    return kEntry ? kEntry->ppn : 0;
+  }
+
+  uint64_t LoadVirt(uint64_t vaddr) {
+    uint64_t val = 0;
+    const auto kTrap = cpu_->Load(vaddr, sizeof(uint64_t),
+                                  reinterpret_cast<uint8_t*>(&val));
+    EXPECT_EQ(TrapType::kNone, kTrap.type);
+    return val;
+  }
+
+  const rv64_emulator::mmu::Tlb& DataTlb() const {
+    return cpu_->mmu_->sv39_->GetDataTlb();
+  }
+
+  std::unique_ptr<rv64_emulator::cpu::CPU> cpu_;
+};
+
+TEST_F(MmuTest, Translate) {
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  ASSERT_EQ(3, LoadVirt(kMegaVaddr));
+  WriteData(kMegaPage + 0x1000, 4);
+  ASSERT_EQ(4, LoadVirt(kMegaVaddr + 0x1000));
+  ASSERT_EQ(2, DataTlb().GetMisses());
+  ASSERT_EQ(1, DataTlb().GetHits());
+
+  // data and instruction translations don't share entries
+  ASSERT_EQ(kPage, LookUp(kVaddr, AccessType::kFetch));
+  ASSERT_EQ(1, cpu_->mmu_->sv39_->GetInstTlb().GetMisses());
+}
+
+TEST_F(MmuTest, AsidSurvivesSatpSwitch) {
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  SetAsid(2);
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  ASSERT_EQ(2, DataTlb().GetMisses());
+
+  // both address spaces stay cached
+  SetAsid(1);
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  SetAsid(2);
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  ASSERT_EQ(2, DataTlb().GetMisses());
+  ASSERT_EQ(2, DataTlb().GetHits());
+}
+
+TEST_F(MmuTest, FlushByAddress) {
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  ASSERT_EQ(3, LoadVirt(kMegaVaddr));
+
+  // stale until the page is flushed
+  WritePte(kLevel0Table, 1, Pte(kOtherPage, kPteV | kPteRwx | kPteAd));
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+
+  cpu_->FlushTlb(kVaddr, 2, false, false);
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  cpu_->FlushTlb(kVaddr, 1, false, false);
+  ASSERT_EQ(2, LoadVirt(kVaddr));
+
+  // only the given page is dropped
+  const uint64_t kMisses = DataTlb().GetMisses();
+  ASSERT_EQ(3, LoadVirt(kMegaVaddr));
+  ASSERT_EQ(kMisses, DataTlb().GetMisses());
+}
+
+TEST_F(MmuTest, FlushGlobal) {
+  WritePte(kLevel0Table, 1, Pte(kPage, kPteV | kPteRwx | kPteAd | kPteG));
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+
+  // global mappings are visible from every asid
+  SetAsid(2);
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  ASSERT_EQ(1, DataTlb().GetMisses());
+
+  WritePte(kLevel0Table, 1,
+           Pte(kOtherPage, kPteV | kPteRwx | kPteAd | kPteG));
+
+  // asid specific flushes keep global mappings
+  cpu_->FlushTlb(0, 2, true, false);
+  cpu_->FlushTlb(kVaddr, 2, false, false);
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+
+  cpu_->FlushTlb(kVaddr, 0, false, true);
+  ASSERT_EQ(2, LoadVirt(kVaddr));
+
+  WritePte(kLevel0Table, 1, Pte(kPage, kPteV | kPteRwx | kPteAd | kPteG));
+  cpu_->FlushTlb(0, 0, true, true);
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+}
+
+TEST_F(MmuTest, SetConflicts) {
+  // more pages than ways mapping to the same set are evicted one by one
+  constexpr uint64_t kSets = kTlbEntryNum / kTlbWays;
+  constexpr uint64_t kPages = kTlbWays + 1;
+  constexpr uint64_t kBase = 0x400000;
+  constexpr uint64_t kTable = kDramBaseAddr + 0x103000;
+  ASSERT_LE(kPages * kSets, 1024);
+
+  // [0x400000, 0x800000) shares one level 0 table
+  WritePte(kLevel1Table, 2, Pte(kTable, kPteV));
+  WritePte(kLevel1Table, 3, Pte(kTable, kPteV));
+  for (uint64_t i = 0; i < kPages; i++) {
+    WritePte(kTable, i * kSets % 512, Pte(kPage, kPteV | kPteRwx | kPteAd));
+  }
+
+  for (uint64_t round = 0; round < 2; round++) {
+    for (uint64_t i = 0; i < kPages; i++) {
+      ASSERT_EQ(kPage, LookUp(kBase + (i * kSets << 12), AccessType::kLoad));
+    }
+  }
+  ASSERT_EQ(2 * kPages, DataTlb().GetMisses());
+  ASSERT_EQ(0, DataTlb().GetHits());
+}
+
+TEST_F(MmuTest, SoftTlb) {
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  ASSERT_EQ(0, LoadVirt(kVaddr + 8));
+  ASSERT_EQ(1, DataTlb().GetMisses());
+  ASSERT_EQ(0, DataTlb().GetHits());
+
+  // ram is accessed in place, stores through the bus are visible
+  WriteData(kPage, 5);
+  ASSERT_EQ(5, LoadVirt(kVaddr));
+
+  uint64_t val = 6;
+  ASSERT_EQ(TrapType::kNone,
+            cpu_->Store(kVaddr, sizeof(uint64_t),
+                        reinterpret_cast<const uint8_t*>(&val))
+                .type);
+  ASSERT_EQ(6, LoadVirt(kVaddr));
+
+  // machine mode accesses are not translated
+  cpu_->priv_mode_ = PrivilegeMode::kMachine;
+  ASSERT_EQ(6, LoadVirt(kPage));
+  cpu_->priv_mode_ = PrivilegeMode::kSupervisor;
+  ASSERT_EQ(TrapType::kLoadPageFault,
+            cpu_->Load(kPage, sizeof(uint64_t),
+                       reinterpret_cast<uint8_t*>(&val))
+                .type);
+}
+
+TEST_F(MmuTest, SoftTlbPermission) {
+  // read only supervisor page
+  WritePte(kLevel0Table, 2, Pte(kOtherPage, kPteV | 0b001 << 1 | kPteAd));
+  constexpr uint64_t kReadOnly = 0x2000;
+  ASSERT_EQ(2, LoadVirt(kReadOnly));
+
+  uint64_t val = 0;
+  const auto kStoreTrap = cpu_->Store(kReadOnly, sizeof(uint64_t),
+                                      reinterpret_cast<const uint8_t*>(&val));
+  ASSERT_EQ(TrapType::kStorePageFault, kStoreTrap.type);
+
+  // fetch from a non-executable page
+  uint64_t paddr = 0;
+  ASSERT_EQ(TrapType::kInstructionPageFault,
+            cpu_->mmu_->TranslateFetch(kReadOnly, &paddr).type);
+
+  // user mode can't fetch supervisor pages, even if they were fetched before
+  ASSERT_EQ(TrapType::kNone, cpu_->mmu_->TranslateFetch(kVaddr, &paddr).type);
+  cpu_->priv_mode_ = PrivilegeMode::kUser;
+  ASSERT_EQ(TrapType::kInstructionPageFault,
+            cpu_->mmu_->TranslateFetch(kVaddr, &paddr).type);
+}
+
+TEST_F(MmuTest, SoftTlbFlush) {
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  ASSERT_EQ(3, LoadVirt(kMegaVaddr));
+
+  WritePte(kLevel1Table, 1, Pte(kDramBaseAddr, kPteV | kPteRwx | kPteAd));
+  WriteData(kDramBaseAddr, 7);
+
+  // a page inside a superpage drops every cached page of it
+  cpu_->FlushTlb(kMegaVaddr + 0x5000, 1, false, false);
+  ASSERT_EQ(7, LoadVirt(kMegaVaddr));
+  ASSERT_EQ(0, DataTlb().GetHits());
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  ASSERT_EQ(1, DataTlb().GetHits());
+}
+
+TEST_F(MmuTest, PageWalkCache) {
+  const auto& kPwc = cpu_->mmu_->sv39_->GetPageWalkCache();
+  ASSERT_EQ(kPage, LookUp(kVaddr, AccessType::kLoad));
+  ASSERT_EQ(0, kPwc.GetHits());
+
+  // the neighbour page only needs its leaf pte
+  WritePte(kLevel0Table, 2, Pte(kOtherPage, kPteV | kPteRwx | kPteAd));
+  ASSERT_EQ(kOtherPage, LookUp(0x2000, AccessType::kLoad));
+  ASSERT_EQ(1, kPwc.GetHits());
+
+  // non-leaf ptes are cached until a fence of the whole address space
+  WritePte(kRootTable, 0, 0);
+  WritePte(kLevel0Table, 3, Pte(kOtherPage, kPteV | kPteRwx | kPteAd));
+  ASSERT_EQ(kOtherPage, LookUp(0x3000, AccessType::kLoad));
+
+  cpu_->FlushTlb(0, 0, true, true);
+  ASSERT_EQ(0, LookUp(kVaddr, AccessType::kLoad));
+}
+
+TEST_F(MmuTest, PageWalkCacheFlushByAddress) {
+  ASSERT_EQ(kPage, LookUp(kVaddr, AccessType::kLoad));
+
+  // a page table freed with per page fences
+  WritePte(kLevel1Table, 0, 0);
+  cpu_->FlushTlb(kVaddr + 0x1000, 1, false, false);
+  ASSERT_EQ(0, LookUp(kVaddr + 0x1000, AccessType::kLoad));
+}
+
+TEST_F(MmuTest, HardwareAdUpdate) {
+  WritePte(kLevel0Table, 1, Pte(kPage, kPteV | kPteRwx));
+  WritePte(kLevel0Table, 2, Pte(kOtherPage, kPteV | 0b001 << 1));
+
+  // the first touch sets a, only a permitted store sets d
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  ASSERT_EQ(kPteA, ReadPte(kLevel0Table, 1) & kPteAd);
+
+  uint64_t val = 5;
+  ASSERT_EQ(TrapType::kNone,
+            cpu_->Store(kVaddr, sizeof(uint64_t),
+                        reinterpret_cast<const uint8_t*>(&val))
+                .type);
+  ASSERT_EQ(kPteAd, ReadPte(kLevel0Table, 1) & kPteAd);
+  ASSERT_EQ(5, LoadVirt(kVaddr));
+  // the tlb entry is refreshed in place
+  ASSERT_EQ(1, DataTlb().GetMisses());
+
+  ASSERT_EQ(TrapType::kStorePageFault,
+            cpu_->Store(0x2000, sizeof(uint64_t),
+                        reinterpret_cast<const uint8_t*>(&val))
+                .type);
+  ASSERT_EQ(kPteA, ReadPte(kLevel0Table, 2) & kPteAd);
+}
+
+TEST_F(MmuTest, SoftwareAdUpdate) {
+  cpu_->state_.Write(kCsrMenvcfg, 0);
+  WritePte(kLevel0Table, 1, Pte(kPage, kPteV | kPteRwx));
+
+  uint64_t val = 0;
+  ASSERT_EQ(TrapType::kLoadPageFault,
+            cpu_->Load(kVaddr, sizeof(uint64_t),
+                       reinterpret_cast<uint8_t*>(&val))
+                .type);
+  ASSERT_EQ(0, ReadPte(kLevel0Table, 1) & kPteAd);
+
+  // the guest sets a and fences
+  WritePte(kLevel0Table, 1, Pte(kPage, kPteV | kPteRwx | kPteA));
+  cpu_->FlushTlb(kVaddr, 1, false, false);
+  ASSERT_EQ(1, LoadVirt(kVaddr));
+  ASSERT_EQ(TrapType::kStorePageFault,
+            cpu_->Store(kVaddr, sizeof(uint64_t),
+                        reinterpret_cast<const uint8_t*>(&val))
+                .type);
+}
@@ -4,10 +4,12 @@
 #include <memory>
 #include <utility>
 
+#include "device/scheduler.h"
 #include "fmt/core.h"
 #include "gtest/gtest.h"
 
 using namespace rv64_emulator::device::plic;
+using rv64_emulator::device::scheduler::Scheduler;
 
 class PlicTest : public testing::Test {
  protected:
@@ -262,17 +264,21 @@ TEST_F(PlicTest, GetInterrupt) {
   // case 1: normal select
   plic_->contexts_[3].enable[0] = 0b1110;
   plic_->contexts_[3].claimed_[0] = 0b0010;
+  // registers were set behind the back of the arbitration
+  plic_->Rebuild();
   ASSERT_TRUE(plic_->GetInterrupt(3));
   ASSERT_EQ(plic_->contexts_.at(3).claim, 3);
 
   // case 2: context 3 has two valid irq, select device 1
   plic_->contexts_[3].claimed_[0] = 0b0100;
   plic_->priority_[1] = plic_->priority_[3] + 1;
+  plic_->Rebuild();
   ASSERT_TRUE(plic_->GetInterrupt(3));
   ASSERT_EQ(plic_->contexts_.at(3).claim, 1);
 
   // the same as case 2 but device 1 not enable, select device 3
   plic_->contexts_[3].enable[0] = 0b1100;
+  plic_->Rebuild();
   ASSERT_TRUE(plic_->GetInterrupt(3));
   ASSERT_EQ(plic_->contexts_.at(3).claim, 3);
 
@@ -284,6 +290,7 @@ TEST_F(PlicTest, GetInterrupt) {
   plic_->priority_[1] = plic_->contexts_[3].threshold - 1;
   plic_->priority_[2] = plic_->contexts_[3].threshold + 1;
   plic_->priority_[3] = plic_->contexts_[3].threshold;
+  plic_->Rebuild();
   ASSERT_TRUE(plic_->GetInterrupt(3));
   ASSERT_EQ(plic_->contexts_.at(3).claim, 2);
 }
@@ -303,4 +310,68 @@ TEST_F(PlicTest, UpdateExt) {
   ASSERT_EQ(plic_->pending_[0], ~(1U << kSourceId));
 }
 
+TEST_F(PlicTest, IncrementalArbitration) {
+  // sources in several bitmap words, one hart with m and s contexts
+  auto plic = std::make_unique<Plic>(1, true, 200);
+  plic_ = std::move(plic);
+  Scheduler scheduler(kRunBudget);
+  plic_->SetScheduler(&scheduler);
+
+  auto store = [this](uint64_t addr, uint32_t val) {
+    return plic_->Store(addr, sizeof(val),
+                        reinterpret_cast<const uint8_t*>(&val));
+  };
+  auto claim = [this](uint64_t ctx_id) {
+    uint32_t val = UINT32_MAX;
+    plic_->Load(kContextBase + ctx_id * kContextBytesPerHart + 4, sizeof(val),
+                reinterpret_cast<uint8_t*>(&val));
+    return val;
+  };
+
+  constexpr uint32_t kSources[] = {3, 70, 130, 190};
+  for (const uint32_t kSrc : kSources) {
+    ASSERT_TRUE(store(kSourcePriorityBase + kSrc * 4, 1));
+    ASSERT_TRUE(store(kEnableBase + kEnableBytesPerHart + kSrc / 32 * 4,
+                      1U << (kSrc % 32)));
+  }
+  ASSERT_TRUE(store(kSourcePriorityBase + 130 * 4, 2));
+  ASSERT_FALSE(scheduler.TakeIrq());
+
+  // only the first pending source changes the irq line
+  plic_->UpdateExt(190, true);
+  ASSERT_TRUE(scheduler.TakeIrq());
+  ASSERT_FALSE(plic_->GetInterrupt(0));
+  ASSERT_TRUE(plic_->GetInterrupt(1));
+  ASSERT_EQ(plic_->contexts_[1].claim, 190);
+  plic_->UpdateExt(70, true);
+  plic_->UpdateExt(130, true);
+  ASSERT_FALSE(scheduler.TakeIrq());
+
+  // higher priority first, then the lower source id
+  ASSERT_EQ(claim(1), 130);
+  ASSERT_EQ(claim(1), 70);
+  ASSERT_EQ(claim(1), 190);
+  ASSERT_TRUE(scheduler.TakeIrq());
+  ASSERT_FALSE(plic_->GetInterrupt(1));
+  ASSERT_EQ(claim(1), 0);
+
+  // completion makes a still pending source eligible again
+  ASSERT_TRUE(store(kContextBase + kContextBytesPerHart + 4, 70));
+  ASSERT_TRUE(scheduler.TakeIrq());
+  ASSERT_EQ(plic_->contexts_[1].claim, 70);
+
+  // a threshold above the priority masks it
+  ASSERT_TRUE(store(kContextBase + kContextBytesPerHart, 2));
+  ASSERT_TRUE(scheduler.TakeIrq());
+  ASSERT_FALSE(plic_->GetInterrupt(1));
+  ASSERT_TRUE(store(kSourcePriorityBase + 70 * 4, 2));
+  ASSERT_TRUE(scheduler.TakeIrq());
+  ASSERT_EQ(plic_->contexts_[1].claim, 70);
+
+  // as does disabling it
+  ASSERT_TRUE(store(kEnableBase + kEnableBytesPerHart + 70 / 32 * 4, 0));
+  ASSERT_TRUE(scheduler.TakeIrq());
+  ASSERT_FALSE(plic_->GetInterrupt(1));
+}
+
 TEST_F(PlicTest, Reset) { plic_->Reset(); }
@@ -0,0 +1,98 @@
+#include "libs/ring_buffer.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "fmt/core.h"
+#include "gtest/gtest.h"
+
+using rv64_emulator::libs::RingBuffer;
+
+class RingBufferTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    fmt::print("start running RingBuffer test case...\n");
+  }
+
+  static void TearDownTestSuite() {
+    fmt::print("finish running RingBuffer test case...\n");
+  }
+
+  void SetUp() override { ring_ = std::make_unique<RingBuffer<uint64_t, 4>>(); }
+
+  void TearDown() override {}
+
+  std::unique_ptr<RingBuffer<uint64_t, 4>> ring_;
+};
+
+TEST_F(RingBufferTest, PushPop) {
+  uint64_t val = 0;
+  ASSERT_TRUE(ring_->Empty());
+  ASSERT_FALSE(ring_->Pop(&val));
+
+  // wraps around the storage a few times
+  for (uint64_t round = 0; round < 3; round++) {
+    for (uint64_t i = 0; i < 4; i++) {
+      ASSERT_TRUE(ring_->Push(round * 4 + i));
+    }
+    ASSERT_TRUE(ring_->Full());
+    ASSERT_FALSE(ring_->Push(UINT64_MAX));
+
+    ASSERT_TRUE(ring_->Peek(&val));
+    ASSERT_EQ(val, round * 4);
+    ASSERT_EQ(ring_->Size(), 4);
+
+    for (uint64_t i = 0; i < 4; i++) {
+      ASSERT_TRUE(ring_->Pop(&val));
+      ASSERT_EQ(val, round * 4 + i);
+    }
+    ASSERT_TRUE(ring_->Empty());
+  }
+}
+
+TEST_F(RingBufferTest, Clear) {
+  ASSERT_TRUE(ring_->Push(1));
+  ASSERT_TRUE(ring_->Push(2));
+  ring_->Clear();
+
+  uint64_t val = 0;
+  ASSERT_TRUE(ring_->Empty());
+  ASSERT_FALSE(ring_->Peek(&val));
+  ASSERT_TRUE(ring_->Push(3));
+  ASSERT_TRUE(ring_->Pop(&val));
+  ASSERT_EQ(val, 3);
+}
+
+TEST_F(RingBufferTest, ProducerConsumer) {
+  constexpr uint64_t kItems = 1 << 20;
+  auto ring = std::make_unique<RingBuffer<uint64_t, 1024>>();
+
+  // yield when blocked, the two sides may share a single host cpu
+  std::thread producer([&ring]() {
+    for (uint64_t i = 0; i < kItems;) {
+      if (ring->Push(i)) {
+        i++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  // every item arrives once and in order
+  uint64_t expected = 0;
+  uint64_t mismatches = 0;
+  while (expected < kItems) {
+    uint64_t val = 0;
+    if (ring->Pop(&val)) {
+      mismatches += val != expected;
+      expected++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  producer.join();
+  ASSERT_EQ(mismatches, 0);
+  ASSERT_TRUE(ring->Empty());
+}
@@ -0,0 +1,124 @@
+#include "device/scheduler.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "fmt/core.h"
+#include "gtest/gtest.h"
+
+using rv64_emulator::device::scheduler::kNoDeadline;
+using rv64_emulator::device::scheduler::Scheduler;
+
+constexpr uint64_t kMaxBudget = 1024;
+
+class SchedulerTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    fmt::print("start running Scheduler test case...\n");
+  }
+
+  static void TearDownTestSuite() {
+    fmt::print("finish running Scheduler test case...\n");
+  }
+
+  void SetUp() override {
+    scheduler_ = std::make_unique<Scheduler>(kMaxBudget);
+  }
+
+  void TearDown() override {}
+
+  std::unique_ptr<Scheduler> scheduler_;
+};
+
+TEST_F(SchedulerTest, RunExpired) {
+  std::vector<uint64_t> fired;
+  uint64_t timers[3];
+  for (uint64_t i = 0; i < 3; i++) {
+    timers[i] =
+        scheduler_->AddTimer([&fired, i](uint64_t) { fired.push_back(i); });
+  }
+  ASSERT_EQ(scheduler_->NextDeadline(), kNoDeadline);
+
+  scheduler_->Arm(timers[0], 30);
+  scheduler_->Arm(timers[1], 10);
+  scheduler_->Arm(timers[2], 20);
+  ASSERT_EQ(scheduler_->NextDeadline(), 10);
+
+  ASSERT_EQ(scheduler_->RunExpired(9), 0);
+  ASSERT_EQ(scheduler_->RunExpired(15), 1);
+  ASSERT_EQ(scheduler_->NextDeadline(), 20);
+
+  // a later deadline of the earliest timer moves the next one
+  scheduler_->Arm(timers[2], 40);
+  ASSERT_EQ(scheduler_->NextDeadline(), 30);
+  scheduler_->Disarm(timers[0]);
+  ASSERT_EQ(scheduler_->NextDeadline(), 40);
+
+  ASSERT_EQ(scheduler_->RunExpired(100), 1);
+  ASSERT_EQ(fired, (std::vector<uint64_t>{1, 2}));
+  ASSERT_EQ(scheduler_->NextDeadline(), kNoDeadline);
+}
+
+TEST_F(SchedulerTest, RearmInCallback) {
+  uint64_t fired = 0;
+  uint64_t timer = 0;
+  timer = scheduler_->AddTimer([&](uint64_t now) {
+    if (++fired < 3) {
+      scheduler_->Arm(timer, now + 10);
+    }
+  });
+  scheduler_->Arm(timer, 10);
+
+  ASSERT_EQ(scheduler_->RunExpired(10), 1);
+  ASSERT_EQ(scheduler_->NextDeadline(), 20);
+  ASSERT_EQ(scheduler_->RunExpired(20), 1);
+  ASSERT_EQ(scheduler_->RunExpired(30), 1);
+  ASSERT_EQ(scheduler_->NextDeadline(), kNoDeadline);
+  ASSERT_EQ(fired, 3);
+}
+
+TEST_F(SchedulerTest, Budget) {
+  // nothing armed or no runs accounted yet, every run gets the full budget
+  ASSERT_EQ(scheduler_->GetBudget(0), kMaxBudget);
+  const uint64_t kTimer = scheduler_->AddTimer([](uint64_t) {});
+  scheduler_->Arm(kTimer, 100);
+  ASSERT_EQ(scheduler_->GetBudget(0), kMaxBudget);
+
+  // 10 insts per tick
+  for (uint64_t i = 0; i < 200; i++) {
+    scheduler_->Account(1000, 100);
+  }
+  scheduler_->Arm(kTimer, 1000);
+  const uint64_t kBudget = scheduler_->GetBudget(990);
+  ASSERT_LE(kBudget, 100);
+  ASSERT_GE(kBudget, 90);
+  ASSERT_EQ(scheduler_->GetBudget(0), kMaxBudget);
+
+  // a due deadline still lets the hart make progress
+  ASSERT_EQ(scheduler_->GetBudget(1000), 1);
+  ASSERT_EQ(scheduler_->GetBudget(2000), 1);
+}
+
+TEST_F(SchedulerTest, Irq) {
+  uint64_t kicks = 0;
+  scheduler_->SetKick([&kicks]() { kicks++; });
+
+  ASSERT_FALSE(scheduler_->TakeIrq());
+  scheduler_->RaiseIrq();
+  scheduler_->RaiseIrq();
+  ASSERT_EQ(kicks, 2);
+  ASSERT_TRUE(scheduler_->TakeIrq());
+  ASSERT_FALSE(scheduler_->TakeIrq());
+
+  // a pending edge does not let the idle hart wait
+  scheduler_->RaiseIrq();
+  scheduler_->WaitIrq(0);
+  ASSERT_TRUE(scheduler_->TakeIrq());
+
+  // neither does a due deadline
+  const uint64_t kTimer = scheduler_->AddTimer([](uint64_t) {});
+  scheduler_->Arm(kTimer, 10);
+  scheduler_->WaitIrq(10);
+  ASSERT_FALSE(scheduler_->TakeIrq());
+}
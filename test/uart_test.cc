@@ -1,12 +1,18 @@
 #include "device/uart.h"
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <memory>
+#include <thread>
 #include <utility>
 
+#include "conf.h"
+#include "device/scheduler.h"
 #include "fmt/core.h"
 #include "gtest/gtest.h"
 
+using rv64_emulator::device::scheduler::Scheduler;
 using rv64_emulator::device::uart::Uart;
 
 class UartTest : public testing::Test {
@@ -43,13 +49,13 @@ TEST_F(UartTest, StoreInvalid) {
 }
 
 TEST_F(UartTest, StoreTxBuffer) {
-  for (const char c : kData) {
-    ASSERT_TRUE(uart_->Store(kTxFifoAddr, sizeof(c),
-                             reinterpret_cast<const uint8_t*>(&c)));
-    ASSERT_EQ(c, uart_->tx_buffer_.back());
+  for (uint64_t i = 0; i < sizeof(kData); i++) {
+    ASSERT_TRUE(uart_->Store(kTxFifoAddr, sizeof(kData[i]),
+                             reinterpret_cast<const uint8_t*>(&kData[i])));
+    ASSERT_EQ(i + 1, uart_->tx_buffer_.Size());
   }
 
-  ASSERT_EQ(sizeof(kData), uart_->tx_buffer_.size());
+  ASSERT_EQ(sizeof(kData), uart_->tx_buffer_.Size());
   for (const char c : kData) {
     ASSERT_EQ(c, uart_->Getc());
   }
@@ -65,7 +71,7 @@ TEST_F(UartTest, StoreControlRstTx) {
       ASSERT_TRUE(uart_->Store(kTxFifoAddr, sizeof(c),
                                reinterpret_cast<const uint8_t*>(&c)));
     }
-    ASSERT_EQ(sizeof(kData), uart_->tx_buffer_.size());
+    ASSERT_EQ(sizeof(kData), uart_->tx_buffer_.Size());
 
     ASSERT_TRUE(uart_->Store(kControlAddr, sizeof(kCmd),
                              reinterpret_cast<const uint8_t*>(&kCmd)));
@@ -79,13 +85,13 @@ TEST_F(UartTest, StoreControlRstRx) {
   for (const char c : kData) {
     uart_->Putc(c);
   }
-  ASSERT_EQ(sizeof(kData), uart_->rx_buffer_.size());
+  ASSERT_EQ(sizeof(kData), uart_->rx_buffer_.Size());
 
   constexpr uint32_t kRstRx[] = {~kControlRstRx, kControlRstRx};
   for (const uint32_t kCmd : kRstRx) {
     ASSERT_TRUE(uart_->Store(kControlAddr, sizeof(kCmd),
                              reinterpret_cast<const uint8_t*>(&kCmd)));
-    ASSERT_NE(uart_->rx_buffer_.size() != 0, kCmd & kControlRstRx);
+    ASSERT_NE(uart_->rx_buffer_.Size() != 0, kCmd & kControlRstRx);
   }
 }
 
@@ -95,13 +101,13 @@ TEST_F(UartTest, StoreControlRstRxTx) {
     ASSERT_TRUE(uart_->Store(kTxFifoAddr, sizeof(c),
                              reinterpret_cast<const uint8_t*>(&c)));
   }
-  ASSERT_EQ(sizeof(kData), uart_->rx_buffer_.size());
-  ASSERT_EQ(sizeof(kData), uart_->tx_buffer_.size());
+  ASSERT_EQ(sizeof(kData), uart_->rx_buffer_.Size());
+  ASSERT_EQ(sizeof(kData), uart_->tx_buffer_.Size());
 
   constexpr uint32_t kRstRxTxCmd = kControlRstRx | kControlRstTx;
   ASSERT_TRUE(uart_->Store(kControlAddr, sizeof(kRstRxTxCmd),
                            reinterpret_cast<const uint8_t*>(&kRstRxTxCmd)));
-  ASSERT_EQ(0, uart_->rx_buffer_.size());
+  ASSERT_EQ(0, uart_->rx_buffer_.Size());
   ASSERT_FALSE(uart_->TxBufferNotEmpty());
 }
 
@@ -119,3 +125,92 @@ TEST_F(UartTest, Irq) {
   ASSERT_EQ(kData[0], uart_->Getc());
   ASSERT_TRUE(uart_->wait_ack_);
 }
+
+TEST_F(UartTest, TxFifoFull) {
+  constexpr uint64_t kStatusAddr = offsetof(Uart::UartReg, status);
+  constexpr uint32_t kTxFifoFull = 0b1000;
+
+  for (uint64_t i = 0; i < kUartBufferSize + 1; i++) {
+    ASSERT_TRUE(uart_->Store(kTxFifoAddr, sizeof(kData[0]),
+                             reinterpret_cast<const uint8_t*>(&kData[0])));
+  }
+  ASSERT_EQ(kUartBufferSize, uart_->tx_buffer_.Size());
+
+  uint32_t status = 0;
+  ASSERT_TRUE(uart_->Load(kStatusAddr, sizeof(status),
+                          reinterpret_cast<uint8_t*>(&status)));
+  ASSERT_TRUE(status & kTxFifoFull);
+
+  ASSERT_EQ(kData[0], uart_->Getc());
+  ASSERT_TRUE(uart_->Load(kStatusAddr, sizeof(status),
+                          reinterpret_cast<uint8_t*>(&status)));
+  ASSERT_FALSE(status & kTxFifoFull);
+}
+
+TEST_F(UartTest, IrqEdge) {
+  Scheduler scheduler(kRunBudget);
+  uart_->SetScheduler(&scheduler);
+
+  // polling the status register alone is no edge
+  constexpr uint64_t kStatusAddr = offsetof(Uart::UartReg, status);
+  uint32_t status = 0;
+  ASSERT_TRUE(uart_->Load(kStatusAddr, sizeof(status),
+                          reinterpret_cast<uint8_t*>(&status)));
+  ASSERT_FALSE(scheduler.TakeIrq());
+
+  uart_->Putc(kData[0]);
+  ASSERT_TRUE(scheduler.TakeIrq());
+
+  constexpr uint64_t kRxFifoAddr = offsetof(Uart::UartReg, rx_fifo);
+  uint32_t rx = 0;
+  ASSERT_TRUE(uart_->Load(kRxFifoAddr, sizeof(rx),
+                          reinterpret_cast<uint8_t*>(&rx)));
+  ASSERT_EQ(rx, kData[0]);
+  ASSERT_TRUE(scheduler.TakeIrq());
+
+  // the host console drained tx
+  ASSERT_TRUE(uart_->Store(kTxFifoAddr, sizeof(kData[1]),
+                           reinterpret_cast<const uint8_t*>(&kData[1])));
+  ASSERT_FALSE(scheduler.TakeIrq());
+  ASSERT_EQ(uart_->Getc(), kData[1]);
+  ASSERT_TRUE(scheduler.TakeIrq());
+}
+
+TEST_F(UartTest, ConcurrentRx) {
+  // byte n typed on the host is n % 251, pushed while the guest keeps
+  // reading rx_fifo, also when it has nothing yet
+  constexpr uint64_t kBytes = 1 << 20;
+  // the guest side raises stop when it gives up, a full ring then no longer
+  // keeps the host side spinning
+  std::atomic<bool> stop = false;
+  std::thread input([this, &stop]() {
+    for (uint64_t i = 0;
+         i < kBytes && !stop.load(std::memory_order_relaxed);) {
+      if (!uart_->rx_buffer_.Full()) {
+        uart_->Putc(static_cast<char>(i++ % 251));
+      }
+    }
+  });
+
+  constexpr uint32_t kRxFifoValidData = 0b0001;
+  const auto kDeadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  uint64_t received = 0;
+  uint64_t mismatches = 0;
+  bool loaded = true;
+  while (loaded && received < kBytes &&
+         std::chrono::steady_clock::now() < kDeadline) {
+    Uart::UartReg reg;
+    loaded = uart_->Load(0, sizeof(reg), reinterpret_cast<uint8_t*>(&reg));
+    if (loaded && (reg.status & kRxFifoValidData)) {
+      mismatches += static_cast<char>(reg.rx_fifo) !=
+                    static_cast<char>(received++ % 251);
+    }
+  }
+  stop.store(true, std::memory_order_relaxed);
+  input.join();
+  ASSERT_TRUE(loaded);
+  // a byte popped without being shown in rx_fifo would be lost
+  ASSERT_EQ(received, kBytes);
+  ASSERT_EQ(mismatches, 0);
+}
@@ -0,0 +1,324 @@
+#include "device/virtio_blk.h"
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "conf.h"
+#include "device/block.h"
+#include "device/bus.h"
+#include "device/dram.h"
+#include "device/virtio.h"
+#include "device/virtqueue.h"
+#include "fmt/core.h"
+#include "gtest/gtest.h"
+#include "virtio_driver.h"
+
+using namespace rv64_emulator::device::virtio;
+using rv64_emulator::device::block::Backend;
+using rv64_emulator::device::block::kSectorBytes;
+using rv64_emulator::device::block::RawImage;
+using rv64_emulator::device::bus::Bus;
+using rv64_emulator::device::dram::DRAM;
+
+constexpr uint16_t kQueueSize = 32;
+constexpr uint64_t kImageSectors = 256;
+
+constexpr uint64_t kRingAddr = kDramBaseAddr + 0x1000;
+constexpr uint64_t kHeaderAddr = kDramBaseAddr + 0x4000;
+constexpr uint64_t kStatusAddr = kDramBaseAddr + 0x5000;
+constexpr uint64_t kBufAddr = kDramBaseAddr + 0x10000;
+
+// holds every read until the test opens the gate
+class GatedImage : public Backend {
+ public:
+  explicit GatedImage(std::unique_ptr<Backend> image)
+      : image_(std::move(image)) {}
+
+  uint64_t GetSize() const override { return image_->GetSize(); }
+  bool IsReadOnly() const override { return image_->IsReadOnly(); }
+  bool Read(uint64_t offset, const iovec* iov, int iovcnt) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    reading_ = true;
+    cv_.notify_all();
+    cv_.wait(lock, [this]() { return open_; });
+    return image_->Read(offset, iov, iovcnt);
+  }
+  bool Write(uint64_t offset, const iovec* iov, int iovcnt) override {
+    return image_->Write(offset, iov, iovcnt);
+  }
+  bool Flush() override { return image_->Flush(); }
+
+  void WaitReading() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return reading_; });
+  }
+  void Open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_ = true;
+    cv_.notify_all();
+  }
+
+ private:
+  std::unique_ptr<Backend> image_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool reading_ = false;
+  bool open_ = false;
+};
+
+class VirtioBlkTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    fmt::print("start running VirtioBlk test case...\n");
+  }
+
+  static void TearDownTestSuite() {
+    fmt::print("finish running VirtioBlk test case...\n");
+  }
+
+  void SetUp() override {
+    char path[] = "/tmp/virtio_blk_test_XXXXXX";
+    fd_ = mkstemp(path);
+    ASSERT_GE(fd_, 0);
+    path_ = path;
+    // sector n is filled with the byte n
+    for (uint64_t i = 0; i < kImageSectors; i++) {
+      std::vector<uint8_t> sector(kSectorBytes, i);
+      ASSERT_EQ(pwrite(fd_, sector.data(), kSectorBytes, i * kSectorBytes),
+                kSectorBytes);
+    }
+
+    bus_ = std::make_unique<Bus>();
+    bus_->MountDevice({
+        .base = kDramBaseAddr,
+        .size = kDramSize,
+        .dev = std::make_unique<DRAM>(kDramSize),
+    });
+  }
+
+  void TearDown() override {
+    if (driver_) {
+      EXPECT_EQ(driver_->GetFailedAccesses(), 0);
+    }
+    driver_.reset();
+    dev_.reset();
+    close(fd_);
+    unlink(path_.c_str());
+  }
+
+  void MakeDevice(bool read_only) {
+    auto image = std::make_unique<RawImage>();
+    ASSERT_TRUE(image->Open(path_.c_str(), read_only));
+    MakeDevice(std::move(image));
+  }
+
+  void MakeDevice(std::unique_ptr<Backend> backend) {
+    dev_ = std::make_unique<VirtioBlk>(bus_.get(), std::move(backend), 2,
+                                       kQueueSize);
+    driver_ = std::make_unique<VirtioDriver>(bus_.get(), dev_.get(),
+                                             kRingAddr, kQueueSize);
+  }
+
+  uint8_t* Buf(uint64_t offset) {
+    return bus_->GetHostPtr(kBufAddr + offset, 1);
+  }
+
+  uint8_t Status(uint16_t slot) {
+    return *bus_->GetHostPtr(kStatusAddr + slot, 1);
+  }
+
+  // request slot uses descriptors 3 * slot to 3 * slot + 2, the header, the
+  // data at buf offset if there is any and the status byte
+  void AddRequest(uint16_t slot, uint32_t type, uint64_t sector,
+                  uint64_t offset, uint32_t bytes) {
+    const uint16_t kHead = slot * 3;
+    const BlkReqHeader kHeader = {
+        .type = type, .reserved = 0, .sector = sector};
+    memcpy(bus_->GetHostPtr(kHeaderAddr + slot * sizeof(kHeader), 1),
+           &kHeader, sizeof(kHeader));
+    *bus_->GetHostPtr(kStatusAddr + slot, 1) = 0xff;
+
+    VirtqDesc* desc = driver_->Desc(0);
+    desc[kHead] = {.addr = kHeaderAddr + slot * sizeof(kHeader),
+                   .len = sizeof(kHeader),
+                   .flags = kDescFlagNext,
+                   .next = static_cast<uint16_t>(kHead + 1)};
+    uint16_t status = kHead + 1;
+    if (bytes) {
+      desc[kHead + 1] = {
+          .addr = kBufAddr + offset,
+          .len = bytes,
+          .flags = static_cast<uint16_t>(
+              kDescFlagNext | (type == kBlkTypeOut ? 0 : kDescFlagWrite)),
+          .next = static_cast<uint16_t>(kHead + 2)};
+      status = kHead + 2;
+    }
+    desc[status] = {.addr = kStatusAddr + slot,
+                    .len = 1,
+                    .flags = kDescFlagWrite,
+                    .next = 0};
+    driver_->Publish(0, kHead);
+  }
+
+  int fd_;
+  std::string path_;
+  std::unique_ptr<Bus> bus_;
+  std::unique_ptr<VirtioBlk> dev_;
+  std::unique_ptr<VirtioDriver> driver_;
+};
+
+TEST_F(VirtioBlkTest, Config) {
+  MakeDevice(false);
+  ASSERT_EQ(driver_->ReadReg(kDeviceId), kBlkDeviceId);
+  ASSERT_EQ(
+      driver_->ReadReg(kDeviceFeatures) & (kBlkFeatureFlush | kBlkFeatureRo),
+      kBlkFeatureFlush);
+  ASSERT_EQ(driver_->ReadReg(kConfig), kImageSectors);
+  ASSERT_EQ(driver_->ReadReg(kConfig + 4), 0);
+  ASSERT_EQ(driver_->ReadReg(kConfig + 20), kSectorBytes);
+
+  MakeDevice(true);
+  ASSERT_TRUE(driver_->ReadReg(kDeviceFeatures) & kBlkFeatureRo);
+}
+
+TEST_F(VirtioBlkTest, ReadWrite) {
+  MakeDevice(false);
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kBlkFeatureFlush, 1));
+
+  memset(Buf(0), 0xaa, 2 * kSectorBytes);
+  AddRequest(0, kBlkTypeOut, 10, 0, 2 * kSectorBytes);
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_TRUE(driver_->WaitUsed(0, 1));
+  ASSERT_EQ(Status(0), kBlkStatusOk);
+  ASSERT_EQ(driver_->UsedElem(0, 0).len, 1);
+  ASSERT_TRUE(dev_->Irq());
+  driver_->WriteReg(kInterruptAck, kInterruptUsedBuffer);
+
+  AddRequest(1, kBlkTypeFlush, 0, 0, 0);
+  AddRequest(2, kBlkTypeIn, 9, 0x1000, 4 * kSectorBytes);
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_TRUE(driver_->WaitUsed(0, 3));
+  ASSERT_EQ(Status(1), kBlkStatusOk);
+  ASSERT_EQ(Status(2), kBlkStatusOk);
+  ASSERT_TRUE(dev_->Irq());
+  for (uint64_t i = 0; i < 4; i++) {
+    const uint8_t kExpect = (i == 1 || i == 2) ? 0xaa : 9 + i;
+    ASSERT_EQ(Buf(0x1000 + i * kSectorBytes)[0], kExpect);
+  }
+
+  // the write reached the image
+  uint8_t byte = 0;
+  ASSERT_EQ(pread(fd_, &byte, 1, 11 * kSectorBytes), 1);
+  ASSERT_EQ(byte, 0xaa);
+}
+
+TEST_F(VirtioBlkTest, Outstanding) {
+  MakeDevice(false);
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kBlkFeatureFlush, 1));
+
+  // every request is in flight before the first one completes
+  constexpr uint16_t kRequests = kQueueSize / 3;
+  for (uint16_t i = 0; i < kRequests; i++) {
+    AddRequest(i, kBlkTypeIn, i * 7, i * 0x1000, 0x1000);
+  }
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_TRUE(driver_->WaitUsed(0, kRequests));
+
+  std::vector<bool> seen(kRequests, false);
+  for (uint16_t i = 0; i < kRequests; i++) {
+    const VirtqUsedElem kElem = driver_->UsedElem(0, i);
+    const uint16_t kSlot = kElem.id / 3;
+    ASSERT_EQ(kElem.len, 0x1000 + 1);
+    ASSERT_FALSE(seen[kSlot]);
+    seen[kSlot] = true;
+    ASSERT_EQ(Status(kSlot), kBlkStatusOk);
+    ASSERT_EQ(Buf(kSlot * 0x1000)[0], kSlot * 7);
+    ASSERT_EQ(Buf(kSlot * 0x1000 + 0xfff)[0], kSlot * 7 + 7);
+  }
+}
+
+TEST_F(VirtioBlkTest, Errors) {
+  MakeDevice(true);
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kBlkFeatureFlush, 1));
+
+  AddRequest(0, kBlkTypeIn, kImageSectors - 1, 0, 2 * kSectorBytes);
+  AddRequest(1, kBlkTypeIn, 0, 0, 100);
+  AddRequest(2, kBlkTypeOut, 0, 0, kSectorBytes);
+  AddRequest(3, 42, 0, 0, 0);
+  AddRequest(4, kBlkTypeGetId, 0, 0x1000, kBlkIdBytes);
+  // no status byte
+  driver_->Desc(0)[15] = {
+      .addr = kHeaderAddr, .len = sizeof(BlkReqHeader), .flags = 0, .next = 0};
+  driver_->Publish(0, 15);
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_TRUE(driver_->WaitUsed(0, 6));
+
+  ASSERT_EQ(Status(0), kBlkStatusIoErr);
+  ASSERT_EQ(Status(1), kBlkStatusIoErr);
+  ASSERT_EQ(Status(2), kBlkStatusIoErr);
+  ASSERT_EQ(Status(3), kBlkStatusUnsupp);
+  ASSERT_EQ(Status(4), kBlkStatusOk);
+  ASSERT_STREQ(reinterpret_cast<const char*>(Buf(0x1000)), "rv64_emulator");
+  for (uint16_t i = 0; i < 6; i++) {
+    if (driver_->UsedElem(0, i).id == 15) {
+      ASSERT_EQ(driver_->UsedElem(0, i).len, 0);
+    }
+  }
+}
+
+TEST_F(VirtioBlkTest, ResetWaits) {
+  MakeDevice(false);
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kBlkFeatureFlush, 1));
+
+  for (uint16_t i = 0; i < kQueueSize / 3; i++) {
+    AddRequest(i, kBlkTypeIn, i, i * 0x1000, 0x1000);
+  }
+  driver_->WriteReg(kQueueNotify, 0);
+  // nothing is left running on the old rings
+  driver_->WriteReg(kStatus, 0);
+  ASSERT_EQ(dev_->in_flight_, 0);
+  ASSERT_EQ(driver_->ReadReg(kQueueReady), 0);
+  ASSERT_FALSE(dev_->Irq());
+}
+
+TEST_F(VirtioBlkTest, RepublishedHead) {
+  auto image = std::make_unique<RawImage>();
+  ASSERT_TRUE(image->Open(path_.c_str(), false));
+  auto gated = std::make_unique<GatedImage>(std::move(image));
+  GatedImage* gate = gated.get();
+  MakeDevice(std::move(gated));
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kBlkFeatureFlush, 1));
+
+  AddRequest(0, kBlkTypeIn, 5, 0, 0x1000);
+  driver_->WriteReg(kQueueNotify, 0);
+  gate->WaitReading();
+
+  // the head comes back while a worker reads into its buffers, the device
+  // gives up instead of parsing the chain over the request
+  driver_->Publish(0, 0);
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_TRUE(driver_->ReadReg(kStatus) & kStatusNeedsReset);
+  ASSERT_TRUE(driver_->ReadReg(kInterruptStatus) & kInterruptConfigChange);
+
+  // the request in flight completes untouched
+  gate->Open();
+  ASSERT_TRUE(driver_->WaitUsed(0, 1));
+  ASSERT_EQ(driver_->UsedElem(0, 0).id, 0);
+  ASSERT_EQ(driver_->UsedElem(0, 0).len, 0x1000 + 1);
+  ASSERT_EQ(Status(0), kBlkStatusOk);
+  ASSERT_EQ(Buf(0)[0], 5);
+  ASSERT_EQ(Buf(0xfff)[0], 5 + 7);
+
+  // a reset brings the device back
+  driver_->WriteReg(kStatus, 0);
+  ASSERT_FALSE(driver_->ReadReg(kStatus) & kStatusNeedsReset);
+}
@@ -0,0 +1,291 @@
+#include "device/virtio_console.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "conf.h"
+#include "device/bus.h"
+#include "device/dram.h"
+#include "device/virtio.h"
+#include "device/virtqueue.h"
+#include "fmt/core.h"
+#include "gtest/gtest.h"
+#include "virtio_driver.h"
+
+using namespace rv64_emulator::device::virtio;
+using rv64_emulator::device::bus::Bus;
+using rv64_emulator::device::dram::DRAM;
+
+constexpr uint16_t kQueueSize = 16;
+constexpr uint32_t kPorts = 2;
+constexpr uint32_t kQueues = 2 * (kPorts + 1);
+constexpr uint64_t kMultiportFeatures =
+    kFeatureVersion1 | kConsoleFeatureMultiport;
+
+// queue n has its buffers at kBufAddr + n * kBufStride, one kSlotBytes
+// buffer per descriptor
+constexpr uint64_t kRingAddr = kDramBaseAddr;
+constexpr uint64_t kBufAddr = kDramBaseAddr + 0x100000;
+constexpr uint64_t kSlotBytes = 0x40000;
+constexpr uint64_t kBufStride = kSlotBytes * kQueueSize;
+
+class VirtioConsoleTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    fmt::print("start running VirtioConsole test case...\n");
+  }
+
+  static void TearDownTestSuite() {
+    fmt::print("finish running VirtioConsole test case...\n");
+  }
+
+  void SetUp() override {
+    bus_ = std::make_unique<Bus>();
+    bus_->MountDevice({
+        .base = kDramBaseAddr,
+        .size = kDramSize,
+        .dev = std::make_unique<DRAM>(kDramSize),
+    });
+
+    // port 0 is the console, port 1 a named one
+    std::vector<ConsolePort> ports;
+    for (uint32_t i = 0; i < kPorts; i++) {
+      ASSERT_EQ(pipe(in_[i]), 0);
+      ASSERT_EQ(pipe2(out_[i], O_NONBLOCK), 0);
+      ports.push_back({.name = i ? "log" : "",
+                       .console = i == 0,
+                       .in_fd = in_[i][0],
+                       .out_fd = out_[i][1]});
+    }
+    dev_ = std::make_unique<VirtioConsole>(bus_.get(), std::move(ports),
+                                           kQueueSize);
+    driver_ = std::make_unique<VirtioDriver>(bus_.get(), dev_.get(),
+                                             kRingAddr, kQueueSize);
+  }
+
+  void TearDown() override {
+    EXPECT_EQ(driver_->GetFailedAccesses(), 0);
+    driver_.reset();
+    dev_.reset();
+    for (uint32_t i = 0; i < kPorts; i++) {
+      for (const int kFd : {in_[i][0], in_[i][1], out_[i][0], out_[i][1]}) {
+        close(kFd);
+      }
+    }
+  }
+
+  uint8_t* Buf(uint32_t queue, uint16_t slot) {
+    return bus_->GetHostPtr(kBufAddr + queue * kBufStride + slot * kSlotBytes,
+                            1);
+  }
+
+  // slot uses descriptor slot and its buffer, bytes of output for tx queues
+  // and control messages, room for that much for rx ones
+  void AddBuffer(uint32_t queue, uint16_t slot, uint32_t bytes) {
+    const bool kRx = queue == kConsoleControlRxQueue || queue % 2 == 0;
+    driver_->Desc(queue)[slot] = {
+        .addr = kBufAddr + queue * kBufStride + slot * kSlotBytes,
+        .len = bytes,
+        .flags = kRx ? kDescFlagWrite : uint16_t(0),
+        .next = 0};
+    driver_->Publish(queue, slot);
+  }
+
+  void SendControl(uint32_t id, uint16_t event, uint16_t value) {
+    const ConsoleControl kMsg = {.id = id, .event = event, .value = value};
+    const uint16_t kSlot = control_sent_++ % kQueueSize;
+    memcpy(Buf(kConsoleControlTxQueue, kSlot), &kMsg, sizeof(kMsg));
+    AddBuffer(kConsoleControlTxQueue, kSlot, sizeof(kMsg));
+    driver_->WriteReg(kQueueNotify, kConsoleControlTxQueue);
+  }
+
+  // the control message the device put in the index-th used buffer
+  ConsoleControl Control(uint16_t index) {
+    ConsoleControl msg;
+    const VirtqUsedElem kElem =
+        driver_->UsedElem(kConsoleControlRxQueue, index);
+    memcpy(&msg, Buf(kConsoleControlRxQueue, kElem.id), sizeof(msg));
+    return msg;
+  }
+
+  // what arrived at the host end of a port within a second
+  std::string ReadOut(uint32_t port) {
+    pollfd fd = {.fd = out_[port][0], .events = POLLIN, .revents = 0};
+    if (poll(&fd, 1, 1000) != 1) {
+      return "";
+    }
+    char buf[4096];
+    const ssize_t kBytes = read(out_[port][0], buf, sizeof(buf));
+    return std::string(buf, kBytes > 0 ? kBytes : 0);
+  }
+
+  int in_[kPorts][2];
+  int out_[kPorts][2];
+  std::unique_ptr<Bus> bus_;
+  std::unique_ptr<VirtioConsole> dev_;
+  std::unique_ptr<VirtioDriver> driver_;
+  uint16_t control_sent_ = 0;
+};
+
+TEST_F(VirtioConsoleTest, Config) {
+  ASSERT_EQ(driver_->ReadReg(kDeviceId), kConsoleDeviceId);
+  ASSERT_TRUE(driver_->ReadReg(kDeviceFeatures) & kConsoleFeatureMultiport);
+  ASSERT_EQ(driver_->ReadReg(kConfig + 4), kPorts);
+  driver_->WriteReg(kQueueSel, kQueues - 1);
+  ASSERT_EQ(driver_->ReadReg(kQueueNumMax), kQueueSize);
+  driver_->WriteReg(kQueueSel, kQueues);
+  ASSERT_EQ(driver_->ReadReg(kQueueNumMax), 0);
+}
+
+TEST_F(VirtioConsoleTest, Handshake) {
+  ASSERT_TRUE(driver_->Init(kMultiportFeatures, kQueues));
+  for (uint16_t i = 0; i < 8; i++) {
+    AddBuffer(kConsoleControlRxQueue, i, 4096);
+  }
+  driver_->WriteReg(kQueueNotify, kConsoleControlRxQueue);
+
+  // every port gets added once the driver is ready
+  SendControl(0, kConsoleDeviceReady, 1);
+  ASSERT_TRUE(driver_->WaitUsed(kConsoleControlRxQueue, kPorts));
+  for (uint32_t i = 0; i < kPorts; i++) {
+    ASSERT_EQ(Control(i).id, i);
+    ASSERT_EQ(Control(i).event, kConsoleDeviceAdd);
+  }
+
+  // then the ports are described and opened on the host side
+  SendControl(0, kConsolePortReady, 1);
+  SendControl(1, kConsolePortReady, 1);
+  ASSERT_TRUE(driver_->WaitUsed(kConsoleControlRxQueue, kPorts + 4));
+  const uint16_t kEvents[] = {kConsoleConsolePort, kConsolePortOpen,
+                              kConsolePortName, kConsolePortOpen};
+  for (uint16_t i = 0; i < 4; i++) {
+    ASSERT_EQ(Control(kPorts + i).id, i / 2);
+    ASSERT_EQ(Control(kPorts + i).event, kEvents[i]);
+    ASSERT_EQ(Control(kPorts + i).value, 1);
+  }
+  const VirtqUsedElem kName =
+      driver_->UsedElem(kConsoleControlRxQueue, kPorts + 2);
+  ASSERT_EQ(kName.len, sizeof(ConsoleControl) + 3);
+  ASSERT_EQ(memcmp(Buf(kConsoleControlRxQueue, kName.id) +
+                       sizeof(ConsoleControl),
+                   "log", 3),
+            0);
+}
+
+TEST_F(VirtioConsoleTest, BufferedOutput) {
+  ASSERT_TRUE(driver_->Init(kMultiportFeatures, kQueues));
+
+  // a burst of small writes reaches the host in one piece
+  const uint32_t kTx = ConsoleRxQueue(1) + 1;
+  std::string expect;
+  for (uint16_t i = 0; i < 8; i++) {
+    const std::string kLine = fmt::format("log line {}\n", i);
+    memcpy(Buf(kTx, i), kLine.data(), kLine.size());
+    AddBuffer(kTx, i, kLine.size());
+    expect += kLine;
+  }
+  driver_->WriteReg(kQueueNotify, kTx);
+  ASSERT_TRUE(driver_->WaitUsed(kTx, 8));
+  ASSERT_TRUE(dev_->Irq());
+  ASSERT_EQ(ReadOut(1), expect);
+  // nothing went to the console
+  char c = 0;
+  ASSERT_LT(read(out_[0][0], &c, sizeof(c)), 0);
+}
+
+TEST_F(VirtioConsoleTest, Backpressure) {
+  ASSERT_TRUE(driver_->Init(kMultiportFeatures, kQueues));
+  ASSERT_GT(fcntl(out_[0][0], F_SETPIPE_SZ, 4096), 0);
+
+  // byte n of the output is n % 251
+  const uint32_t kTx = ConsoleRxQueue(0) + 1;
+  uint64_t total = 0;
+  for (uint16_t i = 0; i < kQueueSize; i++) {
+    for (uint64_t j = 0; j < kSlotBytes; j++) {
+      Buf(kTx, i)[j] = (total + j) % 251;
+    }
+    AddBuffer(kTx, i, kSlotBytes);
+    total += kSlotBytes;
+  }
+  driver_->WriteReg(kQueueNotify, kTx);
+
+  // the host buffer fills up and the rest stays with the guest
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  ASSERT_LT(driver_->UsedIdx(kTx), kQueueSize);
+
+  uint64_t received = 0;
+  while (received < total) {
+    const std::string kData = ReadOut(0);
+    ASSERT_FALSE(kData.empty());
+    uint64_t mismatches = 0;
+    for (uint64_t i = 0; i < kData.size(); i++) {
+      mismatches += static_cast<uint8_t>(kData[i]) != (received + i) % 251;
+    }
+    ASSERT_EQ(mismatches, 0);
+    received += kData.size();
+  }
+  ASSERT_TRUE(driver_->WaitUsed(kTx, kQueueSize));
+}
+
+TEST_F(VirtioConsoleTest, Input) {
+  ASSERT_TRUE(driver_->Init(kMultiportFeatures, kQueues));
+  const uint32_t kRx = ConsoleRxQueue(1);
+  AddBuffer(kRx, 0, 64);
+  AddBuffer(kRx, 1, 64);
+  driver_->WriteReg(kQueueNotify, kRx);
+
+  // input waits on the host until the guest opens the port
+  ASSERT_EQ(write(in_[1][1], "hello", 5), 5);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_EQ(driver_->UsedIdx(kRx), 0);
+
+  SendControl(1, kConsolePortOpen, 1);
+  ASSERT_TRUE(driver_->WaitUsed(kRx, 1));
+  ASSERT_EQ(driver_->UsedElem(kRx, 0).len, 5);
+  ASSERT_EQ(memcmp(Buf(kRx, driver_->UsedElem(kRx, 0).id), "hello", 5), 0);
+
+  // the end of the input keeps the other buffer with the guest
+  close(in_[1][1]);
+  in_[1][1] = -1;
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_EQ(driver_->UsedIdx(kRx), 1);
+}
+
+TEST_F(VirtioConsoleTest, SinglePort) {
+  // without multiport port 0 is a plain console, open from the start
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1, 2));
+  AddBuffer(0, 0, 64);
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_EQ(write(in_[0][1], "ls\r", 3), 3);
+  ASSERT_TRUE(driver_->WaitUsed(0, 1));
+  ASSERT_EQ(driver_->UsedElem(0, 0).len, 3);
+
+  memcpy(Buf(1, 0), "ls\r\n", 4);
+  AddBuffer(1, 0, 4);
+  driver_->WriteReg(kQueueNotify, 1);
+  ASSERT_EQ(ReadOut(0), "ls\r\n");
+}
+
+TEST_F(VirtioConsoleTest, Reset) {
+  ASSERT_TRUE(driver_->Init(kMultiportFeatures, kQueues));
+  SendControl(0, kConsoleDeviceReady, 1);
+  SendControl(1, kConsolePortOpen, 1);
+  ASSERT_TRUE(driver_->WaitUsed(kConsoleControlTxQueue, 2));
+
+  // the next driver starts over with closed ports
+  driver_->WriteReg(kStatus, 0);
+  std::lock_guard<std::mutex> lock(dev_->mutex_);
+  ASSERT_FALSE(dev_->ports_[1].guest_open);
+  ASSERT_TRUE(dev_->control_.empty());
+  ASSERT_EQ(dev_->queues_[kConsoleControlRxQueue].IsReady(), false);
+}
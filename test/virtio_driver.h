@@ -0,0 +1,201 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "device/bus.h"
+#include "device/mmio.hpp"
+#include "device/virtio.h"
+#include "device/virtqueue.h"
+
+namespace rv64_emulator::device::virtio {
+
+// queue n has its descriptor table at the ring address + n * kDriverRingStride,
+// its avail ring 4K and its used ring 8K behind it
+constexpr uint64_t kDriverRingStride = 0x4000;
+
+// plays the guest side of a virtio-mmio device for the unit tests and the
+// benchmarks, through its registers and the rings in guest memory
+class VirtioDriver {
+ public:
+  VirtioDriver(bus::Bus* bus, MmioDevice* dev, uint64_t ring_addr,
+               uint16_t queue_size)
+      : bus_(bus),
+        dev_(dev),
+        ring_addr_(ring_addr),
+        queue_size_(queue_size) {}
+
+  // UINT32_MAX if the device refuses the access
+  uint32_t ReadReg(uint64_t addr) {
+    uint32_t val = UINT32_MAX;
+    if (!dev_->Load(addr, sizeof(val), reinterpret_cast<uint8_t*>(&val))) {
+      failed_accesses_++;
+      return UINT32_MAX;
+    }
+    return val;
+  }
+
+  bool WriteReg(uint64_t addr, uint32_t val) {
+    if (!dev_->Store(addr, sizeof(val),
+                     reinterpret_cast<const uint8_t*>(&val))) {
+      failed_accesses_++;
+      return false;
+    }
+    return true;
+  }
+
+  // register accesses the device refused so far
+  uint64_t GetFailedAccesses() const { return failed_accesses_; }
+
+  // the driver side of the virtio initialization, sets up queues 0 to queues
+  // - 1 and forgets everything about earlier rings
+  bool Init(uint64_t features, uint32_t queues) {
+    WriteReg(kStatus, kStatusAcknowledge | kStatusDriver);
+    WriteReg(kDriverFeaturesSel, 0);
+    WriteReg(kDriverFeatures, features);
+    WriteReg(kDriverFeaturesSel, 1);
+    WriteReg(kDriverFeatures, features >> 32);
+    WriteReg(kStatus, kStatusAcknowledge | kStatusDriver | kStatusFeaturesOk);
+    if (!(ReadReg(kStatus) & kStatusFeaturesOk)) {
+      return false;
+    }
+    event_idx_ = features & kFeatureEventIdx;
+
+    queues_.assign(queues, {});
+    for (uint32_t i = 0; i < queues; i++) {
+      const uint64_t kRing = ring_addr_ + i * kDriverRingStride;
+      WriteReg(kQueueSel, i);
+      WriteReg(kQueueNum, queue_size_);
+      WriteReg(kQueueDescLow, kRing);
+      WriteReg(kQueueDescHigh, kRing >> 32);
+      WriteReg(kQueueDriverLow, kRing + 0x1000);
+      WriteReg(kQueueDriverHigh, (kRing + 0x1000) >> 32);
+      WriteReg(kQueueDeviceLow, kRing + 0x2000);
+      WriteReg(kQueueDeviceHigh, (kRing + 0x2000) >> 32);
+      WriteReg(kQueueReady, 1);
+      if (ReadReg(kQueueReady) != 1) {
+        return false;
+      }
+
+      queues_[i].desc = reinterpret_cast<VirtqDesc*>(
+          bus_->GetHostPtr(kRing, sizeof(VirtqDesc) * queue_size_));
+      queues_[i].avail = reinterpret_cast<uint16_t*>(bus_->GetHostPtr(
+          kRing + 0x1000, sizeof(uint16_t) * (3 + queue_size_)));
+      queues_[i].used = reinterpret_cast<uint16_t*>(
+          bus_->GetHostPtr(kRing + 0x2000, sizeof(uint16_t) * 3 +
+                                               sizeof(VirtqUsedElem) *
+                                                   queue_size_));
+    }
+    return WriteReg(kStatus, kStatusAcknowledge | kStatusDriver |
+                                 kStatusFeaturesOk | kStatusDriverOk);
+  }
+
+  // the rings of a queue set up by Init
+  VirtqDesc* Desc(uint32_t queue) { return queues_[queue].desc; }
+  uint16_t* Avail(uint32_t queue) { return queues_[queue].avail; }
+  uint16_t* Used(uint32_t queue) { return queues_[queue].used; }
+  uint16_t* UsedEvent(uint32_t queue) {
+    return queues_[queue].avail + 2 + queue_size_;
+  }
+  uint16_t* AvailEvent(uint32_t queue) {
+    return reinterpret_cast<uint16_t*>(
+        reinterpret_cast<VirtqUsedElem*>(queues_[queue].used + 2) +
+        queue_size_);
+  }
+
+  // makes the chain at head available, the device may run on another thread
+  void Publish(uint32_t queue, uint16_t head) {
+    uint16_t* avail = queues_[queue].avail;
+    avail[2 + avail[1] % queue_size_] = head;
+    __atomic_store_n(avail + 1, avail[1] + 1, __ATOMIC_RELEASE);
+  }
+
+  // notifies the device of the chains published since the last kick unless
+  // it asked not to, returns whether it did
+  bool Kick(uint32_t queue) {
+    Queue& q = queues_[queue];
+    const uint16_t kNew = q.avail[1];
+    const uint16_t kOld = q.kicked;
+    q.kicked = kNew;
+    const bool kNotify =
+        event_idx_
+            ? static_cast<uint16_t>(kNew - *AvailEvent(queue) - 1) <
+                  static_cast<uint16_t>(kNew - kOld)
+            : !(__atomic_load_n(q.used, __ATOMIC_ACQUIRE) & kUsedFlagNoNotify);
+    if (kNotify) {
+      WriteReg(kQueueNotify, queue);
+      kicks_++;
+    }
+    return kNotify;
+  }
+
+  uint64_t GetKicks() const { return kicks_; }
+
+  uint16_t UsedIdx(uint32_t queue) {
+    return __atomic_load_n(queues_[queue].used + 1, __ATOMIC_ACQUIRE);
+  }
+
+  VirtqUsedElem UsedElem(uint32_t queue, uint16_t index) {
+    return reinterpret_cast<VirtqUsedElem*>(
+        queues_[queue].used + 2)[index % queue_size_];
+  }
+
+  // completions of devices with their own threads come in asynchronously
+  bool WaitUsed(uint32_t queue, uint16_t idx) {
+    const auto kDeadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (UsedIdx(queue) != idx) {
+      if (std::chrono::steady_clock::now() > kDeadline) {
+        return false;
+      }
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+  // hands every used element not seen yet to take, returns how many
+  template <typename Take>
+  uint64_t Reap(uint32_t queue, Take take) {
+    Queue& q = queues_[queue];
+    const uint16_t kUsed = UsedIdx(queue);
+    const uint64_t kReaped = static_cast<uint16_t>(kUsed - q.last_used);
+    for (; q.last_used != kUsed; q.last_used++) {
+      take(UsedElem(queue, q.last_used));
+    }
+    return kReaped;
+  }
+
+  // acks a pending interrupt like an irq handler would, returns whether
+  // there was one
+  bool AckIrq() {
+    const uint32_t kPending = ReadReg(kInterruptStatus);
+    if (kPending == 0 || kPending == UINT32_MAX) {
+      return false;
+    }
+    WriteReg(kInterruptAck, kPending);
+    return true;
+  }
+
+ private:
+  using Queue = struct Queue {
+    VirtqDesc* desc = nullptr;
+    uint16_t* avail = nullptr;
+    uint16_t* used = nullptr;
+    // the avail index at the last kick
+    uint16_t kicked = 0;
+    uint16_t last_used = 0;
+  };
+
+  bus::Bus* bus_;
+  MmioDevice* dev_;
+  uint64_t ring_addr_;
+  uint16_t queue_size_;
+  bool event_idx_ = false;
+  std::vector<Queue> queues_;
+  uint64_t failed_accesses_ = 0;
+  uint64_t kicks_ = 0;
+};
+
+}  // namespace rv64_emulator::device::virtio
@@ -0,0 +1,271 @@
+#include "device/virtio_net.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "conf.h"
+#include "device/bus.h"
+#include "device/dram.h"
+#include "device/net.h"
+#include "device/virtio.h"
+#include "device/virtqueue.h"
+#include "fmt/core.h"
+#include "gtest/gtest.h"
+#include "virtio_driver.h"
+
+using namespace rv64_emulator::device::virtio;
+using rv64_emulator::device::bus::Bus;
+using rv64_emulator::device::dram::DRAM;
+using rv64_emulator::device::net::DatagramSocket;
+
+constexpr uint16_t kQueueSize = 16;
+constexpr uint32_t kBufBytes = 2048;
+constexpr uint8_t kMac[kNetMacBytes] = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
+
+// buffers of queue n start at kBufAddr + n * kBufStride
+constexpr uint64_t kRingAddr = kDramBaseAddr + 0x1000;
+constexpr uint64_t kBufAddr = kDramBaseAddr + 0x10000;
+constexpr uint64_t kBufStride = 0x100000;
+
+class VirtioNetTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    fmt::print("start running VirtioNet test case...\n");
+  }
+
+  static void TearDownTestSuite() {
+    fmt::print("finish running VirtioNet test case...\n");
+  }
+
+  void SetUp() override {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0);
+    peer_ = fds[1];
+    const timeval kTimeout = {.tv_sec = 5, .tv_usec = 0};
+    setsockopt(peer_, SOL_SOCKET, SO_RCVTIMEO, &kTimeout, sizeof(kTimeout));
+
+    bus_ = std::make_unique<Bus>();
+    bus_->MountDevice({
+        .base = kDramBaseAddr,
+        .size = kDramSize,
+        .dev = std::make_unique<DRAM>(kDramSize),
+    });
+    auto socket = std::make_unique<DatagramSocket>();
+    ASSERT_TRUE(socket->Adopt(fds[0]));
+    dev_ = std::make_unique<VirtioNet>(bus_.get(), std::move(socket), kMac,
+                                       kQueueSize);
+    driver_ = std::make_unique<VirtioDriver>(bus_.get(), dev_.get(),
+                                             kRingAddr, kQueueSize);
+  }
+
+  void TearDown() override {
+    EXPECT_EQ(driver_->GetFailedAccesses(), 0);
+    driver_.reset();
+    dev_.reset();
+    close(peer_);
+  }
+
+  uint8_t* Buf(uint32_t queue, uint16_t slot) {
+    return bus_->GetHostPtr(kBufAddr + queue * kBufStride + slot * kBufBytes,
+                            1);
+  }
+
+  // slot uses descriptor slot and its buffer, a packet of bytes for tx, an
+  // empty buffer for rx
+  void AddBuffer(uint32_t queue, uint16_t slot, uint32_t bytes) {
+    driver_->Desc(queue)[slot] = {
+        .addr = kBufAddr + queue * kBufStride + slot * kBufBytes,
+        .len = bytes,
+        .flags = queue == kNetRxQueue ? kDescFlagWrite : uint16_t(0),
+        .next = 0};
+    driver_->Publish(queue, slot);
+  }
+
+  // a packet of bytes behind the header, byte i of the frame is seed + i
+  static std::vector<uint8_t> MakePacket(const NetHdr& hdr, uint32_t bytes,
+                                         uint8_t seed) {
+    std::vector<uint8_t> packet(sizeof(hdr) + bytes);
+    memcpy(packet.data(), &hdr, sizeof(hdr));
+    for (uint32_t i = 0; i < bytes; i++) {
+      packet[sizeof(hdr) + i] = seed + i;
+    }
+    return packet;
+  }
+
+  int peer_;
+  std::unique_ptr<Bus> bus_;
+  std::unique_ptr<VirtioNet> dev_;
+  std::unique_ptr<VirtioDriver> driver_;
+};
+
+TEST_F(VirtioNetTest, Config) {
+  ASSERT_EQ(driver_->ReadReg(kDeviceId), kNetDeviceId);
+  const uint64_t kFeatures = kNetFeatureCsum | kNetFeatureGuestCsum |
+                             kNetFeatureMac | kNetFeatureStatus;
+  ASSERT_EQ(driver_->ReadReg(kDeviceFeatures) & kFeatures, kFeatures);
+
+  uint8_t mac[kNetMacBytes];
+  for (uint64_t i = 0; i < kNetMacBytes; i++) {
+    ASSERT_TRUE(dev_->Load(kConfig + i, 1, mac + i));
+  }
+  ASSERT_EQ(memcmp(mac, kMac, kNetMacBytes), 0);
+  uint16_t status = 0;
+  ASSERT_TRUE(dev_->Load(kConfig + kNetMacBytes, sizeof(status),
+                         reinterpret_cast<uint8_t*>(&status)));
+  ASSERT_EQ(status, kNetStatusLinkUp);
+}
+
+TEST_F(VirtioNetTest, Transmit) {
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kNetFeatureCsum, 2));
+
+  // the whole burst goes out on one notification
+  constexpr uint16_t kPackets = 5;
+  const NetHdr kHdr = {.flags = kNetHdrNeedsCsum,
+                       .gso_type = 0,
+                       .hdr_len = 0,
+                       .gso_size = 0,
+                       .csum_start = 34,
+                       .csum_offset = 16,
+                       .num_buffers = 0};
+  for (uint16_t i = 0; i < kPackets; i++) {
+    const auto kPacket = MakePacket(kHdr, 60 + i, i);
+    memcpy(Buf(kNetTxQueue, i), kPacket.data(), kPacket.size());
+    AddBuffer(kNetTxQueue, i, kPacket.size());
+  }
+  driver_->WriteReg(kQueueNotify, kNetTxQueue);
+  ASSERT_TRUE(driver_->WaitUsed(kNetTxQueue, kPackets));
+  ASSERT_TRUE(dev_->Irq());
+
+  for (uint16_t i = 0; i < kPackets; i++) {
+    ASSERT_EQ(driver_->UsedElem(kNetTxQueue, i).id, i);
+    ASSERT_EQ(driver_->UsedElem(kNetTxQueue, i).len, 0);
+    // the header goes along untouched
+    uint8_t packet[kBufBytes];
+    const auto kExpect = MakePacket(kHdr, 60 + i, i);
+    ASSERT_EQ(recv(peer_, packet, sizeof(packet), 0), kExpect.size());
+    ASSERT_EQ(memcmp(packet, kExpect.data(), kExpect.size()), 0);
+  }
+}
+
+TEST_F(VirtioNetTest, Receive) {
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kNetFeatureGuestCsum, 2));
+  for (uint16_t i = 0; i < 4; i++) {
+    AddBuffer(kNetRxQueue, i, kBufBytes);
+  }
+  driver_->WriteReg(kQueueNotify, kNetRxQueue);
+
+  const NetHdr kHdr = {.flags = kNetHdrDataValid,
+                       .gso_type = 0,
+                       .hdr_len = 0,
+                       .gso_size = 0,
+                       .csum_start = 0,
+                       .csum_offset = 0,
+                       .num_buffers = 0};
+  for (uint16_t i = 0; i < 3; i++) {
+    const auto kPacket = MakePacket(kHdr, 100 * (i + 1), i);
+    ASSERT_EQ(send(peer_, kPacket.data(), kPacket.size(), 0), kPacket.size());
+  }
+  ASSERT_TRUE(driver_->WaitUsed(kNetRxQueue, 3));
+  ASSERT_TRUE(dev_->Irq());
+
+  for (uint16_t i = 0; i < 3; i++) {
+    const VirtqUsedElem kElem = driver_->UsedElem(kNetRxQueue, i);
+    ASSERT_EQ(kElem.id, i);
+    ASSERT_EQ(kElem.len, sizeof(NetHdr) + 100 * (i + 1));
+    NetHdr hdr;
+    memcpy(&hdr, Buf(kNetRxQueue, i), sizeof(hdr));
+    ASSERT_EQ(hdr.num_buffers, 1);
+    // the driver takes the offload state as it is
+    ASSERT_EQ(hdr.flags, kNetHdrDataValid);
+    ASSERT_EQ(Buf(kNetRxQueue, i)[sizeof(hdr) + 42], uint8_t(i + 42));
+  }
+}
+
+TEST_F(VirtioNetTest, CompleteCsum) {
+  // without GUEST_CSUM the device has to finish partial checksums
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1, 2));
+  AddBuffer(kNetRxQueue, 0, kBufBytes);
+  driver_->WriteReg(kQueueNotify, kNetRxQueue);
+
+  constexpr uint16_t kStart = 34;
+  constexpr uint16_t kOffset = 16;
+  constexpr uint32_t kBytes = 123;
+  const NetHdr kHdr = {.flags = kNetHdrNeedsCsum,
+                       .gso_type = 0,
+                       .hdr_len = 0,
+                       .gso_size = 0,
+                       .csum_start = kStart,
+                       .csum_offset = kOffset,
+                       .num_buffers = 0};
+  const auto kPacket = MakePacket(kHdr, kBytes, 7);
+  ASSERT_EQ(send(peer_, kPacket.data(), kPacket.size(), 0), kPacket.size());
+  ASSERT_TRUE(driver_->WaitUsed(kNetRxQueue, 1));
+
+  NetHdr hdr;
+  memcpy(&hdr, Buf(kNetRxQueue, 0), sizeof(hdr));
+  ASSERT_EQ(hdr.flags, 0);
+  const uint8_t* kFrame = Buf(kNetRxQueue, 0) + sizeof(hdr);
+  // bytes before the checksummed range are left alone
+  ASSERT_EQ(kFrame[kStart - 1], uint8_t(7 + kStart - 1));
+  // the field held the pseudo header sum, with it the range and the final
+  // checksum sum up to all ones
+  const uint8_t* kSeed = kPacket.data() + sizeof(hdr) + kStart + kOffset;
+  uint32_t sum = kSeed[0] << 8 | kSeed[1];
+  for (uint32_t i = kStart; i < kBytes; i++) {
+    sum += (i - kStart) % 2 ? kFrame[i] : kFrame[i] << 8;
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  ASSERT_EQ(sum, 0xffff);
+}
+
+TEST_F(VirtioNetTest, RxStarved) {
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kNetFeatureGuestCsum, 2));
+
+  // packets wait in the backend until the driver adds buffers
+  const auto kPacket = MakePacket({}, 64, 1);
+  ASSERT_EQ(send(peer_, kPacket.data(), kPacket.size(), 0), kPacket.size());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_EQ(driver_->UsedIdx(kNetRxQueue), 0);
+
+  // a buffer too small for the header goes back empty
+  AddBuffer(kNetRxQueue, 0, sizeof(NetHdr) - 1);
+  AddBuffer(kNetRxQueue, 1, kBufBytes);
+  driver_->WriteReg(kQueueNotify, kNetRxQueue);
+  ASSERT_TRUE(driver_->WaitUsed(kNetRxQueue, 2));
+  ASSERT_EQ(driver_->UsedElem(kNetRxQueue, 0).len, 0);
+  ASSERT_EQ(driver_->UsedElem(kNetRxQueue, 1).len, kPacket.size());
+}
+
+TEST_F(VirtioNetTest, Reset) {
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kNetFeatureGuestCsum, 2));
+  AddBuffer(kNetRxQueue, 0, kBufBytes);
+  driver_->WriteReg(kQueueNotify, kNetRxQueue);
+
+  // the io thread lets go of the rings, later packets stay in the backend
+  driver_->WriteReg(kStatus, 0);
+  ASSERT_EQ(driver_->ReadReg(kQueueReady), 0);
+  const auto kPacket = MakePacket({}, 64, 1);
+  ASSERT_EQ(send(peer_, kPacket.data(), kPacket.size(), 0), kPacket.size());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_EQ(driver_->UsedIdx(kNetRxQueue), 0);
+  ASSERT_FALSE(dev_->Irq());
+
+  // and go to the next driver
+  memset(driver_->Avail(kNetRxQueue), 0, 4);
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kNetFeatureGuestCsum, 2));
+  AddBuffer(kNetRxQueue, 0, kBufBytes);
+  driver_->WriteReg(kQueueNotify, kNetRxQueue);
+  ASSERT_TRUE(driver_->WaitUsed(kNetRxQueue, 1));
+  ASSERT_EQ(driver_->UsedElem(kNetRxQueue, 0).len, kPacket.size());
+}
@@ -0,0 +1,278 @@
+#include "device/virtio.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "conf.h"
+#include "device/bus.h"
+#include "device/dram.h"
+#include "device/virtqueue.h"
+#include "fmt/core.h"
+#include "gtest/gtest.h"
+#include "virtio_driver.h"
+
+using namespace rv64_emulator::device::virtio;
+using rv64_emulator::device::bus::Bus;
+using rv64_emulator::device::dram::DRAM;
+
+constexpr uint32_t kTestDeviceId = 42;
+constexpr uint16_t kQueueSize = 16;
+
+constexpr uint64_t kRingAddr = kDramBaseAddr + 0x1000;
+constexpr uint64_t kIndirectAddr = kDramBaseAddr + 0x4000;
+constexpr uint64_t kBufAddr = kDramBaseAddr + 0x10000;
+
+// copies what the driver sent back to it
+class EchoDevice : public VirtioMmio {
+ public:
+  explicit EchoDevice(Bus* bus)
+      : VirtioMmio(bus, kTestDeviceId, 0, 1, kQueueSize) {}
+
+  uint64_t notifies_ = 0;
+
+ protected:
+  bool ReadConfig(uint64_t offset, uint64_t bytes, uint8_t* buffer) override {
+    constexpr uint64_t kConfigVal = 0x1122334455667788;
+    if (offset + bytes > sizeof(kConfigVal)) {
+      return false;
+    }
+    memcpy(buffer, reinterpret_cast<const uint8_t*>(&kConfigVal) + offset,
+           bytes);
+    return true;
+  }
+
+  void QueueNotify(uint32_t index) override {
+    notifies_++;
+    ServeQueue(index, [](const Chain& chain) {
+      std::vector<uint8_t> data(chain.ReadableBytes());
+      chain.Read(0, data.data(), data.size());
+      return static_cast<uint32_t>(chain.Write(0, data.data(), data.size()));
+    });
+  }
+};
+
+class VirtioTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    fmt::print("start running Virtio test case...\n");
+  }
+
+  static void TearDownTestSuite() {
+    fmt::print("finish running Virtio test case...\n");
+  }
+
+  void SetUp() override {
+    bus_ = std::make_unique<Bus>();
+    bus_->MountDevice({
+        .base = kDramBaseAddr,
+        .size = kDramSize,
+        .dev = std::make_unique<DRAM>(kDramSize),
+    });
+    dev_ = std::make_unique<EchoDevice>(bus_.get());
+    driver_ = std::make_unique<VirtioDriver>(bus_.get(), dev_.get(),
+                                             kRingAddr, kQueueSize);
+  }
+
+  void TearDown() override {
+    ASSERT_EQ(driver_->GetFailedAccesses(), 0);
+  }
+
+  uint8_t* Buf(uint64_t offset) {
+    return bus_->GetHostPtr(kBufAddr + offset, 1);
+  }
+
+  // chain of a readable and a writable buffer of bytes each
+  void AddChain(uint16_t head, uint64_t offset, uint32_t bytes) {
+    VirtqDesc* desc = driver_->Desc(0);
+    desc[head] = {.addr = kBufAddr + offset,
+                  .len = bytes,
+                  .flags = kDescFlagNext,
+                  .next = static_cast<uint16_t>(head + 1)};
+    desc[head + 1] = {.addr = kBufAddr + offset + bytes,
+                      .len = bytes,
+                      .flags = kDescFlagWrite,
+                      .next = 0};
+    driver_->Publish(0, head);
+  }
+
+  std::unique_ptr<Bus> bus_;
+  std::unique_ptr<EchoDevice> dev_;
+  std::unique_ptr<VirtioDriver> driver_;
+};
+
+TEST_F(VirtioTest, Registers) {
+  ASSERT_EQ(driver_->ReadReg(kMagicValue), kMagic);
+  ASSERT_EQ(driver_->ReadReg(kVersion), kMmioVersion);
+  ASSERT_EQ(driver_->ReadReg(kDeviceId), kTestDeviceId);
+  ASSERT_EQ(driver_->ReadReg(kQueueNumMax), kQueueSize);
+
+  driver_->WriteReg(kDeviceFeaturesSel, 1);
+  ASSERT_EQ(driver_->ReadReg(kDeviceFeatures), kFeatureVersion1 >> 32);
+  driver_->WriteReg(kDeviceFeaturesSel, 0);
+  ASSERT_EQ(driver_->ReadReg(kDeviceFeatures),
+            kFeatureIndirectDesc | kFeatureEventIdx);
+
+  // a queue the device does not have
+  driver_->WriteReg(kQueueSel, 1);
+  ASSERT_EQ(driver_->ReadReg(kQueueNumMax), 0);
+
+  // registers only take 32 bits accesses, the config space any width
+  uint64_t val = 0;
+  ASSERT_FALSE(
+      dev_->Load(kMagicValue, sizeof(val), reinterpret_cast<uint8_t*>(&val)));
+  ASSERT_FALSE(dev_->Load(kMagicValue + 2, sizeof(uint32_t),
+                          reinterpret_cast<uint8_t*>(&val)));
+  ASSERT_TRUE(
+      dev_->Load(kConfig, sizeof(val), reinterpret_cast<uint8_t*>(&val)));
+  ASSERT_EQ(val, 0x1122334455667788);
+  uint8_t byte = 0;
+  ASSERT_TRUE(dev_->Load(kConfig + 1, sizeof(byte), &byte));
+  ASSERT_EQ(byte, 0x77);
+}
+
+TEST_F(VirtioTest, FeatureNegotiation) {
+  // a feature the device does not offer keeps FEATURES_OK clear
+  driver_->WriteReg(kDriverFeaturesSel, 0);
+  driver_->WriteReg(kDriverFeatures, 1);
+  driver_->WriteReg(kDriverFeaturesSel, 1);
+  driver_->WriteReg(kDriverFeatures, kFeatureVersion1 >> 32);
+  driver_->WriteReg(kStatus, kStatusFeaturesOk);
+  ASSERT_FALSE(driver_->ReadReg(kStatus) & kStatusFeaturesOk);
+
+  driver_->WriteReg(kStatus, 0);
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kFeatureEventIdx, 1));
+  ASSERT_TRUE(dev_->Negotiated(kFeatureEventIdx));
+  ASSERT_FALSE(dev_->Negotiated(kFeatureIndirectDesc));
+
+  // reset brings everything back
+  driver_->WriteReg(kStatus, 0);
+  ASSERT_EQ(driver_->ReadReg(kStatus), 0);
+  ASSERT_EQ(driver_->ReadReg(kQueueReady), 0);
+  ASSERT_FALSE(dev_->Negotiated(kFeatureEventIdx));
+}
+
+TEST_F(VirtioTest, Batch) {
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1, 1));
+  for (uint16_t i = 0; i < 4; i++) {
+    memset(Buf(i * 0x100), 'a' + i, 0x80);
+    AddChain(i * 2, i * 0x100, 0x80);
+  }
+
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_EQ(dev_->notifies_, 1);
+  // all of them are completed with one interrupt
+  ASSERT_EQ(driver_->UsedIdx(0), 4);
+  for (uint16_t i = 0; i < 4; i++) {
+    ASSERT_EQ(driver_->UsedElem(0, i).id, i * 2);
+    ASSERT_EQ(driver_->UsedElem(0, i).len, 0x80);
+    ASSERT_EQ(memcmp(Buf(i * 0x100), Buf(i * 0x100 + 0x80), 0x80), 0);
+  }
+  ASSERT_TRUE(dev_->Irq());
+  ASSERT_EQ(driver_->ReadReg(kInterruptStatus), kInterruptUsedBuffer);
+  driver_->WriteReg(kInterruptAck, kInterruptUsedBuffer);
+  ASSERT_FALSE(dev_->Irq());
+
+  // the driver asked for no interrupts
+  driver_->Avail(0)[0] = kAvailFlagNoInterrupt;
+  AddChain(8, 0x400, 0x10);
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_EQ(driver_->UsedIdx(0), 5);
+  ASSERT_FALSE(dev_->Irq());
+}
+
+TEST_F(VirtioTest, IndirectDesc) {
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kFeatureIndirectDesc, 1));
+
+  // the request is split over three readable buffers in the table
+  auto* table = reinterpret_cast<VirtqDesc*>(
+      bus_->GetHostPtr(kIndirectAddr, sizeof(VirtqDesc) * 4));
+  table[0] = {.addr = kBufAddr, .len = 3, .flags = kDescFlagNext, .next = 2};
+  table[2] = {
+      .addr = kBufAddr + 3, .len = 5, .flags = kDescFlagNext, .next = 1};
+  table[1] = {
+      .addr = kBufAddr + 8, .len = 8, .flags = kDescFlagNext, .next = 3};
+  table[3] = {.addr = kBufAddr + 0x100,
+              .len = 16,
+              .flags = kDescFlagWrite,
+              .next = 0};
+  driver_->Desc(0)[0] = {.addr = kIndirectAddr,
+                         .len = sizeof(VirtqDesc) * 4,
+                         .flags = kDescFlagIndirect,
+                         .next = 0};
+  memcpy(Buf(0), "0123456789abcdef", 16);
+  driver_->Publish(0, 0);
+
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_EQ(driver_->UsedIdx(0), 1);
+  ASSERT_EQ(driver_->UsedElem(0, 0).len, 16);
+  ASSERT_EQ(memcmp(Buf(0x100), "0123456789abcdef", 16), 0);
+}
+
+TEST_F(VirtioTest, EventIdx) {
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1 | kFeatureEventIdx, 1));
+  uint16_t* used_event = driver_->UsedEvent(0);
+  uint16_t* avail_event = driver_->AvailEvent(0);
+
+  // interrupt only once the third chain is used
+  *used_event = 2;
+  AddChain(0, 0, 0x10);
+  AddChain(2, 0x100, 0x10);
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_EQ(driver_->UsedIdx(0), 2);
+  ASSERT_FALSE(dev_->Irq());
+  // the device wants a notification for anything beyond what it consumed
+  ASSERT_EQ(*avail_event, 2);
+
+  AddChain(4, 0x200, 0x10);
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_EQ(driver_->UsedIdx(0), 3);
+  ASSERT_TRUE(dev_->Irq());
+  ASSERT_EQ(*avail_event, 3);
+}
+
+TEST_F(VirtioTest, MalformedChain) {
+  ASSERT_TRUE(driver_->Init(kFeatureVersion1, 1));
+
+  // a loop and a buffer outside of RAM are handed back untouched
+  VirtqDesc* desc = driver_->Desc(0);
+  desc[0] = {.addr = kBufAddr, .len = 4, .flags = kDescFlagNext, .next = 1};
+  desc[1] = {.addr = kBufAddr, .len = 4, .flags = kDescFlagNext, .next = 0};
+  driver_->Publish(0, 0);
+  desc[2] = {.addr = 0x1000, .len = 4, .flags = kDescFlagWrite, .next = 0};
+  driver_->Publish(0, 2);
+  AddChain(4, 0, 0x10);
+
+  driver_->WriteReg(kQueueNotify, 0);
+  ASSERT_EQ(driver_->UsedIdx(0), 3);
+  ASSERT_EQ(driver_->UsedElem(0, 0).len, 0);
+  ASSERT_EQ(driver_->UsedElem(0, 1).len, 0);
+  ASSERT_EQ(driver_->UsedElem(0, 2).id, 4);
+  ASSERT_EQ(driver_->UsedElem(0, 2).len, 0x10);
+}
+
+TEST_F(VirtioTest, QueueOutsideRam) {
+  driver_->WriteReg(kQueueSel, 0);
+  driver_->WriteReg(kQueueNum, kQueueSize);
+  driver_->WriteReg(kQueueDescLow, 0x1000);
+  driver_->WriteReg(kQueueReady, 1);
+  ASSERT_EQ(driver_->ReadReg(kQueueReady), 0);
+  ASSERT_TRUE(driver_->ReadReg(kStatus) & kStatusNeedsReset);
+  ASSERT_EQ(driver_->ReadReg(kInterruptStatus), kInterruptConfigChange);
+}
+
+TEST(VirtioSlotTest, Empty) {
+  Bus bus;
+  VirtioMmio slot(&bus, 0, 0, 0, 0);
+  uint32_t val = 0;
+  ASSERT_TRUE(slot.Load(kMagicValue, sizeof(val),
+                        reinterpret_cast<uint8_t*>(&val)));
+  ASSERT_EQ(val, kMagic);
+  ASSERT_TRUE(
+      slot.Load(kDeviceId, sizeof(val), reinterpret_cast<uint8_t*>(&val)));
+  ASSERT_EQ(val, 0);
+  ASSERT_FALSE(
+      slot.Load(kConfig, sizeof(val), reinterpret_cast<uint8_t*>(&val)));
+}
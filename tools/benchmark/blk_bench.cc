@@ -0,0 +1,270 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "conf.h"
+#include "device/block.h"
+#include "device/bus.h"
+#include "device/dram.h"
+#include "device/virtio.h"
+#include "device/virtio_blk.h"
+#include "device/virtqueue.h"
+#include "virtio_driver.h"
+
+using rv64_emulator::device::block::Backend;
+using rv64_emulator::device::block::CowImage;
+using rv64_emulator::device::block::kSectorBytes;
+using rv64_emulator::device::block::RawImage;
+using rv64_emulator::device::bus::Bus;
+using rv64_emulator::device::dram::DRAM;
+using namespace rv64_emulator::device::virtio;
+
+constexpr uint16_t kQueueSize = kVirtioBlkQueueSize;
+// a request takes 3 descriptors, the header, the data and the status
+constexpr uint64_t kMaxDepth = kQueueSize / 3;
+constexpr uint64_t kBlockBytes = 4096;
+
+constexpr uint64_t kRingAddr = kDramBaseAddr;
+constexpr uint64_t kHeaderAddr = kDramBaseAddr + 0x4000;
+constexpr uint64_t kStatusAddr = kDramBaseAddr + 0x5000;
+constexpr uint64_t kBufAddr = kDramBaseAddr + 0x10000;
+constexpr uint64_t kRamBytes = 0x10000 + kMaxDepth * kBlockBytes;
+
+using Job = struct Job {
+  const char* name;
+  uint32_t type;
+  bool random;
+};
+
+// plays the guest driver of a virtio-blk device, like fio with the libaio
+// engine keeps depth requests of 4K in flight
+class Driver {
+ public:
+  Driver(std::unique_ptr<Backend> image, uint64_t workers) {
+    bus_.MountDevice({
+        .base = kDramBaseAddr,
+        .size = kRamBytes,
+        .dev = std::make_unique<DRAM>(kRamBytes),
+    });
+    blocks_ = image->GetSize() / kBlockBytes;
+    dev_ = std::make_unique<VirtioBlk>(&bus_, std::move(image), workers,
+                                       kQueueSize);
+
+    driver_ = std::make_unique<VirtioDriver>(&bus_, dev_.get(), kRingAddr,
+                                             kQueueSize);
+    if (!driver_->Init(kFeatureVersion1, 1)) {
+      printf("the device refused the driver\n");
+      exit(-1);
+    }
+
+    headers_ = reinterpret_cast<BlkReqHeader*>(
+        bus_.GetHostPtr(kHeaderAddr, sizeof(BlkReqHeader) * kMaxDepth));
+    status_ = bus_.GetHostPtr(kStatusAddr, kMaxDepth);
+  }
+
+  uint64_t GetBlocks() const { return blocks_; }
+
+  void Run(const Job& job, uint64_t depth, uint64_t requests) {
+    std::vector<uint16_t> free_slots;
+    for (uint64_t i = 0; i < depth; i++) {
+      free_slots.push_back(i);
+    }
+    std::vector<std::chrono::steady_clock::time_point> issued(depth);
+
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    uint64_t errors = 0;
+    uint64_t next_block = 0;
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    std::chrono::duration<double> latency(0);
+    const auto kStart = std::chrono::steady_clock::now();
+    while (completed < requests) {
+      bool added = false;
+      while (!free_slots.empty() && submitted < requests) {
+        uint64_t block = next_block++ % blocks_;
+        if (job.random) {
+          seed ^= seed << 13;
+          seed ^= seed >> 7;
+          seed ^= seed << 17;
+          block = seed % blocks_;
+        }
+        const uint16_t kSlot = free_slots.back();
+        free_slots.pop_back();
+        issued[kSlot] = std::chrono::steady_clock::now();
+        Submit(kSlot, job.type, block * kBlockBytes / kSectorBytes);
+        submitted++;
+        added = true;
+      }
+      if (added) {
+        driver_->Kick(0);
+      }
+
+      const auto kNow = std::chrono::steady_clock::now();
+      const uint64_t kReaped =
+          driver_->Reap(0, [&](const VirtqUsedElem& kElem) {
+            const uint16_t kSlot = kElem.id / 3;
+            errors += status_[kSlot] != kBlkStatusOk;
+            latency += kNow - issued[kSlot];
+            free_slots.push_back(kSlot);
+          });
+      if (!kReaped) {
+        std::this_thread::yield();
+        continue;
+      }
+      completed += kReaped;
+      driver_->AckIrq();
+    }
+    const auto kEnd = std::chrono::steady_clock::now();
+
+    const double kSeconds =
+        std::chrono::duration<double>(kEnd - kStart).count();
+    printf("%-9s  bs 4k  qd %3lu  %9.1f IOPS  %8.2f MB/s  lat %8.2f us%s\n",
+           job.name, depth, static_cast<double>(completed) / kSeconds,
+           static_cast<double>(completed * kBlockBytes) / kSeconds / 1e6,
+           latency.count() / static_cast<double>(completed) * 1e6,
+           errors ? "  errors!" : "");
+  }
+
+ private:
+  Bus bus_;
+  std::unique_ptr<VirtioBlk> dev_;
+  std::unique_ptr<VirtioDriver> driver_;
+  uint64_t blocks_;
+  BlkReqHeader* headers_;
+  uint8_t* status_;
+
+  void Submit(uint16_t slot, uint32_t type, uint64_t sector) {
+    const uint16_t kHead = slot * 3;
+    headers_[slot] = {.type = type, .reserved = 0, .sector = sector};
+    VirtqDesc* desc = driver_->Desc(0);
+    desc[kHead] = {.addr = kHeaderAddr + slot * sizeof(BlkReqHeader),
+                   .len = sizeof(BlkReqHeader),
+                   .flags = kDescFlagNext,
+                   .next = static_cast<uint16_t>(kHead + 1)};
+    desc[kHead + 1] = {
+        .addr = kBufAddr + slot * kBlockBytes,
+        .len = kBlockBytes,
+        .flags = static_cast<uint16_t>(
+            kDescFlagNext | (type == kBlkTypeIn ? kDescFlagWrite : 0)),
+        .next = static_cast<uint16_t>(kHead + 2)};
+    desc[kHead + 2] = {.addr = kStatusAddr + slot,
+                       .len = 1,
+                       .flags = kDescFlagWrite,
+                       .next = 0};
+    driver_->Publish(0, kHead);
+  }
+};
+
+void Usage(const char* name) {
+  printf(
+      "usage: %s [-c] [-f image] [-s image size in MiB] [-n requests] "
+      "[-q queue depth] [-w workers]\n",
+      name);
+}
+
+int main(int argc, char* argv[]) {
+  std::string path;
+  uint64_t image_mib = 256;
+  uint64_t requests = 1 << 16;
+  uint64_t depth = 32;
+  uint64_t workers = kVirtioBlkWorkers;
+  bool cow = false;
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "cf:s:n:q:w:")) != -1) {
+    switch (opt) {
+      case 'c':
+        cow = true;
+        break;
+      case 'f':
+        path = optarg;
+        break;
+      case 's':
+        image_mib = strtoull(optarg, nullptr, 0);
+        break;
+      case 'n':
+        requests = strtoull(optarg, nullptr, 0);
+        break;
+      case 'q':
+        depth = strtoull(optarg, nullptr, 0);
+        break;
+      case 'w':
+        workers = strtoull(optarg, nullptr, 0);
+        break;
+      default:
+        Usage(argv[0]);
+        return -1;
+    }
+  }
+  if (depth == 0 || depth > kMaxDepth || workers == 0 || image_mib == 0) {
+    printf("queue depth goes up to %lu, workers and size must not be 0\n",
+           kMaxDepth);
+    return -1;
+  }
+
+  // without -f a scratch image is created and removed afterwards
+  const bool kScratch = path.empty();
+  if (kScratch) {
+    char scratch[] = "/tmp/blk_bench_XXXXXX";
+    const int kFd = mkstemp(scratch);
+    if (kFd < 0 || ftruncate(kFd, image_mib << 20) != 0) {
+      printf("failed to create a scratch image: %s\n", strerror(errno));
+      return -1;
+    }
+    close(kFd);
+    path = scratch;
+  }
+
+  // -c writes to a temporary overlay of the image instead
+  std::unique_ptr<Backend> image;
+  bool opened = false;
+  if (cow) {
+    auto overlay = std::make_unique<CowImage>();
+    opened = overlay->Open(path.c_str(), "");
+    image = std::move(overlay);
+  } else {
+    auto raw = std::make_unique<RawImage>();
+    opened = raw->Open(path.c_str(), false);
+    image = std::move(raw);
+  }
+  if (!opened) {
+    printf("failed to open %s: %s\n", path.c_str(), strerror(errno));
+    return -1;
+  }
+
+  Driver driver(std::move(image), workers);
+  if (driver.GetBlocks() == 0) {
+    printf("%s is smaller than one block\n", path.c_str());
+    return -1;
+  }
+  printf("virtio-blk on %s%s, %lu workers, %lu requests per job\n",
+         path.c_str(), cow ? " with an overlay" : "", workers, requests);
+  // the writes go first so that the reads hit allocated blocks
+  const Job kJobs[] = {
+      {.name = "seqwrite", .type = kBlkTypeOut, .random = false},
+      {.name = "seqread", .type = kBlkTypeIn, .random = false},
+      {.name = "randwrite", .type = kBlkTypeOut, .random = true},
+      {.name = "randread", .type = kBlkTypeIn, .random = true},
+  };
+  for (const auto& kJob : kJobs) {
+    for (const uint64_t kDepth : {uint64_t{1}, depth}) {
+      driver.Run(kJob, kDepth, requests);
+    }
+  }
+
+  if (kScratch) {
+    unlink(path.c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,248 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "conf.h"
+#include "device/bus.h"
+#include "device/dram.h"
+#include "device/uart.h"
+#include "device/virtio.h"
+#include "device/virtio_console.h"
+#include "device/virtqueue.h"
+#include "virtio_driver.h"
+
+using rv64_emulator::device::bus::Bus;
+using rv64_emulator::device::dram::DRAM;
+using rv64_emulator::device::uart::Uart;
+using namespace rv64_emulator::device::virtio;
+
+constexpr uint16_t kQueueSize = kVirtioConsoleQueueSize;
+constexpr uint64_t kMaxWriteBytes = 4096;
+// port 0 without multiport, its tx queue follows the rx one
+constexpr uint32_t kTxQueue = ConsoleRxQueue(0) + 1;
+
+// descriptor i of the tx queue points at buffer i
+constexpr uint64_t kRingAddr = kDramBaseAddr;
+constexpr uint64_t kBufAddr = kDramBaseAddr + 0x10000;
+constexpr uint64_t kRamBytes = 0x10000 + kQueueSize * kMaxWriteBytes;
+
+// the uartlite registers the guest driver touches for every byte
+constexpr uint64_t kUartTxFifo = 4;
+constexpr uint64_t kUartStatus = 8;
+constexpr uint32_t kUartTxFull = 0b1000;
+
+// console text, a line of 80 chars
+char TextByte(uint64_t i) {
+  return i % 80 == 79 ? '\n' : static_cast<char>('a' + i % 26);
+}
+
+// the host end of the console, reads until bytes arrived
+std::thread StartSink(int fd, uint64_t bytes) {
+  return std::thread([fd, bytes]() {
+    std::vector<char> buf(1 << 16);
+    for (uint64_t received = 0; received < bytes;) {
+      const ssize_t kRead = read(fd, buf.data(), buf.size());
+      if (kRead <= 0 && errno != EINTR) {
+        printf("the console output ended early: %s\n", strerror(errno));
+        exit(-1);
+      }
+      received += kRead > 0 ? kRead : 0;
+    }
+  });
+}
+
+void Report(const char* name, uint64_t bytes, double seconds,
+            uint64_t exits, uint64_t irqs) {
+  const double kKiB = static_cast<double>(bytes) / 1024;
+  printf("%-34s %9.2f MiB/s  %9.3f exits/KiB  %7.3f irqs/KiB\n", name,
+         kKiB / 1024 / seconds, static_cast<double>(exits) / kKiB,
+         static_cast<double>(irqs) / kKiB);
+}
+
+// Moves what the guest stored to tx_fifo to the host, like the emulator does
+// between instruction budgets.
+void DrainUart(Uart* uart, int fd, std::string* out) {
+  while (uart->TxBufferNotEmpty()) {
+    out->push_back(uart->Getc());
+  }
+  for (uint64_t done = 0; done < out->size();) {
+    const ssize_t kWritten = write(fd, out->data() + done, out->size() - done);
+    if (kWritten < 0 && errno != EINTR) {
+      printf("failed to write the console output: %s\n", strerror(errno));
+      exit(-1);
+    }
+    done += kWritten > 0 ? kWritten : 0;
+  }
+  out->clear();
+}
+
+// The uartlite driver polls the status register before every byte it puts
+// into tx_fifo, the host drains the fifo whenever the guest finds it full.
+void RunUart(uint64_t bytes) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    printf("failed to create a pipe: %s\n", strerror(errno));
+    exit(-1);
+  }
+  std::thread sink = StartSink(fds[0], bytes);
+
+  Uart uart;
+  std::string out;
+  uint64_t exits = 0;
+  const auto kStart = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < bytes; i++) {
+    uint32_t status = kUartTxFull;
+    while (status & kUartTxFull) {
+      uart.Load(kUartStatus, sizeof(status),
+                reinterpret_cast<uint8_t*>(&status));
+      exits++;
+      if (status & kUartTxFull) {
+        DrainUart(&uart, fds[1], &out);
+      }
+    }
+    const uint32_t kCh = static_cast<uint8_t>(TextByte(i));
+    uart.Store(kUartTxFifo, sizeof(kCh),
+               reinterpret_cast<const uint8_t*>(&kCh));
+    exits++;
+  }
+  DrainUart(&uart, fds[1], &out);
+  sink.join();
+  const auto kEnd = std::chrono::steady_clock::now();
+
+  Report("uartlite", bytes,
+         std::chrono::duration<double>(kEnd - kStart).count(), exits, 0);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// The hvc driver hands out write_bytes of output per chain and publishes up
+// to batch chains before it kicks the device, then reaps them and acks the
+// interrupt if one came.
+void RunVirtio(uint64_t bytes, uint64_t write_bytes, uint64_t batch) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    printf("failed to create a pipe: %s\n", strerror(errno));
+    exit(-1);
+  }
+  std::thread sink = StartSink(fds[0], bytes);
+
+  Bus bus;
+  bus.MountDevice({
+      .base = kDramBaseAddr,
+      .size = kRamBytes,
+      .dev = std::make_unique<DRAM>(kRamBytes),
+  });
+  std::vector<ConsolePort> ports;
+  ports.push_back({.name = {}, .console = true, .in_fd = -1, .out_fd = fds[1]});
+  auto dev = std::make_unique<VirtioConsole>(&bus, std::move(ports),
+                                             kQueueSize);
+  VirtioDriver driver(&bus, dev.get(), kRingAddr, kQueueSize);
+  if (!driver.Init(kFeatureVersion1, kTxQueue + 1)) {
+    printf("the device refused the driver\n");
+    exit(-1);
+  }
+
+  VirtqDesc* desc = driver.Desc(kTxQueue);
+  std::vector<uint16_t> free_slots;
+  for (uint16_t i = 0; i < kQueueSize; i++) {
+    desc[i] = {.addr = kBufAddr + i * kMaxWriteBytes,
+               .len = static_cast<uint32_t>(write_bytes),
+               .flags = 0,
+               .next = 0};
+    free_slots.push_back(i);
+  }
+
+  uint64_t irqs = 0;
+  uint64_t written = 0;
+  const auto kStart = std::chrono::steady_clock::now();
+  while (written < bytes || free_slots.size() < kQueueSize) {
+    uint64_t progress = 0;
+    for (uint64_t added = 0;
+         added < batch && written < bytes && !free_slots.empty(); added++) {
+      const uint16_t kSlot = free_slots.back();
+      free_slots.pop_back();
+      const uint64_t kLen = std::min(write_bytes, bytes - written);
+      uint8_t* buf = bus.GetHostPtr(desc[kSlot].addr, kLen);
+      for (uint64_t i = 0; i < kLen; i++) {
+        buf[i] = TextByte(written + i);
+      }
+      desc[kSlot].len = static_cast<uint32_t>(kLen);
+      driver.Publish(kTxQueue, kSlot);
+      written += kLen;
+      progress++;
+    }
+    if (progress) {
+      driver.Kick(kTxQueue);
+    }
+    progress +=
+        driver.Reap(kTxQueue, [&free_slots](const VirtqUsedElem& kElem) {
+          free_slots.push_back(kElem.id);
+        });
+    irqs += driver.AckIrq();
+    if (!progress) {
+      std::this_thread::yield();
+    }
+  }
+  // the device holds back a partial burst for a flush interval at most
+  sink.join();
+  const auto kEnd = std::chrono::steady_clock::now();
+  dev.reset();
+
+  // every irq costs the guest a status read and an ack on top of its kicks
+  const std::string kName = "virtio-console write " +
+                            std::to_string(write_bytes) + " batch " +
+                            std::to_string(batch);
+  Report(kName.c_str(), bytes,
+         std::chrono::duration<double>(kEnd - kStart).count(),
+         driver.GetKicks() + 2 * irqs, irqs);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void Usage(const char* name) {
+  printf("usage: %s [-n bytes] [-b max batch]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint64_t bytes = 1 << 25;
+  uint64_t max_batch = 64;
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+    switch (opt) {
+      case 'n':
+        bytes = strtoull(optarg, nullptr, 0);
+        break;
+      case 'b':
+        max_batch = strtoull(optarg, nullptr, 0);
+        break;
+      default:
+        Usage(argv[0]);
+        return -1;
+    }
+  }
+  if (bytes == 0 || max_batch == 0 || max_batch > kQueueSize) {
+    printf("the batch goes up to %u, bytes must not be 0\n", kQueueSize);
+    return -1;
+  }
+
+  printf("guest console output into a pipe, %lu bytes per run\n", bytes);
+  RunUart(bytes);
+  for (const uint64_t kWrite : {uint64_t{64}, kMaxWriteBytes}) {
+    for (uint64_t batch = 1; batch <= max_batch; batch *= 8) {
+      RunVirtio(bytes, kWrite, batch);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "cpu/decode.h"
+
+using rv64_emulator::cpu::decode::GetInstIndex;
+using rv64_emulator::cpu::decode::kInstTable;
+using rv64_emulator::cpu::decode::kInstTableSize;
+
+constexpr uint64_t kWordsNum = 1 << 16;
+constexpr uint64_t kRounds = 256;
+
+// the decoder before the lookup tables, kept as the baseline
+int32_t LinearScanInstIndex(uint32_t word) {
+  for (uint32_t i = 0; i < kInstTableSize; i++) {
+    if ((word & kInstTable[i].mask) == kInstTable[i].signature) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+template <typename F>
+double MeasureMlps(const std::vector<uint32_t>& words, F decoder,
+                   int64_t* checksum) {
+  const auto kStart = std::chrono::high_resolution_clock::now();
+  int64_t sum = 0;
+  for (uint64_t r = 0; r < kRounds; r++) {
+    for (const uint32_t kWord : words) {
+      sum += decoder(kWord);
+    }
+  }
+  const auto kEnd = std::chrono::high_resolution_clock::now();
+  const auto kDurationUs =
+      std::chrono::duration_cast<std::chrono::microseconds>(kEnd - kStart);
+  *checksum = sum;
+  return static_cast<double>(words.size() * kRounds) /
+         static_cast<double>(kDurationUs.count());
+}
+
+void RunCase(const char* name, const std::vector<uint32_t>& words) {
+  for (const uint32_t kWord : words) {
+    if (GetInstIndex(kWord) != LinearScanInstIndex(kWord)) {
+      printf("mismatch on word %#010x\n", kWord);
+      return;
+    }
+  }
+
+  int64_t linear_sum = 0;
+  int64_t table_sum = 0;
+  const double kLinear = MeasureMlps(words, LinearScanInstIndex, &linear_sum);
+  const double kTable = MeasureMlps(words, GetInstIndex, &table_sum);
+  printf("%-24s linear: %8.2f M/s  table: %8.2f M/s  speedup: %5.2fx\n", name,
+         kLinear, kTable, kTable / kLinear);
+  if (linear_sum != table_sum) {
+    printf("checksum mismatch\n");
+  }
+}
+
+int main() {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint32_t> dis(0, UINT32_MAX);
+
+  // every inst of the table with random operands, rare insts included
+  std::vector<uint32_t> uniform_insts(kWordsNum);
+  for (auto& word : uniform_insts) {
+    const auto& kDesc = kInstTable[dis(gen) % kInstTableSize];
+    word = (dis(gen) & ~kDesc.mask) | kDesc.signature;
+  }
+
+  // the head of the table is what the linear scan is tuned for
+  std::vector<uint32_t> hot_insts(kWordsNum);
+  for (auto& word : hot_insts) {
+    const auto& kDesc = kInstTable[dis(gen) % 8];
+    word = (dis(gen) & ~kDesc.mask) | kDesc.signature;
+  }
+
+  std::vector<uint32_t> random_words(kWordsNum);
+  for (auto& word : random_words) {
+    word = dis(gen);
+  }
+
+  RunCase("uniform table insts", uniform_insts);
+  RunCase("hot insts", hot_insts);
+  RunCase("random words", random_words);
+  return 0;
+}
@@ -0,0 +1,259 @@
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "device/dram.h"
+
+using rv64_emulator::device::dram::DRAM;
+using rv64_emulator::device::dram::PageBacking;
+
+constexpr uint64_t kDefaultMemMiB = 512;
+constexpr uint64_t kAccesses = 1 << 26;
+
+using Backing = struct Backing {
+  PageBacking backing;
+  const char* name;
+  // value of the emulator -p option, small pages are the default
+  const char* option;
+};
+
+constexpr Backing kBackings[] = {
+    {PageBacking::kSmall, "small", nullptr},
+    {PageBacking::kTransparent, "thp", "thp"},
+    {PageBacking::kHuge2M, "2m", "2m"},
+    {PageBacking::kHuge1G, "1g", "1g"},
+};
+
+const char* GetName(PageBacking backing) {
+  for (const auto& kBacking : kBackings) {
+    if (kBacking.backing == backing) {
+      return kBacking.name;
+    }
+  }
+  return "unknown";
+}
+
+// user space dTLB misses of pid and its threads, -1 if the host pmu does not
+// expose the event
+int OpenDtlbMissCounter(pid_t pid, uint64_t op, bool enable_on_exec) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB | (op << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.enable_on_exec = enable_on_exec;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0));
+}
+
+using DtlbCounters = struct DtlbCounters {
+  int load_fd;
+  int store_fd;
+};
+
+DtlbCounters OpenDtlbCounters(pid_t pid, bool enable_on_exec) {
+  const DtlbCounters kCounters = {
+      .load_fd = OpenDtlbMissCounter(pid, PERF_COUNT_HW_CACHE_OP_READ,
+                                     enable_on_exec),
+      .store_fd = OpenDtlbMissCounter(pid, PERF_COUNT_HW_CACHE_OP_WRITE,
+                                      enable_on_exec),
+  };
+
+  static bool warned = false;
+  if ((kCounters.load_fd < 0 || kCounters.store_fd < 0) && !warned) {
+    printf("some dTLB events are not available, check perf_event_paranoid, "
+           "they are reported as -1\n");
+    warned = true;
+  }
+  return kCounters;
+}
+
+void SetDtlbCounters(const DtlbCounters& counters, bool enable) {
+  for (const int kFd : {counters.load_fd, counters.store_fd}) {
+    if (kFd >= 0) {
+      ioctl(kFd, enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+}
+
+// misses per 1000 units of work, negative if the counter is not available
+double ReadRate(int fd, uint64_t units) {
+  uint64_t val = 0;
+  if (fd < 0 || read(fd, &val, sizeof(val)) != sizeof(val)) {
+    return -1;
+  }
+  return static_cast<double>(val) * 1000 / static_cast<double>(units);
+}
+
+void CloseDtlbCounters(const DtlbCounters& counters) {
+  for (const int kFd : {counters.load_fd, counters.store_fd}) {
+    if (kFd >= 0) {
+      close(kFd);
+    }
+  }
+}
+
+// Random 8 bytes read-modify-writes over the whole RAM through the host
+// pointer, the way the soft tlb fast path reaches guest memory when the
+// guest works on a large data set.
+void RunMemoryBound(uint64_t mem_bytes) {
+  printf("memory bound workload, %lu MiB, %lu accesses\n", mem_bytes >> 20,
+         kAccesses);
+  for (const auto& kBacking : kBackings) {
+    DRAM dram(mem_bytes, kBacking.backing);
+    uint8_t* host = dram.GetHostPtr(0, mem_bytes);
+    // fault everything in first, only the steady state is measured
+    memset(host, 1, mem_bytes);
+
+    const DtlbCounters kCounters = OpenDtlbCounters(0, false);
+    const uint64_t kSlots = mem_bytes / sizeof(uint64_t);
+    uint64_t state = 0x9e3779b97f4a7c15;
+
+    SetDtlbCounters(kCounters, true);
+    const auto kStart = std::chrono::high_resolution_clock::now();
+    for (uint64_t i = 0; i < kAccesses; i++) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      uint8_t* slot = host + (state % kSlots) * sizeof(uint64_t);
+      uint64_t val = 0;
+      memcpy(&val, slot, sizeof(val));
+      val += i;
+      memcpy(slot, &val, sizeof(val));
+    }
+    const auto kEnd = std::chrono::high_resolution_clock::now();
+    SetDtlbCounters(kCounters, false);
+
+    const auto kDurationUs =
+        std::chrono::duration_cast<std::chrono::microseconds>(kEnd - kStart);
+    printf("%-6s -> %-6s %8.2f M/s  dTLB load misses: %8.2f  "
+           "store misses: %8.2f per 1k accesses\n",
+           kBacking.name, GetName(dram.GetBacking()),
+           static_cast<double>(kAccesses) /
+               static_cast<double>(kDurationUs.count()),
+           ReadRate(kCounters.load_fd, kAccesses),
+           ReadRate(kCounters.store_fd, kAccesses));
+    CloseDtlbCounters(kCounters);
+  }
+}
+
+// Runs the emulator command once per backing for the given time, e.g. to
+// compare the Linux boot. The emulator output is dropped and its stdin is an
+// idle pipe, so the uart input thread just blocks.
+void RunCommand(uint64_t seconds, char* cmd[], int cmd_num) {
+  printf("%s for %lu seconds\n", cmd[0], seconds);
+  for (const auto& kBacking : kBackings) {
+    std::vector<char*> args(cmd, cmd + 1);
+    if (kBacking.option) {
+      args.push_back(const_cast<char*>("-p"));
+      args.push_back(const_cast<char*>(kBacking.option));
+    }
+    args.insert(args.end(), cmd + 1, cmd + cmd_num);
+    args.push_back(nullptr);
+
+    int sync[2];
+    if (pipe(sync) != 0) {
+      perror("pipe");
+      return;
+    }
+
+    // the child must not replay what is still buffered
+    fflush(stdout);
+    const pid_t kChild = fork();
+    if (kChild == 0) {
+      // wait until the counters are attached
+      char go = 0;
+      if (read(sync[0], &go, sizeof(go)) != sizeof(go)) {
+        _exit(-1);
+      }
+      dup2(sync[0], STDIN_FILENO);
+      if (!freopen("/dev/null", "w", stdout)) {
+        perror("freopen");
+        _exit(-1);
+      }
+      execvp(args[0], args.data());
+      _exit(-1);
+    }
+
+    const DtlbCounters kCounters = OpenDtlbCounters(kChild, true);
+    const char kGo = 1;
+    if (write(sync[1], &kGo, sizeof(kGo)) != sizeof(kGo)) {
+      // the child would never start, the counters would measure it idling
+      perror("write");
+      kill(kChild, SIGKILL);
+      waitpid(kChild, nullptr, 0);
+      CloseDtlbCounters(kCounters);
+      close(sync[0]);
+      close(sync[1]);
+      exit(-1);
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    kill(kChild, SIGKILL);
+    int status = 0;
+    waitpid(kChild, &status, 0);
+    if (!WIFSIGNALED(status)) {
+      // it did not run for the whole measurement
+      fprintf(stderr, "%s exited early with status %d\n", args[0],
+              WEXITSTATUS(status));
+      exit(-1);
+    }
+
+    printf("%-6s dTLB load misses: %10.2f  store misses: %10.2f per ms\n",
+           kBacking.name, ReadRate(kCounters.load_fd, seconds * 1000 * 1000),
+           ReadRate(kCounters.store_fd, seconds * 1000 * 1000));
+    CloseDtlbCounters(kCounters);
+    close(sync[0]);
+    close(sync[1]);
+  }
+}
+
+void Usage(const char* name) {
+  printf("usage: %s [-m memory size in MiB]\n", name);
+  printf("       %s -t seconds -- <emulator> [emulator args]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint64_t mem_mib = kDefaultMemMiB;
+  uint64_t seconds = 0;
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "m:t:")) != -1) {
+    switch (opt) {
+      case 'm':
+        mem_mib = strtoull(optarg, nullptr, 0);
+        break;
+      case 't':
+        seconds = strtoull(optarg, nullptr, 0);
+        break;
+      default:
+        Usage(argv[0]);
+        return -1;
+    }
+  }
+
+  if (seconds) {
+    if (optind >= argc) {
+      Usage(argv[0]);
+      return -1;
+    }
+    RunCommand(seconds, argv + optind, argc - optind);
+  } else {
+    RunMemoryBound(mem_mib << 20);
+  }
+  return 0;
+}
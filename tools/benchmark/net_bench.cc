@@ -0,0 +1,218 @@
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "conf.h"
+#include "device/bus.h"
+#include "device/dram.h"
+#include "device/net.h"
+#include "device/virtio.h"
+#include "device/virtio_net.h"
+#include "device/virtqueue.h"
+#include "virtio_driver.h"
+
+using rv64_emulator::device::bus::Bus;
+using rv64_emulator::device::dram::DRAM;
+using rv64_emulator::device::net::DatagramSocket;
+using namespace rv64_emulator::device::virtio;
+
+constexpr uint16_t kQueueSize = kVirtioNetQueueSize;
+constexpr uint32_t kBufBytes = 2048;
+constexpr uint64_t kMaxFrameBytes = 1514;
+
+// descriptor i of queue n points at buffer n * kQueueSize + i
+constexpr uint64_t kRingAddr = kDramBaseAddr;
+constexpr uint64_t kBufAddr = kDramBaseAddr + 0x10000;
+constexpr uint64_t kRamBytes = 0x10000 + 2 * kQueueSize * kBufBytes;
+
+// plays the guest driver of a virtio-net device, the tx side of one end and
+// the rx side of the other make up an iperf like stream
+class Driver {
+ public:
+  Driver(int fd, uint8_t id) {
+    bus_.MountDevice({
+        .base = kDramBaseAddr,
+        .size = kRamBytes,
+        .dev = std::make_unique<DRAM>(kRamBytes),
+    });
+    auto socket = std::make_unique<DatagramSocket>();
+    socket->Adopt(fd);
+    const uint8_t kMac[] = {0x52, 0x54, 0x00, 0x00, 0x00, id};
+    dev_ = std::make_unique<VirtioNet>(&bus_, std::move(socket), kMac,
+                                       kQueueSize);
+
+    driver_ = std::make_unique<VirtioDriver>(&bus_, dev_.get(), kRingAddr,
+                                             kQueueSize);
+    if (!driver_->Init(
+            kFeatureVersion1 | kNetFeatureCsum | kNetFeatureGuestCsum, 2)) {
+      printf("the device refused the driver\n");
+      exit(-1);
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+      VirtqDesc* desc = driver_->Desc(i);
+      for (uint16_t j = 0; j < kQueueSize; j++) {
+        desc[j] = {.addr = kBufAddr + (i * kQueueSize + j) * kBufBytes,
+                   .len = kBufBytes,
+                   .flags = i == kNetRxQueue ? kDescFlagWrite : uint16_t(0),
+                   .next = 0};
+      }
+    }
+
+    // every rx buffer is handed out up front and again once it is used
+    for (uint16_t i = 0; i < kQueueSize; i++) {
+      Add(kNetRxQueue, i, kBufBytes);
+    }
+    driver_->Kick(kNetRxQueue);
+    for (uint16_t i = 0; i < kQueueSize; i++) {
+      tx_free_.push_back(i);
+    }
+  }
+
+  // queues up to batch frames of bytes, returns how many
+  uint64_t Send(uint64_t bytes, uint64_t batch) {
+    uint64_t added = 0;
+    for (; added < batch && !tx_free_.empty(); added++) {
+      const uint16_t kSlot = tx_free_.back();
+      tx_free_.pop_back();
+      Add(kNetTxQueue, kSlot, sizeof(NetHdr) + bytes);
+    }
+    if (added) {
+      driver_->Kick(kNetTxQueue);
+    }
+    return added;
+  }
+
+  // takes back the sent frames, returns how many
+  uint64_t ReapTx() {
+    return driver_->Reap(kNetTxQueue, [this](const VirtqUsedElem& kElem) {
+      tx_free_.push_back(kElem.id);
+    });
+  }
+
+  // takes the received frames and hands their buffers out again, returns
+  // how many
+  uint64_t ReapRx(uint64_t* bytes) {
+    const uint64_t kReaped =
+        driver_->Reap(kNetRxQueue, [this, bytes](const VirtqUsedElem& kElem) {
+          *bytes += kElem.len - sizeof(NetHdr);
+          Add(kNetRxQueue, kElem.id, kBufBytes);
+        });
+    if (kReaped) {
+      driver_->Kick(kNetRxQueue);
+    }
+    return kReaped;
+  }
+
+  // the interrupts the driver took, acked like an irq handler would
+  uint64_t TakeIrqs() {
+    irqs_ += driver_->AckIrq();
+    return irqs_;
+  }
+
+  uint64_t GetKicks() const { return driver_->GetKicks(); }
+
+ private:
+  Bus bus_;
+  std::unique_ptr<VirtioNet> dev_;
+  std::unique_ptr<VirtioDriver> driver_;
+  std::vector<uint16_t> tx_free_;
+  uint64_t irqs_ = 0;
+
+  void Add(uint32_t queue, uint16_t slot, uint32_t bytes) {
+    driver_->Desc(queue)[slot].len = bytes;
+    driver_->Publish(queue, slot);
+  }
+};
+
+void Run(uint64_t frame, uint64_t batch, uint64_t packets) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) != 0) {
+    printf("failed to create a socketpair: %s\n", strerror(errno));
+    exit(-1);
+  }
+  Driver sender(fds[0], 1);
+  Driver receiver(fds[1], 2);
+
+  uint64_t sent = 0;
+  uint64_t received = 0;
+  uint64_t bytes = 0;
+  const auto kStart = std::chrono::steady_clock::now();
+  while (received < packets) {
+    uint64_t progress = 0;
+    if (sent < packets) {
+      const uint64_t kAdded =
+          sender.Send(frame, std::min(batch, packets - sent));
+      sent += kAdded;
+      progress += kAdded;
+    }
+    progress += sender.ReapTx();
+    const uint64_t kReceived = receiver.ReapRx(&bytes);
+    received += kReceived;
+    progress += kReceived;
+    sender.TakeIrqs();
+    receiver.TakeIrqs();
+    if (!progress) {
+      std::this_thread::yield();
+    }
+  }
+  const auto kEnd = std::chrono::steady_clock::now();
+
+  const double kSeconds =
+      std::chrono::duration<double>(kEnd - kStart).count();
+  const double kPackets = static_cast<double>(received);
+  printf(
+      "frame %4lu  batch %3lu  %10.0f pkt/s  %6.2f Gbit/s  "
+      "%.3f kicks/pkt  %.3f irqs/pkt%s\n",
+      frame, batch, kPackets / kSeconds,
+      static_cast<double>(bytes) * 8 / kSeconds / 1e9,
+      static_cast<double>(sender.GetKicks()) / kPackets,
+      static_cast<double>(sender.TakeIrqs() + receiver.TakeIrqs()) / kPackets,
+      bytes != received * frame ? "  short frames!" : "");
+}
+
+void Usage(const char* name) {
+  printf("usage: %s [-n packets] [-b max batch]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint64_t packets = 1 << 18;
+  uint64_t max_batch = 64;
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+    switch (opt) {
+      case 'n':
+        packets = strtoull(optarg, nullptr, 0);
+        break;
+      case 'b':
+        max_batch = strtoull(optarg, nullptr, 0);
+        break;
+      default:
+        Usage(argv[0]);
+        return -1;
+    }
+  }
+  if (packets == 0 || max_batch == 0 || max_batch > kQueueSize) {
+    printf("the batch goes up to %u, packets must not be 0\n", kQueueSize);
+    return -1;
+  }
+
+  printf("virtio-net over a unix socketpair, %lu packets per run\n", packets);
+  for (const uint64_t kFrame : {uint64_t{64}, kMaxFrameBytes}) {
+    for (uint64_t batch = 1; batch <= max_batch; batch *= 8) {
+      Run(kFrame, batch, packets);
+    }
+  }
+  return 0;
+}
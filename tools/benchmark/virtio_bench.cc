@@ -0,0 +1,136 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include "conf.h"
+#include "device/bus.h"
+#include "device/dram.h"
+#include "device/virtio.h"
+#include "device/virtqueue.h"
+#include "virtio_driver.h"
+
+using rv64_emulator::device::bus::Bus;
+using rv64_emulator::device::dram::DRAM;
+using namespace rv64_emulator::device::virtio;
+
+constexpr uint16_t kQueueSize = 256;
+constexpr uint64_t kDefaultChains = 1 << 20;
+constexpr uint64_t kDefaultBufBytes = 4096;
+
+constexpr uint64_t kRingAddr = kDramBaseAddr;
+constexpr uint64_t kBufAddr = kDramBaseAddr + 0x10000;
+
+// copies each request into its response buffer, the data movement of a
+// device doing DMA in both directions
+class EchoDevice : public VirtioMmio {
+ public:
+  explicit EchoDevice(Bus* bus) : VirtioMmio(bus, 0, 0, 1, kQueueSize) {}
+
+  uint64_t notifies_ = 0;
+
+ protected:
+  void QueueNotify(uint32_t index) override {
+    notifies_++;
+    ServeQueue(index, [](const Chain& chain) {
+      const Segment& kIn = chain.readable.front();
+      const Segment& kOut = chain.writable.front();
+      memcpy(kOut.host, kIn.host, kIn.len);
+      return kIn.len;
+    });
+  }
+};
+
+// The driver publishes batch chains at a time and kicks the device when the
+// device asks for it, then reaps them and acks the interrupt if one came.
+// Every chain is a readable and a writable buffer of buf_bytes.
+void Run(uint64_t batch, bool event_idx, uint64_t chains, uint64_t buf_bytes) {
+  const uint64_t kRamBytes = 0x10000 + kQueueSize * buf_bytes;
+  Bus bus;
+  bus.MountDevice({
+      .base = kDramBaseAddr,
+      .size = kRamBytes,
+      .dev = std::make_unique<DRAM>(kRamBytes),
+  });
+  EchoDevice dev(&bus);
+  VirtioDriver driver(&bus, &dev, kRingAddr, kQueueSize);
+  if (!driver.Init(kFeatureVersion1 | (event_idx ? kFeatureEventIdx : 0), 1)) {
+    printf("the device refused the driver\n");
+    exit(-1);
+  }
+
+  VirtqDesc* desc = driver.Desc(0);
+  for (uint16_t i = 0; i < kQueueSize / 2; i++) {
+    desc[i * 2] = {.addr = kBufAddr + i * 2 * buf_bytes,
+                   .len = static_cast<uint32_t>(buf_bytes),
+                   .flags = kDescFlagNext,
+                   .next = static_cast<uint16_t>(i * 2 + 1)};
+    desc[i * 2 + 1] = {.addr = kBufAddr + (i * 2 + 1) * buf_bytes,
+                       .len = static_cast<uint32_t>(buf_bytes),
+                       .flags = kDescFlagWrite,
+                       .next = 0};
+  }
+
+  uint64_t irqs = 0;
+  uint64_t done = 0;
+  uint16_t slot = 0;
+  const auto kStart = std::chrono::high_resolution_clock::now();
+  while (done < chains) {
+    for (uint64_t i = 0; i < batch; i++) {
+      driver.Publish(0, slot * 2);
+      slot = (slot + 1) % (kQueueSize / 2);
+    }
+    // interrupt on the last chain of the batch only
+    *driver.UsedEvent(0) = driver.Avail(0)[1] - 1;
+    driver.Kick(0);
+
+    done += driver.Reap(0, [](const VirtqUsedElem&) {});
+    irqs += driver.AckIrq();
+  }
+  const auto kEnd = std::chrono::high_resolution_clock::now();
+
+  const double kSeconds =
+      std::chrono::duration<double>(kEnd - kStart).count();
+  printf("batch %3lu  event_idx %d  %8.2f K chains/s  %8.2f MB/s  "
+         "kicks/chain %.3f  irqs/chain %.3f\n",
+         batch, event_idx, static_cast<double>(done) / kSeconds / 1e3,
+         static_cast<double>(done * buf_bytes) / kSeconds / 1e6,
+         static_cast<double>(driver.GetKicks()) / static_cast<double>(done),
+         static_cast<double>(irqs) / static_cast<double>(done));
+}
+
+void Usage(const char* name) {
+  printf("usage: %s [-n chains] [-s buffer bytes]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint64_t chains = kDefaultChains;
+  uint64_t buf_bytes = kDefaultBufBytes;
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+      case 'n':
+        chains = strtoull(optarg, nullptr, 0);
+        break;
+      case 's':
+        buf_bytes = strtoull(optarg, nullptr, 0);
+        break;
+      default:
+        Usage(argv[0]);
+        return -1;
+    }
+  }
+
+  printf("virtqueue echo, %lu chains of 2 x %lu bytes\n", chains, buf_bytes);
+  for (const bool kEventIdx : {false, true}) {
+    for (const uint64_t kBatch : {1, 8, 32, 128}) {
+      Run(kBatch, kEventIdx, chains, buf_bytes);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,59 @@
+target("decode_bench")
+    set_kind("binary")
+    set_targetdir("$(projectdir)/build")
+    add_files("decode_bench.cc")
+
+target("hugepage_bench")
+    set_kind("binary")
+    set_targetdir("$(projectdir)/build")
+    add_files("hugepage_bench.cc")
+    add_files("$(projectdir)/src/device/dram.cc", "$(projectdir)/src/libs/guard.cc")
+    add_defines("FMT_HEADER_ONLY")
+
+target("virtio_bench")
+    set_kind("binary")
+    set_targetdir("$(projectdir)/build")
+    add_files("virtio_bench.cc")
+    add_includedirs("$(projectdir)/test")
+    add_files("$(projectdir)/src/device/bus.cc", "$(projectdir)/src/device/dram.cc")
+    add_files("$(projectdir)/src/device/virtio.cc", "$(projectdir)/src/device/virtqueue.cc")
+    add_files("$(projectdir)/src/device/scheduler.cc", "$(projectdir)/src/libs/guard.cc")
+    add_defines("FMT_HEADER_ONLY")
+
+target("blk_bench")
+    set_kind("binary")
+    set_targetdir("$(projectdir)/build")
+    add_files("blk_bench.cc")
+    add_includedirs("$(projectdir)/test")
+    add_files("$(projectdir)/src/device/bus.cc", "$(projectdir)/src/device/dram.cc")
+    add_files("$(projectdir)/src/device/virtio.cc", "$(projectdir)/src/device/virtqueue.cc")
+    add_files("$(projectdir)/src/device/virtio_blk.cc", "$(projectdir)/src/device/block.cc")
+    add_files("$(projectdir)/src/device/scheduler.cc", "$(projectdir)/src/libs/guard.cc")
+    add_syslinks("pthread")
+    add_defines("FMT_HEADER_ONLY")
+
+target("net_bench")
+    set_kind("binary")
+    set_targetdir("$(projectdir)/build")
+    add_files("net_bench.cc")
+    add_includedirs("$(projectdir)/test")
+    add_files("$(projectdir)/src/device/bus.cc", "$(projectdir)/src/device/dram.cc")
+    add_files("$(projectdir)/src/device/virtio.cc", "$(projectdir)/src/device/virtqueue.cc")
+    add_files("$(projectdir)/src/device/virtio_io.cc", "$(projectdir)/src/device/virtio_net.cc")
+    add_files("$(projectdir)/src/device/net.cc")
+    add_files("$(projectdir)/src/device/scheduler.cc", "$(projectdir)/src/libs/guard.cc")
+    add_syslinks("pthread")
+    add_defines("FMT_HEADER_ONLY")
+
+target("console_bench")
+    set_kind("binary")
+    set_targetdir("$(projectdir)/build")
+    add_files("console_bench.cc")
+    add_includedirs("$(projectdir)/test")
+    add_files("$(projectdir)/src/device/bus.cc", "$(projectdir)/src/device/dram.cc")
+    add_files("$(projectdir)/src/device/virtio.cc", "$(projectdir)/src/device/virtqueue.cc")
+    add_files("$(projectdir)/src/device/virtio_io.cc", "$(projectdir)/src/device/virtio_console.cc")
+    add_files("$(projectdir)/src/device/uart.cc")
+    add_files("$(projectdir)/src/device/scheduler.cc", "$(projectdir)/src/libs/guard.cc")
+    add_syslinks("pthread")
+    add_defines("FMT_HEADER_ONLY")
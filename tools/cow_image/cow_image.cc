@@ -0,0 +1,71 @@
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "device/block.h"
+
+using rv64_emulator::device::block::CowImage;
+
+void Usage(const char* name) {
+  printf("usage: %s create|info|commit|discard <base image> <overlay>\n",
+         name);
+  printf("  create   makes an empty overlay of the base image\n");
+  printf("  info     shows how much of the disk the overlay holds\n");
+  printf("  commit   writes the overlay into the base and empties it\n");
+  printf("  discard  drops everything written to the overlay\n");
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 4) {
+    Usage(argv[0]);
+    return -1;
+  }
+  const char* kCmd = argv[1];
+  const char* kBase = argv[2];
+  const char* kOverlay = argv[3];
+
+  struct stat st;
+  const bool kExists = stat(kOverlay, &st) == 0;
+  if (strcmp(kCmd, "create") == 0 && kExists) {
+    printf("%s exists already\n", kOverlay);
+    return -1;
+  }
+  if (strcmp(kCmd, "create") != 0 && !kExists) {
+    printf("%s does not exist\n", kOverlay);
+    return -1;
+  }
+
+  CowImage image;
+  errno = 0;
+  if (!image.Open(kBase, kOverlay)) {
+    printf("failed to open %s over %s: %s\n", kOverlay, kBase,
+           errno ? strerror(errno) : "not an overlay of this base");
+    return -1;
+  }
+
+  bool ok = true;
+  if (strcmp(kCmd, "commit") == 0) {
+    ok = image.Commit();
+  } else if (strcmp(kCmd, "discard") == 0) {
+    ok = image.Discard();
+  } else if (strcmp(kCmd, "info") == 0) {
+    stat(kOverlay, &st);
+    printf("disk size      %lu bytes\n", image.GetSize());
+    printf("cluster size   %lu bytes\n", image.GetClusterBytes());
+    printf("written        %lu clusters\n", image.GetAllocatedClusters());
+    printf("overlay usage  %lu bytes on disk\n",
+           static_cast<uint64_t>(st.st_blocks) * 512);
+  } else if (strcmp(kCmd, "create") != 0) {
+    Usage(argv[0]);
+    return -1;
+  }
+
+  if (!ok) {
+    printf("%s failed: %s\n", kCmd, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,5 @@
+target("cow_image")
+    set_kind("binary")
+    set_targetdir("$(projectdir)/build")
+    add_files("cow_image.cc")
+    add_files("$(projectdir)/src/device/block.cc")
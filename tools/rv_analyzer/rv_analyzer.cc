@@ -32,21 +32,7 @@ int main(int argc, char* argv[]) {
         const uint32_t kInstructionLen = (!(*ptr & 0b11) ? 2 : 4);
         const uint32_t kWord = *reinterpret_cast<const uint32_t*>(ptr);
         ptr += kInstructionLen;
-        bool not_fount = true;
-        for (int32_t i = 0;
-             i < sizeof(rv64_emulator::cpu::decode::kInstTable) /
-                     sizeof(rv64_emulator::cpu::decode::InstDesc);
-             i++) {
-          auto inst = rv64_emulator::cpu::decode::kInstTable[i];
-          if ((kWord & inst.mask) == inst.signature) {
-            ++counter[i];
-            not_fount = false;
-            break;
-          }
-        }
-        if (not_fount) {
-          ++counter[-1];
-        }
+        ++counter[rv64_emulator::cpu::decode::GetInstIndex(kWord)];
       }
     }
   }